@@ -0,0 +1,150 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+#include <vector>
+#include <iomanip>
+#include <core/xmipp_program.h>
+#include <core/xmipp_datatype_cast.h>
+#include <core/utils/time_utils.h>
+
+// Reference conversion, one value at a time
+template <typename Tin, typename Tout>
+#ifdef __GNUC__
+__attribute__((optimize("no-tree-vectorize")))
+#endif
+void castPageScalar(const Tin * in, Tout * out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (Tout) in[i];
+}
+
+class ProgImageCastBenchmark: public XmippProgram
+{
+public:
+    size_t minSize, maxSize;
+    int repeat;
+
+    void defineParams()
+    {
+        addUsageLine("Measure the speed of the datatype conversions used to read and write images");
+        addUsageLine("+Every conversion is measured for pages from min_size to max_size values, multiplying");
+        addUsageLine("+the size by 4 each time. Smaller pages are converted more times, so that the same");
+        addUsageLine("+number of values is converted for every size.");
+        addParamsLine(" [--min_size <n=4096>]     : Number of values of the smallest page");
+        addParamsLine(" [--max_size <n=16777216>] : Number of values of the largest page");
+        addParamsLine(" [--repeat <n=20>]         : Number of conversions of the largest page");
+        addExampleLine("xmipp_image_cast_benchmark --min_size 65536 --max_size 65536");
+    }
+
+    void readParams()
+    {
+        minSize = getIntParam("--min_size");
+        maxSize = getIntParam("--max_size");
+        repeat = getIntParam("--repeat");
+        if (minSize == 0 || minSize > maxSize)
+            REPORT_ERROR(ERR_ARG_INCORRECT, "min_size must be between 1 and max_size");
+    }
+
+    void show()
+    {
+        std::cout
+        << "Page sizes      = " << minSize << " to " << maxSize << std::endl
+        << "Repetitions     = " << repeat << std::endl
+        << "Instruction set = " << castPageInstructionSet() << std::endl
+        ;
+    }
+
+    /* Repetitions of a page of size values */
+    int repetitions(size_t size)
+    {
+        return (int) std::max((size_t) 1, repeat * (maxSize / size));
+    }
+
+    template <typename Tin, typename Tout>
+    void benchmark(const char * name)
+    {
+        std::vector<Tin> in(maxSize);
+        std::vector<Tout> out(maxSize);
+        for (size_t i = 0; i < maxSize; ++i)
+            in[i] = (Tin) (i % 100);
+        for (size_t size = minSize; size <= maxSize; size *= 4)
+        {
+            int n = repetitions(size);
+            double megabytes = n * size * (sizeof(Tin) + sizeof(Tout)) / 1048576.;
+
+            auto scalar = timeUtils::measureTime<std::chrono::microseconds>([&]{
+                for (int r = 0; r < n; ++r)
+                    castPageScalar(&in[0], &out[0], size);
+            });
+            auto vectorized = timeUtils::measureTime<std::chrono::microseconds>([&]{
+                for (int r = 0; r < n; ++r)
+                    castPage(&in[0], &out[0], size);
+            });
+            std::cout << std::setw(16) << name << std::setw(12) << size
+            << std::fixed << std::setprecision(1)
+            << std::setw(12) << megabytes * 1e6 / std::max(scalar, (decltype(scalar)) 1)
+            << std::setw(12) << megabytes * 1e6 / std::max(vectorized, (decltype(vectorized)) 1)
+            << std::endl;
+        }
+    }
+
+    void run()
+    {
+        show();
+        std::cout << std::setw(16) << "conversion" << std::setw(12) << "page size"
+        << std::setw(12) << "scalar" << std::setw(12) << "kernel" << "   (MB/s)" << std::endl;
+        benchmark<unsigned char, float>("uchar->float");
+        benchmark<signed char, float>("schar->float");
+        benchmark<unsigned short, float>("ushort->float");
+        benchmark<short, float>("short->float");
+        benchmark<int, float>("int->float");
+        benchmark<float, double>("float->double");
+        benchmark<unsigned char, double>("uchar->double");
+        benchmark<short, double>("short->double");
+        benchmark<double, float>("double->float");
+        benchmark<float, unsigned char>("float->uchar");
+        benchmark<float, short>("float->short");
+        benchmark<double, short>("double->short");
+
+        std::vector<char> page(maxSize * sizeof(float));
+        for (size_t size = minSize; size <= maxSize; size *= 4)
+        {
+            int n = repetitions(size);
+            size_t bytes = size * sizeof(float);
+            auto swap = timeUtils::measureTime<std::chrono::microseconds>([&]{
+                for (int r = 0; r < n; ++r)
+                    swapPageBytes(&page[0], bytes, sizeof(float));
+            });
+            std::cout << std::setw(16) << "swap 4 bytes" << std::setw(12) << size
+            << std::setw(12) << "-"
+            << std::setw(12) << 2. * n * bytes / 1048576. * 1e6 / std::max(swap, (decltype(swap)) 1)
+            << std::endl;
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    ProgImageCastBenchmark program;
+    program.read(argc, argv);
+    program.tryRun();
+}
@@ -77,6 +77,120 @@ TEST_F( FftwTest, directFourierTransformComplex)
     transformer1.cleanup();
 }
 
+TEST_F( FftwTest, planCache)
+{
+    MultidimArray< std::complex< double > > FFT1, FFT2;
+    MultidimArray<double> copyDouble=mulDouble;
+    FourierTransformer transformer1, transformer2;
+    transformer1.FourierTransform(mulDouble, FFT1, true);
+    size_t cachedPlans=FFTWPlanCache::size();
+    // Same shape and alignment, the plans must be reused
+    transformer2.FourierTransform(copyDouble, FFT2, true);
+    EXPECT_EQ(cachedPlans, FFTWPlanCache::size());
+    EXPECT_EQ(FFT1,FFT2);
+
+    // Transforming back through the shared plan must recover the input
+    transformer2.inverseFourierTransform();
+    EXPECT_TRUE(copyDouble.equal(mulDouble,1e-6));
+}
+
+TEST_F( FftwTest, destroyThreads)
+{
+    MultidimArray< std::complex< double > > FFT1, FFT2;
+    MultidimArray<double> copyDouble=mulDouble;
+    FourierTransformer transformer1, transformer2;
+    transformer1.setThreadsNumber(2);
+    transformer2.setThreadsNumber(2);
+    transformer1.FourierTransform(mulDouble, FFT1, true);
+    transformer2.FourierTransform(copyDouble, FFT2, true);
+    size_t cachedPlans=FFTWPlanCache::size();
+
+    // The plans of the other transformer are still valid
+    transformer1.destroyThreads();
+    EXPECT_LE(cachedPlans, FFTWPlanCache::size());
+    transformer2.inverseFourierTransform();
+    EXPECT_TRUE(copyDouble.equal(mulDouble,1e-6));
+    transformer1.FourierTransform();
+    transformer1.getFourierCopy(FFT2);
+    EXPECT_EQ(FFT1,FFT2);
+}
+
+TEST_F( FftwTest, wisdom)
+{
+    // Double and single precision wisdom in separate files
+    FileName fnWisdom;
+    fnWisdom.initUniqueName("/tmp/temp_wisdom_XXXXXX");
+    EXPECT_TRUE(FFTWPlanCache::exportWisdom(fnWisdom));
+    EXPECT_TRUE(fnWisdom.exists());
+    EXPECT_TRUE(fnWisdom.addExtension("float").exists());
+    EXPECT_TRUE(FFTWPlanCache::importWisdom(fnWisdom));
+    fnWisdom.deleteFile();
+    fnWisdom.addExtension("float").deleteFile();
+}
+
+TEST_F( FftwTest, batchTransform)
+{
+    MultidimArray<double> stack(5,1,6,7), img, original;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(stack)
+    DIRECT_MULTIDIM_ELEM(stack,n) = sin(0.3 * n) + (n % 5);
+    original = stack;
+
+    // Same transforms as one image at a time
+    MultidimArray< std::complex< double > > F, Fimg;
+    FourierTransformer transformer;
+    for (int nThreads = 1; nThreads <= 3; nThreads += 2)
+    {
+        BatchFourierTransformer batch;
+        batch.setThreadsNumber(nThreads);
+        batch.setReal(stack);
+        batch.FourierTransform();
+        for (size_t i = 0; i < NSIZE(stack); ++i)
+        {
+            img.aliasImageInStack(original, i);
+            transformer.FourierTransform(img, Fimg, true);
+            batch.getFourierAlias(i, F);
+            ASSERT_TRUE(F.sameShape(Fimg));
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(F)
+            EXPECT_NEAR(abs(DIRECT_MULTIDIM_ELEM(F,n) - DIRECT_MULTIDIM_ELEM(Fimg,n)), 0, 1e-12);
+        }
+        batch.inverseFourierTransform();
+        EXPECT_TRUE(stack.equal(original, 1e-10));
+    }
+}
+
+TEST_F( FftwTest, singlePrecision)
+{
+    MultidimArray<double> img(16,18), resized;
+    MultidimArray<float> imgFloat, resizedFloat;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+    DIRECT_MULTIDIM_ELEM(img,n) = sin(0.3 * n) + (n % 5);
+    typeCast(img, imgFloat);
+
+    // Same transform as in double precision
+    MultidimArray< std::complex< double > > F;
+    MultidimArray< std::complex< float > > Ffloat;
+    FourierTransformer transformer;
+    FourierTransformerFloat transformerFloat;
+    transformer.FourierTransform(img, F, true);
+    transformerFloat.FourierTransform(imgFloat, Ffloat, true);
+    ASSERT_EQ(XSIZE(F), XSIZE(Ffloat));
+    ASSERT_EQ(YSIZE(F), YSIZE(Ffloat));
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(F)
+    EXPECT_NEAR(abs(DIRECT_MULTIDIM_ELEM(F,n) - std::complex<double>(DIRECT_MULTIDIM_ELEM(Ffloat,n))), 0, 1e-5);
+
+    MultidimArray<float> back(imgFloat);
+    transformerFloat.inverseFourierTransform(Ffloat, back);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+    EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(img,n), DIRECT_MULTIDIM_ELEM(back,n), 1e-5);
+
+    // Fourier resize
+    scaleToSizeFourier(1, 8, 9, img, resized);
+    scaleToSizeFourier(1, 8, 9, imgFloat, resizedFloat);
+    ASSERT_EQ(XSIZE(resized), XSIZE(resizedFloat));
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(resized)
+    EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(resized,n), DIRECT_MULTIDIM_ELEM(resizedFloat,n), 1e-5);
+}
+
 TEST_F( FftwTest, fft_IDX2DIGFREQ)
 {
 	double w;
@@ -1,5 +1,6 @@
 #include <core/xmipp_image.h>
 #include <data/filters.h>
+#include <data/fourier_filter.h>
 #include <core/xmipp_fftw.h>
 #include <iostream>
 #include <gtest/gtest.h>
@@ -198,6 +199,43 @@ TEST_F( FiltersTest, regionGrowing3DEqualValue)
     EXPECT_DOUBLE_EQ(result,1.);
 
 }
+TEST_F( FiltersTest, fourierFilterSinglePrecision)
+{
+    MultidimArray<double> I(3,1,64,64);
+    I.initRandom(0, 1);
+    MultidimArray<float> If, If0;
+    typeCast(I, If);
+    If0.aliasImageInStack(If, 0);
+    MultidimArray<float> Jf = If0;
+
+    FourierFilter filter, filterf, filterJ;
+    filter.FilterBand = filterf.FilterBand = filterJ.FilterBand = BANDPASS;
+    filter.w1 = filterf.w1 = filterJ.w1 = 0.05;
+    filter.w2 = filterf.w2 = filterJ.w2 = 0.2;
+    filter.raised_w = filterf.raised_w = filterJ.raised_w = 0.02;
+
+    // The images of a stack
+    MultidimArray<double> I0;
+    I0.aliasImageInStack(I, 0);
+    filter.generateMask(I0);
+    filterf.generateMask(I0);
+    filter.applyMaskSpace(I);
+    filterf.applyMaskSpace(If);
+
+    double maxDiff = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(I)
+    maxDiff = XMIPP_MAX(maxDiff, fabs(DIRECT_MULTIDIM_ELEM(I,n) - DIRECT_MULTIDIM_ELEM(If,n)));
+    EXPECT_LT(maxDiff, 1e-5);
+    EXPECT_GT(I.computeStddev(), 1e-2);
+
+    // A single image, the mask is generated by apply
+    filterJ.apply(Jf);
+    maxDiff = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Jf)
+    maxDiff = XMIPP_MAX(maxDiff, fabs(DIRECT_MULTIDIM_ELEM(I0,n) - DIRECT_MULTIDIM_ELEM(Jf,n)));
+    EXPECT_LT(maxDiff, 1e-5);
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
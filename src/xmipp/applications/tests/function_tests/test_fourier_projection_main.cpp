@@ -0,0 +1,64 @@
+#include <iostream>
+#include <data/fourier_projection.h>
+
+#include <gtest/gtest.h>
+
+class FourierProjectionTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        // Smooth blob, so that its spectrum is within the maximum frequency
+        vol.resize(32,32,32);
+        vol.setXmippOrigin();
+        FOR_ALL_ELEMENTS_IN_ARRAY3D(vol)
+        A3D_ELEM(vol,k,i,j) = exp(-(k*k + 1.5*i*i + (j-2)*(j-2))/20.);
+
+        // Projection along Z
+        sumZ.initZeros(YSIZE(vol),XSIZE(vol));
+        sumZ.setXmippOrigin();
+        FOR_ALL_ELEMENTS_IN_ARRAY3D(vol)
+        A2D_ELEM(sumZ,i,j) += A3D_ELEM(vol,k,i,j);
+    }
+
+    MultidimArray<double> vol, sumZ;
+};
+
+TEST_F( FourierProjectionTest, projectAlongZ)
+{
+    int degrees[] = {0, 1, 3};
+    for (int d = 0; d < 3; ++d)
+    {
+        MultidimArray<double> V = vol;
+        FourierProjector projector(V, 2, 0.5, degrees[d]);
+        projector.project(0, 0, 0);
+        EXPECT_TRUE(sumZ.equal(projector.projection(), 1e-3)) << "B-spline degree " << degrees[d];
+    }
+}
+
+TEST_F( FourierProjectionTest, projectMany)
+{
+    MultidimArray<double> V = vol;
+    FourierProjector projector(V, 2, 0.5, 3);
+    std::vector<double> rot, tilt, psi;
+    for (int n = 0; n < 7; ++n)
+    {
+        rot.push_back(37.*n);
+        tilt.push_back(13.*n);
+        psi.push_back(-21.*n);
+    }
+    std::vector< MultidimArray<double> > projections;
+    projector.projectMany(rot, tilt, psi, projections, 3);
+    ASSERT_EQ(rot.size(), projections.size());
+    for (size_t n = 0; n < rot.size(); ++n)
+    {
+        projector.project(rot[n], tilt[n], psi[n]);
+        EXPECT_TRUE(projector.projection().equal(projections[n], 1e-12));
+    }
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -29,6 +29,31 @@ TEST_F( FuncTest, CompareTwoFiles)
     ASSERT_FALSE(compareTwoFiles(source1,source2,0));
 }
 
+TEST_F( FuncTest, MemToDouble)
+{
+    const char * numbers[] = {"0", "-0.5", "+3", "12.", ".25", "1e5", "-2.5E-3",
+                              "0.1", "3.14159265358979", "123456789012345678901234",
+                              "0.000000000000000000000000001234", "1.7976931348623157e308",
+                              "4.9e-324", "0.30000000000000004"};
+    double value;
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+    {
+        String str = (String)"  " + numbers[i] + " next";
+        const char *next = memToDouble(str.data(), str.data() + str.size(), value);
+        ASSERT_TRUE(next != NULL) << numbers[i];
+        EXPECT_EQ(strtod(numbers[i], NULL), value) << numbers[i];
+        EXPECT_EQ(" next", String(next));
+    }
+    // The buffer does not need to be null terminated
+    String str = "1.5e12";
+    EXPECT_TRUE(memToDouble(str.data(), str.data() + 3, value) != NULL);
+    EXPECT_EQ(1.5, value);
+    EXPECT_TRUE(memToDouble(str.data(), str.data() + 4, value) == NULL);
+    str = "text";
+    EXPECT_TRUE(memToDouble(str.data(), str.data() + str.size(), value) == NULL);
+    str = "1e999";
+    EXPECT_TRUE(memToDouble(str.data(), str.data() + str.size(), value) == NULL);
+}
 
 GTEST_API_ int main(int argc, char **argv)
 {
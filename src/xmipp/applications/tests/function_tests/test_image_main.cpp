@@ -2,9 +2,15 @@
 #include <stdlib.h>
 #include <core/xmipp_image.h>
 #include <core/xmipp_image_extension.h>
+#include <core/xmipp_image_generic.h>
+#include <core/xmipp_image_writer.h>
+#include <core/xmipp_image_prefetch.h>
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <gtest/gtest.h>
 #include <core/metadata.h>
+#include <core/xmipp_threads.h>
 // MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
 // This test is named "Size", and belongs to the "MetadataTest"
 // test case.
@@ -280,6 +286,72 @@ TEST_F( ImageTest, writeMRCVOLstack)
     XMIPP_CATCH
 }
 
+TEST_F( ImageTest, writeMRC4bit)
+{
+    XMIPP_TRY
+    FileName auxFn, fnStack;
+    auxFn.initUniqueName("/tmp/temp_mrc4_XXXXXX");
+    fnStack = auxFn + ":mrcs";
+    // Odd width, the rows start at a byte boundary
+    size_t nImages = 5, ydim = 29, xdim = 37;
+    Image<double> stack(xdim, ydim, 1, nImages);
+    FOR_ALL_DIRECT_NZYX_ELEMENTS_IN_MULTIDIMARRAY(stack())
+    DIRECT_NZYX_ELEM(stack(), l, k, i, j) = (j + 2 * i + 3 * l) % 16;
+    stack.write(fnStack + "%uint4");
+    EXPECT_EQ(1024 + nImages * ydim * (xdim + 1) / 2, auxFn.getFileSize());
+    ImageInfo info;
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(DT_UHalfByte, info.datatype);
+    EXPECT_TRUE(checkImageFileSize(fnStack, info));
+
+    Image<double> auxImage;
+    auxImage.read(fnStack);
+    EXPECT_TRUE(stack().equal(auxImage()));
+
+    // Single frames, from the file, the mapping of the file and the shared mapping
+    MultidimArray<double> expected(1, 1, ydim, xdim);
+    stack().getImage(2, expected);
+    Image<unsigned char> frame;
+    MultidimArray<double> converted;
+    for (int i = 0; i < 3; ++i)
+    {
+        ImageFileMap::setEnabled(i == 2);
+        frame.read(fnStack, DATA, 3, i > 0);
+        EXPECT_FALSE(frame.isMapped());
+        typeCast(frame(), converted);
+        converted.resetOrigin();
+        EXPECT_TRUE(expected.equal(converted));
+    }
+    ImageFileMap::setEnabled(false);
+
+    // Values over 15 saturate, unless they are converted to the range of 4 bits
+    stack() *= 2;
+    stack.write(fnStack + "%uint4");
+    auxImage.read(fnStack);
+    EXPECT_DOUBLE_EQ(15, auxImage().computeMax());
+    EXPECT_DOUBLE_EQ(14, DIRECT_NZYX_ELEM(auxImage(), 0, 0, 0, 7));
+    EXPECT_DOUBLE_EQ(15, DIRECT_NZYX_ELEM(auxImage(), 0, 0, 0, 8));
+    // Also the values that a cast to bytes would wrap, and the negative ones
+    Image<double> extremes(xdim, 1);
+    const double values[] = {256, 272, 1000, -1, -300, 3.7};
+    const double saturated[] = {15, 15, 15, 0, 0, 3};
+    for (int j = 0; j < 6; ++j)
+        DIRECT_A2D_ELEM(extremes(), 0, j) = values[j];
+    extremes.write(fnStack + "%uint4");
+    auxImage.read(fnStack);
+    for (int j = 0; j < 6; ++j)
+        EXPECT_DOUBLE_EQ(saturated[j], DIRECT_A2D_ELEM(auxImage(), 0, j));
+    stack.write(fnStack + "%uint4", ALL_IMAGES, false, WRITE_OVERWRITE, CW_CONVERT);
+    auxImage.read(fnStack);
+    EXPECT_DOUBLE_EQ(15, auxImage().computeMax());
+    EXPECT_DOUBLE_EQ(7, DIRECT_NZYX_ELEM(auxImage(), 0, 0, 0, 7));
+    // Later frames are converted with their own range
+    EXPECT_DOUBLE_EQ(13, DIRECT_NZYX_ELEM(auxImage(), 2, 0, 0, 7));
+    EXPECT_DOUBLE_EQ(0, DIRECT_NZYX_ELEM(auxImage(), 2, 0, 0, 10));
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
 TEST_F( ImageTest, writeTIFimage)
 {
     XMIPP_TRY
@@ -294,6 +366,305 @@ TEST_F( ImageTest, writeTIFimage)
     XMIPP_CATCH
 }
 
+/* Write a TIFF movie of xdim x ydim frames with libtiff, in strips of
+ * rowsPerStrip rows or in 16x16 tiles, and return the expected values */
+void writeTIFFMovie(const FileName &fn, size_t nFrames, size_t xdim, size_t ydim,
+                    int bitsPerSample, uint16 compression, uint32 rowsPerStrip,
+                    bool tiled, MultidimArray<double> &expected)
+{
+    int maxValue = (1 << bitsPerSample) - 1;
+    expected.resizeNoCopy(nFrames, 1, ydim, xdim);
+    FOR_ALL_DIRECT_NZYX_ELEMENTS_IN_MULTIDIMARRAY(expected)
+    DIRECT_NZYX_ELEM(expected, l, k, i, j) = (j * 3 + i * 5 + l * 11) % (maxValue + 1);
+
+    TIFF * tif = TIFFOpen(fn.c_str(), "w");
+    size_t rowBytes = (xdim * bitsPerSample + 7) / 8;
+    for (size_t n = 0; n < nFrames; ++n)
+    {
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32) xdim);
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32) ydim);
+        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16) bitsPerSample);
+        TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16) 1);
+        TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+        TIFFSetField(tif, TIFFTAG_SUBFILETYPE, (unsigned int) 0x2);
+        TIFFSetField(tif, TIFFTAG_PAGENUMBER, (uint16) n, (uint16) nFrames);
+        if (tiled)
+        {
+            TIFFSetField(tif, TIFFTAG_TILEWIDTH, (uint32) 16);
+            TIFFSetField(tif, TIFFTAG_TILELENGTH, (uint32) 16);
+        }
+        else
+            TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+
+        // Packed rows of the frame
+        std::vector<unsigned char> frame(rowBytes * ydim, 0);
+        for (size_t i = 0; i < ydim; ++i)
+            for (size_t j = 0; j < xdim; ++j)
+            {
+                int value = (int) DIRECT_NZYX_ELEM(expected, n, 0, i, j);
+                unsigned char * row = &frame[i * rowBytes];
+                if (bitsPerSample == 4)
+                    row[j / 2] |= (j % 2) ? value : value << 4;
+                else if (bitsPerSample == 8)
+                    row[j] = value;
+                else
+                    ((uint16 *) row)[j] = value;
+            }
+        if (tiled)
+        {
+            std::vector<unsigned char> tile(16 * 16 * bitsPerSample / 8);
+            for (size_t y = 0; y < ydim; y += 16)
+                for (size_t x = 0; x < xdim; x += 16)
+                {
+                    std::fill(tile.begin(), tile.end(), 0);
+                    size_t bytes = std::min((size_t) 16, xdim - x) * bitsPerSample / 8;
+                    for (size_t i = y; i < std::min(y + 16, ydim); ++i)
+                        memcpy(&tile[(i - y) * 16 * bitsPerSample / 8], &frame[i * rowBytes + x * bitsPerSample / 8], bytes);
+                    TIFFWriteTile(tif, &tile[0], x, y, 0, 0);
+                }
+        }
+        else
+            for (size_t i = 0; i < ydim; ++i)
+                TIFFWriteScanline(tif, &frame[i * rowBytes], i, 0);
+        TIFFWriteDirectory(tif);
+    }
+    TIFFClose(tif);
+}
+
+TEST_F( ImageTest, readTIFFMovie)
+{
+    XMIPP_TRY
+    FileName auxFn, fnTiff;
+    auxFn.initUniqueName("/tmp/temp_tif_XXXXXX");
+    fnTiff = auxFn + ".tif";
+    Image<double> img;
+    MultidimArray<double> expected;
+
+    // Compressed frames, in strips of several rows, decoded serially and in parallel
+    writeTIFFMovie(fnTiff, 7, 37, 29, 16, COMPRESSION_LZW, 4, false, expected);
+    EXPECT_EQ(1, ImageBase::getTIFFReadThreads());
+    img.read(fnTiff);
+    img().resetOrigin();
+    EXPECT_TRUE(img().equal(expected));
+    ImageBase::setTIFFReadThreads(3);
+    img.read(fnTiff);
+    ImageBase::setTIFFReadThreads(1);
+    img().resetOrigin();
+    EXPECT_TRUE(img().equal(expected));
+    img.read(formatString("5@%s", fnTiff.c_str()));
+    img().resetOrigin();
+    MultidimArray<double> frame(1, 1, 29, 37);
+    expected.getImage(4, frame);
+    EXPECT_TRUE(img().equal(frame));
+
+    // 4-bit samples, odd width
+    writeTIFFMovie(fnTiff, 3, 37, 29, 4, COMPRESSION_ADOBE_DEFLATE, 6, false, expected);
+    img.read(fnTiff);
+    img().resetOrigin();
+    EXPECT_EQ(DT_UHalfByte, img.datatype());
+    EXPECT_TRUE(img().equal(expected));
+
+    // Tiled, uncompressed
+    writeTIFFMovie(fnTiff, 2, 40, 21, 8, COMPRESSION_NONE, 0, true, expected);
+    img.read(fnTiff);
+    img().resetOrigin();
+    EXPECT_TRUE(img().equal(expected));
+    fnTiff.deleteFile();
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
+TEST_F( ImageTest, writeHDF5stack)
+{
+    XMIPP_TRY
+    FileName auxFn, fnStack, fnImg;
+    auxFn.initUniqueName("/tmp/temp_h5_XXXXXX");
+    fnStack = auxFn + ":h5";
+    // Compressed, with several images per chunk
+    myStack.write(fnStack + "%chunk=2,deflate=6,shuffle");
+    Image<double> auxImage;
+    auxImage.read(fnStack);
+    EXPECT_EQ(myStack, auxImage);
+
+    // Single images written into a preallocated stack, as metadata programs do,
+    // which delete the output before preallocating it
+    size_t nImages = NSIZE(myStack());
+    auxFn.deleteFile();
+    createEmptyFile(fnStack + "%float,deflate", XSIZE(myStack()), YSIZE(myStack()), ZSIZE(myStack()),
+                    nImages, true, WRITE_OVERWRITE);
+    ImageInfo info;
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(nImages, info.adim.ndim);
+    EXPECT_EQ(DT_Float, info.datatype);
+    Image<double> img;
+    for (size_t n = nImages; n > 0; --n)
+    {
+        myStack().getImage(n - 1, img());
+        fnImg.compose(n, fnStack);
+        img.write(fnImg, ALL_IMAGES, true, WRITE_REPLACE);
+    }
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(nImages, info.adim.ndim);
+    auxImage.read(fnStack);
+    EXPECT_EQ(myStack, auxImage);
+
+    // Integer datatype
+    myStack.write(fnStack + "%uint16,deflate", ALL_IMAGES, false, WRITE_OVERWRITE, CW_CONVERT);
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(DT_UShort, info.datatype);
+    EXPECT_EQ(nImages, info.adim.ndim);
+    // Every image is converted to the whole range of the datatype
+    fnImg.compose(nImages, fnStack);
+    img.read(fnImg);
+    EXPECT_DOUBLE_EQ(0, img().computeMin());
+    EXPECT_DOUBLE_EQ(65535, img().computeMax());
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
+TEST_F( ImageTest, writeXCSstack)
+{
+    XMIPP_TRY
+    FileName auxFn, fnStack, fnImg;
+    auxFn.initUniqueName("/tmp/temp_xcs_XXXXXX");
+    fnStack = auxFn + ":xcs";
+    // Lossless
+    myStack.write(fnStack);
+    Image<double> auxImage;
+    auxImage.read(fnStack);
+    EXPECT_EQ(myStack, auxImage);
+    size_t losslessSize = auxFn.getFileSize();
+
+    // Single images, replaced and appended
+    size_t nImages = NSIZE(myStack());
+    Image<double> img, img2;
+    fnImg.compose(nImages, fnStack);
+    img.read(fnImg);
+    MultidimArray<double> lastImage(1, ZSIZE(myStack()), YSIZE(myStack()), XSIZE(myStack()));
+    myStack().getImage(nImages - 1, lastImage);
+    img().resetOrigin();
+    EXPECT_TRUE(img().equal(lastImage));
+
+    fnImg.compose(1, fnStack);
+    img.write(fnImg, ALL_IMAGES, true, WRITE_REPLACE);
+    img.write(fnStack, ALL_IMAGES, true, WRITE_APPEND);
+    img2.read(fnImg);
+    EXPECT_EQ(img, img2);
+    fnImg.compose(nImages + 1, fnStack);
+    img2.read(fnImg);
+    EXPECT_EQ(img, img2);
+    fnImg.compose(2, fnStack);
+    img2.read(fnImg);
+    myStack().getImage(1, lastImage);
+    img2().resetOrigin();
+    EXPECT_TRUE(img2().equal(lastImage));
+    ImageInfo info;
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(nImages + 1, info.adim.ndim);
+    EXPECT_EQ(DT_Float, info.datatype);
+
+    // Quantized, the error is at most half a level
+    myStack.write(fnStack + "%bits=12,deflate=9");
+    EXPECT_LT(auxFn.getFileSize(), losslessSize);
+    auxImage.read(fnStack);
+    for (size_t n = 0; n < nImages; ++n)
+    {
+        myStack().getImage(n, lastImage);
+        double min0, max0;
+        lastImage.computeDoubleMinMax(min0, max0);
+        double step = (max0 - min0) / 4095;
+        for (size_t i = 0; i < MULTIDIM_SIZE(lastImage); ++i)
+            EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(lastImage, i), auxImage().data[n * MULTIDIM_SIZE(lastImage) + i],
+                        step / 2 + 1e-6 * fabs(max0));
+    }
+
+    // Integer images written into a preallocated stack, as metadata programs do,
+    // which delete the output before preallocating it
+    auxFn.deleteFile();
+    createEmptyFile(fnStack + "%uint16,deflate=1", 13, 11, 1, 3, true, WRITE_OVERWRITE);
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(3u, info.adim.ndim);
+    EXPECT_EQ(DT_UShort, info.datatype);
+    Image<double> integers(13, 11, 1, 3);
+    FOR_ALL_DIRECT_NZYX_ELEMENTS_IN_MULTIDIMARRAY(integers())
+    DIRECT_NZYX_ELEM(integers(), l, k, i, j) = 1000 * l + 7 * i + j;
+    for (size_t n = 0; n < 3; ++n)
+    {
+        integers().getImage(n, img());
+        fnImg.compose(n + 1, fnStack);
+        img.write(fnImg, ALL_IMAGES, true, WRITE_REPLACE);
+    }
+    auxImage.read(fnStack);
+    EXPECT_TRUE(integers().equal(auxImage()));
+    // Quantized stacks can be preallocated too
+    auxFn.deleteFile();
+    createEmptyFile(fnStack + "%bits=12", 13, 11, 1, 3, true, WRITE_OVERWRITE);
+    getImageInfo(fnStack, info);
+    EXPECT_EQ(3u, info.adim.ndim);
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
+// Every thread replaces its own images of a common XCS stack
+struct ThreadXCSStack
+{
+    FileName fnStack;
+    size_t nImages;
+    double constant;
+};
+
+void replaceThreadXCSImages(ThreadArgument &thArg)
+{
+    ThreadXCSStack *data = (ThreadXCSStack *)thArg.workClass;
+    Image<double> img(16, 16);
+    FileName fnImg;
+    for (size_t m = thArg.thread_id; m < data->nImages; m += thArg.getNumberOfThreads())
+    {
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img())
+        DIRECT_MULTIDIM_ELEM(img(), n) = (data->constant > 0) ? data->constant : sin(1000. * m + n);
+        fnImg.compose(m + 1, data->fnStack);
+        img.write(fnImg, ALL_IMAGES, true, WRITE_REPLACE);
+    }
+}
+
+TEST_F( ImageTest, writeXCSthreads)
+{
+    XMIPP_TRY
+    FileName auxFn;
+    auxFn.initUniqueName("/tmp/temp_xcs_XXXXXX");
+    ThreadXCSStack data;
+    data.fnStack = auxFn + ":xcs";
+    data.nImages = 40;
+    data.constant = 0;
+    Image<double> zeros(16, 16, 1, data.nImages);
+    zeros.write(data.fnStack);
+
+    // New blocks do not fit in the old ones and go to the end of the file
+    ThreadManager thMgr(4, &data);
+    thMgr.run(replaceThreadXCSImages);
+    Image<double> auxImage;
+    auxImage.read(data.fnStack);
+    ASSERT_EQ(data.nImages, NSIZE(auxImage()));
+    FOR_ALL_DIRECT_NZYX_ELEMENTS_IN_MULTIDIMARRAY(auxImage())
+    EXPECT_FLOAT_EQ(sin(1000. * l + 16 * i + j), DIRECT_NZYX_ELEM(auxImage(), l, k, i, j));
+
+    // The space of the replaced blocks and of the previous indexes is reused,
+    // otherwise every image would add an index to the file
+    size_t fileSize = auxFn.getFileSize();
+    data.constant = 3;
+    thMgr.run(replaceThreadXCSImages);
+    EXPECT_LT(auxFn.getFileSize(), fileSize + fileSize / 2);
+    auxImage.read(data.fnStack);
+    ASSERT_EQ(data.nImages, NSIZE(auxImage()));
+    EXPECT_DOUBLE_EQ(3, auxImage().computeMin());
+    EXPECT_DOUBLE_EQ(3, auxImage().computeMax());
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
 TEST_F( ImageTest, writeINFimage)
 {
     XMIPP_TRY
@@ -420,6 +791,228 @@ TEST_F( ImageTest, checkImageFileSize)
     XMIPP_CATCH
 }
 
+TEST_F( ImageTest, castPages)
+{
+    // Odd size so that the kernels also go through their scalar tail
+    const size_t n = 1027;
+    std::vector<short> shorts(n);
+    std::vector<double> doubles(n), converted(n);
+    std::vector<float> floats(n);
+    for (size_t i = 0; i < n; ++i)
+        shorts[i] = (short) (i * 61 - 30000);
+
+    castPage(&shorts[0], &doubles[0], n);
+    castPage(&doubles[0], &floats[0], n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        ASSERT_EQ(shorts[i], doubles[i]);
+        ASSERT_EQ(shorts[i], floats[i]);
+    }
+
+    // Same result as the generic conversion
+    std::vector<unsigned char> uchars(n), expected(n);
+    for (size_t i = 0; i < n; ++i)
+        floats[i] = (i % 256) + 0.75f;
+    castPage(&floats[0], &uchars[0], n);
+    for (size_t i = 0; i < n; ++i)
+        ASSERT_EQ((unsigned char) floats[i], uchars[i]);
+
+    // Values out of the range of the output type are clamped
+    doubles[0] = -1;
+    doubles[1] = 1000;
+    castConvertPage(&doubles[0], &uchars[0], 2, 0., 1., 0.);
+    EXPECT_EQ(0, uchars[0]);
+    EXPECT_EQ(255, uchars[1]);
+
+    // Swapping twice leaves the page as it was
+    for (size_t i = 0; i < n; ++i)
+        doubles[i] = i * 0.5;
+    converted = doubles;
+    Image<double> img;
+    img.swapPage((char *) &converted[0], n * sizeof(double), DT_Double);
+    EXPECT_NE(0, memcmp(&converted[1], &doubles[1], (n - 1) * sizeof(double)));
+    unsigned char * bytes = (unsigned char *) &converted[1];
+    unsigned char * original = (unsigned char *) &doubles[1];
+    for (size_t j = 0; j < sizeof(double); ++j)
+        EXPECT_EQ(original[j], bytes[sizeof(double) - 1 - j]);
+    img.swapPage((char *) &converted[0], n * sizeof(double), DT_Double);
+    EXPECT_EQ(0, memcmp(&converted[0], &doubles[0], n * sizeof(double)));
+}
+
+TEST_F( ImageTest, readSharedMap)
+{
+    XMIPP_TRY
+    FileName auxFn;
+    auxFn.initUniqueName("/tmp/temp_mapstk_XXXXXX");
+    auxFn = auxFn + ":mrcs";
+    Image<float> stack;
+    typeCast(myStack(), stack());
+    stack.write(auxFn);
+
+    ImageFileMap::setEnabled(true);
+    size_t nImages = NSIZE(myStack());
+    Image<float> view;
+    Image<double> converted, spider;
+    MultidimArray<double> expected(1, ZSIZE(myStack()), YSIZE(myStack()), XSIZE(myStack()));
+    for (size_t n = FIRST_IMAGE; n <= nImages; ++n)
+    {
+        myStack().getImage(n - 1, expected);
+        // Read-only view of the mapped stack
+        view.read(auxFn, DATA, n, true);
+        EXPECT_TRUE(view.isMapped());
+        // Converted into memory
+        converted.read(auxFn, DATA, n, true);
+        EXPECT_FALSE(converted.isMapped());
+        EXPECT_EQ(expected, converted());
+        typeCast(view(), converted());
+        EXPECT_EQ(expected, converted());
+        // Individual headers of SPIDER stacks are also read from the mapped file
+        spider.read(stackName, DATA, n);
+        EXPECT_EQ(expected, spider());
+    }
+    view.read(auxFn, DATA, ALL_IMAGES, true);
+    EXPECT_TRUE(view.isMapped());
+    EXPECT_EQ(nImages, NSIZE(view()));
+
+    // Reads that apply the geometry, of a SPIDER volume with padding after the data
+    FileName volFn;
+    volFn.initUniqueName("/tmp/temp_mapvol_XXXXXX");
+    volFn = volFn + ":vol";
+    Image<double> vol(expected);
+    vol.write(volFn);
+    MDRow row;
+    Image<double> geo;
+    geo.readApplyGeo(volFn, row);
+    EXPECT_EQ(expected, geo());
+    volFn.deleteFile();
+
+    // The file is mapped again when it changes
+    MultidimArray<float> first(1, ZSIZE(stack()), YSIZE(stack()), XSIZE(stack()));
+    stack().getImage(0, first);
+    first *= 2;
+    Image<float> changed(first);
+    changed.write(auxFn);
+    converted.read(auxFn, DATA, FIRST_IMAGE, true);
+    myStack().getImage(0, expected);
+    expected *= 2;
+    EXPECT_EQ(expected, converted());
+    ImageFileMap::setEnabled(false);
+
+    // Only exact SPIDER and MRC extensions are mapped
+    EXPECT_TRUE(ImageFileMap::isMappedFormat("mrcs%uint8"));
+    EXPECT_TRUE(ImageFileMap::isMappedFormat("st"));
+    EXPECT_FALSE(ImageFileMap::isMappedFormat("xcs"));
+    EXPECT_FALSE(ImageFileMap::isMappedFormat("stl"));
+
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
+TEST_F( ImageTest, stackWriter)
+{
+    XMIPP_TRY
+    const char * formats[] = {":stk", ":mrcs"};
+    size_t nImages = NSIZE(myStack());
+    MultidimArray<double> img(1, ZSIZE(myStack()), YSIZE(myStack()), XSIZE(myStack()));
+    for (int f = 0; f < 2; ++f)
+    {
+        FileName syncFn, asyncFn;
+        syncFn.initUniqueName("/tmp/temp_syncstk_XXXXXX");
+        asyncFn.initUniqueName("/tmp/temp_asyncstk_XXXXXX");
+        syncFn = syncFn + formats[f];
+        asyncFn = asyncFn + formats[f];
+        createEmptyFile(syncFn, XSIZE(img), YSIZE(img), 1, nImages, true, WRITE_OVERWRITE);
+        createEmptyFile(asyncFn, XSIZE(img), YSIZE(img), 1, nImages, true, WRITE_OVERWRITE);
+
+        // Out of order, as images processed by several threads
+        ImageStackWriter writer(asyncFn);
+        for (size_t n = nImages; n >= FIRST_IMAGE; --n)
+        {
+            myStack().getImage(n - 1, img);
+            Image<double> I(img);
+            FileName fnImg;
+            fnImg.compose(n, syncFn);
+            I.write(fnImg);
+            fnImg.compose(n, asyncFn);
+            EXPECT_EQ(&writer, ImageStackWriter::find(fnImg));
+            I.write(fnImg);
+        }
+        // Images of other sizes are not written by the writer
+        Image<double> small(4, 4);
+        EXPECT_FALSE(writer.write(small, FIRST_IMAGE));
+        writer.close();
+        EXPECT_TRUE(ImageStackWriter::find(asyncFn) == NULL);
+
+        // Same file as writing every image
+        std::ifstream syncFile(syncFn.removeFileFormat().c_str(), std::ios::binary);
+        std::ifstream asyncFile(asyncFn.removeFileFormat().c_str(), std::ios::binary);
+        std::string syncBytes((std::istreambuf_iterator<char>(syncFile)), std::istreambuf_iterator<char>());
+        std::string asyncBytes((std::istreambuf_iterator<char>(asyncFile)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(syncBytes.size(), asyncBytes.size());
+        EXPECT_TRUE(syncBytes == asyncBytes);
+
+        Image<double> stack;
+        stack.read(asyncFn);
+        EXPECT_EQ(myStack, stack);
+        syncFn.deleteFile();
+        asyncFn.deleteFile();
+    }
+    XMIPP_CATCH
+}
+
+TEST_F( ImageTest, prefetcher)
+{
+    XMIPP_TRY
+    MetaData md(stackName);
+    size_t nImages = md.size();
+    std::vector<size_t> objIds;
+    md.findObjects(objIds);
+    size_t imageBytes = MULTIDIM_SIZE(myStack()) / NSIZE(myStack()) * sizeof(float);
+
+    // The images ahead of the current one are limited to maxBytes
+    ImagePrefetcher prefetcher(md, MDL_IMAGE, imageBytes);
+    prefetcher.setObject(objIds[0]);
+    prefetcher.waitIdle();
+    EXPECT_LT(prefetcher.prefetched(), nImages);
+    EXPECT_GT(prefetcher.bytesRead(), 0);
+
+    // Following the current image up to the end of the metadata
+    prefetcher.setObject(objIds[nImages - 2]);
+    prefetcher.waitIdle();
+    EXPECT_EQ(nImages, prefetcher.prefetched());
+    EXPECT_LE(prefetcher.bytesRead(), stackName.getFileSize());
+
+    // The images are read as usual
+    Image<double> I;
+    FileName fnImg;
+    md.getValue(MDL_IMAGE, fnImg, objIds[nImages - 1]);
+    I.read(fnImg);
+    MultidimArray<double> img(1, ZSIZE(myStack()), YSIZE(myStack()), XSIZE(myStack()));
+    myStack().getImage(nImages - 1, img);
+    I().resetOrigin();
+    EXPECT_TRUE(I().equal(img));
+
+    // The images of stacks with an unknown layout are not read ahead
+    FileName auxFn, fnXCS;
+    auxFn.initUniqueName("/tmp/temp_prefetch_XXXXXX");
+    fnXCS = auxFn + ":xcs";
+    myStack.write(fnXCS);
+    MetaData mdXCS;
+    for (size_t n = 1; n <= nImages; ++n)
+    {
+        fnImg.compose(n, fnXCS);
+        mdXCS.setValue(MDL_IMAGE, fnImg, mdXCS.addObject());
+    }
+    mdXCS.findObjects(objIds);
+    ImagePrefetcher prefetcherXCS(mdXCS, MDL_IMAGE);
+    prefetcherXCS.setObject(objIds[0]);
+    prefetcherXCS.waitIdle();
+    EXPECT_EQ(nImages, prefetcherXCS.prefetched());
+    EXPECT_EQ(0u, prefetcherXCS.bytesRead());
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -4,6 +4,7 @@
 #include <core/metadata_extension.h>
 #include <data/xmipp_image_convert.h>
 #include <core/xmipp_funcs.h>
+#include <core/xmipp_threads.h>
 #include <iostream>
 #include <gtest/gtest.h>
 #include <string.h>
@@ -1650,6 +1651,48 @@ TEST_F( MetadataTest, CopyColumn)
     XMIPP_CATCH
 }
 
+TEST_F( MetadataTest, ColumnArray)
+{
+    XMIPP_TRY
+    MetaData md1(mDsource), md2;
+    std::vector<double> values, expected;
+    md1.getColumnValues(MDL_Y, expected);
+    md1.getColumnArray(MDL_Y, values);
+    EXPECT_EQ(expected, values);
+
+    // Set into an empty metadata and into the existing objects
+    std::vector<double> x;
+    md1.getColumnArray(MDL_X, x);
+    md2.setColumnArray(MDL_X, x);
+    md2.setColumnArray(MDL_Y, values);
+    EXPECT_EQ(md1, md2);
+
+    std::vector<size_t> counts;
+    values[0] = 7;
+    values[1] = 9;
+    md2.setColumnArray(MDL_COUNT, values);
+    md2.getColumnValues(MDL_COUNT, counts);
+    EXPECT_EQ(7, counts[0]);
+    EXPECT_EQ(9, counts[1]);
+
+    // Integer labels only take exact integers of their type
+    values[1] = -1;
+    EXPECT_THROW(md2.setColumnArray(MDL_COUNT, values), XmippError);
+    values[1] = 2.5;
+    EXPECT_THROW(md2.setColumnArray(MDL_COUNT, values), XmippError);
+    values[1] = 3e9;
+    EXPECT_THROW(md2.setColumnArray(MDL_REF, values), XmippError);
+    // size_t values are kept as int
+    EXPECT_THROW(md2.setColumnArray(MDL_COUNT, values), XmippError);
+    md2.getColumnValues(MDL_COUNT, counts);
+    EXPECT_EQ(9, counts[1]);
+
+    values.push_back(1);
+    EXPECT_THROW(md2.setColumnArray(MDL_COUNT, values), XmippError);
+    EXPECT_THROW(md2.getColumnArray(MDL_IMAGE, values), XmippError);
+    XMIPP_CATCH
+}
+
 TEST_F( MetadataTest, RenameColumn)
 {
     XMIPP_TRY
@@ -1911,6 +1954,153 @@ TEST_F( MetadataTest, updateRow)
     */
 }
 
+// Every thread fills its own metadata and adds it to a common one
+struct ThreadMetaData
+{
+    MetaData mdAll;
+    std::vector<MetaData *> mdThread;
+    Mutex mutex;
+};
+
+void fillThreadMetaData(ThreadArgument &thArg)
+{
+    ThreadMetaData *data = (ThreadMetaData *)thArg.workClass;
+    MetaData *md = new MetaData();
+    for (int i = 0; i < 500; ++i)
+    {
+        size_t id = md->addObject();
+        md->setValue(MDL_X, (double)thArg.thread_id, id);
+        md->setValue(MDL_Y, (double)i, id);
+    }
+    double x, sum = 0;
+    FOR_ALL_OBJECTS_IN_METADATA(*md)
+    {
+        md->getValue(MDL_Y, x, __iter.objId);
+        sum += x;
+    }
+    md->setValueCol(MDL_Z, sum);
+    data->mutex.lock();
+    data->mdAll.unionAll(*md);
+    data->mdThread[thArg.thread_id] = md;
+    data->mutex.unlock();
+}
+
+TEST_F( MetadataTest, ThreadOwnedMetaData)
+{
+    int nThreads = 4;
+    ThreadMetaData data;
+    data.mdThread.resize(nThreads);
+    ThreadManager thMgr(nThreads, &data);
+    thMgr.run(fillThreadMetaData);
+
+    EXPECT_EQ((size_t)nThreads*500, data.mdAll.size());
+    EXPECT_DOUBLE_EQ(124750., data.mdAll.getColumnMax(MDL_Z));
+    EXPECT_DOUBLE_EQ(124750., data.mdAll.getColumnMin(MDL_Z));
+
+    // Metadata created by the threads are still usable once they have finished
+    for (int t = 0; t < nThreads; ++t)
+    {
+        MetaData auxMetadata = *(data.mdThread[t]);
+        EXPECT_EQ(auxMetadata, *(data.mdThread[t]));
+        MetaData mdJoin;
+        mdJoin.join1(mDjoin, *(data.mdThread[t]), MDL_X, INNER);
+        EXPECT_EQ((t == 1 || t == 3) ? 500u : 0u, mdJoin.size());
+        delete data.mdThread[t];
+    }
+}
+
+TEST_F( MetadataTest, ColumnsAndSqlite)
+{
+    // Values are kept in columns, expressions are evaluated by sqlite
+    MetaData auxMetadata;
+    size_t id;
+    for (int i = 0; i < 3000; ++i)
+    {
+        id = auxMetadata.addObject();
+        auxMetadata.setValue(MDL_X, (double)i, id);
+        auxMetadata.setValue(MDL_ORDER, (size_t)i, id);
+        auxMetadata.setValue(MDL_IMAGE, formatString("%06d@stack.stk", i), id);
+        auxMetadata.setValue(MDL_ENABLED, (i % 3 == 0) ? -1 : 1, id);
+    }
+    EXPECT_EQ(1000, auxMetadata.removeObjects(MDValueEQ(MDL_ENABLED, -1)));
+    EXPECT_EQ(2000u, auxMetadata.size());
+    EXPECT_EQ(66, auxMetadata.removeObjects(MDExpression((String)"x < 100")));
+    EXPECT_EQ(1934u, auxMetadata.size());
+    EXPECT_EQ(100u, auxMetadata.countObjects(MDValueRange(MDL_X, 1000., 1149.)));
+
+    id = auxMetadata.firstObject();
+    auxMetadata.setValue(MDL_IMAGE, (String)"first@stack.stk", id);
+    MetaData auxMetadata2;
+    auxMetadata2.sort(auxMetadata, MDL_X, false);
+    FileName fnImage;
+    auxMetadata2.getValue(MDL_IMAGE, fnImage, auxMetadata2.firstObject());
+    EXPECT_EQ("002999@stack.stk", fnImage);
+    auxMetadata2.getValue(MDL_IMAGE, fnImage, auxMetadata2.lastObject());
+    EXPECT_EQ("first@stack.stk", fnImage);
+
+    auxMetadata2.operate((String)"x=2*x");
+    EXPECT_DOUBLE_EQ(5998., auxMetadata2.getColumnMax(MDL_X));
+    auxMetadata2.setValue(MDL_X, -1., auxMetadata2.firstObject());
+    EXPECT_DOUBLE_EQ(5996., auxMetadata2.getColumnMax(MDL_X));
+    EXPECT_DOUBLE_EQ(-1., auxMetadata2.getColumnMin(MDL_X));
+
+    FileName fn;
+    fn.initUniqueName("ColumnsAndSqlite_XXXXXX");
+    FileName fnDB = fn + ".sqlite";
+    auxMetadata2.write(fnDB);
+    MetaData auxMetadata3(fnDB);
+    EXPECT_EQ(auxMetadata2, auxMetadata3);
+    unlink(fn.c_str());
+    unlink(fnDB.c_str());
+}
+TEST_F( MetadataTest, ReadLargeStar)
+{
+    // Large data loops are parsed by several threads
+    MetaData auxMetadata;
+    size_t id;
+    for (int i = 0; i < 200000; ++i)
+    {
+        id = auxMetadata.addObject();
+        auxMetadata.setValue(MDL_IMAGE, formatString("%06d@stack with spaces.stk", i), id);
+        auxMetadata.setValue(MDL_X, i / 4., id);
+        auxMetadata.setValue(MDL_ORDER, (size_t)i, id);
+        auxMetadata.setValue(MDL_ENABLED, (i % 2) ? 1 : -1, id);
+    }
+    FileName fn;
+    fn.initUniqueName("ReadLargeStar_XXXXXX");
+    FileName fnSTAR = fn + ".xmd";
+    auxMetadata.write(fnSTAR);
+
+    MetaData auxMetadata2(fnSTAR);
+    EXPECT_EQ(auxMetadata, auxMetadata2);
+
+    // Only the desired columns
+    std::vector<MDLabel> labels;
+    labels.push_back(MDL_ORDER);
+    labels.push_back(MDL_IMAGE);
+    auxMetadata2.read(fnSTAR, &labels);
+    EXPECT_EQ(200000u, auxMetadata2.size());
+    EXPECT_FALSE(auxMetadata2.containsLabel(MDL_X));
+    EXPECT_FALSE(auxMetadata2.containsLabel(MDL_ENABLED));
+    FileName fnImage;
+    size_t order;
+    id = auxMetadata2.lastObject();
+    auxMetadata2.getValue(MDL_IMAGE, fnImage, id);
+    auxMetadata2.getValue(MDL_ORDER, order, id);
+    EXPECT_EQ("199999@stack with spaces.stk", fnImage);
+    EXPECT_EQ(199999u, order);
+
+    // Only the first rows, all lines are counted
+    MetaData auxMetadata3;
+    auxMetadata3.setMaxRows(10);
+    auxMetadata3.read(fnSTAR);
+    EXPECT_EQ(10u, auxMetadata3.size());
+    EXPECT_EQ(200000u, auxMetadata3.getParsedLines());
+
+    unlink(fn.c_str());
+    unlink(fnSTAR.c_str());
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
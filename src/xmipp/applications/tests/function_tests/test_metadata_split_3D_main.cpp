@@ -0,0 +1,56 @@
+#include <iostream>
+#include <reconstruction/metadata_split_3D.h>
+
+#include <gtest/gtest.h>
+
+class MetadataSplit3DTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        // Images of 20 image indexes spread over the sphere, several
+        // images of the same index and name are a single group
+        for (size_t n = 0; n < 300; ++n)
+        {
+            size_t id = prog.mdIn.addObject();
+            prog.mdIn.setValue(MDL_ANGLE_ROT, (double) ((n * 37) % 360), id);
+            prog.mdIn.setValue(MDL_ANGLE_TILT, (double) ((n * 53) % 180), id);
+            prog.mdIn.setValue(MDL_IMAGE_IDX, n % 20, id);
+            prog.mdIn.setValue(MDL_IMAGE, formatString("%lu@particles.stk", n % 70), id);
+            prog.mdIn.setValue(MDL_MAXCC, fmod(n * 0.6180339887, 1.), id);
+        }
+        for (size_t r = 0; r < 120; ++r)
+        {
+            size_t id = prog.mdRef.addObject();
+            prog.mdRef.setValue(MDL_ANGLE_ROT, (double) ((r * 97) % 360), id);
+            prog.mdRef.setValue(MDL_ANGLE_TILT, (double) ((r * 29) % 180), id);
+        }
+        prog.maxDist = DEG2RAD(30.);
+        prog.verbose = 0;
+    }
+
+    ProgMetadataSplit3D prog;
+};
+
+TEST_F( MetadataSplit3DTest, threads)
+{
+    // Same votes, and so the same split, with any number of threads
+    prog.Nthreads = 1;
+    prog.classifyImages();
+    Matrix1D<int> correlatesWell = prog.correlatesWell;
+    EXPECT_EQ(20, VEC_XSIZE(correlatesWell));
+    int votes = 0;
+    FOR_ALL_ELEMENTS_IN_MATRIX1D(correlatesWell)
+    votes += abs(VEC_ELEM(correlatesWell, i));
+    EXPECT_GT(votes, 0);
+
+    prog.Nthreads = 4;
+    prog.classifyImages();
+    EXPECT_EQ(correlatesWell, prog.correlatesWell);
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,4 +1,6 @@
 #include <core/multidim_array.h>
+#include <core/multidim_array_expression.h>
+#include <core/multidim_array_stats.h>
 #include <core/matrix2d.h>
 #include <iostream>
 #include <gtest/gtest.h>
@@ -354,6 +356,90 @@ TEST( MultidimTest, window2D)
     XMIPP_CATCH
 }
 
+TEST( MultidimTest, expressions)
+{
+    MultidimArray<double> a(40,50,60), b(40,50,60), c(40,50,60), result, expected;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(a)
+    {
+        DIRECT_MULTIDIM_ELEM(a,n) = n % 17 + 1;
+        DIRECT_MULTIDIM_ELEM(b,n) = 0.5 * (n % 5) - 1.25;
+        DIRECT_MULTIDIM_ELEM(c,n) = (double) (n % 7);
+    }
+
+    // Same values as the operators of MultidimArray
+    expected = a * b + c * 2.0;
+    evaluateExpression(result, arrayExpr(a) * b + arrayExpr(c) * 2.0);
+    EXPECT_EQ(expected, result);
+    evaluateExpression(result, arrayExpr(a) * b + arrayExpr(c) * 2.0, 3);
+    EXPECT_EQ(expected, result);
+
+    evaluateExpression(result, -sqrt(abs(c - arrayExpr(a) / b)), 2);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(result)
+    EXPECT_DOUBLE_EQ(-sqrt(fabs(DIRECT_MULTIDIM_ELEM(c,n) - DIRECT_MULTIDIM_ELEM(a,n) / DIRECT_MULTIDIM_ELEM(b,n))),
+                     DIRECT_MULTIDIM_ELEM(result,n));
+
+    // The result can be one of the operands
+    expected = 1.0 - a;
+    evaluateExpression(a, 1.0 - arrayExpr(a), 4);
+    EXPECT_EQ(expected, a);
+
+    MultidimArray<double> small(3,4);
+    EXPECT_THROW(evaluateExpression(result, arrayExpr(a) + small), XmippError);
+}
+
+TEST( MultidimTest, stats)
+{
+    MultidimArray<double> v(40,50,60);
+    MultidimArray<int> mask(40,50,60);
+    v.setXmippOrigin();
+    mask.setXmippOrigin();
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(v)
+    {
+        DIRECT_MULTIDIM_ELEM(v,n) = sin(0.01 * n) * (n % 13);
+        DIRECT_MULTIDIM_ELEM(mask,n) = (n % 3 == 0);
+    }
+
+    double avg, stddev, min, max;
+    v.computeStats(avg, stddev, min, max);
+    ArrayStats stats;
+    computeArrayStats(v, stats);
+    EXPECT_EQ(MULTIDIM_SIZE(v), stats.N);
+    EXPECT_NEAR(avg, stats.avg(), 1e-12);
+    EXPECT_DOUBLE_EQ(min, stats.minval);
+    EXPECT_DOUBLE_EQ(max, stats.maxval);
+
+    std::vector<size_t> indexes;
+    binaryMaskIndexes(mask, v, indexes);
+    v.computeAvgStdev_within_binary_mask(mask, avg, stddev);
+    ArrayStats statsMask, statsThreads;
+    computeArrayStats(v, indexes, statsMask);
+    EXPECT_EQ(indexes.size(), statsMask.N);
+    EXPECT_NEAR(avg, statsMask.avg(), 1e-12);
+    EXPECT_NEAR(stddev, statsMask.stddev(), 1e-12);
+    computeArrayStats(v, indexes, statsThreads, 3);
+    EXPECT_NEAR(statsMask.avg(), statsThreads.avg(), 1e-12);
+    EXPECT_NEAR(statsMask.stddev(), statsThreads.stddev(), 1e-12);
+    EXPECT_EQ(statsMask.minval, statsThreads.minval);
+    EXPECT_EQ(statsMask.maxval, statsThreads.maxval);
+
+    // Quantiles and median by selection
+    MultidimArray<double> x(6);
+    x.initConstant(0);
+    DIRECT_A1D_ELEM(x,0) = 5;
+    DIRECT_A1D_ELEM(x,1) = -1;
+    DIRECT_A1D_ELEM(x,2) = 3;
+    DIRECT_A1D_ELEM(x,3) = 8;
+    DIRECT_A1D_ELEM(x,4) = 2;
+    DIRECT_A1D_ELEM(x,5) = 4;
+    EXPECT_DOUBLE_EQ(3.5, x.computeMedian());
+    EXPECT_DOUBLE_EQ(3.5, computeArrayQuantile(x, 0.5));
+    EXPECT_DOUBLE_EQ(-1, computeArrayQuantile(x, 0));
+    EXPECT_DOUBLE_EQ(8, computeArrayQuantile(x, 1));
+    EXPECT_DOUBLE_EQ(2.5, computeArrayQuantile(x, 0.3));
+    x.resize(5);
+    EXPECT_DOUBLE_EQ(3, x.computeMedian());
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
 
@@ -1,4 +1,6 @@
 #include "data/sampling.h"
+#include "data/sphere_index.h"
+#include <core/geometry.h>
 
 #include <iostream>
 #include <gtest/gtest.h>
@@ -194,6 +196,48 @@ TEST_F(SamplingTest, computeNeighborsC1)
     XMIPP_CATCH
 }
 
+// The index must give the same answers as checking all the points
+TEST(SphereIndexTest, coneAndNearest)
+{
+    Sampling s;
+    s.setSampling(7);
+    s.computeSamplingPoints(false, 180., 0.);
+    const std::vector<Matrix1D<double> > &points = s.sampling_points_vector;
+    SphereIndex index(points);
+    ASSERT_EQ(points.size(), index.size());
+
+    double radii[] = {0.5, 3, 10, 45, 120};
+    Matrix1D<double> direction(3);
+    std::vector<size_t> neighbours, expected;
+    for (double rot = -177; rot < 180; rot += 23.3)
+        for (double tilt = 0; tilt <= 180; tilt += 8.9)
+        {
+            Euler_direction(rot, tilt, 0., direction);
+            for (int r = 0; r < 5; r++)
+            {
+                double cosRadius = cos(DEG2RAD(radii[r]));
+                expected.clear();
+                for (size_t i = 0; i < points.size(); i++)
+                    if (dotProduct(points[i], direction) > cosRadius)
+                        expected.push_back(i);
+                index.cone(direction, cosRadius, neighbours);
+                EXPECT_EQ(expected, neighbours) << rot << " " << tilt << " " << radii[r];
+            }
+
+            int closest = -1;
+            double best = -2;
+            for (size_t i = 0; i < points.size(); i++)
+                if (dotProduct(points[i], direction) > best)
+                {
+                    best = dotProduct(points[i], direction);
+                    closest = i;
+                }
+            double dot;
+            EXPECT_EQ(closest, index.nearest(direction, dot)) << rot << " " << tilt;
+            EXPECT_EQ(best, dot);
+        }
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <reconstruction/symmetrize.h>
+
+#include <gtest/gtest.h>
+
+class SymmetrizeTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        // Smooth blob off the symmetry axes
+        vol.resize(32,32,32);
+        vol.setXmippOrigin();
+        FOR_ALL_ELEMENTS_IN_ARRAY3D(vol)
+        A3D_ELEM(vol,k,i,j) = exp(-((k-2)*(k-2) + (i-5)*(i-5) + (j-3)*(j-3))/8.);
+
+        SL.readSymmetryFile("c4");
+    }
+
+    MultidimArray<double> vol;
+    SymList SL;
+};
+
+TEST_F( SymmetrizeTest, insideMask)
+{
+    MultidimArray<double> mask, Vall, Vmask;
+    mask.initZeros(vol);
+    mask.setXmippOrigin();
+    FOR_ALL_ELEMENTS_IN_ARRAY3D(mask)
+    if (k*k + i*i + j*j < 100)
+        A3D_ELEM(mask,k,i,j) = 1;
+
+    int splines[] = {1, 3};
+    for (int s = 0; s < 2; ++s)
+    {
+        symmetrizeVolume(SL, vol, Vall, splines[s], true, false);
+        symmetrizeVolume(SL, vol, Vmask, splines[s], true, false, false, false, false, false,
+                         0., 0., 0., 0.95, &mask, 3);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(vol)
+        if (DIRECT_MULTIDIM_ELEM(mask,n) != 0)
+            EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(Vall,n), DIRECT_MULTIDIM_ELEM(Vmask,n), 1e-10);
+        else
+            EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(vol,n), DIRECT_MULTIDIM_ELEM(Vmask,n), 1e-10);
+    }
+}
+
+TEST_F( SymmetrizeTest, fourier)
+{
+    MultidimArray<double> Vreal, Vfourier, Vthreads;
+    symmetrizeVolume(SL, vol, Vreal, 3, true, false);
+    symmetrizeVolumeFourier(SL, vol, Vfourier, 2);
+    EXPECT_TRUE(Vreal.equal(Vfourier, 1e-6));
+
+    symmetrizeVolumeFourier(SL, vol, Vthreads, 2, false, NULL, 3);
+    EXPECT_TRUE(Vfourier.equal(Vthreads, 1e-12));
+
+    // The result does not change with a rotation of the group
+    MultidimArray<double> Vrotated;
+    rotate(1, Vrotated, Vfourier, 90, 'Z');
+    EXPECT_TRUE(Vfourier.equal(Vrotated, 1e-6));
+}
+
+TEST_F( SymmetrizeTest, fourierIcosahedral)
+{
+    // Most rotations of the icosahedral group do not map the frequency grid onto
+    // itself, the interpolation error is bounded relative to the peak
+    SymList SLi;
+    SLi.readSymmetryFile("i1");
+    MultidimArray<double> Vreal, Vfourier;
+    symmetrizeVolume(SLi, vol, Vreal, 3, true, false);
+    symmetrizeVolumeFourier(SLi, vol, Vfourier, 2);
+    double maxDiff = 0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Vreal)
+    maxDiff = XMIPP_MAX(maxDiff, fabs(DIRECT_MULTIDIM_ELEM(Vreal,n) - DIRECT_MULTIDIM_ELEM(Vfourier,n)));
+    EXPECT_LT(maxDiff, 0.01 * Vreal.computeMax());
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
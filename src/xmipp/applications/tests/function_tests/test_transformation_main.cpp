@@ -112,6 +112,40 @@ TEST_F(TransformationTest, selfApplyGeometry)
     EXPECT_EQ(volref,volout);
 }
 
+TEST_F(TransformationTest, applyGeometry3DThreads)
+{
+    MultidimArray<double> V(16,15,14);
+    V.setXmippOrigin();
+    FOR_ALL_ELEMENTS_IN_ARRAY3D(V)
+    A3D_ELEM(V,k,i,j) = sin(0.3*k + 0.2*i*i - 0.1*j) + 0.01*(k*i - j);
+
+    Matrix2D<double> A, Rx;
+    rotation3DMatrix(25, 'Z', A);
+    rotation3DMatrix(-40, 'X', Rx);
+    A = A * Rx;
+    MAT_ELEM(A,0,3) = 1.3;
+    MAT_ELEM(A,2,3) = -0.6;
+
+    int degrees[] = {NEAREST, LINEAR, BSPLINE2, BSPLINE3};
+    for (int d = 0; d < 4; ++d)
+        for (int wrap = 0; wrap < 2; ++wrap)
+        {
+            MultidimArray<double> V1, V3;
+            applyGeometry(degrees[d], V1, V, A, IS_NOT_INV, wrap, 0.5);
+            applyGeometry(degrees[d], V3, V, A, IS_NOT_INV, wrap, 0.5, NULL, 3);
+            EXPECT_TRUE(V1 == V3) << "Spline degree " << degrees[d] << " wrap " << wrap;
+        }
+
+    // The specialized B-spline 3 interpolation gives the same values
+    MultidimArray<double> Bcoeffs;
+    produceSplineCoefficients(BSPLINE3, Bcoeffs, V);
+    for (double z = -9; z < 9; z += 0.7)
+        for (double y = -8.5; y < 8.5; y += 1.3)
+            for (double x = -8; x < 8; x += 0.9)
+                ASSERT_EQ(Bcoeffs.interpolatedElementBSpline3D(x, y, z, 3),
+                          Bcoeffs.interpolatedElementBSpline3D_Degree3(x, y, z));
+}
+
 TEST_F(TransformationTest, scaleToSizeNearest)
 {
     MultidimArray<double> imOut, auxMul;
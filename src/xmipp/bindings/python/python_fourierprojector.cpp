@@ -130,18 +130,21 @@ PyObject * FourierProjector_projectVolume(PyObject * obj, PyObject *args, PyObje
       PyObject *projection_image = NULL;
       if (self != NULL && PyArg_ParseTuple(args, "O|ddd", &projection_image, &rot, &tilt, &psi))
       {
+          if (!Image_checkNoViews((ImageObject *)projection_image))
+              return NULL;
           try
           {
         	  Projection P;
               projectVolume(FourierProjector_Value(self), P, self->dims.xdim, self->dims.ydim, rot, tilt, psi);
               Image_Value(projection_image).data->setImage(MULTIDIM_ARRAY(P));
+              Py_RETURN_NONE;
           }
           catch (XmippError &xe)
           {
               PyErr_SetString(PyXmippError, xe.msg.c_str());
           }
       }
-      Py_RETURN_NONE;
+      return NULL;
 }
 
 
@@ -27,6 +27,7 @@
 #include <data/ctf.h>
 #include <data/filters.h>
 #include "data/dimensions.h"
+#include <map>
 
 /***************************************************************/
 /*                            Image                         */
@@ -40,6 +41,28 @@ void Image_dealloc(ImageObject* self)
     self->ob_type->tp_free((PyObject*) self);
 }//function Image_dealloc
 
+/* Number of numpy views of the data of each image, see Image_getData */
+static std::map<ImageObject *, size_t> imageViews;
+
+/* Destructor of the base object of a view */
+static void Image_releaseView(PyObject *capsule)
+{
+    ImageObject *self = (ImageObject *) PyCapsule_GetPointer(capsule, NULL);
+    if (--imageViews[self] == 0)
+        imageViews.erase(self);
+    Py_DECREF((PyObject *) self);
+}
+
+/* The data of images viewed by numpy arrays cannot be reallocated */
+bool Image_checkNoViews(ImageObject *self)
+{
+    if (imageViews.find(self) == imageViews.end())
+        return true;
+    PyErr_SetString(PyXmippError, "The image data is being used by numpy arrays from "
+                    "getData(copy=False), it cannot be reallocated. Delete them or use getData()");
+    return false;
+}
+
 
 /* Image methods that behave like numbers */
 PyNumberMethods Image_NumberMethods =
@@ -110,8 +133,8 @@ PyMethodDef Image_methods[] =
           "Read image from disk applying geometry in referring metadata" },
         { "write", (PyCFunction) Image_write, METH_VARARGS,
           "Write image to disk" },
-        { "getData", (PyCFunction) Image_getData, METH_VARARGS,
-          "Return NumPy array from image data" },
+        { "getData", (PyCFunction) Image_getData, METH_VARARGS | METH_KEYWORDS,
+          "Return NumPy array from image data, getData(copy=False) returns a view of the image data" },
 
         { "setData", (PyCFunction) Image_setData, METH_VARARGS,
           "Copy NumPy array to image data" },
@@ -387,6 +410,8 @@ PyObject *
 Image_read(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
 
     if (self != NULL)
     {
@@ -444,6 +469,8 @@ PyObject *
 Image_readPreview(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
 
     if (self != NULL)
     {
@@ -483,6 +510,8 @@ PyObject *
 Image_readPreviewSmooth(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
 
     if (self != NULL)
     {
@@ -598,8 +627,10 @@ PyObject *
 Image_getData(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    PyObject *pyCopy = NULL;
+    static const char *kwlist[] = { "copy", NULL };
 
-    if (self != NULL)
+    if (self != NULL && PyArg_ParseTupleAndKeywords(args, kwargs, "|O", (char **) kwlist, &pyCopy))
     {
         try
         {
@@ -617,9 +648,35 @@ Image_getData(PyObject *obj, PyObject *args, PyObject *kwargs)
             void *mymem = image().getArrayPointer();
             NPY_TYPES type = datatype2NpyType(dt);
             //dims pointer is shifted if ndim or zdim are 1
-            PyArrayObject * arr = (PyArrayObject*) PyArray_SimpleNew(nd, dims+4-nd, type);
-            void * data = PyArray_DATA(arr);
-            memcpy(data, mymem, adim.nzyxdim * gettypesize(dt));
+            PyArrayObject * arr;
+            if (pyCopy == NULL || PyObject_IsTrue(pyCopy))
+            {
+                arr = (PyArrayObject*) PyArray_SimpleNew(nd, dims+4-nd, type);
+                void * data = PyArray_DATA(arr);
+                memcpy(data, mymem, adim.nzyxdim * gettypesize(dt));
+            }
+            else
+            {
+                // View of the image data, the array keeps a reference to the
+                // image, whose data cannot be reallocated while there are views
+                arr = (PyArrayObject*) PyArray_SimpleNewFromData(nd, dims+4-nd, type, mymem);
+                if (arr == NULL)
+                    return NULL;
+                PyObject * base = PyCapsule_New(self, NULL, Image_releaseView);
+                if (base == NULL)
+                {
+                    Py_DECREF(arr);
+                    return NULL;
+                }
+                Py_INCREF(obj);
+                ++imageViews[self];
+                // The base is released by numpy even if this fails
+                if (PyArray_SetBaseObject(arr, base) < 0)
+                {
+                    Py_DECREF(arr);
+                    return NULL;
+                }
+            }
 
             return (PyObject*)arr;
         }
@@ -638,6 +695,8 @@ PyObject *
 Image_setData(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     PyArrayObject * arr = NULL;
 
     if (self != NULL && PyArg_ParseTuple(args, "O", &arr))
@@ -795,6 +854,8 @@ PyObject *
 Image_resize(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     int xDim = 0, yDim = 0, zDim = 1;
     size_t nDim = 1;
 
@@ -818,6 +879,8 @@ PyObject *
 Image_scale(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     int xDim = 0, yDim = 0, zDim = 1;
 
     if (self != NULL && PyArg_ParseTuple(args, "ii|i", &xDim, &yDim, &zDim))
@@ -841,6 +904,8 @@ PyObject *
 Image_reslice(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     int axis = VIEW_Z_NEG;
 
     if (self != NULL && PyArg_ParseTuple(args, "i", &axis))
@@ -908,6 +973,8 @@ PyObject *
 Image_setDataType(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     int datatype;
 
     if (self != NULL && PyArg_ParseTuple(args, "i", &datatype))
@@ -930,6 +997,8 @@ PyObject *
 Image_convert2DataType(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     int datatype;
     int castMode=CW_CONVERT;
 
@@ -1196,6 +1265,9 @@ Image_correlation(PyObject *obj, PyObject *args, PyObject *kwargs)
             PyObject *pimg2 = NULL;
             if (PyArg_ParseTuple(args, "O", &pimg2))
             {
+                // Both images are converted to double in place
+                if (!Image_checkNoViews(self) || !Image_checkNoViews((ImageObject *)pimg2))
+                    return NULL;
 	            ImageGeneric *image = self->image;
 	            image->convert2Datatype(DT_Double);
 	            MultidimArray<double> * pImage=NULL;
@@ -1522,6 +1594,8 @@ Image_applyTransforMatScipion(PyObject *obj, PyObject *args, PyObject *kwargs)
 	PyObject * list = NULL;
     PyObject * item = NULL;
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     ImageBase * img;
     PyObject *only_apply_shifts = Py_False;
     PyObject *wrap = (WRAP ? Py_True : Py_False);
@@ -1591,6 +1665,8 @@ Image_warpAffine(PyObject *obj, PyObject *args, PyObject *kwargs)
     PyObject * border_value = NULL;
 
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
     ImageGeneric * image = self->image;
     double doubleBorder_value = 1.0;
     size_t Xdim, Ydim, Zdim;
@@ -1650,6 +1726,8 @@ PyObject *
 Image_readApplyGeo(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
 
     if (self != NULL)
     {
@@ -1695,6 +1773,8 @@ PyObject *
 Image_applyGeo(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
     ImageObject *self = (ImageObject*) obj;
+    if (!Image_checkNoViews(self))
+        return NULL;
 
     if (self != NULL)
     {
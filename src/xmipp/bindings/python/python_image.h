@@ -51,6 +51,10 @@ ImageObject;
 
 #define ImageObject_New() (ImageObject*)malloc(sizeof(ImageObject))
 
+/* Set a Python error and return false if numpy arrays view the image data.
+ * Every function that reallocates the data of an existing image must call it */
+bool Image_checkNoViews(ImageObject *self);
+
 /* Destructor */
 void Image_dealloc(ImageObject* self);
 
@@ -305,6 +305,10 @@ PyMethodDef MetaData_methods[] =
           METH_VARARGS, "Get all values value from column(label)" },
         { "setColumnValues", (PyCFunction) MetaData_setColumnValues,
           METH_VARARGS, "Set all values value from column(label)" },
+        { "getColumnArray", (PyCFunction) MetaData_getColumnArray,
+          METH_VARARGS, "Get all values from a numeric column(label) as a NumPy array" },
+        { "setColumnArray", (PyCFunction) MetaData_setColumnArray,
+          METH_VARARGS, "Set all values of a numeric column(label) from a NumPy array" },
         { "getActiveLabels",
           (PyCFunction) MetaData_getActiveLabels,
           METH_VARARGS,
@@ -1076,6 +1080,108 @@ MetaData_setColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs)
     Py_RETURN_NONE;
 }
 
+/** Just to statically call the function import_array
+ * required to work with NumPy arrays
+ */
+class NumpyStaticImportMetaData
+{
+public:
+    NumpyStaticImportMetaData()
+    {
+        import_array();
+    }
+}
+;//class NumpyStaticImportMetaData
+
+//Declare a variable to call the constructor
+static NumpyStaticImportMetaData _npyImport;
+
+/* getColumnArray */
+PyObject *
+MetaData_getColumnArray(PyObject *obj, PyObject *args, PyObject *kwargs)
+{
+    int label;
+    if (PyArg_ParseTuple(args, "i", &label))
+    {
+        try
+        {
+            MetaDataObject *self = (MetaDataObject*) obj;
+
+            std::vector<double> v;
+            self->metadata->getColumnArray((MDLabel) label, v);
+
+            npy_intp size = v.size();
+            PyArrayObject * arr;
+            switch (MDL::labelType((MDLabel) label))
+            {
+            case LABEL_BOOL:
+                {
+                    arr = (PyArrayObject*) PyArray_SimpleNew(1, &size, NPY_BOOL);
+                    npy_bool * data = (npy_bool *) PyArray_DATA(arr);
+                    for (npy_intp i = 0; i < size; ++i)
+                        data[i] = (v[i] != 0);
+                    break;
+                }
+            case LABEL_INT:
+                {
+                    arr = (PyArrayObject*) PyArray_SimpleNew(1, &size, NPY_INT);
+                    int * data = (int *) PyArray_DATA(arr);
+                    for (npy_intp i = 0; i < size; ++i)
+                        data[i] = (int) v[i];
+                    break;
+                }
+            case LABEL_SIZET:
+                {
+                    arr = (PyArrayObject*) PyArray_SimpleNew(1, &size, NPY_UINT64);
+                    npy_uint64 * data = (npy_uint64 *) PyArray_DATA(arr);
+                    for (npy_intp i = 0; i < size; ++i)
+                        data[i] = (npy_uint64) v[i];
+                    break;
+                }
+            default:
+                arr = (PyArrayObject*) PyArray_SimpleNew(1, &size, NPY_DOUBLE);
+                if (size > 0)
+                    memcpy(PyArray_DATA(arr), &v[0], size * sizeof(double));
+            }
+            return (PyObject*)arr;
+        }
+        catch (XmippError &xe)
+        {
+            PyErr_SetString(PyXmippError, xe.msg.c_str());
+        }
+    }
+    return NULL;
+}
+
+/* setColumnArray */
+PyObject *
+MetaData_setColumnArray(PyObject *obj, PyObject *args, PyObject *kwargs)
+{
+    int label;
+    PyObject *input = NULL;
+    if (PyArg_ParseTuple(args, "iO", &label, &input))
+    {
+        // Any sequence of numbers is converted to a contiguous array of doubles
+        PyArrayObject * arr = (PyArrayObject*) PyArray_FROM_OTF(input, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+        if (arr == NULL)
+            return NULL;
+        try
+        {
+            MetaDataObject *self = (MetaDataObject*) obj;
+            double * data = (double *) PyArray_DATA(arr);
+            std::vector<double> v(data, data + PyArray_SIZE(arr));
+            Py_DECREF(arr);
+            self->metadata->setColumnArray((MDLabel) label, v);
+            Py_RETURN_NONE;
+        }
+        catch (XmippError &xe)
+        {
+            PyErr_SetString(PyXmippError, xe.msg.c_str());
+        }
+    }
+    return NULL;
+}
+
 /* containsLabel */
 PyObject *
 MetaData_getActiveLabels(PyObject *obj, PyObject *args, PyObject *kwargs)
@@ -259,6 +259,14 @@ MetaData_getColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs);
 PyObject *
 MetaData_setColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs);
 
+/* getColumnArray */
+PyObject *
+MetaData_getColumnArray(PyObject *obj, PyObject *args, PyObject *kwargs);
+
+/* setColumnArray */
+PyObject *
+MetaData_setColumnArray(PyObject *obj, PyObject *args, PyObject *kwargs);
+
 /* containsLabel */
 PyObject *
 MetaData_getActiveLabels(PyObject *obj, PyObject *args, PyObject *kwargs);
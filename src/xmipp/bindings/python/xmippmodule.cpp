@@ -613,6 +613,9 @@ bool validateInputImageString(PyObject * pyImage, PyObject *pyStrFn, FileName &f
                         "bad argument: Expected Image as first argument");
         return false;
     }
+    // The filtered image replaces the data of pyImage
+    if (!Image_checkNoViews((ImageObject *)pyImage))
+        return false;
     if (PyString_Check(pyStrFn))
         fn = PyString_AsString(pyStrFn);
     else if (FileName_Check(pyStrFn))
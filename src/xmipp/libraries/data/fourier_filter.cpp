@@ -40,6 +40,8 @@ void FourierFilter::init()
     ctf.clear();
     ctf.enable_CTFnoise = false;
     do_generate_3dmask = false;
+    singlePrecision = false;
+    maskGenerated = false;
     sampling_rate = -1.;
 }
 
@@ -90,6 +92,9 @@ void FourierFilter::defineParams(XmippProgram *program)
     program->addParamsLine("         requires --fourier;");
     program->addParamsLine("  [--save <filename=\"\"> ]                  : Do not apply just save the mask");
     program->addParamsLine("         requires --fourier;");
+    program->addParamsLine("  [--single_precision]                       : Compute the transforms in single precision.");
+    program->addParamsLine("                                             : Sparsify is not available");
+    program->addParamsLine("         requires --fourier;");
 }
 
 /* Read parameters from command line. -------------------------------------- */
@@ -100,6 +105,7 @@ void FourierFilter::readParams(XmippProgram *program)
         maskFn = program->getParam("--save");
     if (program->checkParam("--sampling"))
         sampling_rate = program->getDoubleParam("--sampling");
+    singlePrecision = program->checkParam("--single_precision");
 
     // Filter shape .........................................................
     String filter_type;
@@ -346,12 +352,19 @@ void FourierFilter::show()
 
 void FourierFilter::apply(MultidimArray<double> &img)
 {
-    static bool firstTime = true;
+    if (singlePrecision && maskFn == "")
+    {
+        MultidimArray<float> imgf;
+        typeCast(img, imgf);
+        apply(imgf);
+        typeCast(imgf, img);
+        return;
+    }
     do_generate_3dmask = (img.zdim > 1);
-    if (firstTime)
+    if (!maskGenerated)
     {
         generateMask(img);
-        firstTime = false;
+        maskGenerated = true;
     }
     if (maskFn != "")
         if (do_generate_3dmask==0 && MULTIDIM_SIZE(img)>1024*1024)
@@ -378,6 +391,29 @@ void FourierFilter::apply(MultidimArray<double> &img)
         applyMaskSpace(img);
 }
 
+void FourierFilter::apply(MultidimArray<float> &img)
+{
+    if (maskFn != "")
+    {
+        // Saving the mask does not depend on the precision
+        MultidimArray<double> aux;
+        typeCast(img, aux);
+        apply(aux);
+        return;
+    }
+    do_generate_3dmask = (img.zdim > 1);
+    if (!maskGenerated)
+    {
+        // The mask is computed once in double precision, only the size of
+        // the image is needed
+        MultidimArray<double> aux;
+        aux.resizeNoCopy(ZSIZE(img), YSIZE(img), XSIZE(img));
+        generateMask(aux);
+        maskGenerated = true;
+    }
+    applyMaskSpace(img);
+}
+
 /* Get mask value ---------------------------------------------------------- */
 double FourierFilter::maskValue(const Matrix1D<double> &w)
 {
@@ -651,42 +687,97 @@ void FourierFilter::generateMask(MultidimArray<double> &v)
 void FourierFilter::applyMaskSpace(MultidimArray<double> &v)
 {
     MultidimArray< std::complex<double> > aux3D;
+    if (NSIZE(v)>1)
+    {
+        batchTransformer.setReal(v);
+        batchTransformer.FourierTransform();
+        for (size_t n=0; n<NSIZE(v); ++n)
+        {
+            batchTransformer.getFourierAlias(n, aux3D);
+            applyMaskFourierSpace(v, aux3D);
+        }
+        batchTransformer.inverseFourierTransform();
+        return;
+    }
     transformer.FourierTransform(v, aux3D, false);
     applyMaskFourierSpace(v, aux3D);
     transformer.inverseFourierTransform();
 }
 
+void FourierFilter::applyMaskSpace(MultidimArray<float> &v)
+{
+    MultidimArray< std::complex<float> > aux3D;
+    if (NSIZE(v)>1)
+    {
+        MultidimArray<float> vn;
+        for (size_t n=0; n<NSIZE(v); ++n)
+        {
+            vn.aliasImageInStack(v, n);
+            transformerf.FourierTransform(vn, aux3D, false);
+            applyMaskFourierSpace(vn, aux3D);
+            transformerf.inverseFourierTransform();
+        }
+        return;
+    }
+    transformerf.FourierTransform(v, aux3D, false);
+    applyMaskFourierSpace(v, aux3D);
+    transformerf.inverseFourierTransform();
+}
+
 void FourierFilter::applyMaskFourierSpace(const MultidimArray<double> &v, MultidimArray<std::complex<double> > &V)
+{
+    applyMaskFourierSpaceT(v, V);
+}
+
+void FourierFilter::applyMaskFourierSpace(const MultidimArray<float> &v, MultidimArray<std::complex<float> > &V)
+{
+    applyMaskFourierSpaceT(v, V);
+}
+
+/* Keep only the coefficients above the given percentile of magnitude */
+static void sparsifyFourier(MultidimArray<std::complex<double> > &V, double percentage,
+                            MultidimArray<double> &vMag, MultidimArray<double> &vMagSorted)
+{
+    FFT_magnitude(V,vMag);
+    vMag.resize(1,1,1,MULTIDIM_SIZE(vMag));
+    vMag.sort(vMagSorted);
+    double minMagnitude=A1D_ELEM(vMagSorted,(int)(percentage*XSIZE(vMag)));
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V)
+    if (DIRECT_MULTIDIM_ELEM(vMag,n)<minMagnitude)
+    {
+        double *ptr=(double*)&DIRECT_MULTIDIM_ELEM(V,n);
+        *ptr=0;
+        *(ptr+1)=0;
+    }
+}
+
+static void sparsifyFourier(MultidimArray<std::complex<float> > &, double,
+                            MultidimArray<double> &, MultidimArray<double> &)
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"Sparsify is not available in single precision");
+}
+
+template<typename T>
+void FourierFilter::applyMaskFourierSpaceT(const MultidimArray<T> &v, MultidimArray<std::complex<T> > &V)
 {
     if (XSIZE(maskFourier)!=0)
     {
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V)
-        DIRECT_MULTIDIM_ELEM(V,n)*=DIRECT_MULTIDIM_ELEM(maskFourier,n);
+        DIRECT_MULTIDIM_ELEM(V,n)*=(T)DIRECT_MULTIDIM_ELEM(maskFourier,n);
     }
     else if (XSIZE(maskFourierd)!=0)
     {
-        double *ptrV=(double*)&DIRECT_MULTIDIM_ELEM(V,0);
+        T *ptrV=(T*)&DIRECT_MULTIDIM_ELEM(V,0);
         double *ptrMask=(double*)&DIRECT_MULTIDIM_ELEM(maskFourierd,0);
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V)
         {
-            *ptrV++ *= *ptrMask;
-            *ptrV++ *= *ptrMask++;
+            T mask=(T)*ptrMask++;
+            *ptrV++ *= mask;
+            *ptrV++ *= mask;
         }
     }
     else if (FilterShape==SPARSIFY)
-    {
-        FFT_magnitude(V,vMag);
-        vMag.resize(1,1,1,MULTIDIM_SIZE(vMag));
-        vMag.sort(vMagSorted);
-        double minMagnitude=A1D_ELEM(vMagSorted,(int)(percentage*XSIZE(vMag)));
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V)
-        if (DIRECT_MULTIDIM_ELEM(vMag,n)<minMagnitude)
-        {
-            double *ptr=(double*)&DIRECT_MULTIDIM_ELEM(V,n);
-            *ptr=0;
-            *(ptr+1)=0;
-        }
-    }
+        sparsifyFourier(V,percentage,vMag,vMagSorted);
     else
     {
         w.resizeNoCopy(3);
@@ -699,7 +790,7 @@ void FourierFilter::applyMaskFourierSpace(const MultidimArray<double> &v, Multid
                 for (size_t j=0; j<XSIZE(V); j++)
                 {
                     FFT_IDX2DIGFREQ(j,XSIZE(v),XX(w));
-                    DIRECT_A3D_ELEM(V,k,i,j)*=maskValue(w);
+                    DIRECT_A3D_ELEM(V,k,i,j)*=(T)maskValue(w);
                 }
             }
         }
@@ -138,6 +138,12 @@ public:
     /** Flag to generate 3D mask */
     bool do_generate_3dmask;
 
+    /** Compute the transforms in single precision, also for double images */
+    bool singlePrecision;
+
+    /** The mask has been generated by the first call to apply */
+    bool maskGenerated;
+
 public:
     /** Define parameters */
     static void defineParams(XmippProgram * program);
@@ -149,6 +155,10 @@ public:
     /** Process one image */
     void apply(MultidimArray<double> &img);
 
+    /** Process one float image with single precision transforms.
+     * The mask is computed in double precision, as for double images. */
+    void apply(MultidimArray<float> &img);
+
     /** Empty constructor */
     FourierFilter();
 
@@ -166,7 +176,8 @@ public:
     /** Generate nD mask. */
     void generateMask(MultidimArray<double> &v);
 
-    /** Apply mask in real space. */
+    /** Apply mask in real space.
+     * The images of a stack are filtered with batched Fourier transforms. */
     void applyMaskSpace(MultidimArray<double> &v);
 
     /** Apply mask in Fourier space.
@@ -174,6 +185,18 @@ public:
      */
     void applyMaskFourierSpace(const MultidimArray<double> &v, MultidimArray<std::complex<double> > &V);
 
+    /** Apply mask in real space to a float image or stack of images.
+     * Sparsify is not available in single precision. */
+    void applyMaskSpace(MultidimArray<float> &v);
+
+    /** Apply mask in Fourier space to the transform of a float image. */
+    void applyMaskFourierSpace(const MultidimArray<float> &v, MultidimArray<std::complex<float> > &V);
+
+    /** Apply mask in Fourier space in the precision of the image.
+     * Shared by both applyMaskFourierSpace. */
+    template<typename T>
+    void applyMaskFourierSpaceT(const MultidimArray<T> &v, MultidimArray<std::complex<T> > &V);
+
     /** Get the power of the nD mask. */
     double maskPower();
     
@@ -192,6 +215,12 @@ public:
     // Transformer
     FourierTransformer transformer;
 
+    // Transformer of stacks
+    BatchFourierTransformer batchTransformer;
+
+    // Single precision transformer
+    FourierTransformerFloat transformerf;
+
     // Auxiliary variables for sparsify
     MultidimArray<double> vMag, vMagSorted;
 
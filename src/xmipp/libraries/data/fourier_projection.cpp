@@ -25,6 +25,7 @@
 
 #include "fourier_projection.h"
 #include <core/xmipp_fft.h>
+#include <core/xmipp_threads.h>
 
 /* Empty constructor ======================================================= */
 Projection::Projection(): Image<double>()
@@ -101,160 +102,271 @@ void FourierProjector::updateVolume(MultidimArray<double> &V)
 }
 
 
-void FourierProjector::project(double rot, double tilt, double psi, const MultidimArray<double> *ctf)
+/* Interpolation of the coefficients of the volume at the points (x[n],y[n],z[n]),
+ * in logical coordinates. The degree of the B-spline is a template parameter so
+ * that each row is interpolated without checking it for every pixel.
+ */
+template <int degree>
+static void interpolateRow(const MultidimArray<double> &VRe, const MultidimArray<double> &VIm,
+                           const double *x, const double *y, const double *z, size_t n,
+                           double *c, double *d);
+
+template <>
+void interpolateRow<0>(const MultidimArray<double> &VRe, const MultidimArray<double> &VIm,
+                       const double *x, const double *y, const double *z, size_t n,
+                       double *c, double *d)
 {
-    double freqy, freqx;
-    std::complex< double > f;
-    Euler_angles2matrix(rot,tilt,psi,E);
+    for (size_t j=0; j<n; ++j)
+    {
+        int kVolume=(int)round(z[j]);
+        int iVolume=(int)round(y[j]);
+        int jVolume=(int)round(x[j]);
+        c[j] = A3D_ELEM(VRe,kVolume,iVolume,jVolume);
+        d[j] = A3D_ELEM(VIm,kVolume,iVolume,jVolume);
+    }
+}
 
-    projectionFourier.initZeros();
-    double maxFreq2=maxFrequency*maxFrequency;
-    int Xdim=(int)XSIZE(VfourierRealCoefs);
-    int Ydim=(int)YSIZE(VfourierRealCoefs);
-    int Zdim=(int)ZSIZE(VfourierRealCoefs);
+template <>
+void interpolateRow<1>(const MultidimArray<double> &VRe, const MultidimArray<double> &VIm,
+                       const double *x, const double *y, const double *z, size_t n,
+                       double *c, double *d)
+{
+    // Same as interpolatedElement3D, but both volumes share the weights
+    for (size_t j=0; j<n; ++j)
+    {
+        int x0 = FLOOR(x[j]);
+        int y0 = FLOOR(y[j]);
+        int z0 = FLOOR(z[j]);
+        double fx = x[j] - x0;
+        double fy = y[j] - y0;
+        double fz = z[j] - z0;
+        double re[8], im[8];
+        for (int nn=0; nn<8; ++nn)
+        {
+            int zz = z0 + (nn >> 2);
+            int yy = y0 + ((nn >> 1) & 1);
+            int xx = x0 + (nn & 1);
+            if (zz < STARTINGZ(VRe) || zz > FINISHINGZ(VRe) || yy < STARTINGY(VRe) ||
+                yy > FINISHINGY(VRe) || xx < STARTINGX(VRe) || xx > FINISHINGX(VRe))
+                re[nn] = im[nn] = 0.;
+            else
+            {
+                re[nn] = A3D_ELEM(VRe,zz,yy,xx);
+                im[nn] = A3D_ELEM(VIm,zz,yy,xx);
+            }
+        }
+        double reXY0 = LIN_INTERP(fy, LIN_INTERP(fx, re[0], re[1]), LIN_INTERP(fx, re[2], re[3]));
+        double reXY1 = LIN_INTERP(fy, LIN_INTERP(fx, re[4], re[5]), LIN_INTERP(fx, re[6], re[7]));
+        double imXY0 = LIN_INTERP(fy, LIN_INTERP(fx, im[0], im[1]), LIN_INTERP(fx, im[2], im[3]));
+        double imXY1 = LIN_INTERP(fy, LIN_INTERP(fx, im[4], im[5]), LIN_INTERP(fx, im[6], im[7]));
+        c[j] = LIN_INTERP(fz, reXY0, reXY1);
+        d[j] = LIN_INTERP(fz, imXY0, imXY1);
+    }
+}
 
-    for (size_t i=0; i<YSIZE(projectionFourier); ++i)
+// Indexes (mirrored at the borders) and weights of the cubic B-spline at x
+static inline void bspline3Weights(double x, int size, int *index, double *weight)
+{
+    int l1 = (int)ceil(x - 2);
+    for (int n=0; n<4; ++n)
     {
-        FFT_IDX2DIGFREQ(i,volumeSize,freqy);
-        double freqy2=freqy*freqy;
+        int l = l1 + n;
+        BSPLINE03(weight[n], x - l);
+        if (l < 0)
+            l = -l - 1;
+        else if (l >= size)
+            l = 2 * size - l - 1;
+        index[n] = l;
+    }
+}
 
-        double freqYvol_X=MAT_ELEM(E,1,0)*freqy;
-        double freqYvol_Y=MAT_ELEM(E,1,1)*freqy;
-        double freqYvol_Z=MAT_ELEM(E,1,2)*freqy;
-        for (size_t j=0; j<XSIZE(projectionFourier); ++j)
+template <>
+void interpolateRow<3>(const MultidimArray<double> &VRe, const MultidimArray<double> &VIm,
+                       const double *x, const double *y, const double *z, size_t n,
+                       double *c, double *d)
+{
+    // Same as interpolatedElementBSpline3D, computing the 12 weights only once
+    int Xdim=(int)XSIZE(VRe);
+    int Ydim=(int)YSIZE(VRe);
+    int Zdim=(int)ZSIZE(VRe);
+    const double *ptrRe=MULTIDIM_ARRAY(VRe);
+    const double *ptrIm=MULTIDIM_ARRAY(VIm);
+    int lx[4], ly[4], lz[4];
+    double wx[4], wy[4], wz[4];
+    for (size_t j=0; j<n; ++j)
+    {
+        bspline3Weights(x[j] - STARTINGX(VRe), Xdim, lx, wx);
+        bspline3Weights(y[j] - STARTINGY(VRe), Ydim, ly, wy);
+        bspline3Weights(z[j] - STARTINGZ(VRe), Zdim, lz, wz);
+        double sumRe = 0.0, sumIm = 0.0;
+        for (int nn=0; nn<4; ++nn)
         {
-            // The frequency of pairs (i,j) in 2D
-            FFT_IDX2DIGFREQ(j,volumeSize,freqx);
+            double yxsumRe = 0.0, yxsumIm = 0.0;
+            for (int m=0; m<4; ++m)
+            {
+                size_t rowOffset = ((size_t)lz[nn] * Ydim + ly[m]) * Xdim;
+                const double *rowRe = ptrRe + rowOffset;
+                const double *rowIm = ptrIm + rowOffset;
+                double xsumRe = rowRe[lx[0]] * wx[0] + rowRe[lx[1]] * wx[1] +
+                                rowRe[lx[2]] * wx[2] + rowRe[lx[3]] * wx[3];
+                double xsumIm = rowIm[lx[0]] * wx[0] + rowIm[lx[1]] * wx[1] +
+                                rowIm[lx[2]] * wx[2] + rowIm[lx[3]] * wx[3];
+                yxsumRe += xsumRe * wy[m];
+                yxsumIm += xsumIm * wy[m];
+            }
+            sumRe += yxsumRe * wz[nn];
+            sumIm += yxsumIm * wz[nn];
+        }
+        c[j] = sumRe;
+        d[j] = sumIm;
+    }
+}
 
-            // Do not consider pixels with high frequency
-            if ((freqy2+freqx*freqx)>maxFreq2)
-                continue;
+template <int degree>
+static void projectSlice(const FourierProjector &projector, const Matrix2D<double> &E,
+                         MultidimArray< std::complex<double> > &projectionFourier,
+                         const MultidimArray<double> *ctf)
+{
+    projectionFourier.initZeros();
+    size_t Xdim=XSIZE(projectionFourier);
+    std::vector<double> x(Xdim), y(Xdim), z(Xdim), c(Xdim), d(Xdim);
 
-            // Compute corresponding frequency in the volume
-            double freqvol_X=freqYvol_X+MAT_ELEM(E,0,0)*freqx;
-            double freqvol_Y=freqYvol_Y+MAT_ELEM(E,0,1)*freqx;
-            double freqvol_Z=freqYvol_Z+MAT_ELEM(E,0,2)*freqx;
+    // Step in the volume per unit of frequency along the rows and columns
+    double K=projector.volumePaddedSize;
+    double stepX_X=MAT_ELEM(E,0,0)*K, stepX_Y=MAT_ELEM(E,0,1)*K, stepX_Z=MAT_ELEM(E,0,2)*K;
+    double stepY_X=MAT_ELEM(E,1,0)*K, stepY_Y=MAT_ELEM(E,1,1)*K, stepY_Z=MAT_ELEM(E,1,2)*K;
+    const double *freqx=&projector.columnFrequency[0];
 
-            double c,d;
-            if (BSplineDeg==0)
-            {
-                // 0 order interpolation
-                // Compute corresponding index in the volume
-                int kVolume=(int)round(freqvol_Z*volumePaddedSize);
-                int iVolume=(int)round(freqvol_Y*volumePaddedSize);
-                int jVolume=(int)round(freqvol_X*volumePaddedSize);
-                c = A3D_ELEM(VfourierRealCoefs,kVolume,iVolume,jVolume);
-                d = A3D_ELEM(VfourierImagCoefs,kVolume,iVolume,jVolume);
-            }
-            else if (BSplineDeg==1)
-            {
-                // B-spline linear interpolation
-                double kVolume=freqvol_Z*volumePaddedSize;
-                double iVolume=freqvol_Y*volumePaddedSize;
-                double jVolume=freqvol_X*volumePaddedSize;
-                c=VfourierRealCoefs.interpolatedElement3D(jVolume,iVolume,kVolume);
-                d=VfourierImagCoefs.interpolatedElement3D(jVolume,iVolume,kVolume);
-            }
-            else
-            {
-                // B-spline cubic interpolation
-                double kVolume=freqvol_Z*volumePaddedSize;
-                double iVolume=freqvol_Y*volumePaddedSize;
-                double jVolume=freqvol_X*volumePaddedSize;
-
-                // Commented for speed-up, the corresponding code is below
-                // c=VfourierRealCoefs.interpolatedElementBSpline3D(jVolume,iVolume,kVolume);
-                // d=VfourierImagCoefs.interpolatedElementBSpline3D(jVolume,iVolume,kVolume);
-
-                // The code below is a replicate for speed reasons of interpolatedElementBSpline3D
-                double z=kVolume;
-                double y=iVolume;
-                double x=jVolume;
-
-                // Logical to physical
-                z -= STARTINGZ(VfourierRealCoefs);
-                y -= STARTINGY(VfourierRealCoefs);
-                x -= STARTINGX(VfourierRealCoefs);
-
-                int l1 = (int)ceil(x - 2);
-                int l2 = l1 + 3;
-
-                int m1 = (int)ceil(y - 2);
-                int m2 = m1 + 3;
-
-                int n1 = (int)ceil(z - 2);
-                int n2 = n1 + 3;
-
-                c = d = 0.0;
-                double aux;
-                for (int nn = n1; nn <= n2; nn++)
-                {
-                    int equivalent_nn=nn;
-                    if      (nn<0)
-                        equivalent_nn=-nn-1;
-                    else if (nn>=Zdim)
-                        equivalent_nn=2*Zdim-nn-1;
-                    double yxsumRe = 0.0, yxsumIm = 0.0;
-                    for (int m = m1; m <= m2; m++)
-                    {
-                        int equivalent_m=m;
-                        if      (m<0)
-                            equivalent_m=-m-1;
-                        else if (m>=Ydim)
-                            equivalent_m=2*Ydim-m-1;
-                        double xsumRe = 0.0, xsumIm = 0.0;
-                        for (int l = l1; l <= l2; l++)
-                        {
-                            double xminusl = x - (double) l;
-                            int equivalent_l=l;
-                            if      (l<0)
-                                equivalent_l=-l-1;
-                            else if (l>=Xdim)
-                                equivalent_l=2*Xdim-l-1;
-                            double CoeffRe = (double) DIRECT_A3D_ELEM(VfourierRealCoefs,equivalent_nn,equivalent_m,equivalent_l);
-                            double CoeffIm = (double) DIRECT_A3D_ELEM(VfourierImagCoefs,equivalent_nn,equivalent_m,equivalent_l);
-                            BSPLINE03(aux,xminusl);
-                            xsumRe += CoeffRe * aux;
-                            xsumIm += CoeffIm * aux;
-                        }
-
-                        double yminusm = y - (double) m;
-                        BSPLINE03(aux,yminusm);
-						yxsumRe += xsumRe * aux;
-						yxsumIm += xsumIm * aux;
-                    }
-
-                    double zminusn = z - (double) nn;
-                    BSPLINE03(aux,zminusn);
-					c += yxsumRe * aux;
-					d += yxsumIm * aux;
-                }
-            }
+    for (size_t i=0; i<YSIZE(projectionFourier); ++i)
+    {
+        // Pixels in the row within the maximum frequency
+        int n=projector.lastColumn[i]+1;
+        if (n==0)
+            continue;
+
+        // Corresponding frequencies in the volume
+        double freqy=projector.rowFrequency[i];
+        double freqYvol_X=stepY_X*freqy;
+        double freqYvol_Y=stepY_Y*freqy;
+        double freqYvol_Z=stepY_Z*freqy;
+        for (int j=0; j<n; ++j)
+        {
+            x[j]=freqYvol_X+stepX_X*freqx[j];
+            y[j]=freqYvol_Y+stepX_Y*freqx[j];
+            z[j]=freqYvol_Z+stepX_Z*freqx[j];
+        }
 
-            // Phase shift to move the origin of the image to the corner
-            double a=DIRECT_A2D_ELEM(phaseShiftImgA,i,j);
-            double b=DIRECT_A2D_ELEM(phaseShiftImgB,i,j);
-            if (ctf!=NULL)
+        interpolateRow<degree>(projector.VfourierRealCoefs, projector.VfourierImagCoefs,
+                               &x[0], &y[0], &z[0], n, &c[0], &d[0]);
+
+        // Phase shift to move the origin of the image to the corner
+        const double *ptrA=&DIRECT_A2D_ELEM(projector.phaseShiftImgA,i,0);
+        const double *ptrB=&DIRECT_A2D_ELEM(projector.phaseShiftImgB,i,0);
+        const double *ptrCtf=(ctf!=NULL) ? &DIRECT_A2D_ELEM(*ctf,i,0) : NULL;
+        double *ptrI=(double *)&DIRECT_A2D_ELEM(projectionFourier,i,0);
+        for (int j=0; j<n; ++j)
+        {
+            double a=ptrA[j];
+            double b=ptrB[j];
+            if (ptrCtf!=NULL)
             {
-            	double ctfij=DIRECT_A2D_ELEM(*ctf,i,j);
-            	a*=ctfij;
-            	b*=ctfij;
+                a*=ptrCtf[j];
+                b*=ptrCtf[j];
             }
 
             // Multiply Fourier coefficient in volume times phase shift
-            double ac = a * c;
-            double bd = b * d;
-            double ab_cd = (a + b) * (c + d);
+            double ac = a * c[j];
+            double bd = b * d[j];
+            double ab_cd = (a + b) * (c[j] + d[j]);
 
             // And store the multiplication
-            double *ptrI_ij=(double *)&DIRECT_A2D_ELEM(projectionFourier,i,j);
-            *ptrI_ij = ac - bd;
-            *(ptrI_ij+1) = ab_cd - ac - bd;
+            ptrI[2*j] = ac - bd;
+            ptrI[2*j+1] = ab_cd - ac - bd;
         }
     }
+}
+
+void FourierProjector::projectFourier(const Matrix2D<double> &E,
+                                      MultidimArray< std::complex<double> > &projectionFourier,
+                                      const MultidimArray<double> *ctf) const
+{
+    switch ((int)BSplineDeg)
+    {
+    case 0:
+        projectSlice<0>(*this, E, projectionFourier, ctf);
+        break;
+    case 1:
+        projectSlice<1>(*this, E, projectionFourier, ctf);
+        break;
+    default:
+        projectSlice<3>(*this, E, projectionFourier, ctf);
+    }
+}
+
+void FourierProjector::project(double rot, double tilt, double psi, const MultidimArray<double> *ctf)
+{
+    Euler_angles2matrix(rot,tilt,psi,E);
+    projectFourier(E, projectionFourier, ctf);
     transformer2D.inverseFourierTransform();
 }
 
+struct FourierProjectorBatch
+{
+    const FourierProjector *projector;
+    const std::vector<double> *rot, *tilt, *psi;
+    std::vector< MultidimArray<double> > *projections;
+    const MultidimArray<double> *ctf;
+    ThreadTaskDistributor *distributor;
+};
+
+// Each thread has its own Fourier transformer and projection
+static void threadProjectMany(ThreadArgument &thArg)
+{
+    FourierProjectorBatch *batch=(FourierProjectorBatch *)thArg.workClass;
+    const FourierProjector &projector=*batch->projector;
+    MultidimArray<double> projection;
+    MultidimArray< std::complex<double> > projectionFourier;
+    FourierTransformer transformer;
+    Matrix2D<double> E;
+    projection.initZeros(projector.volumeSize,projector.volumeSize);
+    projection.setXmippOrigin();
+    transformer.FourierTransform(projection,projectionFourier,false);
+
+    size_t first, last;
+    while (batch->distributor->getTasks(first, last))
+        for (size_t n=first; n<=last; ++n)
+        {
+            Euler_angles2matrix((*batch->rot)[n],(*batch->tilt)[n],(*batch->psi)[n],E);
+            projector.projectFourier(E, projectionFourier, batch->ctf);
+            transformer.inverseFourierTransform();
+            (*batch->projections)[n]=projection;
+        }
+}
+
+void FourierProjector::projectMany(const std::vector<double> &rot, const std::vector<double> &tilt,
+                                   const std::vector<double> &psi,
+                                   std::vector< MultidimArray<double> > &projections,
+                                   int nThreads, const MultidimArray<double> *ctf) const
+{
+    if (tilt.size()!=rot.size() || psi.size()!=rot.size())
+        REPORT_ERROR(ERR_ARG_INCORRECT,"FourierProjector::projectMany: there must be as many rot, tilt and psi angles");
+    projections.resize(rot.size());
+    if (rot.empty())
+        return;
+
+    ThreadTaskDistributor distributor(rot.size(), 1);
+    FourierProjectorBatch batch;
+    batch.projector=this;
+    batch.rot=&rot;
+    batch.tilt=&tilt;
+    batch.psi=&psi;
+    batch.projections=&projections;
+    batch.ctf=ctf;
+    batch.distributor=&distributor;
+    ThreadManager thMgr(std::max(1,std::min(nThreads,(int)rot.size())),&batch);
+    thMgr.run(threadProjectMany);
+}
+
 void FourierProjector::produceSideInfo()
 {
     // Zero padding
@@ -278,6 +390,7 @@ void FourierProjector::produceSideInfo()
     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Vfourier)
     DIRECT_MULTIDIM_ELEM(Vfourier,n)*=K;
     Vpadded.clear();
+    volumePaddedSize=XSIZE(Vfourier);
     // Compute Bspline coefficients
     if (BSplineDeg==3)
     {
@@ -290,7 +403,6 @@ void FourierProjector::produceSideInfo()
         VfourierRealAux.clear();
 
         // Remove all those coefficients we are sure we will not use during the projections
-        volumePaddedSize=XSIZE(VfourierRealCoefs);
         int idxMax=maxFrequency*XSIZE(VfourierRealCoefs)+10; // +10 is a safety guard
         idxMax=std::min(FINISHINGX(VfourierRealCoefs),idxMax);
         int idxMin=std::max(-idxMax,STARTINGX(VfourierRealCoefs));
@@ -323,6 +435,24 @@ void FourierProjector::produceSideInfo()
             sincos(dotp,&DIRECT_A2D_ELEM(phaseShiftImgB,i,j),&DIRECT_A2D_ELEM(phaseShiftImgA,i,j));
         }
     }
+
+    // Frequencies of the rows and columns, and last column of each row within maxFrequency
+    double maxFreq2=maxFrequency*maxFrequency;
+    rowFrequency.resize(YSIZE(projectionFourier));
+    columnFrequency.resize(XSIZE(projectionFourier));
+    lastColumn.resize(YSIZE(projectionFourier));
+    for (size_t j=0; j<XSIZE(projectionFourier); ++j)
+        FFT_IDX2DIGFREQ(j,volumeSize,columnFrequency[j]);
+    for (size_t i=0; i<YSIZE(projectionFourier); ++i)
+    {
+        FFT_IDX2DIGFREQ(i,volumeSize,rowFrequency[i]);
+        double freqy2=rowFrequency[i]*rowFrequency[i];
+        lastColumn[i]=-1;
+        // Column frequencies are not negative and increasing
+        for (size_t j=0; j<XSIZE(projectionFourier); ++j)
+            if (freqy2+columnFrequency[j]*columnFrequency[j]<=maxFreq2)
+                lastColumn[i]=j;
+    }
 }
 
 void projectVolume(FourierProjector &projector, Projection &P, int Ydim, int Xdim,
@@ -152,6 +152,12 @@ public:
 
     // Euler matrix
     Matrix2D<double> E;
+
+    // Frequency of each row and column of projectionFourier
+    std::vector<double> rowFrequency, columnFrequency;
+
+    // Last column of each row within maxFrequency (-1 if none)
+    std::vector<int> lastColumn;
 public:
     /* Empty constructor */
     FourierProjector(double paddFactor, double maxFreq, int degree);
@@ -166,6 +172,22 @@ public:
      */
     void project(double rot, double tilt, double psi, const MultidimArray<double> *ctf=NULL);
 
+    /**
+     * Projections of the volume for several orientations computed in parallel. projections[n]
+     * is the projection in real space for rot[n], tilt[n] and psi[n]. The members of the
+     * projector are not modified, each thread uses its own Fourier transformer.
+     */
+    void projectMany(const std::vector<double> &rot, const std::vector<double> &tilt,
+                     const std::vector<double> &psi, std::vector< MultidimArray<double> > &projections,
+                     int nThreads=1, const MultidimArray<double> *ctf=NULL) const;
+
+    /**
+     * Fourier transform of the projection for the Euler matrix E. projectionFourier must have
+     * the size of the Fourier transform of the projection.
+     */
+    void projectFourier(const Matrix2D<double> &E, MultidimArray< std::complex<double> > &projectionFourier,
+                        const MultidimArray<double> *ctf=NULL) const;
+
     /** Update volume */
     void updateVolume(MultidimArray<double> &V);
 private:
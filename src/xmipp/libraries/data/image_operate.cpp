@@ -26,11 +26,15 @@
 
 #include "image_operate.h"
 #include <core/metadata_extension.h>
+#include <core/multidim_array_expression.h>
 #include <data/numerical_tools.h>
 
+// Threads of the element-wise operations of a single image or volume
+static int operateThreads = 1;
+
 void minus(Image<double> &op1, const Image<double> &op2)
 {
-    op1() -= op2();
+    evaluateExpression(op1(), arrayExpr(op1()) - op2(), operateThreads);
 }
 
 class MinusAdjustedPrm
@@ -73,8 +77,7 @@ void minusAdjusted(Image<double> &op1, const Image<double> &op2)
 
 	double a=p(0);
 	double b=p(1);
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(pI1)
-		DIRECT_MULTIDIM_ELEM(pI1,n)-=(a*DIRECT_MULTIDIM_ELEM(pI2,n)+b);
+	evaluateExpression(pI1, pI1 - (a*arrayExpr(pI2) + b), operateThreads);
 }
 
 
@@ -98,17 +101,17 @@ void dropOut(Image<double> &op1)
 
 void plus(Image<double> &op1, const Image<double> &op2)
 {
-    op1() += op2();
+    evaluateExpression(op1(), arrayExpr(op1()) + op2(), operateThreads);
 }
 
 void mult(Image<double> &op1, const Image<double> &op2)
 {
-    op1() *= op2();
+    evaluateExpression(op1(), arrayExpr(op1()) * op2(), operateThreads);
 }
 
 void divide(Image<double> &op1, const Image<double> &op2)
 {
-    op1() /= op2();
+    evaluateExpression(op1(), arrayExpr(op1()) / op2(), operateThreads);
 }
 
 void min(Image<double> &op1, const Image<double> &op2)
@@ -206,28 +209,19 @@ void ge(Image<double> &op1, const Image<double> &op2)
 void sqrt(Image<double> &op)
 {
     MultidimArray<double> &mOp = op();
-    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mOp)
-    {
-        dAi(mOp, n) = sqrt(dAi(mOp, n));
-    }
+    evaluateExpression(mOp, sqrt(arrayExpr(mOp)), operateThreads);
 }
 
 void abs(Image<double> &op)
 {
     MultidimArray<double> &mOp = op();
-    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mOp)
-    {
-        dAi(mOp, n) = ABS(dAi(mOp, n));
-    }
+    evaluateExpression(mOp, abs(arrayExpr(mOp)), operateThreads);
 }
 
 void log(Image<double> &op)
 {
     MultidimArray<double> &mOp = op();
-    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mOp)
-    {
-        dAi(mOp, n) = log(dAi(mOp, n));
-    }
+    evaluateExpression(mOp, log(arrayExpr(mOp)), operateThreads);
 }
 
 void log10(Image<double> &op)
@@ -291,6 +285,7 @@ void ProgOperate::defineParams()
     each_image_produces_an_output = true;
     save_metadata_stack = true;
     keep_input_columns = true;
+    allow_threads = true;
     addUsageLine("A simple Xmipp images calculator. Binary and unary operations");
     XmippMetadataProgram::defineParams();
     addParamsLine("== Binary operations: ==");
@@ -512,6 +507,15 @@ void ProgOperate::readParams()
         if (!dotProduct && checkParam("--dot_product"))
             REPORT_ERROR(ERR_ARG_INCORRECT,"Dot product can only be computed between two files");
     }
+
+    // The second metadata is traversed in input order, the dot product is
+    // printed in that order, dropout shares the random generator and
+    // the radial average is written to a single file
+    if ((binaryOperator != NULL && !isValue) || binaryOperator == imageDotProduct ||
+        unaryOperator == dropOut || unaryOperator == radialAvg)
+        nThreads = 1;
+    // A single image or volume is split among the threads instead
+    operateThreads = single_image ? nThreads : 1;
 }
 
 void ProgOperate::processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
@@ -37,6 +37,7 @@ void ProgImageResize::defineParams()
     save_metadata_stack = true;
     keep_input_columns = true;
     allow_apply_geo = true;
+    allow_threads = true;
     temporaryOutput = false;
     XmippMetadataProgram::defineParams();
     //usage
@@ -64,6 +65,8 @@ void ProgImageResize::defineParams()
     addParamsLine("      where <interpolation_type>");
     addParamsLine("        spline          : Use spline interpolation");
     addParamsLine("        linear          : Use bilinear/trilinear interpolation");
+    addParamsLine(" [--single_precision]            : Fourier resize of float images with single precision transforms,");
+    addParamsLine("                                 : faster and with half the memory, up to a relative error of about 1e-6");
 }
 
 void ProgImageResize::readParams()
@@ -76,6 +79,7 @@ void ProgImageResize::readParams()
     else if (degree == "linear")
         splineDegree = LINEAR;
 
+    singlePrecision = checkParam("--single_precision");
     scale_type = RESIZE_NONE;
 }
 
@@ -196,6 +200,7 @@ void ProgImageResize::processImage(const FileName &fnImg, const FileName &fnImgO
     else
         rowOut.resetGeo(false);
 
+    ImageGeneric img, imgOut;
     img.read(fnImg);
     img().setXmippOrigin();
     imgOut.setDatatype(img.getDatatype());
@@ -215,7 +220,7 @@ void ProgImageResize::processImage(const FileName &fnImg, const FileName &fnImgO
         //selfPyramidReduce(splineDegree, img(), pyramid_level);
         break;
     case RESIZE_FOURIER:
-        selfScaleToSizeFourier(zdimOut, ydimOut, xdimOut, img(), fourier_threads);
+        selfScaleToSizeFourier(zdimOut, ydimOut, xdimOut, img(), fourier_threads, singlePrecision);
         img.write(fnImgOut);
         return;
     case RESIZE_NONE:
@@ -49,10 +49,9 @@ protected:
     ScaleType scale_type;
 
     int             splineDegree, dim, pyramid_level, fourier_threads;
-    bool            isVol, temporaryOutput;
+    bool            isVol, temporaryOutput, singlePrecision;
     //Matrix2D<double> R, T, S, A, B;
     Matrix1D<double>   resizeFactor;
-    ImageGeneric img, imgOut;
 
     void defineParams();
     void readParams();
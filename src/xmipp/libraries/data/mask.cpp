@@ -23,6 +23,7 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <atomic>
 #include "mask.h"
 #include <core/xmipp_program.h>
 
@@ -1796,6 +1797,7 @@ void ProgMask::defineParams()
     each_image_produces_an_output = true;
     save_metadata_stack = true;
     keep_input_columns = true;
+    allow_threads = true;
     XmippMetadataProgram::defineParams();
     Mask::defineParams(this);
 
@@ -1849,6 +1851,9 @@ void ProgMask::readParams()
     //mask.read(argc, argv);
     str_subs_val = getParam("--substitute");
     count = count_below || count_above;
+    // Counts are reported in input order and a created mask is a single file
+    if (count || create_mask)
+        nThreads = 1;
 }
 
 
@@ -1857,6 +1862,12 @@ void ProgMask::preProcess()
 {
     if (create_mask && input_is_stack)
         REPORT_ERROR(ERR_MD_NOOBJ, "Mask: Cannot create a mask for a selection file\n");
+
+    // Without geometry the mask only depends on the size of the images, so it
+    // is generated once here and only read by the threads
+    sharedMask = !create_mask && !apply_geo && xdimOut > 0;
+    if (sharedMask)
+        mask.generate_mask(zdimOut, ydimOut, xdimOut);
 }
 
 /* Postprocess ------------------------------------------------------------- */
@@ -1870,15 +1881,28 @@ void ProgMask::postProcess()
 void ProgMask::processImage(const FileName &fnImg, const FileName &fnImgOut, 
                             const MDRow &rowIn, MDRow &rowOut)
 {
-    static size_t imageCount = 0;
-    ++imageCount;
+    // Counted by all the worker threads
+    static std::atomic<size_t> imageCount(0);
+    size_t imageNumber = ++imageCount;
     Image<double> image;
     image.readApplyGeo(fnImg, rowIn);
     image().setXmippOrigin();
 
-    // Generate mask
+    bool apply_geo = this->apply_geo;
     if (ZSIZE(image()) > 1)
         apply_geo=false;
+
+    // Images may be processed by several threads. The mask generated in
+    // preProcess is shared if it fits the image, otherwise the mask is
+    // generated in a private copy
+    Mask privateMask;
+    bool useShared = sharedMask && !apply_geo && XSIZE(image()) == xdimOut &&
+                     YSIZE(image()) == ydimOut && ZSIZE(image()) == zdimOut;
+    if (!useShared)
+        privateMask = this->mask;
+    Mask &mask = useShared ? this->mask : privateMask;
+
+    // Generate mask
     if (apply_geo)
     {
         if (mask.x0 + mask.y0 != 0.)
@@ -1887,11 +1911,13 @@ void ProgMask::processImage(const FileName &fnImg, const FileName &fnImgOut,
             // Read geometric transformation from the image and store for mask
             image.getTransformationMatrix(mask.mask_geo);
     }
-    mask.generate_mask(image());
+    if (!useShared)
+        mask.generate_mask(image());
 
     // Apply mask
     if (!create_mask)
     {
+        double subs_val;
         if      (str_subs_val=="min")
             subs_val=image().computeMin();
         else if (str_subs_val=="max")
@@ -1945,7 +1971,7 @@ void ProgMask::processImage(const FileName &fnImg, const FileName &fnImgOut,
             std::cerr << "Cannot count pixels with a continuous mask\n";
     }
 
-    if (imageCount % 25 == 0 && !count)
-        progress_bar(imageCount);
+    if (imageNumber % 25 == 0 && !count && nThreads == 1)
+        progress_bar(imageNumber);
 }
 
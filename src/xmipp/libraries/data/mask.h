@@ -1054,6 +1054,8 @@ public:
     std::string  str_subs_val;
     int          count;
     int          max_length;
+    // The mask is generated in preProcess for images of size xdimOut, ydimOut, zdimOut
+    bool         sharedMask;
 
     void defineParams();
     void readParams();
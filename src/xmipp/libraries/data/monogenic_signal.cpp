@@ -407,6 +407,165 @@ void Monogenic::amplitudeMonoSig3D_LPF(const MultidimArray< std::complex<double>
 }
 
 
+
+void MonogenicBandBank::initialize(const MultidimArray<double> &V, int nthreads)
+{
+	VRiesz.resizeNoCopy(V);
+	transformer.setThreadsNumber(nthreads);
+	transformer.setReal(VRiesz);
+	fftVRiesz_aux.resizeNoCopy(transformer.fFourier);
+
+	Monogenic mono;
+	iu = mono.fourierFreqs_3D(transformer.fFourier, V, freq_fourier_x, freq_fourier_y, freq_fourier_z);
+}
+
+
+void MonogenicBandBank::amplitude(const MultidimArray< std::complex<double> > &myfftV,
+		double freq, double freqH, double freqL, MultidimArray<double> &amplitude)
+{
+	// The Riesz components are written directly in the spectrum of the transformer,
+	// its inverse transform lands in VRiesz
+	MultidimArray< std::complex<double> > &fftVRiesz = transformer.fFourier;
+	std::complex<double> J(0,1);
+
+	// Filter the input volume and keep -J*H*V/|u| for the Riesz components
+	double ideltal=PI/(freq-freqH);
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(myfftV)
+	{
+		double iun=DIRECT_MULTIDIM_ELEM(iu,n);
+		double un=1.0/iun;
+		std::complex<double> &filtered=DIRECT_MULTIDIM_ELEM(fftVRiesz, n);
+		std::complex<double> &aux=DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
+		if (un>freq)
+		{
+			filtered = DIRECT_MULTIDIM_ELEM(myfftV, n);
+			aux = -J;
+			aux *= filtered;
+			aux *= iun;
+		}
+		else if (freqH<=un)
+		{
+			filtered = DIRECT_MULTIDIM_ELEM(myfftV, n);
+			filtered *= 0.5*(1+cos((un-freq)*ideltal));
+			aux = -J;
+			aux *= filtered;
+			aux *= iun;
+		}
+		else
+		{
+			filtered = 0;
+			aux = 0;
+		}
+	}
+
+	transformer.inverseFourierTransform();
+	if (!amplitude.sameShape(VRiesz))
+		amplitude.resizeNoCopy(VRiesz);
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
+		DIRECT_MULTIDIM_ELEM(amplitude,n)=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
+
+	// First component of the Riesz vector
+	long n=0;
+	for(size_t k=0; k<ZSIZE(myfftV); ++k)
+		for(size_t i=0; i<YSIZE(myfftV); ++i)
+			for(size_t j=0; j<XSIZE(myfftV); ++j, ++n)
+				DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = VEC_ELEM(freq_fourier_x,j)*DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
+	transformer.inverseFourierTransform();
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
+		DIRECT_MULTIDIM_ELEM(amplitude,n)+=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
+
+	// Second component
+	n=0;
+	for(size_t k=0; k<ZSIZE(myfftV); ++k)
+		for(size_t i=0; i<YSIZE(myfftV); ++i)
+		{
+			double uy = VEC_ELEM(freq_fourier_y,i);
+			for(size_t j=0; j<XSIZE(myfftV); ++j, ++n)
+				DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = uy*DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
+		}
+	transformer.inverseFourierTransform();
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
+		DIRECT_MULTIDIM_ELEM(amplitude,n)+=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
+
+	// Third component, the amplitude is left in VRiesz to be low pass filtered
+	n=0;
+	for(size_t k=0; k<ZSIZE(myfftV); ++k)
+	{
+		double uz = VEC_ELEM(freq_fourier_z,k);
+		for(size_t i=0; i<YSIZE(myfftV); ++i)
+			for(size_t j=0; j<XSIZE(myfftV); ++j, ++n)
+				DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = uz*DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
+	}
+	transformer.inverseFourierTransform();
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(VRiesz)
+	{
+		double &v=DIRECT_MULTIDIM_ELEM(VRiesz,n);
+		v=sqrt(DIRECT_MULTIDIM_ELEM(amplitude,n)+v*v);
+	}
+
+	// Low pass filter the monogenic amplitude
+	transformer.FourierTransform();
+	double raised_w = PI/(freqL-freq);
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(fftVRiesz)
+	{
+		double un=1.0/DIRECT_MULTIDIM_ELEM(iu,n);
+		if (un>freqL)
+			DIRECT_MULTIDIM_ELEM(fftVRiesz,n) = 0;
+		else if (un>=freq)
+			DIRECT_MULTIDIM_ELEM(fftVRiesz,n) *= 0.5*(1 + cos(raised_w*(un-freq)));
+	}
+	transformer.inverseFourierTransform();
+	memcpy(MULTIDIM_ARRAY(amplitude), MULTIDIM_ARRAY(VRiesz), MULTIDIM_SIZE(VRiesz)*sizeof(double));
+}
+
+
+void MonogenicBandBank::bandPass(const MultidimArray< std::complex<double> > &myfftV,
+		double w, double wL, MultidimArray<double> &filtered)
+{
+	MultidimArray< std::complex<double> > &fftVfilter = transformer.fFourier;
+	fftVfilter.initZeros();
+
+	double delta = wL-w;
+	double w_inf = w-delta;
+	double ideltal=PI/(delta);
+
+	// |u| grows along each row of the half spectrum, so a row is left as soon as
+	// it goes beyond wL, and rows whose first coefficient is already beyond are skipped
+	double uz, uy, ux, uz2, u2, uz2y2;
+	for(size_t k=0; k<ZSIZE(myfftV); ++k)
+	{
+		FFT_IDX2DIGFREQ(k,ZSIZE(VRiesz),uz);
+		uz2=uz*uz;
+		for(size_t i=0; i<YSIZE(myfftV); ++i)
+		{
+			FFT_IDX2DIGFREQ(i,YSIZE(VRiesz),uy);
+			uz2y2=uz2+uy*uy;
+			if (sqrt(uz2y2)>wL)
+				continue;
+
+			long n=(k*YSIZE(myfftV)+i)*XSIZE(myfftV);
+			for(size_t j=0; j<XSIZE(myfftV); ++j, ++n)
+			{
+				FFT_IDX2DIGFREQ(j,XSIZE(VRiesz),ux);
+				u2=uz2y2+ux*ux;
+				double un=((k != 0) || (i != 0) || (j != 0)) ? sqrt(u2) : 1e-38;
+				if (un>wL)
+					break;
+				if (un>=w_inf)
+				{
+					DIRECT_MULTIDIM_ELEM(fftVfilter, n) = DIRECT_MULTIDIM_ELEM(myfftV, n);
+					DIRECT_MULTIDIM_ELEM(fftVfilter, n) *= 0.5*(1+cos((un-w)*ideltal));
+				}
+			}
+		}
+	}
+
+	transformer.inverseFourierTransform();
+	if (!filtered.sameShape(VRiesz))
+		filtered.resizeNoCopy(VRiesz);
+	memcpy(MULTIDIM_ARRAY(filtered), MULTIDIM_ARRAY(VRiesz), MULTIDIM_SIZE(VRiesz)*sizeof(double));
+}
+
 // STATISTICSINBINARYMASK2: Estimates the staticstics of two maps:
 // Signal map "volS" and Noise map "volN". The signal statistics
 // are obtained by mean of a binary mask. The results are the mean
@@ -175,5 +175,56 @@ public:
 
 };
 
+/** Monogenic band bank.
+ * Keeps everything that does not change while a local resolution (or local
+ * sharpening) sweep runs over the frequency bands of one map: the map of
+ * inverse frequencies, the accessible frequencies along each axis, the
+ * Fourier transformer with its plans and the spectral work buffer. Every band
+ * is then computed in fused passes written directly into the buffer of the
+ * transformer, so no spectrum is copied or zeroed twice per band. Signal and
+ * noise spectra of the same map share the same bank.
+ */
+class MonogenicBandBank
+{
+public:
+	/// Inverse of the frequency of each Fourier coefficient (see Monogenic::fourierFreqs_3D)
+	MultidimArray<double> iu;
+
+	/// Accessible frequencies along each direction
+	Matrix1D<double> freq_fourier_x, freq_fourier_y, freq_fourier_z;
+
+public:
+	/** Prepare the bank for maps with the same size as V.
+	 * The Fourier transform of V is only used to set the sizes, the maps
+	 * to be analyzed are given to amplitude() and bandPass() as spectra.
+	 */
+	void initialize(const MultidimArray<double> &V, int nthreads=1);
+
+	/** Real space work array, it has the size and origin of the map given to initialize(). */
+	const MultidimArray<double> &getReal() const
+	{
+		return VRiesz;
+	}
+
+	/** Monogenic amplitude of the high pass filtered map.
+	 * Same as Monogenic::amplitudeMonoSig3D_LPF: myfftV is high pass filtered with a
+	 * raised cosine between freqH and freq, the monogenic amplitude is computed and
+	 * it is finally low pass filtered with a raised cosine between freq and freqL.
+	 */
+	void amplitude(const MultidimArray< std::complex<double> > &myfftV,
+			double freq, double freqH, double freqL, MultidimArray<double> &amplitude);
+
+	/** Band pass filter with a raised cosine centered at w and tails at w+-(wL-w).
+	 * Only the rows of the spectrum that intersect the band are visited.
+	 */
+	void bandPass(const MultidimArray< std::complex<double> > &myfftV,
+			double w, double wL, MultidimArray<double> &filtered);
+
+private:
+	FourierTransformer transformer;
+	MultidimArray<double> VRiesz;
+	MultidimArray< std::complex<double> > fftVRiesz_aux;
+};
+
 //@}
 #endif
@@ -31,6 +31,7 @@
 #include "normalize.h"
 #include <core/metadata.h>
 #include <core/xmipp_image_generic.h>
+#include <core/multidim_array_stats.h>
 
 /* Normalizations ---------------------------------------------------------- */
 void normalize_OldXmipp(MultidimArray<double> &I)
@@ -44,13 +45,19 @@ void normalize_OldXmipp(MultidimArray<double> &I)
 
 void normalize_Near_OldXmipp(MultidimArray<double> &I, const MultidimArray<int> &bg_mask)
 {
-    double avg=0., stddev, min, max;
-    double avgbg, stddevbg, minbg, maxbg;
-    I.computeStats(avg, stddev, min, max);
-    computeStats_within_binary_mask(bg_mask, I, minbg, maxbg, avgbg,
-                                    stddevbg);
-    I -= avg;
-    I /= stddevbg;
+    std::vector<size_t> bgIndexes;
+    binaryMaskIndexes(bg_mask, I, bgIndexes);
+    normalize_Near_OldXmipp(I, bgIndexes);
+}
+
+void normalize_Near_OldXmipp(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                             int nThreads)
+{
+    ArrayStats stats, statsbg;
+    computeArrayStats(I, stats, nThreads);
+    computeArrayStats(I, bgIndexes, statsbg, nThreads);
+    I -= stats.avg();
+    I /= statsbg.stddev();
 }
 
 void normalize_OldXmipp_decomposition(MultidimArray<double> &I, const MultidimArray<int> &bg_mask,
@@ -218,11 +225,19 @@ void normalize_tomography(MultidimArray<double> &I, double tilt, double &mui,
 
 void normalize_Michael(MultidimArray<double> &I, const MultidimArray<int> &bg_mask)
 {
-    double avg, stddev, min=0., max;
-    double avgbg, stddevbg, minbg, maxbg;
-    I.computeStats(avg, stddev, min, max);
-    computeStats_within_binary_mask(bg_mask, I, minbg, maxbg, avgbg,
-                                    stddevbg);
+    std::vector<size_t> bgIndexes;
+    binaryMaskIndexes(bg_mask, I, bgIndexes);
+    normalize_Michael(I, bgIndexes);
+}
+
+void normalize_Michael(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                       int nThreads)
+{
+    ArrayStats stats, statsbg;
+    computeArrayStats(I, stats, nThreads);
+    computeArrayStats(I, bgIndexes, statsbg, nThreads);
+    double min=stats.minval;
+    double avgbg=statsbg.avg();
     if (avgbg > 0)
     {
         I -= avgbg;
@@ -237,21 +252,37 @@ void normalize_Michael(MultidimArray<double> &I, const MultidimArray<int> &bg_ma
 
 void normalize_NewXmipp(MultidimArray<double> &I, const MultidimArray<int> &bg_mask)
 {
-    double avgbg, stddevbg;
-    I.computeAvgStdev_within_binary_mask(bg_mask, avgbg, stddevbg);
-    double istddevbg=1.0/stddevbg;
+    std::vector<size_t> bgIndexes;
+    binaryMaskIndexes(bg_mask, I, bgIndexes);
+    normalize_NewXmipp(I, bgIndexes);
+}
+
+void normalize_NewXmipp(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                        int nThreads)
+{
+    ArrayStats statsbg;
+    computeArrayStats(I, bgIndexes, statsbg, nThreads);
+    double avgbg=statsbg.avg();
+    double istddevbg=1.0/statsbg.stddev();
     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(I)
     DIRECT_MULTIDIM_ELEM(I,n)=(DIRECT_MULTIDIM_ELEM(I,n)-avgbg)*istddevbg;
 }
 
 void normalize_NewXmipp2(MultidimArray<double> &I, const MultidimArray<int> &bg_mask)
 {
-    double avg=0, stddev, min, max;
-    double avgbg=0, stddevbg, minbg, maxbg;
-    I.computeStats(avg, stddev, min, max);
-    computeStats_within_binary_mask(bg_mask, I, minbg, maxbg, avgbg,
-                                    stddevbg);
-    double K=1.0/fabs(avg - avgbg);
+    std::vector<size_t> bgIndexes;
+    binaryMaskIndexes(bg_mask, I, bgIndexes);
+    normalize_NewXmipp2(I, bgIndexes);
+}
+
+void normalize_NewXmipp2(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                         int nThreads)
+{
+    ArrayStats stats, statsbg;
+    computeArrayStats(I, stats, nThreads);
+    computeArrayStats(I, bgIndexes, statsbg, nThreads);
+    double avgbg=statsbg.avg();
+    double K=1.0/fabs(stats.avg() - avgbg);
     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(I)
     DIRECT_MULTIDIM_ELEM(I,n)=(DIRECT_MULTIDIM_ELEM(I,n)-avgbg)*K;
 }
@@ -438,6 +469,7 @@ void ProgNormalize::defineParams()
 {
     each_image_produces_an_output = true;
     allow_apply_geo = true;
+    allow_threads = true;
     save_metadata_stack = true;
     keep_input_columns = true;
     addUsageLine("Change the range of intensity values of pixels.");
@@ -576,6 +608,10 @@ void ProgNormalize::readParams()
         b0 = getDoubleParam("--prm", 2);
         bF = getDoubleParam("--prm", 3);
     }
+
+    // The random number generator cannot be shared by several threads
+    if (method == RANDOM || remove_black_dust || remove_white_dust)
+        nThreads = 1;
 }
 
 void ProgNormalize::show()
@@ -692,6 +728,8 @@ void ProgNormalize::preProcess()
     }
     // backup a copy of the mask for apply_geo mode
     bg_mask_bck = bg_mask;
+    if (!apply_geo)
+        binaryMaskIndexes(bg_mask, bg_mask, bg_indexes);
 
     //#define DEBUG
 #ifdef DEBUG
@@ -750,6 +788,9 @@ void ProgNormalize::processImage(const FileName &fnImg, const FileName &fnImgOut
 
     MultidimArray<double> &img=I();
 
+    // The background mask is shared by all threads, transform a local copy
+    MultidimArray<int> *mask = &bg_mask;
+    MultidimArray<int> maskGeo;
     if (apply_geo)
     {
         Matrix2D<double> A;
@@ -767,9 +808,24 @@ void ProgNormalize::processImage(const FileName &fnImg, const FileName &fnImgOut
         I.getTransformationMatrix(A);
         selfApplyGeometry(BSPLINE3, tmp, A, IS_NOT_INV, DONT_WRAP, outside);
 
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(bg_mask)
-        dAi(bg_mask,n)=(int)round(dAi(tmp,n));
+        maskGeo.resizeNoCopy(bg_mask);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(maskGeo)
+        dAi(maskGeo,n)=(int)round(dAi(tmp,n));
+        mask = &maskGeo;
+    }
+
+    // Pixels of the background, the list of the preprocess is valid for the
+    // images of the size of the mask that are not transformed
+    std::vector<size_t> imgIndexes;
+    const std::vector<size_t> *bgIndexes = &bg_indexes;
+    if (apply_geo || !img.sameShape(bg_mask) || STARTINGX(img) != STARTINGX(bg_mask) ||
+        STARTINGY(img) != STARTINGY(bg_mask) || STARTINGZ(img) != STARTINGZ(bg_mask))
+    {
+        binaryMaskIndexes(*mask, img, imgIndexes);
+        bgIndexes = &imgIndexes;
     }
+    // A single image or volume is processed with all the threads
+    int statsThreads = single_image ? nThreads : 1;
 
     double a, b;
     if (invert_contrast)
@@ -808,19 +864,19 @@ void ProgNormalize::processImage(const FileName &fnImg, const FileName &fnImgOut
         normalize_OldXmipp(img);
         break;
     case NEAR_OLDXMIPP:
-        normalize_Near_OldXmipp(img, bg_mask);
+        normalize_Near_OldXmipp(img, *bgIndexes, statsThreads);
         break;
     case NEWXMIPP:
-        normalize_NewXmipp(img, bg_mask);
+        normalize_NewXmipp(img, *bgIndexes, statsThreads);
         break;
     case NEWXMIPP2:
-        normalize_NewXmipp2(img, bg_mask);
+        normalize_NewXmipp2(img, *bgIndexes, statsThreads);
         break;
     case RAMP:
-        normalize_ramp(img, &bg_mask);
+        normalize_ramp(img, mask);
         break;
     case NEIGHBOUR:
-        normalize_remove_neighbours(img, bg_mask, thresh_neigh);
+        normalize_remove_neighbours(img, *mask, thresh_neigh);
         break;
     case TOMOGRAPHY:
         normalize_tomography(img, I.tilt(), mui, sigmai, tiltMask);
@@ -830,7 +886,7 @@ void ProgNormalize::processImage(const FileName &fnImg, const FileName &fnImgOut
                              true, mu0, sigma0);
         break;
     case MICHAEL:
-        normalize_Michael(img, bg_mask);
+        normalize_Michael(img, *bgIndexes, statsThreads);
         break;
     case RANDOM:
         a = rnd_unif(a0, aF);
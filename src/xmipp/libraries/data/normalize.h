@@ -84,6 +84,12 @@ void normalize_OldXmipp(MultidimArray<double> &I);
 */
 void normalize_Near_OldXmipp(MultidimArray<double> &I, const MultidimArray<int> &bg_mask);
 
+/** Same as above, with the background given by the direct indexes of its
+    elements in I, see binaryMaskIndexes(). The statistics of large images
+    are computed with nThreads threads. */
+void normalize_Near_OldXmipp(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                             int nThreads=1);
+
 /** OldXmipp decomposition.
     @ingroup NormalizationProcedures
    Formula:
@@ -142,6 +148,10 @@ void normalize_tomography(MultidimArray<double> &I, double tilt, double &mui,
 */
 void normalize_Michael(MultidimArray<double> &I, const MultidimArray<int> &bg_mask);
 
+/** Same as above, with the background given by its direct indexes */
+void normalize_Michael(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                       int nThreads=1);
+
 /** NewXmipp's normalization.
     @ingroup NormalizationProcedures
    Formula:
@@ -163,6 +173,10 @@ volume.
 */
 void normalize_NewXmipp(MultidimArray<double> &I, const MultidimArray<int> &bg_mask);
 
+/** Same as above, with the background given by its direct indexes */
+void normalize_NewXmipp(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                        int nThreads=1);
+
 /** NewXmipp 2's normalization.
     @ingroup NormalizationProcedures
    Formula:
@@ -181,6 +195,10 @@ volume.
 */
 void normalize_NewXmipp2(MultidimArray<double> &I, const MultidimArray<int> &bg_mask);
 
+/** Same as above, with the background given by its direct indexes */
+void normalize_NewXmipp2(MultidimArray<double> &I, const std::vector<size_t> &bgIndexes,
+                         int nThreads=1);
+
 /** Removal of inclined background densities (ramps).
     @ingroup NormalizationProcedures
     fitting of a least squares plane through the pixels in the
@@ -281,6 +299,10 @@ protected:
     double thresh_neigh;
 
     MultidimArray<int> bg_mask, bg_mask_bck;
+
+    /** Direct indexes of the background pixels, when the mask is not
+        transformed with each image */
+    std::vector<size_t> bg_indexes;
     bool enable_mask;
 
     /* Mask parameter
@@ -23,6 +23,7 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 #include "sampling.h"
+#include "sphere_index.h"
 #include <core/matrix2d.h>
 #include <core/geometry.h>
 #include <core/xmipp_image.h>
@@ -1272,6 +1273,19 @@ void Sampling::removeRedundantPointsExhaustive(const int symmetry,
     // Precalculate symmetry matrices
     fillLRRepository();
 
+    // The points kept so far are indexed. Since
+    // (L*R^t*k).d1 = k.(R*L^t*d1), the candidates close to a symmetric
+    // version of the point are looked up with R*L^t*d1, and then checked
+    // as before. The cone is slightly wider to absorb the rounding errors.
+    SphereIndex index;
+    index.initialize(old_vector.size());
+    double cos_candidate = cos(XMIPP_MIN(DEG2RAD(max_ang) + 1e-6, PI));
+    std::vector<Matrix2D<double> > RLt_repository(R_repository.size());
+    for (size_t j = 0; j < R_repository.size(); j++)
+        RLt_repository[j] = R_repository[j] * L_repository[j].transpose();
+    std::vector<size_t> candidates;
+    Matrix1D<double> query(3);
+
     // Then check all points versus each other
     for (size_t i = 0; i < old_angles.size(); i++)
     {
@@ -1280,22 +1294,30 @@ void Sampling::removeRedundantPointsExhaustive(const int symmetry,
         bool uniq = true;
         for (size_t j = 0; j < R_repository.size(); j++)
         {
-            for (size_t k = 0; k < no_redundant_sampling_points_vector.size(); k++)
+            query = RLt_repository[j] * direction1;
+            for (int sign = 0; uniq && sign < (only_half_sphere ? 2 : 1); sign++)
             {
-                direction =  L_repository[j] *
-                             (no_redundant_sampling_points_vector[k].transpose() *
-                              R_repository[j]).transpose();
-                //Calculate distance
-                my_dotProduct = dotProduct(direction,direction1);
-                if (only_half_sphere)
-                    my_dotProduct = ABS(my_dotProduct);
-
-                if (my_dotProduct > cos_max_ang)
+                if (sign == 1)
+                    query *= -1;
+                index.cone(query, cos_candidate, candidates);
+                for (size_t c = 0; c < candidates.size(); c++)
                 {
-                    uniq = false;
-                    break;
-                }
-            }// for k
+                    size_t k = candidates[c];
+                    direction =  L_repository[j] *
+                                 (no_redundant_sampling_points_vector[k].transpose() *
+                                  R_repository[j]).transpose();
+                    //Calculate distance
+                    my_dotProduct = dotProduct(direction,direction1);
+                    if (only_half_sphere)
+                        my_dotProduct = ABS(my_dotProduct);
+
+                    if (my_dotProduct > cos_max_ang)
+                    {
+                        uniq = false;
+                        break;
+                    }
+                }// for k
+            }
             if (!uniq)
                 break;
         } // for j
@@ -1303,6 +1325,7 @@ void Sampling::removeRedundantPointsExhaustive(const int symmetry,
         {
             no_redundant_sampling_points_vector.push_back(old_vector[i]);
             no_redundant_sampling_points_angles.push_back(old_angles[i]);
+            index.insert(old_vector[i]);
         }
     } // for i
 
@@ -1714,7 +1737,6 @@ void Sampling::computeNeighbors(bool only_winner)
 
     // calculate some sizes only once
     size_t exp_data_projection_direction_by_L_R_size = exp_data_projection_direction_by_L_R.size();
-    size_t no_redundant_sampling_points_vector_size = no_redundant_sampling_points_vector.size();
 
     if (verbose)
     {
@@ -1724,6 +1746,10 @@ void Sampling::computeNeighbors(bool only_winner)
     size_t ratio = exp_data_projection_direction_by_L_R_size / 60;
     ratio = XMIPP_MAX(ratio, 1);
 
+    // Only the sampling points inside the neighbourhood are visited
+    SphereIndex index(no_redundant_sampling_points_vector);
+    std::vector<size_t> candidates;
+
     for(size_t j = 0; j < exp_data_projection_direction_by_L_R_size;)
     {
         if ((j%ratio) == 0 && verbose)
@@ -1746,8 +1772,10 @@ void Sampling::computeNeighbors(bool only_winner)
 			for (size_t k = 0; k < R_repository.size(); k++,j++)
 			{
 				winner_dotProduct = -1.;
-				for (size_t i = 0; i < no_redundant_sampling_points_vector_size; ++i)
+				index.cone(exp_data_projection_direction_by_L_R[j], cos_neighborhood_radius, candidates);
+				for (size_t c = 0; c < candidates.size(); ++c)
 				{
+					size_t i = candidates[c];
 					my_dotProduct = dotProduct(no_redundant_sampling_points_vector[i],
 											   exp_data_projection_direction_by_L_R[j]);
 
@@ -1913,31 +1941,43 @@ void Sampling::computeNeighbors(bool only_winner)
 
 void Sampling::removePointsFarAwayFromExperimentalData()
 {
-    double my_dotProduct;
-    Matrix1D<double>  row(3),direction(3);
-    Matrix2D<double>  L(4, 4), R(4, 4);
-
-    size_t my_end = no_redundant_sampling_points_vector.size() - 1;
+    // Mark the sampling points in the neighbourhood of any experimental
+    // direction, looking only at the points inside each neighbourhood
+    size_t no_redundant_sampling_points_vector_size = no_redundant_sampling_points_vector.size();
+    std::vector<bool> my_keep(no_redundant_sampling_points_vector_size, false);
+    size_t kept = 0;
+    SphereIndex index(no_redundant_sampling_points_vector);
+    std::vector<size_t> candidates;
+    for (size_t j=0; kept < no_redundant_sampling_points_vector_size &&
+         j< exp_data_projection_direction_by_L_R.size();j++)
+    {
+        index.cone(exp_data_projection_direction_by_L_R[j], cos_neighborhood_radius, candidates);
+        for (size_t c = 0; c < candidates.size(); c++)
+            if (!my_keep[candidates[c]])
+            {
+                my_keep[candidates[c]] = true;
+                ++kept;
+            }
+    }//for j
 
-    for (size_t i = 0; i <= my_end; i++)
+    // The original position of each point is tracked while removing, so that
+    // the points are left in the same order as always
+    std::vector<size_t> my_position(no_redundant_sampling_points_vector_size);
+    for (size_t i = 0; i < no_redundant_sampling_points_vector_size; i++)
+        my_position[i] = i;
+    for (size_t i = 0; i < my_position.size(); )
     {
-        bool my_delete=true;
-        for (size_t j=0; my_delete && j< exp_data_projection_direction_by_L_R.size();j++)
-        {
-            my_dotProduct = dotProduct(no_redundant_sampling_points_vector[i],
-                                       exp_data_projection_direction_by_L_R[j]);
-            if (my_dotProduct > cos_neighborhood_radius)
-                my_delete=false;
-        }//for j
-        if(my_delete)
+        if(!my_keep[my_position[i]])
         {
+            size_t my_end = my_position.size() - 1;
             REMOVE_LAST(no_redundant_sampling_points_vector);
             REMOVE_LAST(no_redundant_sampling_points_angles);
             REMOVE_LAST(no_redundant_sampling_points_index);
-
-            --my_end;
-            --i;//since a point has been swaped we should repeat the same index
+            REMOVE_LAST(my_position);
+            //since a point has been swaped we should repeat the same index
         }// if(my_delete)
+        else
+            i++;
     }//for i end
     //#define CHIMERA
 #ifdef CHIMERA
@@ -2001,6 +2041,7 @@ void Sampling::findClosestSamplingPoint(MetaData &DFi,
     int exp_image=1;
 #endif
 
+    SphereIndex index(no_redundant_sampling_points_vector);
     MDIterator iter(DFi);
     for(size_t i=0;i< exp_data_projection_direction_by_L_R.size();)
     {
@@ -2016,23 +2057,18 @@ void Sampling::findClosestSamplingPoint(MetaData &DFi,
                 <<  " .019"      << std::endl;
             }
 #endif
-            for(size_t j=0;j< no_redundant_sampling_points_vector.size();j++)
+            // Closest sampling point, the first one on ties
+            int j = index.nearest(exp_data_projection_direction_by_L_R[i], my_dotProduct_aux);
+            if ( j != -1 && my_dotProduct_aux > my_dotProduct)
             {
-                my_dotProduct_aux =
-                    dotProduct(exp_data_projection_direction_by_L_R[i],
-                               no_redundant_sampling_points_vector[j]);
-
-                if ( my_dotProduct_aux > my_dotProduct)
-                {
-                    my_dotProduct = my_dotProduct_aux;
-                    winner_sampling = j;
+                my_dotProduct = my_dotProduct_aux;
+                winner_sampling = j;
 #if defined(CHIMERA) || defined(MYPSI)
 
-                    winner_exp_L_R  = i;
+                winner_exp_L_R  = i;
 #endif
 
-                }
-            }//for j
+            }
         }//for k
 #ifdef  DEBUG3
         if( i==  ((exp_image+1)*R_repository.size()) )
@@ -2100,29 +2136,25 @@ void Sampling::findClosestExperimentalPoint()
     aux_my_exp_img_per_sampling_point.resize(
         no_redundant_sampling_points_vector.size());
 
+    SphereIndex index(no_redundant_sampling_points_vector);
+
     for(size_t i=0,l=0;i< exp_data_projection_direction_by_L_R.size();l++)
     {
         my_dotProduct=-2;
         for (size_t k = 0; k < R_repository.size(); k++,i++)
         {
-            for(size_t j=0;j< no_redundant_sampling_points_vector.size();j++)
+            int j = index.nearest(exp_data_projection_direction_by_L_R[i], my_dotProduct_aux);
+            if ( j != -1 && my_dotProduct_aux > my_dotProduct)
             {
-                my_dotProduct_aux =
-                    dotProduct(exp_data_projection_direction_by_L_R[i],
-                               no_redundant_sampling_points_vector[j]);
-
-                if ( my_dotProduct_aux > my_dotProduct)
-                {
-                    my_dotProduct = my_dotProduct_aux;
-                    winner_sampling = j;
+                my_dotProduct = my_dotProduct_aux;
+                winner_sampling = j;
 #ifdef CHIMERA
 
-                    winner_exp_L_R  = i;
+                winner_exp_L_R  = i;
 #endif
 
-                    winner_exp = l;
-                }
-            }//for j
+                winner_exp = l;
+            }
         }//for k
         aux_my_exp_img_per_sampling_point[winner_sampling].push_back(winner_exp);
 #ifdef CHIMERA
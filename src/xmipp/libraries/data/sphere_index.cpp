@@ -0,0 +1,248 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <limits>
+#include "sphere_index.h"
+
+// Average number of points per cell
+#define SPHERE_INDEX_POINTS_PER_CELL 4
+// Smallest cell, in radians (0.25 degrees)
+#define SPHERE_INDEX_MIN_CELL 0.0043633
+// Margin for the rounding errors of the cell geometry
+#define SPHERE_INDEX_MARGIN 1e-9
+// Sets of points, or cones, for which it is faster to check all the points
+#define SPHERE_INDEX_ALL_POINTS 128
+#define SPHERE_INDEX_ALL_RADIUS (PI / 2)
+
+SphereIndex::SphereIndex()
+{
+    initialize(0);
+}
+
+SphereIndex::SphereIndex(const std::vector< Matrix1D<double> > &points)
+{
+    initialize(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+        insert(points[i]);
+}
+
+void SphereIndex::initialize(size_t nPoints)
+{
+    // Cells of about the same area, with a few points each
+    double cellSize = PI;
+    if (nPoints > 0)
+        cellSize = sqrt(4 * PI * SPHERE_INDEX_POINTS_PER_CELL / nPoints);
+    cellSize = XMIPP_MIN(XMIPP_MAX(cellSize, SPHERE_INDEX_MIN_CELL), PI);
+    size_t nRings = (size_t) ceil(PI / cellSize);
+    ringSize = PI / nRings;
+
+    ringStart.resize(nRings);
+    ringSectors.resize(nRings);
+    size_t nCells = 0;
+    for (size_t ring = 0; ring < nRings; ++ring)
+    {
+        double tilt0 = ring * ringSize, tilt1 = tilt0 + ringSize;
+        double maxSin = (tilt0 <= PI / 2 && tilt1 >= PI / 2) ? 1 : XMIPP_MAX(sin(tilt0), sin(tilt1));
+        ringStart[ring] = nCells;
+        ringSectors[ring] = XMIPP_MAX((size_t) 1, (size_t) ceil(2 * PI * maxSin / ringSize));
+        nCells += ringSectors[ring];
+    }
+    cells.clear();
+    cells.resize(nCells);
+    coordinates.clear();
+    coordinates.reserve(3 * nPoints);
+    maxNorm = 0;
+}
+
+size_t SphereIndex::cellOf(double x, double y, double z) const
+{
+    double norm = sqrt(x * x + y * y + z * z);
+    double tilt = acos(norm > 0 ? CLIP(z / norm, -1., 1.) : 1.);
+    size_t ring = XMIPP_MIN((size_t) (tilt / ringSize), ringStart.size() - 1);
+    double rot = atan2(y, x);
+    if (rot < 0)
+        rot += 2 * PI;
+    size_t sectors = ringSectors[ring];
+    return ringStart[ring] + XMIPP_MIN((size_t) (rot / (2 * PI) * sectors), sectors - 1);
+}
+
+void SphereIndex::insert(const Matrix1D<double> &point)
+{
+    double x = XX(point), y = YY(point), z = ZZ(point);
+    cells[cellOf(x, y, z)].push_back(size());
+    coordinates.push_back(x);
+    coordinates.push_back(y);
+    coordinates.push_back(z);
+    maxNorm = XMIPP_MAX(maxNorm, sqrt(x * x + y * y + z * z));
+}
+
+double SphereIndex::coneRadius(double cosRadius, double directionNorm) const
+{
+    // The points are not exactly unit vectors, so the radius is computed for the
+    // largest norm. Cones of 90 degrees or more visit the whole sphere.
+    if (cosRadius <= 0 || directionNorm == 0 || maxNorm == 0)
+        return PI;
+    double cosAngle = cosRadius / (directionNorm * maxNorm);
+    if (cosAngle >= 1)
+        return 0;
+    return acos(cosAngle) + SPHERE_INDEX_MARGIN;
+}
+
+void SphereIndex::candidateCells(double x, double y, double z, double radius,
+                                 std::vector<size_t> &result) const
+{
+    result.clear();
+    double norm = sqrt(x * x + y * y + z * z);
+    if (radius >= PI || norm == 0)
+    {
+        for (size_t cell = 0; cell < cells.size(); ++cell)
+            result.push_back(cell);
+        return;
+    }
+
+    double tilt = acos(CLIP(z / norm, -1., 1.));
+    double rot = atan2(y, x);
+    if (rot < 0)
+        rot += 2 * PI;
+    double tilt0 = tilt - radius, tilt1 = tilt + radius;
+    size_t nRings = ringStart.size();
+    size_t ring0 = tilt0 <= 0 ? 0 : XMIPP_MIN((size_t) (tilt0 / ringSize), nRings - 1);
+    size_t ring1 = tilt1 >= PI ? nRings - 1 : XMIPP_MIN((size_t) (tilt1 / ringSize), nRings - 1);
+
+    // Largest difference in rot inside the cone, unless it contains a pole
+    double sinTilt = sin(tilt), sinRadius = sin(radius);
+    bool wholeRing = tilt0 <= 0 || tilt1 >= PI || sinRadius >= sinTilt;
+    double deltaRot = wholeRing ? PI : asin(sinRadius / sinTilt) + SPHERE_INDEX_MARGIN;
+
+    for (size_t ring = ring0; ring <= ring1; ++ring)
+    {
+        long sectors = (long) ringSectors[ring];
+        long sector0 = (long) floor((rot - deltaRot) / (2 * PI) * sectors);
+        long sector1 = (long) floor((rot + deltaRot) / (2 * PI) * sectors);
+        if (wholeRing || sector1 - sector0 + 1 >= sectors)
+        {
+            sector0 = 0;
+            sector1 = sectors - 1;
+        }
+        for (long sector = sector0; sector <= sector1; ++sector)
+            result.push_back(ringStart[ring] + (size_t) (((sector % sectors) + sectors) % sectors));
+    }
+}
+
+void SphereIndex::cone(const Matrix1D<double> &direction, double cosRadius,
+                       std::vector<size_t> &result) const
+{
+    result.clear();
+    double x = XX(direction), y = YY(direction), z = ZZ(direction);
+    const double * xyz = coordinates.empty() ? NULL : &coordinates[0];
+    double radius = coneRadius(cosRadius, sqrt(x * x + y * y + z * z));
+    if (size() <= SPHERE_INDEX_ALL_POINTS || radius >= SPHERE_INDEX_ALL_RADIUS)
+    {
+        for (size_t n = 0; n < size(); ++n, xyz += 3)
+        {
+            double dot = 0;
+            dot += xyz[0] * x;
+            dot += xyz[1] * y;
+            dot += xyz[2] * z;
+            if (dot > cosRadius)
+                result.push_back(n);
+        }
+        return;
+    }
+
+    std::vector<size_t> candidates;
+    candidateCells(x, y, z, radius, candidates);
+    for (size_t c = 0; c < candidates.size(); ++c)
+    {
+        const std::vector<size_t> &cell = cells[candidates[c]];
+        for (size_t n = 0; n < cell.size(); ++n)
+        {
+            const double * point = xyz + 3 * cell[n];
+            // Same operations as dotProduct()
+            double dot = 0;
+            dot += point[0] * x;
+            dot += point[1] * y;
+            dot += point[2] * z;
+            if (dot > cosRadius)
+                result.push_back(cell[n]);
+        }
+    }
+    std::sort(result.begin(), result.end());
+}
+
+int SphereIndex::nearest(const Matrix1D<double> &direction, double &dot) const
+{
+    dot = -std::numeric_limits<double>::max();
+    if (size() == 0)
+        return -1;
+
+    // Search cones of increasing radius until one of them is not empty. The
+    // nearest point is the best one inside the first cone with points.
+    double x = XX(direction), y = YY(direction), z = ZZ(direction);
+    double norm = sqrt(x * x + y * y + z * z);
+    const double * xyz = &coordinates[0];
+    std::vector<size_t> candidates;
+    for (double radius = ringSize; ; radius *= 2)
+    {
+        if (size() <= SPHERE_INDEX_ALL_POINTS || radius >= SPHERE_INDEX_ALL_RADIUS)
+        {
+            int best = -1;
+            for (size_t n = 0; n < size(); ++n, xyz += 3)
+            {
+                double aux = 0;
+                aux += xyz[0] * x;
+                aux += xyz[1] * y;
+                aux += xyz[2] * z;
+                if (aux > dot)
+                {
+                    dot = aux;
+                    best = (int) n;
+                }
+            }
+            return best;
+        }
+        double cosRadius = cos(radius) * norm * maxNorm;
+        candidateCells(x, y, z, coneRadius(cosRadius, norm), candidates);
+        int best = -1;
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            const std::vector<size_t> &cell = cells[candidates[c]];
+            for (size_t n = 0; n < cell.size(); ++n)
+            {
+                const double * point = xyz + 3 * cell[n];
+                double aux = 0;
+                aux += point[0] * x;
+                aux += point[1] * y;
+                aux += point[2] * z;
+                if (aux > cosRadius && (aux > dot || (aux == dot && (int) cell[n] < best)))
+                {
+                    dot = aux;
+                    best = (int) cell[n];
+                }
+            }
+        }
+        if (best != -1)
+            return best;
+    }
+}
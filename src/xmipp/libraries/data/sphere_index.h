@@ -0,0 +1,101 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef _SPHERE_INDEX_HH
+#define _SPHERE_INDEX_HH
+
+#include <vector>
+#include <core/matrix1d.h>
+
+/**@defgroup SphereIndex Spatial index of directions
+   @ingroup DataLibrary */
+//@{
+/** Spatial index of unit vectors.
+    The sphere is divided in rings of constant tilt, and each ring in sectors
+    of roughly the same size, so that a query only visits the cells that
+    intersect the cone around the query direction. The points are identified
+    by their insertion order.
+
+    @code
+    SphereIndex index(sampling_points_vector);
+    std::vector<size_t> neighbours;
+    index.cone(direction, cos(DEG2RAD(5)), neighbours);
+    double dot;
+    int closest = index.nearest(direction, dot);
+    @endcode
+*/
+class SphereIndex
+{
+public:
+    /** Empty constructor */
+    SphereIndex();
+
+    /** Index of a set of unit vectors */
+    SphereIndex(const std::vector< Matrix1D<double> > &points);
+
+    /** Remove all points and size the cells for about nPoints points */
+    void initialize(size_t nPoints);
+
+    /** Add a unit vector. Its index is the number of points already added */
+    void insert(const Matrix1D<double> &point);
+
+    /** Number of points */
+    size_t size() const
+    {
+        return coordinates.size() / 3;
+    }
+
+    /** Points whose dot product with direction is larger than cosRadius.
+        The indexes are returned in increasing order. */
+    void cone(const Matrix1D<double> &direction, double cosRadius,
+              std::vector<size_t> &result) const;
+
+    /** Point with the largest dot product with direction.
+        On ties, the one with the smallest index. Returns -1 if the index is
+        empty. */
+    int nearest(const Matrix1D<double> &direction, double &dot) const;
+
+private:
+    // Cells intersecting the cone of angular radius around (x,y,z)
+    void candidateCells(double x, double y, double z, double radius,
+                        std::vector<size_t> &cells) const;
+
+    // Angular radius that contains the points with a dot product larger than cosRadius
+    double coneRadius(double cosRadius, double directionNorm) const;
+
+    // Cell of a direction
+    size_t cellOf(double x, double y, double z) const;
+
+    // Angular size of the rings
+    double ringSize;
+    // First cell and number of sectors of each ring
+    std::vector<size_t> ringStart, ringSectors;
+    // Points in each cell
+    std::vector< std::vector<size_t> > cells;
+    // x,y,z of the points
+    std::vector<double> coordinates;
+    // Largest norm of the points
+    double maxNorm;
+};
+//@}
+#endif
@@ -35,6 +35,7 @@ void ProgTransformDownsample::readParams()
 
     XmippMetadataProgram::readParams();
     step=getDoubleParam("--step");
+    singlePrecision=checkParam("--single_precision");
     String strMethod=getParam("--method");
     if (strMethod=="fourier")
     {
@@ -76,7 +77,10 @@ void ProgTransformDownsample::defineParams()
     addParamsLine("                        :+unequal frequency damping.");
     addParamsLine("               smooth: smooth and colordither");
     addParamsLine("                     :+ Both input and output micrographs must be 8 bits, unsigned char");
+    addParamsLine(" [--single_precision]      : Fourier downsampling with single precision transforms,");
+    addParamsLine("                           :+halving the memory of the micrograph and of its transform");
     addExampleLine("xmipp_transform_downsample -i micrograph.tif -o downsampledMicrograph.tif --step 2");
+    addExampleLine("xmipp_transform_downsample -i micrograph.mrc -o downsampledMicrograph.mrc --step 2 --method fourier 4 --single_precision");
 }
 
 // Downsample micrograph ---------------------------------------------------
@@ -104,7 +108,7 @@ void ProgTransformDownsample::processImage(const FileName &fnImg, const FileName
     if (method==KER_RECTANGLE)
         downsampleKernel(M_in,step,M_out);
     else if (method==FOURIER)
-        downsampleFourier(M_in,step,M_out,nThreads);
+        downsampleFourier(M_in,step,M_out,nThreads,singlePrecision);
     else
         downsampleSmooth(M_in,M_out);
 
@@ -200,28 +204,30 @@ void downsampleKernel(const ImageGeneric &M, double step, ImageGeneric &Mp)
         }
 }
 
-void downsampleFourier(const ImageGeneric &M, double step, ImageGeneric &Mp, int nThreads)
+// Fourier downsampling with the transforms of the precision of T
+template<typename T, typename Transformer>
+static void downsampleFourierT(const ImageGeneric &M, ImageGeneric &Mp, int nThreads)
 {
     size_t Ydim, Xdim, Ypdim, Xpdim;
     M().getDimensions(Xdim, Ydim);
     Mp().getDimensions(Xpdim, Ypdim);
 
-    // Read the micrograph in memory as doubles
-    MultidimArray<double> Mmem;
+    // Read the micrograph in memory as T
+    MultidimArray<T> Mmem;
     Mmem.setMmap(true);
     Mmem.resizeNoCopy(Ydim,Xdim);
-    MultidimArray<std::complex<double> > MmemFourier;
+    MultidimArray<std::complex<T> > MmemFourier;
     M().getImage(Mmem);
 
     // Perform the Fourier transform
-    FourierTransformer transformerM;
+    Transformer transformerM;
     transformerM.setThreadsNumber(nThreads);
     transformerM.FourierTransform(Mmem, MmemFourier, false);
 
     // Create space for the downsampled image and its Fourier transform
-    MultidimArray<double> Mpmem(Ypdim,Xpdim);
-    MultidimArray<std::complex<double> > MpmemFourier;
-    FourierTransformer transformerMp;
+    MultidimArray<T> Mpmem(Ypdim,Xpdim);
+    MultidimArray<std::complex<T> > MpmemFourier;
+    Transformer transformerMp;
     transformerMp.setThreadsNumber(nThreads);
     transformerMp.setReal(Mpmem);
     transformerMp.getFourierAlias(MpmemFourier);
@@ -262,6 +268,15 @@ void downsampleFourier(const ImageGeneric &M, double step, ImageGeneric &Mp, int
         Mp.setPixel(i, j, A2D_ELEM(Mpmem,i,j));
 }
 
+void downsampleFourier(const ImageGeneric &M, double step, ImageGeneric &Mp, int nThreads,
+                       bool singlePrecision)
+{
+    if (singlePrecision)
+        downsampleFourierT<float, FourierTransformerFloat>(M, Mp, nThreads);
+    else
+        downsampleFourierT<double, FourierTransformer>(M, Mp, nThreads);
+}
+
 void downsampleSmooth(const ImageGeneric &M, ImageGeneric &Mp)
 {
     if (Mp.datatype!=DT_UChar)
@@ -46,6 +46,9 @@ public:
     /// Number of Threads used in the Fourier Transform
     int nThreads;
 
+    /// Fourier downsampling in single precision
+    bool singlePrecision;
+
 public:
     // Kernel
     MultidimArray<double> kernel;
@@ -71,8 +74,10 @@ void downsampleKernel(const ImageGeneric &M, double step, ImageGeneric &Mp);
 
 /** Downsample a micrograph in Fourier space.
  * The input and output micrographs must be already open.
+ * With singlePrecision the micrograph and its transform are kept as floats.
  */
-void downsampleFourier(const ImageGeneric &M, double step, ImageGeneric &Mp, int nThreads);
+void downsampleFourier(const ImageGeneric &M, double step, ImageGeneric &Mp, int nThreads,
+                       bool singlePrecision=false);
 
 /** Downsample a micrograph using smooth and color dithering.
  * The input and output micrographs must be already open.
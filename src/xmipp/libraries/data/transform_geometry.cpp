@@ -37,6 +37,7 @@ void ProgTransformGeometry::defineParams()
     save_metadata_stack = true;
     keep_input_columns = true;
     allow_apply_geo = true;
+    allow_threads = true;
     mdVol = false;
     XmippMetadataProgram::defineParams();
     //usage
@@ -75,6 +76,9 @@ void ProgTransformGeometry::defineParams()
     addParamsLine("                                    : and the alignment information is stored in metadata");
     addParamsLine("[--dont_wrap]                       : By default, the image/volume is wrapped");
     addParamsLine("[--write_matrix]                    : Print transformation matrix to screen");
+    addParamsLine("[--single_precision]                : Transform double images in single precision (float images already are).");
+    addParamsLine("                                    : Spline coefficients are computed in double,");
+    addParamsLine("                                    : use --interp linear to compute in float end to end");
     //examples
     addExampleLine("Write a metadata with geometrical transformations keeping the reference to original images:", false);
     addExampleLine("xmipp_transform_geometry -i mD1.xmd --shift 2 3 4 --scale 1.2 --rotate 23 -o newGeo.xmd");
@@ -88,6 +92,8 @@ void ProgTransformGeometry::defineParams()
     addExampleLine("xmipp_transform_geometry -i a.vol --shift 10 5 -10 -o b.vol --dont_wrap");
     addExampleLine("Scale a group of images to half size, not modifying image dimensions neither original image files", false);
     addExampleLine("xmipp_transform_geometry -i images.xmd --scale 0.5 -o halvedOriginal.xmd");
+    addExampleLine("Rotate a volume stored in double precision, computing and writing it in single precision", false);
+    addExampleLine("xmipp_transform_geometry -i a.vol --rotate_volume euler 10 20 30 -o b.vol --single_precision --interp linear");
 
 }
 
@@ -103,6 +109,11 @@ void ProgTransformGeometry::readParams()
     else if (degree == "linear")
         splineDegree = LINEAR;
     flip = checkParam("--flip");
+    useMatrix = checkParam("--matrix");
+    if (useMatrix)
+        matrixStr = getParam("--matrix");
+    writeMatrix = checkParam("--write_matrix");
+    singlePrecision = checkParam("--single_precision");
 
     /** In most cases output "-o" is a metadata with the new geometry keeping 
      *  the names of input images so we set the flags to keep the same image 
@@ -210,12 +221,14 @@ void ProgTransformGeometry::processImage(const FileName &fnImg,
                                          const MDRow &rowIn,
                                          MDRow &rowOut)
 {
+    // Images may be processed by several threads, keep everything local
+    Matrix2D<double> B, T;
+    ImageGeneric img, imgOut;
 
-    if (checkParam("--matrix"))
+    if (useMatrix)
     {
       // In this case we are directly reading the transformation matrix
       // from the arguments passed
-      matrixStr = getParam("--matrix");
       string2TransformationMatrix(matrixStr, T);
     }
     else
@@ -229,19 +242,30 @@ void ProgTransformGeometry::processImage(const FileName &fnImg,
       T = A * B;
     }
 
-    if (checkParam("--write_matrix"))
-        std::cerr << T << std::endl;
+    if (writeMatrix)
+    {
+        std::stringstream ss;
+        ss << T << std::endl;
+        writeMatrixMutex.lock();
+        std::cerr << ss.str();
+        writeMatrixMutex.unlock();
+    }
 
     if (applyTransform || fnImg != fnImgOut)
         img.read(fnImg);
 
     if (applyTransform)
     {
+        if (singlePrecision && img.getDatatype() == DT_Double)
+            img.convert2Datatype(DT_Float, CW_CAST);
         img().setXmippOrigin();
         imgOut.setDatatype(img.getDatatype());
         imgOut().resize(1, zdimOut, ydimOut, xdimOut, false);
         imgOut().setXmippOrigin();
-        applyGeometry(splineDegree, imgOut(), img(), T, IS_NOT_INV, wrap, 0.);
+        // A single volume is transformed by all the threads, otherwise each
+        // thread transforms its own images
+        applyGeometry(splineDegree, imgOut(), img(), T, IS_NOT_INV, wrap, 0.,
+                      single_image ? nThreads : 1);
         imgOut.write(fnImgOut);
         rowOut.resetGeo(false);
     }
@@ -45,9 +45,10 @@ public:
 protected:
     int             splineDegree, dim;
     bool            applyTransform, inverse, wrap, isVol, flip, mdVol;
-    Matrix2D<double> R, A, B, T;
-    ImageGeneric img, imgOut;
+    bool            useMatrix, writeMatrix, singlePrecision;
+    Matrix2D<double> R, A;
     String matrixStr; // To read directly the matrix
+    Mutex writeMatrixMutex; // The matrices of different threads are not mixed
 
     void defineParams();
     void readParams();
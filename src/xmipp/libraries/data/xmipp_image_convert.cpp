@@ -87,7 +87,7 @@ void  ProgConvImg::defineParams()
     addParamsLine("         img : Imagic (Data types: uint8, int16, float* and cfloat).");
     addParamsLine("         inf : RAW file with header INF file (Data types: (u)int8, (u)int16 and float*).");
     addParamsLine("         raw : RAW file with header INF file (Data types: (u)int8, (u)int16 and float*).");
-    addParamsLine("         mrc : CCP4 (Data types: uint8, (u)int16, float* and cfloat).");
+    addParamsLine("         mrc : CCP4 (Data types: uint4, uint8, (u)int16, float* and cfloat).");
     addParamsLine("         spi : Spider (Data types: float* and cfloat).");
     addParamsLine("         xmp : Spider (Data types: float* and cfloat).");
     addParamsLine("         tif : TIFF (Data types: uint8*, uint16, uint32 and float).");
@@ -104,6 +104,7 @@ void  ProgConvImg::defineParams()
     addParamsLine("  [--depth+ <bit_depth=default>] : Image bit depth.");
     addParamsLine("          where <bit_depth>");
     addParamsLine("                 default: Default selected value (*)");
+    addParamsLine("                 uint4 : Packed 4-bit, two pixels per byte (MRC only)");
     addParamsLine("                 uint8 : Equivalent to uchar");
     addParamsLine("                 int8  : Equivalent to char");
     addParamsLine("                 uint16: Equivalent to ushort");
@@ -129,6 +130,8 @@ void  ProgConvImg::defineParams()
     addParamsLine("  alias -r;");
     addParamsLine("or --dont_convert : Do not apply any conversion to gray levels when writing");
     addParamsLine("                  : in a lower bit depth or changing the sign");
+    addParamsLine("== Read options == ");
+    addParamsLine("  [--read_threads <N=1>] : Threads decoding the frames of compressed TIFF movies");
     addParamsLine("== Stack options == ");
     addParamsLine("  [--append]           : Append the input to the output stack instead of overwriting it");
     addParamsLine("  alias -a;");
@@ -154,6 +157,8 @@ void  ProgConvImg::defineParams()
     addExampleLine("xmipp_image_convert -i selFile.sel -o stackFile.stk --append");
     addExampleLine("Replace a single image into a stack:",false);
     addExampleLine("xmipp_image_convert -i img.spi -o 3@stackFile.stk");
+    addExampleLine("Convert a compressed TIFF movie to a MRC stack, decoding its frames with 4 threads:",false);
+    addExampleLine("xmipp_image_convert -i movie.tif -o movie.mrcs --read_threads 4");
     addExampleLine("Convert a MRC stack to a MRC volume:",false);
     addExampleLine("xmipp_image_convert -i stack.mrc -o volume.mrc -t vol");
 }
@@ -168,6 +173,12 @@ void ProgConvImg::readParams()
 
     appendToStack = checkParam("--append");
 
+    // The images are read by this thread
+    int readThreads = getIntParam("--read_threads");
+    if (readThreads < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "--read_threads must be at least 1");
+    ImageBase::setTIFFReadThreads(readThreads);
+
     // output extension
     oext = checkParam("--oext") ? getParam("--oext") : "";
     if ( oext == "custom" )
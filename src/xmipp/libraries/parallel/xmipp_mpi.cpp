@@ -271,7 +271,11 @@ int XmippMpiProgram::tryRun()
     try
     {
         if (doRun)
+        {
             this->run();
+            if (node->isMaster())
+                storeFFTWWisdom();
+        }
     }
     catch (XmippError &xe)
     {
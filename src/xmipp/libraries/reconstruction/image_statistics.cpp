@@ -29,6 +29,7 @@
 #include <core/xmipp_program.h>
 #include <core/xmipp_image_generic.h>
 #include <core/metadata.h>
+#include <core/multidim_array_stats.h>
 #include <data/mask.h>
 
 /* PROGRAM ----------------------------------------------------------------- */
@@ -42,6 +43,7 @@ protected:
     MultidimArray<double>    dummyArray;
 
     Mask            mask;
+    std::vector<size_t> maskIndexes;  // Direct indexes of the pixels inside the mask
     int             short_format;     // True if a short line is to be shown
     int             save_mask;        // True if the masks must be saved
     int             repair;           // True if headers are initialized
@@ -129,7 +131,10 @@ protected:
 
         // Generate mask if necessary
         if (apply_mask)
+        {
             mask.generate_mask(zdimOut, ydimOut, xdimOut);
+            binaryMaskIndexes(mask.get_binary_mask(), mask.get_binary_mask(), maskIndexes);
+        }
 
     }
 
@@ -146,7 +151,18 @@ protected:
         if (show_angles)
             image.getEulerAngles(rot,tilt,psi);
 
-        if (apply_mask)
+        size_t xdim, ydim, zdim;
+        image().getDimensions(xdim, ydim, zdim);
+        if (apply_mask && xdim == xdimOut && ydim == ydimOut && zdim == zdimOut)
+        {
+            ArrayStats stats;
+            computeArrayStats(image(), maskIndexes, stats);
+            min_val = stats.minval;
+            max_val = stats.maxval;
+            avg = stats.avg();
+            stddev = stats.stddev();
+        }
+        else if (apply_mask)
         {
             computeStats_within_binary_mask(mask.get_binary_mask(), image(), min_val, max_val,
                                             avg, stddev);
@@ -27,6 +27,8 @@
 #include <core/geometry.h>
 #include <data/filters.h>
 #include <data/basic_pca.h>
+#include <algorithm>
+#include <map>
 
 // Read arguments ==========================================================
 void ProgMetadataSplit3D::readParams()
@@ -37,6 +39,7 @@ void ProgMetadataSplit3D::readParams()
     fn_oroot = getParam("--oroot");
     angularSampling = getDoubleParam("--angSampling");
     maxDist = getDoubleParam("--maxDist");
+    Nthreads = getIntParam("--threads");
 }
 
 // Show ====================================================================
@@ -51,6 +54,7 @@ void ProgMetadataSplit3D::show()
     << "Symmetry:         " << fn_sym << std::endl
     << "Angular sampling: " << angularSampling << std::endl
     << "Maximum distance: " << maxDist << std::endl
+    << "Threads:          " << Nthreads << std::endl
     ;
 }
 
@@ -65,60 +69,151 @@ void ProgMetadataSplit3D::defineParams()
     addParamsLine("                               :+The definition of the symmetry is described at [[transform_symmetrize_v3][transform_symmetrize]]");
     addParamsLine("  [--angSampling <a=5>]        : Angular sampling in degrees");
     addParamsLine("  [--maxDist <a=10>]           : Maximum angular distance in degrees");
+    addParamsLine("  [--threads <N=1>]            : Number of threads");
     addExampleLine("xmipp_metadata_split_3D -i projections.sel --vol volume.vol --oroot split");
 }
 
-void getNeighbours(MetaData &mdIn, const Matrix1D<double> &projectionDir, MetaData &mdNeighbours, double maxDist)
+void ProgMetadataSplit3D::loadImages()
 {
-	Matrix1D<double> projectionDir2;
-	FileName fnImg;
-	mdNeighbours.clear();
-	MetaData mdAux;
-	size_t refno;
-	double cc;
-	FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+	// The metadata is read once, column by column
+	std::vector<double> rot, tilt;
+	std::vector<size_t> refno;
+	std::vector<String> fnImg;
+	mdIn.getColumnValues(MDL_ANGLE_ROT,rot);
+	mdIn.getColumnValues(MDL_ANGLE_TILT,tilt);
+	mdIn.getColumnValues(MDL_IMAGE_IDX,refno);
+	mdIn.getColumnValues(MDL_IMAGE,fnImg);
+	mdIn.getColumnValues(MDL_MAXCC,imgCC);
+
+	size_t nImgs=mdIn.size();
+	imgDirection.resize(nImgs);
+	imgGroup.resize(nImgs);
+	groupRef.clear();
+	std::map< std::pair<size_t,String>, size_t > groups;
+	for (size_t n=0; n<nImgs; ++n)
 	{
-		double rot, tilt;
-		mdIn.getValue(MDL_ANGLE_ROT,rot,__iter.objId);
-		mdIn.getValue(MDL_ANGLE_TILT,tilt,__iter.objId);
-		mdIn.getValue(MDL_IMAGE_IDX,refno,__iter.objId);
-		mdIn.getValue(MDL_MAXCC,cc,__iter.objId);
-		Euler_direction(rot,tilt,0,projectionDir2);
+		Euler_direction(rot[n],tilt[n],0,imgDirection[n]);
+		std::pair<size_t,String> key(refno[n],fnImg[n]);
+		std::map< std::pair<size_t,String>, size_t >::iterator it=groups.find(key);
+		if (it==groups.end())
+		{
+			it=groups.insert(std::make_pair(key,groupRef.size())).first;
+			groupRef.push_back(refno[n]);
+		}
+		imgGroup[n]=it->second;
+	}
+	imgIndex=SphereIndex(imgDirection);
+}
 
-		double angle=acos(dotProduct(projectionDir,projectionDir2));
+void ProgMetadataSplit3D::classifyReference(size_t nref, std::vector<int> &votes,
+		std::vector<double> &groupCC, std::vector<bool> &inGroup) const
+{
+	// Get all images in the input metadata that are close to this reference,
+	// keeping the maximum correlation of each group. The index gives the
+	// candidates in a slightly wider cone, then the distance is checked as always
+	const Matrix1D<double> &projectionDir=refDirection[nref];
+	std::vector<size_t> candidates, groups;
+	imgIndex.cone(projectionDir,cos(std::min(maxDist+1e-6,PI)),candidates);
+	for (size_t c=0; c<candidates.size(); ++c)
+	{
+		size_t n=candidates[c];
+		double angle=acos(dotProduct(projectionDir,imgDirection[n]));
 		if (angle<maxDist)
 		{
-			mdIn.getValue(MDL_IMAGE,fnImg,__iter.objId);
-			size_t id=mdAux.addObject();
-			mdAux.setValue(MDL_IMAGE,fnImg,id);
-			mdAux.setValue(MDL_IMAGE_IDX,refno,id);
-			mdAux.setValue(MDL_MAXCC,cc,id);
+			size_t g=imgGroup[n];
+			if (!inGroup[g])
+			{
+				inGroup[g]=true;
+				groupCC[g]=imgCC[n];
+				groups.push_back(g);
+			}
+			else if (imgCC[n]>groupCC[g])
+				groupCC[g]=imgCC[n];
 		}
 	}
-	mdNeighbours.removeDuplicates(mdAux,MDL_IMAGE_IDX);
-	std::vector<MDLabel> groupBy;
-	groupBy.push_back(MDL_IMAGE_IDX);
-	groupBy.push_back(MDL_IMAGE);
-	if (mdAux.size()>0)
-		mdNeighbours.aggregateGroupBy(mdAux,AGGR_MAX,groupBy,MDL_MAXCC,MDL_MAXCC);
+	if (groups.empty())
+		return;
+
+	// Check if it is upper or lower half
+	std::vector<double> cc(groups.size());
+	for (size_t i=0; i<groups.size(); ++i)
+		cc[i]=groupCC[groups[i]];
+	std::nth_element(cc.begin(),cc.begin()+cc.size()/2,cc.end());
+	double ccMedian=cc[cc.size()/2];
+	for (size_t i=0; i<groups.size(); ++i)
+	{
+		size_t g=groups[i];
+		votes[groupRef[g]]+=(groupCC[g]>ccMedian) ? 1 : -1;
+		inGroup[g]=false;
+	}
 }
 
-void analyzeNeighbours(MetaData &mdNeighbours, const FileName &fnRef)
+/* Data shared by the threads classifying the references */
+struct MetadataSplit3DData
 {
-	std::vector<double> cc;
-	mdNeighbours.getColumnValues(MDL_MAXCC,cc);
-	std::sort(cc.begin(),cc.end());
+	ProgMetadataSplit3D * prog;
+	ThreadTaskDistributor * distributor;
+	/// Per thread votes of each image index
+	std::vector< std::vector<int> > votes;
+};
 
-	double ccMedian=cc[cc.size()/2];
-	FOR_ALL_OBJECTS_IN_METADATA(mdNeighbours)
+void ProgMetadataSplit3D::classifyThread(ThreadArgument &thArg)
+{
+	MetadataSplit3DData * data = (MetadataSplit3DData *) thArg.workClass;
+	const ProgMetadataSplit3D * prog = data->prog;
+	std::vector<int> &votes = data->votes[thArg.thread_id];
+	std::vector<double> groupCC(prog->groupRef.size());
+	std::vector<bool> inGroup(prog->groupRef.size(), false);
+
+	size_t first, last;
+	while (data->distributor->getTasks(first, last))
+	{
+		for (size_t nref=first; nref<=last; ++nref)
+			prog->classifyReference(nref, votes, groupCC, inGroup);
+		if (thArg.thread_id==0 && prog->verbose)
+			progress_bar(last+1);
+	}
+}
+
+void ProgMetadataSplit3D::classifyImages()
+{
+	// Load angles, image indexes and correlations once, and sort the images
+	// by projection direction
+	loadImages();
+	size_t maxRef=0;
+	for (size_t g=0; g<groupRef.size(); ++g)
+		maxRef=std::max(maxRef,groupRef[g]);
+	std::vector<double> rot, tilt;
+	mdRef.getColumnValues(MDL_ANGLE_ROT,rot);
+	mdRef.getColumnValues(MDL_ANGLE_TILT,tilt);
+	refDirection.resize(rot.size());
+	for (size_t nref=0; nref<rot.size(); ++nref)
+		Euler_direction(rot[nref],tilt[nref],0,refDirection[nref]);
+
+	// Calculate coocurrence matrix
+	// The references are distributed among the threads, each one with its
+	// own votes that are added at the end
+	int nthreads = std::max(Nthreads, 1);
+	ThreadTaskDistributor distributor(refDirection.size(), 16);
+	MetadataSplit3DData data;
+	data.prog = this;
+	data.distributor = &distributor;
+	data.votes.resize(nthreads, std::vector<int>(maxRef+1, 0));
+
+	if (verbose)
 	{
-		double cci;
-		mdNeighbours.getValue(MDL_MAXCC,cci,__iter.objId);
-		if (cci>ccMedian)
-			mdNeighbours.setValue(MDL_COST,1.0,__iter.objId);
-		else
-			mdNeighbours.setValue(MDL_COST,-1.0,__iter.objId);
+		std::cerr << "Classifying projections ...\n";
+		init_progress_bar(mdRef.size());
 	}
+	ThreadManager thMgr(nthreads, &data);
+	thMgr.run(classifyThread);
+	if (verbose)
+		progress_bar(mdRef.size());
+
+	correlatesWell.initZeros(maxRef+1);
+	for (int t=0; t<nthreads; ++t)
+		for (size_t r=0; r<=maxRef; ++r)
+			VEC_ELEM(correlatesWell,r)+=data.votes[t][r];
 }
 
 // usage ===================================================================
@@ -141,56 +236,14 @@ void ProgMetadataSplit3D::run()
 	deleteFile(fn_oroot+"_gallery.stk");
 	deleteFile(fn_oroot+"_gallery_sampling.xmd");
 
-	// Get the maximum reference number
-	size_t maxRef=0, refno;
-	FOR_ALL_OBJECTS_IN_METADATA(mdIn)
-	{
-		mdIn.getValue(MDL_IMAGE_IDX,refno,__iter.objId);
-		if (refno>maxRef)
-			maxRef=refno;
-	}
+	if (!mdIn.containsLabel(MDL_MAXCC))
+		REPORT_ERROR(ERR_MD_MISSINGLABEL,"Input metadata with images does not contain a maxCC column");
 
-	// Calculate coocurrence matrix
-	correlatesWell.initZeros(maxRef+1);
-	Matrix1D<double> projectionDir;
-	std::vector<FileName> fnNeighbours;
-	FileName fnImg;
 	maxDist=DEG2RAD(maxDist);
-    MetaData mdNeighbours;
-    std::vector<size_t> refs;
-    std::vector<double> upperHalf;
-    int i=0;
-    std::cerr << "Classifying projections ...\n";
-    init_progress_bar(mdRef.size());
-	FOR_ALL_OBJECTS_IN_METADATA(mdRef)
-	{
-		// Get the projection direction of this image
-		double rot, tilt;
-		mdRef.getValue(MDL_ANGLE_ROT,rot,__iter.objId);
-		mdRef.getValue(MDL_ANGLE_TILT,tilt,__iter.objId);
-		Euler_direction(rot,tilt,0,projectionDir);
-
-		// Get all images in the input metadata that are close to this one
-		getNeighbours(mdIn,projectionDir,mdNeighbours,maxDist);
-
-		// Check if it is upper or lower half
-		if (mdNeighbours.size()>0)
-		{
-			mdRef.getValue(MDL_IMAGE,fnImg,__iter.objId);
-			analyzeNeighbours(mdNeighbours,fnImg);
-			mdNeighbours.getColumnValues(MDL_IMAGE_IDX,refs);
-			mdNeighbours.getColumnValues(MDL_COST,upperHalf);
-
-			size_t imax=refs.size();
-			for (size_t i=0; i<imax; ++i)
-				VEC_ELEM(correlatesWell,refs[i])+=upperHalf[i];
-		}
-		++i;
-		progress_bar(i);
-	}
-	progress_bar(mdRef.size());
+	classifyImages();
 
 	// Split in two metadatas
+	size_t refno;
 	MetaData mdUpper, mdLower;
 	MDRow row;
 	FOR_ALL_OBJECTS_IN_METADATA(mdIn)
@@ -27,6 +27,8 @@
 
 #include <core/xmipp_program.h>
 #include <core/metadata.h>
+#include <core/xmipp_threads.h>
+#include <data/sphere_index.h>
 
 /**@defgroup MetadataSplit3D Split a metadata according to a 3D volume
    @ingroup ReconsLibrary */
@@ -47,6 +49,8 @@ public:
     double angularSampling;
     /** Maximum angular distance */
     double maxDist;
+    /** Number of threads */
+    int Nthreads;
 public:
     // Metadata with reference images
     MetaData mdRef;
@@ -56,6 +60,24 @@ public:
 
     // Correlates_well vector
     Matrix1D<int> correlatesWell;
+
+    // Projection direction of the input images
+    std::vector< Matrix1D<double> > imgDirection;
+
+    // Input images by projection direction
+    SphereIndex imgIndex;
+
+    // Maximum correlation of the input images
+    std::vector<double> imgCC;
+
+    // Group (image index and image name) of the input images
+    std::vector<size_t> imgGroup;
+
+    // Image index of each group
+    std::vector<size_t> groupRef;
+
+    // Projection direction of the references
+    std::vector< Matrix1D<double> > refDirection;
 public:
     /// Read argument from command line
     void readParams();
@@ -66,6 +88,28 @@ public:
     /// Usage
     void defineParams();
 
+    /// Load the angles, image indexes and correlations of the input images
+    void loadImages();
+
+    /** Add the votes of the neighbours of a reference to votes.
+     * votes has one element per image index. The images within maxDist of
+     * the reference are grouped by image index and image name, and each group
+     * adds +1 to the votes of its image index if its maximum correlation is
+     * above the median of the groups, or -1 otherwise. groupCC and inGroup
+     * are work vectors with one element per group.
+     */
+    void classifyReference(size_t nref, std::vector<int> &votes, std::vector<double> &groupCC,
+                           std::vector<bool> &inGroup) const;
+
+    /** Compute correlatesWell from mdIn and mdRef with Nthreads threads.
+     * maxDist is in radians. The votes of all the references are added
+     * for each image index.
+     */
+    void classifyImages();
+
+    // Thread function classifying a subset of the references
+    static void classifyThread(ThreadArgument &thArg);
+
     /// Run
     void run();
 };
@@ -498,7 +498,20 @@ void ProgFSO::fscDir_fast(MultidimArray<double> &fsc, double rot, double tilt,
 	
 
 	// Computing directional resolution
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FT1_vec)
+	// Only the direction buckets that may intersect the cone are visited
+	size_t nBuckets = MAT_YSIZE(dirBuckets);
+	for (size_t b = 0; b<nBuckets; ++b)
+	{
+		double angLimit = fabs(ang_con) + MAT_ELEM(dirBuckets, b, 3);
+		if (angLimit < 0.5*PI)
+		{
+			double cosCenter = fabs(x_dir*MAT_ELEM(dirBuckets, b, 0) + y_dir*MAT_ELEM(dirBuckets, b, 1) +
+			                        z_dir*MAT_ELEM(dirBuckets, b, 2));
+			if (cosCenter < cos(angLimit) - 1e-9)
+				continue;
+		}
+
+	for (long n = DIRECT_MULTIDIM_ELEM(dirBucketStart, b); n<DIRECT_MULTIDIM_ELEM(dirBucketStart, b+1); ++n)
 	{
 		// TODO: Remove unuseful vectors
 		// double cosine = fabs((x_dir*ux + y_dir*uy + z_dir*uz)/sqrt(ux*ux + uy*uy + uz*uz));
@@ -535,6 +548,7 @@ void ProgFSO::fscDir_fast(MultidimArray<double> &fsc, double rot, double tilt,
 			dAi(den2,idxf) += absz2*absz2;
 		}
 	}
+	}
 
 	MultidimArray< double > freq;
 	MultidimArray< double > frc;
@@ -1798,6 +1812,168 @@ void ProgFSO::saveAnisotropyToMetadata(MetaData &mdAnisotropy,
    }
 
 
+void ProgFSO::sortVoxelsByDirection(double binAngle)
+{
+	// A cone includes the directions u and -u, so that only the
+	// hemisphere z>=0 is binned. The hemisphere is divided in rings of
+	// constant tilt, and each ring in sectors of about binAngle
+	size_t nTilt = std::max((size_t) 1, (size_t) ceil(0.5*PI/binAngle));
+	double tiltStep = 0.5*PI/nTilt;
+	std::vector<size_t> ringStart(nTilt), ringSize(nTilt);
+	size_t nBuckets = 0;
+	for (size_t t = 0; t<nTilt; ++t)
+	{
+		double sinTilt = sin((t+1)*tiltStep);
+		ringSize[t] = std::max((size_t) 1, (size_t) ceil(2*PI*sinTilt/binAngle));
+		ringStart[t] = nBuckets;
+		nBuckets += ringSize[t];
+	}
+
+	// Assigning each voxel to a bucket. Voxels without a direction
+	// (the origin) go to an extra bucket that is never visited
+	size_t nVoxels = NZYXSIZE(FT1_vec);
+	std::vector<size_t> voxelBucket(nVoxels);
+	std::vector<size_t> bucketSize(nBuckets+1, 0);
+	for (size_t n = 0; n<nVoxels; ++n)
+	{
+		double ux = DIRECT_MULTIDIM_ELEM(fx, n);
+		double uy = DIRECT_MULTIDIM_ELEM(fy, n);
+		double uz = DIRECT_MULTIDIM_ELEM(fz, n);
+		size_t b = nBuckets;
+		if (std::isfinite(ux) && std::isfinite(uy) && std::isfinite(uz))
+		{
+			if (uz<0)
+			{
+				ux = -ux;
+				uy = -uy;
+				uz = -uz;
+			}
+			double tilt = acos(std::min(uz, 1.0));
+			size_t t = std::min((size_t) (tilt/tiltStep), nTilt-1);
+			double rot = atan2(uy, ux);
+			if (rot<0)
+				rot += 2*PI;
+			size_t r = std::min((size_t) (rot/(2*PI)*ringSize[t]), ringSize[t]-1);
+			b = ringStart[t] + r;
+		}
+		voxelBucket[n] = b;
+		++bucketSize[b];
+	}
+
+	dirBucketStart.initZeros(nBuckets+2);
+	for (size_t b = 0; b<=nBuckets; ++b)
+		DIRECT_MULTIDIM_ELEM(dirBucketStart, b+1) = DIRECT_MULTIDIM_ELEM(dirBucketStart, b) + bucketSize[b];
+
+	// Counting sort of the voxels, the shell order is kept inside each bucket
+	std::vector<size_t> newPos(nVoxels);
+	std::vector<size_t> next(nBuckets+1);
+	for (size_t b = 0; b<=nBuckets; ++b)
+		next[b] = DIRECT_MULTIDIM_ELEM(dirBucketStart, b);
+	for (size_t n = 0; n<nVoxels; ++n)
+		newPos[n] = next[voxelBucket[n]]++;
+
+	MultidimArray< std::complex< double > > FT1_aux, FT2_aux;
+	MultidimArray<double> fx_aux, fy_aux, fz_aux;
+	MultidimArray<long> freqidx_aux, arr2indx_aux;
+	FT1_aux.resizeNoCopy(FT1_vec);
+	FT2_aux.resizeNoCopy(FT2_vec);
+	fx_aux.resizeNoCopy(fx);
+	fy_aux.resizeNoCopy(fy);
+	fz_aux.resizeNoCopy(fz);
+	freqidx_aux.resizeNoCopy(freqidx);
+	arr2indx_aux.resizeNoCopy(arr2indx);
+	for (size_t n = 0; n<nVoxels; ++n)
+	{
+		size_t m = newPos[n];
+		DIRECT_MULTIDIM_ELEM(FT1_aux, m) = DIRECT_MULTIDIM_ELEM(FT1_vec, n);
+		DIRECT_MULTIDIM_ELEM(FT2_aux, m) = DIRECT_MULTIDIM_ELEM(FT2_vec, n);
+		DIRECT_MULTIDIM_ELEM(fx_aux, m) = DIRECT_MULTIDIM_ELEM(fx, n);
+		DIRECT_MULTIDIM_ELEM(fy_aux, m) = DIRECT_MULTIDIM_ELEM(fy, n);
+		DIRECT_MULTIDIM_ELEM(fz_aux, m) = DIRECT_MULTIDIM_ELEM(fz, n);
+		DIRECT_MULTIDIM_ELEM(freqidx_aux, m) = DIRECT_MULTIDIM_ELEM(freqidx, n);
+		DIRECT_MULTIDIM_ELEM(arr2indx_aux, m) = DIRECT_MULTIDIM_ELEM(arr2indx, n);
+	}
+	FT1_vec = FT1_aux;
+	FT2_vec = FT2_aux;
+	fx = fx_aux;
+	fy = fy_aux;
+	fz = fz_aux;
+	freqidx = freqidx_aux;
+	arr2indx = arr2indx_aux;
+
+	// Center and angular radius of each bucket
+	dirBuckets.initZeros(nBuckets, 4);
+	for (size_t b = 0; b<nBuckets; ++b)
+	{
+		long n0 = DIRECT_MULTIDIM_ELEM(dirBucketStart, b);
+		long nF = DIRECT_MULTIDIM_ELEM(dirBucketStart, b+1);
+		double cx = 0, cy = 0, cz = 0;
+		for (long n = n0; n<nF; ++n)
+		{
+			double sign = (DIRECT_MULTIDIM_ELEM(fz, n)<0) ? -1 : 1;
+			cx += sign*DIRECT_MULTIDIM_ELEM(fx, n);
+			cy += sign*DIRECT_MULTIDIM_ELEM(fy, n);
+			cz += sign*DIRECT_MULTIDIM_ELEM(fz, n);
+		}
+		double norm = sqrt(cx*cx + cy*cy + cz*cz);
+		if (norm == 0)
+			continue;
+		cx /= norm;
+		cy /= norm;
+		cz /= norm;
+
+		double minCos = 1;
+		for (long n = n0; n<nF; ++n)
+		{
+			double cosine = fabs(cx*DIRECT_MULTIDIM_ELEM(fx, n) + cy*DIRECT_MULTIDIM_ELEM(fy, n) +
+			                     cz*DIRECT_MULTIDIM_ELEM(fz, n));
+			minCos = std::min(minCos, cosine);
+		}
+		MAT_ELEM(dirBuckets, b, 0) = cx;
+		MAT_ELEM(dirBuckets, b, 1) = cy;
+		MAT_ELEM(dirBuckets, b, 2) = cz;
+		MAT_ELEM(dirBuckets, b, 3) = acos(minCos);
+	}
+}
+
+/* Data shared by the threads of the directional FSC */
+struct FSODirectionalData
+{
+	ProgFSO * prog;
+	/// Global resolution, used when a direction does not cross the threshold
+	double resInterp;
+	/// Per thread accumulators of the 3DFSC, its normalization and the OFSC
+	std::vector< MultidimArray<double> > threeD_FSC, normalizationMap, aniParam;
+	MultidimArray<double> * directionAnisotropy;
+	MultidimArray<double> * resDirFSC;
+};
+
+void ProgFSO::fscDirThread(ThreadArgument &thArg)
+{
+	FSODirectionalData * data = (FSODirectionalData *) thArg.workClass;
+	ProgFSO * prog = data->prog;
+	int thread_id = thArg.thread_id;
+	int nthreads = thArg.getNumberOfThreads();
+
+	MultidimArray<double> fsc;
+	for (size_t k = thread_id; k<prog->angles.mdimx; k += nthreads)
+	{
+		double rot  = MAT_ELEM(prog->angles, 0, k);
+		double tilt = MAT_ELEM(prog->angles, 1, k);
+
+		// Estimating the direction FSC along the diretion given by rot and tilt
+		MetaData mdDirFSC;
+		double resol, resInterp = data->resInterp;
+		prog->fscDir_fast(fsc, rot, tilt, mdDirFSC, data->threeD_FSC[thread_id],
+				data->normalizationMap[thread_id], resol, prog->thrs, resInterp, k);
+
+		dAi(*(data->resDirFSC), k) = resInterp;
+
+		// Updating the FSO curve
+		prog->anistropyParameter(fsc, *(data->directionAnisotropy), k, data->aniParam[thread_id], prog->thrs);
+	}
+}
+
     void ProgFSO::createFullFourier(MultidimArray<double> &fourierHalf, FileName &fnMap,
     		int m1sizeX, int m1sizeY, int m1sizeZ)
     {
@@ -1869,36 +2045,49 @@ void ProgFSO::saveAnisotropyToMetadata(MetaData &mdAnisotropy,
     	MetaData mdAnisotropy;
 
 
+		// Grouping the Fourier voxels by direction, so that each cone
+		// only visits the voxels close to it
+		sortVoxelsByDirection(std::max(fabs(ang_con)/3, PI/180));
+
 		// Computing directional FSC and 3DFSC
-		MultidimArray<double> fsc, threeD_FSC, normalizationMap;
-		threeD_FSC.resizeNoCopy(FT1_vec);
-		threeD_FSC.initZeros();
-		normalizationMap.resizeNoCopy(FT1_vec);
-		normalizationMap.initZeros();
-		
-		
+		// The directions are distributed among the threads, each one with
+		// its own accumulators that are added at the end
 		thrs = 0.143;
-
-    	for (size_t k = 0; k<angles.mdimx; k++)
+		int nthreads = std::max(Nthreads, 1);
+
+		FSODirectionalData data;
+		data.prog = this;
+		data.resInterp = resInterp;
+		data.threeD_FSC.resize(nthreads);
+		data.normalizationMap.resize(nthreads);
+		data.aniParam.resize(nthreads);
+		for (int t = 0; t<nthreads; ++t)
 		{
-			// size_t k = 3;
-			double rot  = MAT_ELEM(angles, 0, k);
-			double tilt = MAT_ELEM(angles, 1, k);
-
-			// Estimating the direction FSC along the diretion given by rot and tilt
-			MetaData mdDirFSC;
-			fscDir_fast(fsc, rot, tilt, mdDirFSC, threeD_FSC, normalizationMap, resol, thrs, resInterp, k);
-
-			std::cout << "Direction " << k << "/" << angles.mdimx << " resolution = " << resInterp << std::endl;
-
+			data.threeD_FSC[t].initZeros(FT1_vec);
+			data.normalizationMap[t].initZeros(FT1_vec);
+			data.aniParam[t].initZeros(aniParam);
+		}
+		data.directionAnisotropy = &directionAnisotropy;
+		data.resDirFSC = &resDirFSC;
 
+		ThreadManager thMgr(nthreads, &data);
+		thMgr.run(fscDirThread);
 
-			dAi(resDirFSC, k) = resInterp;
-			
-			// Updating the FSO curve
-			anistropyParameter(fsc, directionAnisotropy, k, aniParam, thrs);
+		MultidimArray<double> &threeD_FSC = data.threeD_FSC[0];
+		MultidimArray<double> &normalizationMap = data.normalizationMap[0];
+		aniParam = data.aniParam[0];
+		for (int t = 1; t<nthreads; ++t)
+		{
+			threeD_FSC += data.threeD_FSC[t];
+			normalizationMap += data.normalizationMap[t];
+			aniParam += data.aniParam[t];
+			data.threeD_FSC[t].clear();
+			data.normalizationMap[t].clear();
 		}
 
+		for (size_t k = 0; k<angles.mdimx; k++)
+			std::cout << "Direction " << k << "/" << angles.mdimx << " resolution = " << dAi(resDirFSC, k) << std::endl;
+
 		std::cout << "----- Directional resolution estimated -----" <<  std::endl;
     	std::cout << "   " <<  std::endl;
     	std::cout << "Preparing results ..." <<  std::endl;
@@ -30,6 +30,7 @@
 
 #include <core/xmipp_program.h>
 #include <core/xmipp_fftw.h>
+#include <core/xmipp_threads.h>
 #include <core/metadata_extension.h>
 #include <data/monogenic_signal.h>
 
@@ -70,6 +71,11 @@ public:
 
 		//Access indices
 		MultidimArray<long> freqElems, cumpos, freqidx, arr2indx;
+		//Fourier voxels grouped by direction. The voxels of bucket b are stored in
+		//FT1_vec from dirBucketStart(b) to dirBucketStart(b+1)-1. Each row of
+		//dirBuckets stores the bucket center (x,y,z) and its angular radius
+		Matrix2D<double> dirBuckets;
+		MultidimArray<long> dirBucketStart;
 
 
 public:
@@ -243,6 +249,12 @@ public:
 				         MetaData &mdRes, MultidimArray<double> &threeD_FSC, 
 						 MultidimArray<double> &normalizationMap,
 						 double &fscFreq, double &thrs, double &resol, size_t dirnumber);
+		// Sorts the Fourier voxels of FT1_vec (and its companion vectors) by their direction,
+		// grouping them in buckets of about binAngle (radians) on the hemisphere. Thus, the
+		// directional FSC only visits the buckets that may intersect its cone
+		void sortVoxelsByDirection(double binAngle);
+		// Thread function estimating the directional FSC of a subset of directions
+		static void fscDirThread(ThreadArgument &thArg);
 
 };
 
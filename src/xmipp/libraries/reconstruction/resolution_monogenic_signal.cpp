@@ -150,14 +150,12 @@ void ProgMonogenicSignalRes::produceSideInfo()
 		}
 	}
 
-	transformer_inv.setThreadsNumber(nthrs);
 	FourierTransformer transformer;
         transformer.setThreadsNumber(nthrs);
-	VRiesz.resizeNoCopy(inputVol);
 	transformer.FourierTransform(inputVol, fftV);
 
-	// Frequency volume
-	iu = mono.fourierFreqs_3D(fftV, inputVol, freq_fourier_x, freq_fourier_y, freq_fourier_z);
+	// Frequency volume, plans and buffers shared by all the analyzed frequencies
+	bank.initialize(inputVol, nthrs);
 
 	if (freq_step < 0.25)
 		freq_step = 0.25;
@@ -342,7 +340,7 @@ void ProgMonogenicSignalRes::run()
 	produceSideInfo();
 
 	Image<double> outputResolution;
-	outputResolution().resizeNoCopy(VRiesz);
+	outputResolution().resizeNoCopy(bank.getReal());
 
 	MultidimArray<int> &pMask = mask(), &pMaskExcl = maskExcl();
 	MultidimArray<double> &pOutputResolution = outputResolution();
@@ -362,17 +360,17 @@ void ProgMonogenicSignalRes::run()
 
 	//Defining the resolution range:
 	minRes = 2*sampling;
-	DIGFREQ2FFT_IDX((maxRes+3)/sampling, ZSIZE(VRiesz), fourier_idx);
-	FFT_IDX2DIGFREQ(fourier_idx, ZSIZE(VRiesz), freq);
-	FFT_IDX2DIGFREQ(fourier_idx + 2, ZSIZE(VRiesz), freqH);
-	FFT_IDX2DIGFREQ(fourier_idx - 2, ZSIZE(VRiesz), freqL);
+	DIGFREQ2FFT_IDX((maxRes+3)/sampling, ZSIZE(bank.getReal()), fourier_idx);
+	FFT_IDX2DIGFREQ(fourier_idx, ZSIZE(bank.getReal()), freq);
+	FFT_IDX2DIGFREQ(fourier_idx + 2, ZSIZE(bank.getReal()), freqH);
+	FFT_IDX2DIGFREQ(fourier_idx - 2, ZSIZE(bank.getReal()), freqL);
 
 	int count_res = 0;
 	FileName fnDebug;
 
 	//TODO: Set as advanced option
 	if (noiseOnlyInHalves == false)
-		refiningMask(fftV, iu, 2, pMask);
+		refiningMask(fftV, bank.iu, 2, pMask);
 
 
 	amplitudeMS.resizeNoCopy(pOutputResolution);
@@ -431,19 +429,11 @@ void ProgMonogenicSignalRes::run()
 
 //		std::cout << resolution << " " << sampling/freqL << " " << sampling/freq << " " << sampling/freqH << std::endl;
 
-		mono.amplitudeMonoSig3D_LPF(fftV, transformer_inv,
-				fftVRiesz, fftVRiesz_aux, VRiesz,
-				freq, freqH, freqL, iu,
-				freq_fourier_x, freq_fourier_y, freq_fourier_z,
-				amplitudeMS, iter, fnDebug);
+		bank.amplitude(fftV, freq, freqH, freqL, amplitudeMS);
 
 		if (halfMapsGiven){
 			fnDebug = "Noise";
-			mono.amplitudeMonoSig3D_LPF(*fftN, transformer_inv,
-							fftVRiesz, fftVRiesz_aux, VRiesz,
-							freq, freqH, freqL, iu,
-							freq_fourier_x, freq_fourier_y, freq_fourier_z,
-							amplitudeMN, iter, fnDebug);
+			bank.amplitude(*fftN, freq, freqH, freqL, amplitudeMN);
 		}
 
 		double sumS=0, sumS2=0, sumN=0, sumN2=0, NN = 0, NS = 0;
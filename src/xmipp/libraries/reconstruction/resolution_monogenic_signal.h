@@ -93,15 +93,12 @@ public:
 
 private:
     Image<int> mask, maskExcl;
-    MultidimArray<double> iu, VRiesz; // Inverse of the frequency
 	MultidimArray< std::complex<double> > fftV, *fftN; // Fourier transform of the input volume
-	FourierTransformer transformer_inv;
-	MultidimArray< std::complex<double> > fftVRiesz, fftVRiesz_aux;
+	MonogenicBandBank bank; // Inverse of the frequency, plans and buffers of the Riesz transform
 	FourierFilter lowPassFilter, FilterBand;
 	bool halfMapsGiven;
 	Image<double> Vfiltered, VresolutionFiltered;
 	Matrix1D<double> freq_fourier;
-	Matrix1D<double> freq_fourier_x, freq_fourier_y, freq_fourier_z;
 	Matrix2D<double> resolutionMatrix, maskMatrix;
 };
 //@}
@@ -95,11 +95,8 @@ void ProgMonoTomo::produceSideInfo()
 
 	V().setXmippOrigin();
 
-	transformer_inv.setThreadsNumber(nthrs);
-
 	FourierTransformer transformer;
 	MultidimArray<double> &inputVol = V();
-	VRiesz.resizeNoCopy(inputVol);
 
 	#ifdef TEST_FRINGES
 
@@ -129,36 +126,12 @@ void ProgMonoTomo::produceSideInfo()
 
 
 	transformer.FourierTransform(inputVol, fftV);
-	iu.initZeros(fftV);
-
-	// Calculate u and first component of Riesz vector
-	double uz, uy, ux, uz2, u2, uz2y2;
-	long n=0;
-	for(size_t k=0; k<ZSIZE(fftV); ++k)
-	{
-		FFT_IDX2DIGFREQ(k,ZSIZE(inputVol),uz);
-		uz2=uz*uz;
-
-		for(size_t i=0; i<YSIZE(fftV); ++i)
-		{
-			FFT_IDX2DIGFREQ(i,YSIZE(inputVol),uy);
-			uz2y2=uz2+uy*uy;
 
-			for(size_t j=0; j<XSIZE(fftV); ++j)
-			{
-				FFT_IDX2DIGFREQ(j,XSIZE(inputVol),ux);
-				u2=uz2y2+ux*ux;
-				if ((k != 0) || (i != 0) || (j != 0))
-					DIRECT_MULTIDIM_ELEM(iu,n) = 1.0/sqrt(u2);
-				else
-					DIRECT_MULTIDIM_ELEM(iu,n) = 1e38;
-				++n;
-			}
-		}
-	}
+	// Frequency volume, plans and buffers shared by all the analyzed frequencies
+	bank.initialize(inputVol, nthrs);
 	#ifdef DEBUG
 	Image<double> saveiu;
-	saveiu = 1/iu;
+	saveiu = 1/bank.iu;
 	saveiu.write("iu.vol");
 	#endif
 
@@ -223,7 +196,8 @@ void ProgMonoTomo::produceSideInfo()
 	int limit_distance_y = (siz_y-N_smoothing);
 	int limit_distance_z = (siz_z-N_smoothing);
 
-	n=0;
+	double uz, uy, ux;
+	long n=0;
 	for(int k=0; k<ZSIZE(inputVol); ++k)
 	{
 		uz = (k - siz_z);
@@ -258,185 +232,22 @@ void ProgMonoTomo::produceSideInfo()
 	transformer2.FourierTransform(V1(), *fftN);
 
 	V.clear();
-
-	double u;
-
-	freq_fourier_z.initZeros(ZSIZE(fftV));
-	freq_fourier_x.initZeros(XSIZE(fftV));
-	freq_fourier_y.initZeros(YSIZE(fftV));
-
-	VEC_ELEM(freq_fourier_z,0) = 1e-38;
-	for(size_t k=0; k<ZSIZE(fftV); ++k)
-	{
-		FFT_IDX2DIGFREQ(k,ZSIZE(pMask), u);
-		VEC_ELEM(freq_fourier_z,k) = u;
-	}
-
-	VEC_ELEM(freq_fourier_y,0) = 1e-38;
-	for(size_t k=0; k<YSIZE(fftV); ++k)
-	{
-		FFT_IDX2DIGFREQ(k,YSIZE(pMask), u);
-		VEC_ELEM(freq_fourier_y,k) = u;
-	}
-
-	VEC_ELEM(freq_fourier_x,0) = 1e-38;
-	for(size_t k=0; k<XSIZE(fftV); ++k)
-	{
-		FFT_IDX2DIGFREQ(k,XSIZE(pMask), u);
-		VEC_ELEM(freq_fourier_x,k) = u;
-	}
-
 }
 
 
 void ProgMonoTomo::amplitudeMonogenicSignal3D(MultidimArray< std::complex<double> > &myfftV,
 		double freq, double freqH, double freqL, MultidimArray<double> &amplitude, int count, FileName fnDebug)
 {
-	fftVRiesz.initZeros(myfftV);
-	fftVRiesz_aux.initZeros(myfftV);
-	std::complex<double> J(0,1);
-
-	// Filter the input volume and add it to amplitude
-	long n=0;
-	double ideltal=PI/(freq-freqH);
-
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(myfftV)
-	{
-		double iun=DIRECT_MULTIDIM_ELEM(iu,n);
-		double un=1.0/iun;
-		if (freqH<=un && un<=freq)
-		{
-			//double H=0.5*(1+cos((un-w1)*ideltal));
-			DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = DIRECT_MULTIDIM_ELEM(myfftV, n);
-			DIRECT_MULTIDIM_ELEM(fftVRiesz, n) *= 0.5*(1+cos((un-freq)*ideltal));//H;
-			DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) = -J;
-			DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) *= DIRECT_MULTIDIM_ELEM(fftVRiesz, n);
-			DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) *= iun;
-		} else if (un>freq)
-		{
-			DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = DIRECT_MULTIDIM_ELEM(myfftV, n);
-			DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) = -J;
-			DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) *= DIRECT_MULTIDIM_ELEM(fftVRiesz, n);
-			DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) *= iun;
-		}
-	}
-
-	transformer_inv.inverseFourierTransform(fftVRiesz, VRiesz);
-
-	#ifdef DEBUG
-	Image<double> filteredvolume;
-	filteredvolume = VRiesz;
-	filteredvolume.write(formatString("Volumen_filtrado_%i.vol", count));
-
-	FileName iternumber;
-	iternumber = formatString("_Volume_%i.vol", count);
-	Image<double> saveImg2;
-	saveImg2() = VRiesz;
-	  if (fnDebug.c_str() != "")
-	  {
-		saveImg2.write(fnDebug+iternumber);
-	  }
-	saveImg2.clear(); 
-	#endif
-
-	amplitude.resizeNoCopy(VRiesz);
-
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
-		DIRECT_MULTIDIM_ELEM(amplitude,n)=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
-
-	// Calculate first component of Riesz vector
-	double uz, uy, ux;
-	n=0;
-	for(size_t k=0; k<ZSIZE(myfftV); ++k)
-	{
-		for(size_t i=0; i<YSIZE(myfftV); ++i)
-		{
-			for(size_t j=0; j<XSIZE(myfftV); ++j)
-			{
-				ux = VEC_ELEM(freq_fourier_x,j);
-				DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = ux*DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
-				++n;
-			}
-		}
-	}
-	transformer_inv.inverseFourierTransform(fftVRiesz, VRiesz);
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
-		DIRECT_MULTIDIM_ELEM(amplitude,n)+=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
-
-	// Calculate second and third components of Riesz vector
-	n=0;
-	for(size_t k=0; k<ZSIZE(myfftV); ++k)
-	{
-		uz = VEC_ELEM(freq_fourier_z,k);
-		for(size_t i=0; i<YSIZE(myfftV); ++i)
-		{
-			uy = VEC_ELEM(freq_fourier_y,i);
-			for(size_t j=0; j<XSIZE(myfftV); ++j)
-			{
-				DIRECT_MULTIDIM_ELEM(fftVRiesz, n) = uy*DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
-				DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n) = uz*DIRECT_MULTIDIM_ELEM(fftVRiesz_aux, n);
-				++n;
-			}
-		}
-	}
-	transformer_inv.inverseFourierTransform(fftVRiesz, VRiesz);
-
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
-		DIRECT_MULTIDIM_ELEM(amplitude,n)+=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
-
-	transformer_inv.inverseFourierTransform(fftVRiesz_aux, VRiesz);
-
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(amplitude)
-	{
-		DIRECT_MULTIDIM_ELEM(amplitude,n)+=DIRECT_MULTIDIM_ELEM(VRiesz,n)*DIRECT_MULTIDIM_ELEM(VRiesz,n);
-		DIRECT_MULTIDIM_ELEM(amplitude,n)=sqrt(DIRECT_MULTIDIM_ELEM(amplitude,n));
-	}
-	#ifdef DEBUG
-	if (fnDebug.c_str() != "")
-	{
-	Image<double> saveImg;
-	saveImg = amplitude;
-	FileName iternumber;
-	iternumber = formatString("_Amplitude_%i.vol", count);
-	saveImg.write(fnDebug+iternumber);
-	saveImg.clear();
-	}
-	#endif // DEBUG
-//
-	// Low pass filter the monogenic amplitude
-	transformer_inv.FourierTransform(amplitude, fftVRiesz, false);
-	double raised_w = PI/(freqL-freq);
-
-	n=0;
-
-	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(fftVRiesz)
-	{
-		double un=1.0/DIRECT_MULTIDIM_ELEM(iu,n);
-		if ((freqL)>=un && un>=freq)
-		{
-			DIRECT_MULTIDIM_ELEM(fftVRiesz,n) *= 0.5*(1 + cos(raised_w*(un-freq)));
-		}
-		else
-		{
-			if (un>freqL)
-			{
-				DIRECT_MULTIDIM_ELEM(fftVRiesz,n) = 0;
-			}
-		}
-	}
-	transformer_inv.inverseFourierTransform();
-
+	bank.amplitude(myfftV, freq, freqH, freqL, amplitude);
 
 	#ifdef DEBUG
-	Image<double> saveImg2;
-	saveImg2 = amplitude;
-	FileName fnSaveImg2;
 	if (fnDebug.c_str() != "")
 	{
-		iternumber = formatString("_Filtered_Amplitude_%i.vol", count);
+		Image<double> saveImg2;
+		saveImg2 = amplitude;
+		FileName iternumber = formatString("_Filtered_Amplitude_%i.vol", count);
 		saveImg2.write(fnDebug+iternumber);
 	}
-	saveImg2.clear();
 	#endif // DEBUG
 }
 
@@ -679,9 +490,9 @@ void ProgMonoTomo::resolution2eval(int &count_res, double step,
 	double aux_frequency;
 	int fourier_idx;
 
-	DIGFREQ2FFT_IDX(freq, ZSIZE(VRiesz), fourier_idx);
+	DIGFREQ2FFT_IDX(freq, ZSIZE(bank.getReal()), fourier_idx);
 
-	FFT_IDX2DIGFREQ(fourier_idx, ZSIZE(VRiesz), aux_frequency);
+	FFT_IDX2DIGFREQ(fourier_idx, ZSIZE(bank.getReal()), aux_frequency);
 
 	freq = aux_frequency;
 
@@ -708,12 +519,12 @@ void ProgMonoTomo::resolution2eval(int &count_res, double step,
 
 	int fourier_idx_2;
 
-	DIGFREQ2FFT_IDX(freqL, ZSIZE(VRiesz), fourier_idx_2);
+	DIGFREQ2FFT_IDX(freqL, ZSIZE(bank.getReal()), fourier_idx_2);
 
 	if (fourier_idx_2 == fourier_idx)
 	{
 		if (fourier_idx > 0){
-			FFT_IDX2DIGFREQ(fourier_idx - 1, ZSIZE(VRiesz), freqL);
+			FFT_IDX2DIGFREQ(fourier_idx - 1, ZSIZE(bank.getReal()), freqL);
 		}
 		else{
 			freqL = sampling/(resolution + step);
@@ -729,7 +540,7 @@ void ProgMonoTomo::run()
 
 	Image<double> outputResolution;
 
-	outputResolution().resizeNoCopy(VRiesz);
+	outputResolution().resizeNoCopy(bank.getReal());
 	outputResolution().initConstant(maxRes);
 
 	MultidimArray<int> &pMask = mask();
@@ -38,6 +38,7 @@
 #include <complex>
 #include <data/fourier_filter.h>
 #include <data/filters.h>
+#include <data/monogenic_signal.h>
 #include <string>
 
 
@@ -105,14 +106,11 @@ public:
 
 public:
     Image<int> mask;
-    MultidimArray<double> iu, VRiesz; // Inverse of the frequency
 	MultidimArray< std::complex<double> > fftV, *fftN; // Fourier transform of the input volume
-	FourierTransformer transformer_inv;
-	MultidimArray< std::complex<double> > fftVRiesz, fftVRiesz_aux;
+	MonogenicBandBank bank; // Inverse of the frequency, plans and buffers of the Riesz transform
 	FourierFilter lowPassFilter, FilterBand;
 	bool halfMapsGiven;
 	Image<double> Vfiltered, VresolutionFiltered;
-	Matrix1D<double> freq_fourier_z, freq_fourier_y, freq_fourier_x;
 	Matrix2D<double> resolutionMatrix, maskMatrix;
 };
 //@}
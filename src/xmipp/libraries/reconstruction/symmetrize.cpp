@@ -26,6 +26,8 @@
 #include "symmetrize.h"
 
 #include <core/args.h>
+#include <core/xmipp_fftw.h>
+#include <core/xmipp_threads.h>
 #include <data/symmetries.h>
 
 /* Read parameters --------------------------------------------------------- */
@@ -54,6 +56,7 @@ void ProgSymmetrize::readParams()
     sum = checkParam("--sum");
     heightFraction = getDoubleParam("--heightFraction");
     splineOrder = getIntParam("--spline");
+    fourierPadding = checkParam("--fourier") ? getDoubleParam("--fourier") : 0;
 }
 
 /* Usage ------------------------------------------------------------------- */
@@ -61,6 +64,7 @@ void ProgSymmetrize::defineParams()
 {
     addUsageLine("Symmetrize volumes and images ");
     each_image_produces_an_output=true;
+    allow_threads=true;
     XmippMetadataProgram::defineParams();
     addParamsLine("    --sym <symmetry>     : For 2D images: a number");
     addParamsLine("                         : For 3D volumes: a symmetry file or point-group description");
@@ -79,10 +83,15 @@ void ProgSymmetrize::defineParams()
     addParamsLine("   [--sum]               : compute the sum of the images/volumes instead of the average. This is useful for symmetrizing pieces");
     addParamsLine("   [--mask_in <fileName>]: symmetrize only in the masked area");
     addParamsLine("   [--spline <order=3>]  : Spline order for the interpolation (valid values are 1 and 3)");
+    addParamsLine("   [--fourier <pad=2>]   : For 3D volumes: symmetrize in Fourier space with this padding factor.");
+    addParamsLine("                         : It is much faster for large groups, the volume is wrapped and");
+    addParamsLine("                         : the result is limited to the Nyquist frequency");
     addExampleLine("Symmetrize a list of images with 6 fold symmetry",false);
     addExampleLine("   xmipp_transform_symmetrize -i input.sel --sym 6");
     addExampleLine("Symmetrize with i3 symmetry and the volume is not wrapped",false);
     addExampleLine("   xmipp_transform_symmetrize -i input.vol --sym i3 --dont_wrap");
+    addExampleLine("Symmetrize a large volume with i1 symmetry in Fourier space with 4 threads",false);
+    addExampleLine("   xmipp_transform_symmetrize -i input.vol --sym i1 --fourier --thr 4");
 }
 
 /* Show ------------------------------------------------------------------- */
@@ -97,6 +106,8 @@ void ProgSymmetrize::show()
     << "Wrap:     " << wrap << std::endl
     << "Sum:      " << sum << std::endl
 	<< "Spline:   " << splineOrder << std::endl;
+    if (fourierPadding>0)
+        std::cout << "Fourier padding: " << fourierPadding << std::endl;
     if (doMask)
         std::cout << "mask_in    " << fn_Maskin << std::endl;
     if (helical)
@@ -106,12 +117,130 @@ void ProgSymmetrize::show()
 		<< "Height fraction: " << heightFraction << std::endl;
 }
 
+/* Symmetrize inside a mask ---------------------------------------------- */
+/* Data shared by the threads of the symmetrization inside a mask */
+struct SymmetrizeInMaskData
+{
+    const MultidimArray<double> *V_in;
+    const MultidimArray<double> *Bcoeffs;
+    MultidimArray<double> *V_out;
+    // Transformation from output to input coordinates of each operator
+    std::vector< Matrix2D<double> > A;
+    // Direct indexes of the voxels inside the mask
+    std::vector<size_t> voxels;
+    int spline;
+    bool wrap;
+    double outside;
+    ThreadTaskDistributor *distributor;
+};
+
+/* Each thread adds the symmetric values of the voxels given by the
+ * distributor. The coordinates and interpolation are those of applyGeometry.
+ */
+static void symmetrizeInMaskThread(ThreadArgument &thArg)
+{
+    SymmetrizeInMaskData *data=(SymmetrizeInMaskData *) thArg.workClass;
+    const MultidimArray<double> &V_in=*data->V_in;
+    MultidimArray<double> &V_out=*data->V_out;
+    double cen_z = (int)(V_in.zdim / 2);
+    double cen_y = (int)(V_in.ydim / 2);
+    double cen_x = (int)(V_in.xdim / 2);
+    double minxp = -cen_x, maxxp = V_in.xdim - cen_x - 1;
+    double minyp = -cen_y, maxyp = V_in.ydim - cen_y - 1;
+    double minzp = -cen_z, maxzp = V_in.zdim - cen_z - 1;
+
+    size_t first, last;
+    while (data->distributor->getTasks(first, last))
+        for (size_t n=first; n<=last; ++n)
+        {
+            size_t idx=data->voxels[n];
+            double z=(double)(idx / V_in.yxdim) - cen_z;
+            double y=(double)((idx % V_in.yxdim) / V_in.xdim) - cen_y;
+            double x=(double)(idx % V_in.xdim) - cen_x;
+            double value=DIRECT_MULTIDIM_ELEM(V_out, idx);
+            for (size_t s=0; s<data->A.size(); ++s)
+            {
+                const Matrix2D<double> &A=data->A[s];
+                double xp = x * MAT_ELEM(A, 0, 0) + y * MAT_ELEM(A, 0, 1) + z * MAT_ELEM(A, 0, 2) + MAT_ELEM(A, 0, 3);
+                double yp = x * MAT_ELEM(A, 1, 0) + y * MAT_ELEM(A, 1, 1) + z * MAT_ELEM(A, 1, 2) + MAT_ELEM(A, 1, 3);
+                double zp = x * MAT_ELEM(A, 2, 0) + y * MAT_ELEM(A, 2, 1) + z * MAT_ELEM(A, 2, 2) + MAT_ELEM(A, 2, 3);
+                bool x_isOut = XMIPP_RANGE_OUTSIDE(xp, minxp, maxxp);
+                bool y_isOut = XMIPP_RANGE_OUTSIDE(yp, minyp, maxyp);
+                bool z_isOut = XMIPP_RANGE_OUTSIDE(zp, minzp, maxzp);
+                if (data->wrap)
+                {
+                    if (x_isOut)
+                        xp = realWRAP(xp, minxp - 0.5, maxxp + 0.5);
+                    if (y_isOut)
+                        yp = realWRAP(yp, minyp - 0.5, maxyp + 0.5);
+                    if (z_isOut)
+                        zp = realWRAP(zp, minzp - 0.5, maxzp + 0.5);
+                }
+                else if (x_isOut || y_isOut || z_isOut)
+                {
+                    value += data->outside;
+                    continue;
+                }
+
+                if (data->spline == 0)
+                    value += A3D_ELEM(V_in, (int)trunc(zp), (int)trunc(yp), (int)trunc(xp));
+                else if (data->spline == 1)
+                    value += V_in.interpolatedElement3D(xp, yp, zp);
+                else if (data->spline == 3)
+                    value += data->Bcoeffs->interpolatedElementBSpline3D_Degree3(xp, yp, zp);
+                else
+                    value += data->Bcoeffs->interpolatedElementBSpline3D(xp, yp, zp, data->spline);
+            }
+            DIRECT_MULTIDIM_ELEM(V_out, idx)=value;
+        }
+}
+
+/* Adds to V_out the symmetric values of the voxels inside the mask, the
+ * voxels outside it get the value of V_in once per operator. Only the voxels
+ * inside the mask are resampled.
+ */
+static void symmetrizeVolumeInMask(const SymList &SL, const MultidimArray<double> &V_in,
+                                   MultidimArray<double> &V_out, int spline, bool wrap, double avg,
+                                   const MultidimArray<double> *Bcoeffs,
+                                   const MultidimArray<double> &mask, int nThreads)
+{
+    if (!V_in.sameShape(mask) || !V_in.sameShape(V_out))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "symmetrizeVolume: the mask and the volume have different shapes");
+    SymmetrizeInMaskData data;
+    data.V_in=&V_in;
+    data.Bcoeffs=Bcoeffs;
+    data.V_out=&V_out;
+    data.spline=spline;
+    data.wrap=wrap;
+    data.outside=avg;
+    Matrix2D<double> L(4, 4), R(4, 4);
+    for (int i = 0; i < SL.symsNo(); i++)
+    {
+        SL.getMatrices(i, L, R);
+        // Same inverse as applyGeometry with IS_NOT_INV
+        data.A.push_back(R.transpose().inv());
+    }
+    double nsym=SL.symsNo();
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V_in)
+    if (DIRECT_MULTIDIM_ELEM(mask, n)!=0)
+        data.voxels.push_back(n);
+    else
+        DIRECT_MULTIDIM_ELEM(V_out, n)+=nsym*DIRECT_MULTIDIM_ELEM(V_in, n);
+    if (data.voxels.empty())
+        return;
+
+    ThreadTaskDistributor distributor(data.voxels.size(), XMIPP_MAX(data.voxels.size()/(50*nThreads), (size_t)1));
+    data.distributor=&distributor;
+    ThreadManager thMgr(nThreads, &data);
+    thMgr.run(symmetrizeInMaskThread);
+}
+
 /* Symmetrize ------------------------------------------------------- */
 void symmetrizeVolume(const SymList &SL, const MultidimArray<double> &V_in,
                       MultidimArray<double> &V_out, int spline,
                       bool wrap, bool do_outside_avg, bool sum, bool helical, bool dihedral, bool helicalDihedral,
                       double rotHelical, double rotPhaseHelical, double zHelical, double heightFraction,
-                      const MultidimArray<double> * mask)
+                      const MultidimArray<double> * mask, int nThreads)
 {
     Matrix2D<double> L(4, 4), R(4, 4); // A matrix from the list
     MultidimArray<double> V_aux;
@@ -135,27 +264,26 @@ void symmetrizeVolume(const SymList &SL, const MultidimArray<double> &V_in,
     {
     	MultidimArray<double> Bcoeffs;
     	MultidimArray<double> *BcoeffsPtr=NULL;
-    	if (spline==3)
+    	if (spline>1)
     	{
-    		produceSplineCoefficients(BSPLINE3, Bcoeffs, V_in);
+    		produceSplineCoefficients(spline, Bcoeffs, V_in);
     		BcoeffsPtr=&Bcoeffs;
     	}
-        for (int i = 0; i < SL.symsNo(); i++)
-        {
-            SL.getMatrices(i, L, R);
-            /*FIXME: I do not think this make sense since V_aux is empty. ROB
-               SL.getShift(i, sh);
-               R(3, 0) = sh(0) * XSIZE(V_aux);
-               R(3, 1) = sh(1) * YSIZE(V_aux);
-               R(3, 2) = sh(2) * ZSIZE(V_aux);
-            */
-            applyGeometry(spline, V_aux, V_in, R.transpose(), IS_NOT_INV, wrap, avg, BcoeffsPtr);
-
-            if ( mask==NULL)
+        if (mask!=NULL)
+            symmetrizeVolumeInMask(SL, V_in, V_out, spline, wrap, avg, BcoeffsPtr, *mask, nThreads);
+        else
+            for (int i = 0; i < SL.symsNo(); i++)
+            {
+                SL.getMatrices(i, L, R);
+                /*FIXME: I do not think this make sense since V_aux is empty. ROB
+                   SL.getShift(i, sh);
+                   R(3, 0) = sh(0) * XSIZE(V_aux);
+                   R(3, 1) = sh(1) * YSIZE(V_aux);
+                   R(3, 2) = sh(2) * ZSIZE(V_aux);
+                */
+                applyGeometry(spline, V_aux, V_in, R.transpose(), IS_NOT_INV, wrap, avg, BcoeffsPtr, nThreads);
                 arrayByArray(V_out, V_aux, V_out, '+');
-            else               // op1, op2 ,  result
-                selfArrayByArrayMask(V_in, V_aux, V_out, '+', mask);
-        }
+            }
 
         if (!sum)
             arrayByScalar(V_out, 1.0/(SL.symsNo() + 1.0f), V_out, '*');
@@ -177,6 +305,189 @@ void symmetrizeVolume(const SymList &SL, const MultidimArray<double> &V_in,
     }
 }
 
+/* Symmetrize in Fourier space ------------------------------------------- */
+/* Data shared by the threads of the symmetrization in Fourier space */
+struct SymmetrizeFourierData
+{
+    const MultidimArray< std::complex<double> > *Fin;
+    // Spectrum without gridding correction, for the operators that map the
+    // frequency grid onto itself
+    const MultidimArray< std::complex<double> > *Fexact;
+    MultidimArray< std::complex<double> > *Fout;
+    // Rotation of the frequencies of each operator
+    std::vector< Matrix2D<double> > R;
+    // Whether each operator maps the frequency grid onto itself
+    std::vector<bool> onGrid;
+    // Size of the padded volume
+    int Npad;
+    // Largest frequency (in samples) that is symmetrized
+    int maxFreq;
+    ThreadTaskDistributor *distributor;
+};
+
+/* Coefficient of the half spectrum at the frequency (x,y,z), in samples,
+ * with linear interpolation. The negative frequencies in x are taken from
+ * the Hermitian symmetric. The frequency must be within the maximum one. */
+static inline std::complex<double> interpolateHalfSpectrum(const MultidimArray< std::complex<double> > &F,
+        int Npad, double x, double y, double z)
+{
+    bool conjugate=x<0;
+    if (conjugate)
+    {
+        x=-x;
+        y=-y;
+        z=-z;
+    }
+    int x0=FLOOR(x), y0=FLOOR(y), z0=FLOOR(z);
+    double fx=x-x0, fy=y-y0, fz=z-z0;
+    int j0=x0, j1=x0+1;
+    int i0=y0<0 ? y0+Npad : y0, i1=y0+1<0 ? y0+1+Npad : y0+1;
+    int k0=z0<0 ? z0+Npad : z0, k1=z0+1<0 ? z0+1+Npad : z0+1;
+    std::complex<double> dx00=LIN_INTERP(fx, DIRECT_A3D_ELEM(F, k0, i0, j0), DIRECT_A3D_ELEM(F, k0, i0, j1));
+    std::complex<double> dx01=LIN_INTERP(fx, DIRECT_A3D_ELEM(F, k1, i0, j0), DIRECT_A3D_ELEM(F, k1, i0, j1));
+    std::complex<double> dx10=LIN_INTERP(fx, DIRECT_A3D_ELEM(F, k0, i1, j0), DIRECT_A3D_ELEM(F, k0, i1, j1));
+    std::complex<double> dx11=LIN_INTERP(fx, DIRECT_A3D_ELEM(F, k1, i1, j0), DIRECT_A3D_ELEM(F, k1, i1, j1));
+    std::complex<double> dxy0=LIN_INTERP(fy, dx00, dx10);
+    std::complex<double> dxy1=LIN_INTERP(fy, dx01, dx11);
+    std::complex<double> value=LIN_INTERP(fz, dxy0, dxy1);
+    return conjugate ? std::conj(value) : value;
+}
+
+/* Each thread computes the slices of the symmetrized spectrum given by the
+ * distributor. All the operators of a frequency are accumulated together, so
+ * that the threads do not share any output coefficient. */
+static void symmetrizeFourierThread(ThreadArgument &thArg)
+{
+    SymmetrizeFourierData *data=(SymmetrizeFourierData *) thArg.workClass;
+    const MultidimArray< std::complex<double> > &Fin=*data->Fin;
+    MultidimArray< std::complex<double> > &Fout=*data->Fout;
+    int Npad=data->Npad;
+    double maxFreq2=(double)data->maxFreq*data->maxFreq;
+    size_t nsym=data->R.size();
+
+    size_t first, last;
+    while (data->distributor->getTasks(first, last))
+        for (size_t k=first; k<=last; ++k)
+        {
+            int z=(int)k<=Npad/2 ? (int)k : (int)k-Npad;
+            for (size_t i=0; i<YSIZE(Fout); ++i)
+            {
+                int y=(int)i<=Npad/2 ? (int)i : (int)i-Npad;
+                for (size_t j=0; j<XSIZE(Fout); ++j)
+                {
+                    int x=(int)j;
+                    std::complex<double> &value=DIRECT_A3D_ELEM(Fout, k, i, j);
+                    value=0.;
+                    if (x*x+y*y+z*z>maxFreq2)
+                        continue;
+                    for (size_t s=0; s<nsym; ++s)
+                    {
+                        const Matrix2D<double> &R=data->R[s];
+                        double xp = x * MAT_ELEM(R, 0, 0) + y * MAT_ELEM(R, 0, 1) + z * MAT_ELEM(R, 0, 2);
+                        double yp = x * MAT_ELEM(R, 1, 0) + y * MAT_ELEM(R, 1, 1) + z * MAT_ELEM(R, 1, 2);
+                        double zp = x * MAT_ELEM(R, 2, 0) + y * MAT_ELEM(R, 2, 1) + z * MAT_ELEM(R, 2, 2);
+                        if (xp*xp+yp*yp+zp*zp<=maxFreq2)
+                            value+=interpolateHalfSpectrum(data->onGrid[s] ? *data->Fexact : Fin,
+                                                           Npad, xp, yp, zp);
+                    }
+                }
+            }
+        }
+}
+
+void symmetrizeVolumeFourier(const SymList &SL, const MultidimArray<double> &V_in,
+                             MultidimArray<double> &V_out, double padding, bool sum,
+                             const MultidimArray<double> * mask, int nThreads)
+{
+    if (padding<1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "symmetrizeVolumeFourier: the padding factor must be at least 1");
+    if (mask!=NULL && !V_in.sameShape(*mask))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "symmetrizeVolumeFourier: the mask and the volume have different shapes");
+
+    // Zero padding to a cube, with the origin of the volume at the first sample
+    int Npad=(int)(padding*XMIPP_MAX(XMIPP_MAX(XSIZE(V_in), YSIZE(V_in)), ZSIZE(V_in)));
+    MultidimArray<double> Vpadded;
+    V_in.window(Vpadded, FIRST_XMIPP_INDEX(Npad), FIRST_XMIPP_INDEX(Npad), FIRST_XMIPP_INDEX(Npad),
+                LAST_XMIPP_INDEX(Npad), LAST_XMIPP_INDEX(Npad), LAST_XMIPP_INDEX(Npad));
+    CenterFFT(Vpadded, true);
+
+    // Rotation of the frequencies of the operators. A real space rotation
+    // V(r)=V_in(R r) is the same rotation of the frequencies. The identity
+    // is added later in real space, as it does not need any interpolation.
+    SymmetrizeFourierData data;
+    Matrix2D<double> L(4, 4), R(4, 4);
+    bool interpolated=false, exact=false;
+    for (int i = 0; i < SL.symsNo(); i++)
+    {
+        SL.getMatrices(i, L, R);
+        data.R.push_back(R.transpose().inv());
+        bool onGrid=true;
+        const Matrix2D<double> &Rf=data.R.back();
+        for (int r=0; r<3; ++r)
+            for (int c=0; c<3; ++c)
+                if (fabs(MAT_ELEM(Rf, r, c)-ROUND(MAT_ELEM(Rf, r, c)))>1e-6)
+                    onGrid=false;
+        data.onGrid.push_back(onGrid);
+        interpolated|=!onGrid;
+        exact|=onGrid;
+    }
+
+    FourierTransformer transformer;
+    transformer.setThreadsNumber(nThreads);
+    MultidimArray< std::complex<double> > Fin, Fexact;
+    if (exact || !interpolated)
+    {
+        transformer.setReal(Vpadded);
+        transformer.FourierTransform();
+        Fexact=transformer.fFourier;
+    }
+    if (interpolated)
+    {
+        // Gridding correction: the linear interpolation of the spectrum multiplies
+        // the volume by sinc^2 along every axis, which is compensated in advance.
+        // The volume is centered at its first sample after CenterFFT.
+        std::vector<double> correction(Npad);
+        for (int i=0; i<Npad; ++i)
+        {
+            double t=PI*(i<=Npad/2 ? i : i-Npad)/Npad;
+            correction[i]=(t==0) ? 1 : (t*t)/(sin(t)*sin(t));
+        }
+        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Vpadded)
+        DIRECT_A3D_ELEM(Vpadded,k,i,j)*=correction[k]*correction[i]*correction[j];
+        transformer.setReal(Vpadded);
+        transformer.FourierTransform();
+        Fin=transformer.fFourier;
+    }
+
+    // Rotate and accumulate the spectrum
+    data.Fin=interpolated ? &Fin : &Fexact;
+    data.Fexact=&Fexact;
+    data.Fout=&transformer.fFourier;
+    data.Npad=Npad;
+    data.maxFreq=Npad/2-1;
+    ThreadTaskDistributor distributor(ZSIZE(transformer.fFourier), 1);
+    data.distributor=&distributor;
+    ThreadManager thMgr(XMIPP_MIN(nThreads, (int)ZSIZE(transformer.fFourier)), &data);
+    thMgr.run(symmetrizeFourierThread);
+    Fin.clear();
+    Fexact.clear();
+
+    transformer.inverseFourierTransform();
+    CenterFFT(Vpadded, false);
+    Vpadded.window(V_out, STARTINGZ(V_in), STARTINGY(V_in), STARTINGX(V_in),
+                   FINISHINGZ(V_in), FINISHINGY(V_in), FINISHINGX(V_in));
+    V_out+=V_in;
+
+    // The voxels outside the mask are not symmetrized
+    double nsym=SL.symsNo()+1.0;
+    if (mask!=NULL)
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(V_out)
+        if (DIRECT_MULTIDIM_ELEM(*mask, n)==0)
+            DIRECT_MULTIDIM_ELEM(V_out, n)=nsym*DIRECT_MULTIDIM_ELEM(V_in, n);
+    if (!sum)
+        V_out*=1.0/nsym;
+}
+
 void symmetrizeImage(int symorder, const MultidimArray<double> &I_in,
                      MultidimArray<double> &I_out, int spline,
                      bool wrap, bool do_outside_avg, bool sum,
@@ -253,8 +564,13 @@ void ProgSymmetrize::processImage(const FileName &fnImg, const FileName &fnImgOu
     {
         if (SL.symsNo()>0 || helical || dihedral || helicalDihedral)
         {
-            symmetrizeVolume(SL,Iin(),Iout(),splineOrder,wrap,!wrap,
-                             sum,helical,dihedral,helicalDihedral,rotHelical,rotPhaseHelical,zHelical,heightFraction,mmask);
+            int threads=single_image ? nThreads : 1;
+            if (fourierPadding>0 && !helical && !dihedral && !helicalDihedral)
+                symmetrizeVolumeFourier(SL,Iin(),Iout(),fourierPadding,sum,mmask,threads);
+            else
+                symmetrizeVolume(SL,Iin(),Iout(),splineOrder,wrap,!wrap,
+                                 sum,helical,dihedral,helicalDihedral,rotHelical,rotPhaseHelical,zHelical,heightFraction,
+                                 mmask,threads);
         }
         else
             REPORT_ERROR(ERR_ARG_MISSING,"The symmetry description is not valid for volumes");
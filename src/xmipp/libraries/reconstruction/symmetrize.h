@@ -65,6 +65,8 @@ public:
     bool            sum;
     /// Spline order
     int splineOrder;
+    /// Padding factor of the symmetrization in Fourier space (0 for real space)
+    double fourierPadding;
 public:
     /** Read parameters from command line. */
     void readParams();
@@ -93,13 +95,30 @@ public:
     bool helicalDihedral;
 };
 
-/** Symmetrize volume.*/
+/** Symmetrize volume.
+    If there is a mask, the voxels outside the mask are not symmetrized and only
+    the voxels inside it are resampled. The point group symmetrizations are
+    computed with nThreads threads. */
 void symmetrizeVolume(const SymList &SL, const MultidimArray<double> &V_in,
                       MultidimArray<double> &V_out, int spline=BSPLINE3,
                       bool wrap=true, bool do_outside_avg=false, bool sum=false, bool helical=false, bool dihedral=false,
                       bool helicalDihedral=false,
                       double rotHelical=0.0, double rotPhaseHelical=0.0, double zHelical=0.0, double heightFraction=0.95,
-                      const MultidimArray<double> * mask=NULL);
+                      const MultidimArray<double> * mask=NULL, int nThreads=1);
+
+/** Symmetrize volume in Fourier space.
+    The volume is padded by the padding factor and Fourier transformed once,
+    the rotated spectra of all the symmetry operators are accumulated with
+    linear interpolation (with a gridding correction for the operators that
+    do not map the frequency grid onto itself) and the result is transformed
+    back. The identity is added in real space. This is much
+    faster than symmetrizeVolume for large groups (I, O), but the volume is
+    wrapped and the result is limited to the Nyquist frequency. V_in must
+    have its origin at the center. The voxels outside the mask, if given, are
+    not symmetrized. */
+void symmetrizeVolumeFourier(const SymList &SL, const MultidimArray<double> &V_in,
+                             MultidimArray<double> &V_out, double padding=2, bool sum=false,
+                             const MultidimArray<double> * mask=NULL, int nThreads=1);
 
 /** Symmetrize image.*/
 void symmetrizeImage(int symorder, const MultidimArray<double> &I_in,
@@ -66,7 +66,6 @@ void ProgLocSharpening::produceSideInfo()
         if (Nthread>1)
         {
            std::cout << "used procesors = " << Nthread << std::endl;
-           transformer_inv.setThreadsNumber(Nthread);
            transformer.setThreadsNumber(Nthread);
         }
 
@@ -75,31 +74,8 @@ void ProgLocSharpening::produceSideInfo()
 
         transformer.FourierTransform(inputVol, fftV);
 
-        iu.initZeros(fftV);
-        double uz, uy, ux, uz2, u2, uz2y2;
-        long n=0;
-        for(size_t k=0; k<ZSIZE(fftV); ++k)
-        {
-                FFT_IDX2DIGFREQ(k,ZSIZE(inputVol),uz);
-                uz2=uz*uz;
-
-                for(size_t i=0; i<YSIZE(fftV); ++i)
-                {
-                        FFT_IDX2DIGFREQ(i,YSIZE(inputVol),uy);
-                        uz2y2=uz2+uy*uy;
-
-                        for(size_t j=0; j<XSIZE(fftV); ++j)
-                        {
-                                FFT_IDX2DIGFREQ(j,XSIZE(inputVol),ux);
-                                u2=uz2y2+ux*ux;
-                                if ((k != 0) || (i != 0) || (j != 0))
-                                        DIRECT_MULTIDIM_ELEM(iu,n) = sqrt(u2);
-                                else
-                                        DIRECT_MULTIDIM_ELEM(iu,n) = 1e-38;
-                                ++n;
-                        }
-                }
-        }
+        // Frequency map, plans and buffer shared by all the filtered bands
+        bank.initialize(inputVol, Nthread);
 
         inputVol.clear();
 
@@ -181,33 +157,7 @@ void ProgLocSharpening::computeAvgStdev_within_binary_mask(const MultidimArray<
 void ProgLocSharpening::bandPassFilterFunction(const MultidimArray< std::complex<double> > &myfftV,
                 double w, double wL, MultidimArray<double> &filteredVol, int count)
 {
-        fftVfilter.initZeros(myfftV);
-        size_t xdim, ydim, zdim, ndim;
-        Vorig.getDimensions(xdim, ydim, zdim, ndim);
-
-
-        double delta = wL-w;
-        double w_inf = w-delta;
-        // Filter the input volume and add it to amplitude
-        long n=0;
-        double ideltal=PI/(delta);
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(myfftV)
-        {
-                double un=DIRECT_MULTIDIM_ELEM(iu,n);
-                if (un>=w && un<=wL)
-                {
-                        DIRECT_MULTIDIM_ELEM(fftVfilter, n) = DIRECT_MULTIDIM_ELEM(myfftV, n);
-                        DIRECT_MULTIDIM_ELEM(fftVfilter, n) *= 0.5*(1+cos((un-w)*ideltal));//H;
-                } else if (un<=w && un>=w_inf)
-                {
-                        DIRECT_MULTIDIM_ELEM(fftVfilter, n) = DIRECT_MULTIDIM_ELEM(myfftV, n);
-                        DIRECT_MULTIDIM_ELEM(fftVfilter, n) *= 0.5*(1+cos((un-w)*ideltal));//H;
-                }
-        }
-
-        filteredVol.resizeNoCopy(Vorig);
-
-        transformer_inv.inverseFourierTransform(fftVfilter, filteredVol);
+        bank.bandPass(myfftV, w, wL, filteredVol);
 
 //        #ifdef DEBUG_FILTER
 //        Image<double> filteredvolume;
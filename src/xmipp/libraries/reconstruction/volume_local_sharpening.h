@@ -39,6 +39,7 @@
 #include <complex>
 #include <data/fourier_filter.h>
 #include <data/filters.h>
+#include <data/monogenic_signal.h>
 #include <string>
 #include "symmetrize.h"
 
@@ -96,9 +97,10 @@ public:
     MultidimArray<double> Vorig;//, VsoftMask;
     MultidimArray<int> mask;
     MultidimArray<double> resVol;
-    MultidimArray<double> iu, sharpenedMap; // Inverse of the frequency
-	MultidimArray< std::complex<double> > fftV, fftVfilter; // Fourier transform of the input volume
-	FourierTransformer transformer, transformer_inv;
+    MultidimArray<double> sharpenedMap;
+	MultidimArray< std::complex<double> > fftV; // Fourier transform of the input volume
+	FourierTransformer transformer;
+	MonogenicBandBank bank; // Frequency map, plans and buffer of the band pass filters
 	FourierFilter FilterBand;
 };
 //@}
@@ -375,6 +375,36 @@ class TestXmippPythonInterface(unittest.TestCase):
                       [ 0.90717429, 0.6812411, -0.09380955]])
         self.assertEqual(Z.all(), Zref.all())
 
+    def test_Image_getDataView(self):
+        img1 = Image(testFile("singleImage.spi"))
+        Z = img1.getData(copy=False)
+        self.assertTrue((Z == img1.getData()).all())
+        # The view shares the image data and keeps the image alive
+        Z[0, 0] = 5.
+        self.assertAlmostEqual(img1.getPixel(0, 0, 0, 0), 5.)
+        del img1
+        self.assertAlmostEqual(Z[0, 0], 5.)
+
+    def test_Image_getDataViewRealloc(self):
+        img1 = Image(testFile("singleImage.spi"))
+        img1.convert2DataType(DT_FLOAT)
+        img2 = Image(testFile("singleImage.spi"))
+        Z = img1.getData(copy=False)
+        # Functions that reallocate the viewed data are rejected
+        self.assertRaises(XmippError, img1.correlation, img2)
+        self.assertRaises(XmippError, img2.correlation, img1)
+        vol = Image(testFile('progVol.vol'))
+        vol.convert2DataType(DT_DOUBLE)
+        fp = FourierProjector(vol, 2, 0.5, 2)
+        proj = Image()
+        proj.setDataType(DT_DOUBLE)
+        proj.resize(3, 3)
+        P = proj.getData(copy=False)
+        self.assertRaises(XmippError, fp.projectVolume, proj, 0, 0, 0)
+        del Z, P
+        img1.correlation(img2)
+        fp.projectVolume(proj, 0, 0, 0)
+
     def test_Image_initConstant(self):
         imgPath = testFile("tinyImage.spi")
         img = Image(imgPath)
@@ -926,6 +956,20 @@ _rlnDefocusU #2
         self.assertEqual(equalBool, True)
         os.remove(rowFileName)
 
+    def test_Metadata_columnArray(self):
+        from numpy import array
+        md = MetaData()
+        md.setColumnArray(MDL_CTF_DEFOCUSU, array([-100., 200., -300.]))
+        md.setColumnArray(MDL_COUNT, [10, 20, 30])
+        md.setColumnArray(MDL_REF3D, array([-1, 2, -3]))
+        self.assertEqual(md.size(), 3)
+        self.assertEqual(md.getColumnValues(MDL_CTF_DEFOCUSU), [-100., 200., -300.])
+        self.assertEqual(md.getColumnArray(MDL_COUNT).tolist(), [10, 20, 30])
+        self.assertEqual(md.getColumnArray(MDL_REF3D).tolist(), [-1, 2, -3])
+        self.assertEqual(md.getColumnArray(MDL_CTF_DEFOCUSU).dtype.name, 'float64')
+        self.assertRaises(XmippError, md.setColumnArray, MDL_COUNT, [1, 2])
+        self.assertRaises(XmippError, md.getColumnArray, MDL_IMAGE)
+
     def test_Metadata_setValue(self):
         '''MetaData_setValues'''
         '''This test should produce the following metadata, which is the same of 'test.xmd'
@@ -400,6 +400,24 @@ class ImageConvert(XmippProgramTest):
     def test_case4(self):
         self.runCase("-i input/singleImage.spi -o %o/singleImage.img",
                 outputs=["singleImage.img"])
+    def test_case5(self):
+        # Counting-mode movie written as packed 4-bit MRC (mode 101)
+        self.runCase("-i input/smallStack.stk -o %o/smallStack4bit.mrcs -t stk --depth uint4",
+                validate=self.validate_case5)
+
+    def validate_case5(self):
+        import struct
+        from xmippLib import Image
+        fn = os.path.join(self.outputDir, "smallStack4bit.mrcs")
+        f = open(fn, 'rb')
+        xdim, ydim, ndim, mode = struct.unpack('<4i', f.read(16))
+        f.close()
+        self.assertEqual(mode, 101)
+        self.assertEqual(os.path.getsize(fn), 1024 + ndim * ((xdim + 1) / 2) * ydim)
+        img = Image("%d@%s" % (ndim, fn))
+        data = img.getData()
+        self.assertTrue(data.min() >= 0 and data.max() <= 15)
+        self.assertTrue(data.max() > data.min())
 
 
 class ImageFindCenter(XmippProgramTest):
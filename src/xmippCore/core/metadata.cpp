@@ -27,7 +27,9 @@
 #include <regex.h>
 #include <algorithm>
 #include <malloc.h>
+#include <thread>
 #include "metadata.h"
+#include "xmipp_threads.h"
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
 
@@ -260,6 +262,34 @@ void MetaData::setColumnValues(const std::vector<MDObject> &valuesIn)
     }
 }
 
+/* Check that a label can be accessed with getColumnArray and setColumnArray */
+static void checkNumericLabel(const MDLabel label, const char *function)
+{
+    if (!MDL::isBool(label) && !MDL::isInt(label) && !MDL::isLong(label) && !MDL::isDouble(label))
+        REPORT_ERROR(ERR_MD_BADTYPE, formatString("%s: label %s is not numeric",
+                     function, MDL::label2Str(label).c_str()));
+}
+
+void MetaData::getColumnArray(const MDLabel label, std::vector<double> &valuesOut) const
+{
+    checkNumericLabel(label, "getColumnArray");
+    if (!containsLabel(label))
+        REPORT_ERROR(ERR_MD_MISSINGLABEL, (String)"getColumnArray: cannot find label: " + MDL::label2Str(label));
+    myMDSql->getColumnValues(label, valuesOut);
+}
+
+void MetaData::setColumnArray(const MDLabel label, const std::vector<double> &valuesIn)
+{
+    checkNumericLabel(label, "setColumnArray");
+    if (size() == 0)
+        for (size_t n = 0; n < valuesIn.size(); ++n)
+            addObject();
+    if (valuesIn.size() != size())
+        REPORT_ERROR(ERR_MD_OBJECTNUMBER, "Input vector must be of the same size as the metadata");
+    addLabel(label);
+    myMDSql->setColumnValues(label, valuesIn);
+}
+
 bool MetaData::bindValue( size_t id) const
 {
 	bool success=true;
@@ -754,17 +784,14 @@ size_t MetaData::addObject()
 
 void MetaData::importObject(const MetaData &md, const size_t id, bool doClear)
 {
-    MDValueEQ query(MDL_OBJID, id);
-    md.myMDSql->copyObjects(this, &query);
+    md.myMDSql->copyObjects(myMDSql, std::vector<size_t>(1, id));
 }
 
 void MetaData::importObjects(const MetaData &md, const std::vector<size_t> &objectsToAdd, bool doClear)
 {
     init(&(md.activeLabels));
     copyInfo(md);
-    int size = objectsToAdd.size();
-    for (int i = 0; i < size; i++)
-        importObject(md, objectsToAdd[i]);
+    md.myMDSql->copyObjects(myMDSql, objectsToAdd);
 }
 
 void MetaData::importObjects(const MetaData &md, const MDQuery &query, bool doClear)
@@ -786,15 +813,12 @@ void MetaData::importObjects(const MetaData &md, const MDQuery &query, bool doCl
 
 bool MetaData::removeObject(size_t id)
 {
-    int removed = removeObjects(MDValueEQ(MDL_OBJID, id));
-    return (removed > 0);
+    return myMDSql->deleteObjects(std::vector<size_t>(1, id)) > 0;
 }
 
 void MetaData::removeObjects(const std::vector<size_t> &toRemove)
 {
-    int size = toRemove.size();
-    for (int i = 0; i < size; i++)
-        removeObject(toRemove[i]);
+    myMDSql->deleteObjects(toRemove);
 }
 
 int MetaData::removeObjects(const MDQuery &query)
@@ -1175,64 +1199,6 @@ void MetaData::_readColumns(std::istream& is, std::vector<MDObject*> & columnVal
 }
 
 
-void MetaData::_parseObjects(std::istream &is, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime)
-{
-	size_t i=0;				// Loop counter.
-	size_t size=0;			// Column values vector size.
-
-	// Columns loop.
-	size = columnValues.size();
-	for (i=0; i<size ;i++)
-	{
-		columnValues[i]->fromStream(is);
-		if (is.fail())
-		{
-		   String errorMsg = formatString("MetaData: Error parsing column '%s' value.", MDL::label2Str(columnValues[i]->label).c_str());
-		   columnValues[i]->failed = true;
-		   std::cerr << "WARNING: " << errorMsg << std::endl;
-		   //REPORT_ERROR(ERR_MD_BADLABEL, (String)"read: Error parsing data column, expecting " + MDL::label2Str(object.label));
-		}
-		else
-		{
-			if (firstTime)
-			{
-				// Check if current column label exists.
-				if (columnValues[i]->label != MDL_UNDEFINED)
-				{
-					// If there are no desired labels then add all.
-		        	bool reallyAdd=false;
-		        	if (desiredLabels==NULL)
-		        	{
-		        		reallyAdd=true;
-		        	}
-		        	else
-		        	{
-		        		// Check if current column belongs to desired labels.
-		        		for (size_t j=0; j<desiredLabels->size(); ++j)
-		        		{
-		        			if ((*desiredLabels)[j]==columnValues[i]->label)
-		        			{
-		        				reallyAdd=true;
-		        				break;
-		        			}
-		        		}
-		        	}
-
-		        	// Add label if not exists.
-		        	if (reallyAdd)
-		        	{
-		        		addLabel(columnValues[i]->label);
-		        	}
-				}
-			}
-		}
-	}
-
-	// Insert elements in DB.
-	myMDSql->setObjectValues( -1, columnValues, desiredLabels);
-}
-
-
 /* Helper function to parse an MDObject and set its value.
  * The parsing will be from an input stream(istream)
  * and if parsing fails, an error will be raised
@@ -1369,54 +1335,214 @@ void MetaData::_readRows(std::istream& is, std::vector<MDObject*> & columnValues
     }
 }
 
+/* Rows of a STAR data loop parsed by one thread */
+class StarChunk
+{
+public:
+    const char *begin, *end; // Lines of the chunk
+    size_t maxRows; // 0 for all
+    size_t parsedLines;
+    MDColumnStore rows;
+};
+
+/* Data shared by the threads parsing a STAR data loop */
+class StarLoop
+{
+public:
+    const std::vector<MDObject*> *columnValues;
+    std::vector<StarChunk> chunks;
+};
+
+#define STAR_CHUNK_SIZE 4194304
+
+/* Parse the next value of a STAR line as fromStream would do with the object.
+ * Returns the position after the value or NULL if it cannot be parsed.
+ */
+const char * parseStarValue(const char *iter, const char *end, const MDObject &object,
+                            MDColumnStore &rows, MDColumnStore::Column *column, size_t row,
+                            MDObject &value)
+{
+    if (column == NULL) // Not read, skip the token
+    {
+        while (iter < end && isspace(*iter))
+            ++iter;
+        if (iter == end)
+            return NULL;
+        while (iter < end && !isspace(*iter))
+            ++iter;
+        return iter;
+    }
+
+    double d;
+    switch (object.type)
+    {
+    case LABEL_BOOL: //bools are int in sqlite3
+    case LABEL_INT:
+    case LABEL_SIZET:
+    case LABEL_DOUBLE:
+        //NOTE: int, bool and long(size_t) are read as double for compatibility with old doc files
+        if ((iter = memToDouble(iter, end, d)) == NULL)
+            return NULL;
+        if (object.type == LABEL_BOOL)
+            d = ((bool) ((int)d)) ? 1 : 0;
+        else if (object.type == LABEL_INT)
+            d = (int) d;
+        else if (object.type == LABEL_SIZET)
+            d = (int) ((size_t) d);
+        if (column->storage == MDColumnStore::STORE_INTEGER)
+            column->ints[row] = (int) d;
+        else
+            column->doubles[row] = d;
+        column->isSet[row] = 1;
+        return iter;
+    case LABEL_STRING:
+        {
+            while (iter < end && isspace(*iter))
+                ++iter;
+            if (iter == end)
+                return NULL;
+            const char *token = iter;
+            while (iter < end && !isspace(*iter))
+                ++iter;
+            char chr = *token;
+            if (chr != _QUOT && chr != _DQUOT)
+            {
+                column->setText(row, String(token, iter - token));
+                return iter;
+            }
+            // Quoted strings, the words are joined by a single space
+            String str;
+            ++token;
+            while (memchr(token, chr, iter - token) == NULL)
+            {
+                str.append(token, iter - token).append(" ");
+                while (iter < end && isspace(*iter))
+                    ++iter;
+                if (iter == end)
+                    return NULL;
+                token = iter;
+                while (iter < end && !isspace(*iter))
+                    ++iter;
+            }
+            if (iter - token > 1)
+                str.append(token, iter - token - 1); //remove last char '
+            column->setText(row, str);
+            return iter;
+        }
+    default:
+        {
+            std::istringstream is(String(iter, end - iter));
+            value.fromStream(is);
+            if (is.fail())
+                return NULL;
+            rows.setValue(*column, row, value);
+            return is.eof() ? end : iter + (size_t)is.tellg();
+        }
+    }
+}
+
+/* Parse the lines of a chunk of a STAR data loop */
+void parseStarChunk(StarChunk &chunk, const std::vector<MDObject*> &columnValues)
+{
+    size_t nCols = columnValues.size();
+    std::vector<MDLabel> labels;
+    for (size_t i = 0; i < nCols; ++i)
+        if (columnValues[i]->label != MDL_UNDEFINED)
+            labels.push_back(columnValues[i]->label);
+    chunk.rows.reset(labels);
+    std::vector<MDColumnStore::Column *> columns(nCols);
+    std::vector<MDObject> values;
+    values.reserve(nCols);
+    for (size_t i = 0; i < nCols; ++i)
+    {
+        columns[i] = chunk.rows.getColumn(columnValues[i]->label);
+        values.push_back(MDObject(columnValues[i]->label));
+    }
+
+    chunk.parsedLines = 0;
+    const char *iter = chunk.begin, *end = chunk.end, *newline;
+    while (iter < end)
+    {
+        if (!(newline = (const char *) memchr(iter, '\n', end - iter)))
+            newline = end;
+        while (iter < newline && isspace(*iter))
+            ++iter;
+        if (iter < newline && *iter != '#')
+        {
+            //maxRows would be > 0 if we only want to read some
+            // rows from the md for performance reasons...
+            // anyway the number of lines will be counted in parsedLines
+            if (chunk.maxRows == 0 || chunk.parsedLines < chunk.maxRows)
+            {
+                size_t row = chunk.rows.addRow(chunk.parsedLines, false);
+                for (size_t i = 0; i < nCols; ++i)
+                    if (iter == NULL || (iter = parseStarValue(iter, newline, *columnValues[i], chunk.rows,
+                                                               columns[i], row, values[i])) == NULL)
+                        std::cerr << "WARNING: " << formatString("MetaData: Error parsing column '%s' value.",
+                                  MDL::label2Str(columnValues[i]->label).c_str()) << std::endl;
+            }
+            chunk.parsedLines++;
+        }
+        iter = newline + 1; //go to next line
+    }
+}
+
+void threadParseStarChunk(ThreadArgument &thArg)
+{
+    StarLoop *loop = (StarLoop *) thArg.workClass;
+    parseStarChunk(loop->chunks[thArg.thread_id], *(loop->columnValues));
+}
+
 /* This function will be used to parse the rows data in START format
  */
 void MetaData::_readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels)
 {
-    String line;
-    std::stringstream ss;
     size_t n = block.end - block.loop;
-    bool firstTime=true;
+    _parsedLines = 0; //Check how many lines the md have
 
     if (n==0)
         return;
 
-    char * buffer = new char[n];
-    memcpy(buffer, block.loop, n);
-    char *iter = buffer, *end = iter + n, * newline = NULL;
-    _parsedLines = 0; //Check how many lines the md have
+    // Large loops are split at line boundaries and parsed in parallel,
+    // the chunks are appended in file order
+    StarLoop loop;
+    loop.columnValues = &columnValues;
+    size_t nChunks = 1;
+    if (_maxRows == 0)
+        nChunks = std::max(std::min(n / STAR_CHUNK_SIZE, (size_t) std::thread::hardware_concurrency()), (size_t) 1);
+    loop.chunks.resize(nChunks);
+    const char *iter = block.loop, *end = block.end;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        StarChunk &chunk = loop.chunks[i];
+        chunk.begin = iter;
+        chunk.maxRows = _maxRows;
+        if (i + 1 < nChunks)
+        {
+            iter = std::max(iter, (const char *) block.loop + n / nChunks * (i + 1));
+            const char *newline = (const char *) memchr(iter, '\n', end - iter);
+            iter = (newline == NULL) ? end : newline + 1;
+        }
+        else
+            iter = end;
+        chunk.end = iter;
+    }
 
-    if (myMDSql->initializeInsert( desiredLabels, columnValues))
+    if (nChunks == 1)
+        parseStarChunk(loop.chunks[0], columnValues);
+    else
     {
-		while (iter < end) //while there are data lines
-		{
-			//Assing \n position and check if NULL at the same time
-			if (!(newline = END_OF_LINE()))
-				newline = end;
-			line.assign(iter, newline - iter);
-			trim(line);
-
-			if (!line.empty() && line[0] != '#')
-			{
-				//_maxRows would be > 0 if we only want to read some
-				// rows from the md for performance reasons...
-				// anyway the number of lines will be counted in _parsedLines
-				if (_maxRows == 0 || _parsedLines < _maxRows)
-				{
-					std::stringstream ss(line);
-					_parseObjects( ss, columnValues, desiredLabels, firstTime);
-					firstTime=false;
-				}
-				_parsedLines++;
-			}
-			iter = newline + 1; //go to next line
-		}
-
-		// Finalize statement.
-		myMDSql->finalizePreparedStmt();
+        ThreadManager thMgr(nChunks, &loop);
+        thMgr.run(threadParseStarChunk);
     }
 
-    delete[] buffer;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        StarChunk &chunk = loop.chunks[i];
+        myMDSql->addRows(chunk.rows);
+        _parsedLines += chunk.parsedLines;
+        chunk.rows.reset(std::vector<MDLabel>()); // free memory as soon as possible
+    }
 }
 
 /*This function will read the md data if is in row format */
@@ -26,23 +26,131 @@
 #include <algorithm>
 #include <math.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "metadata_sql.h"
 #include "xmipp_threads.h"
+#include <set>
 #include <sys/time.h>
 #include <regex.h>
 //#define DEBUG
 
 //This is needed for static memory allocation
 int MDSql::table_counter = 0;
-sqlite3 *MDSql::db;
-MDSqlStaticInit MDSql::initialization;
-char *MDSql::errmsg;
-const char *MDSql::zLeftover;
-int MDSql::rc;
-Mutex sqlMutex; //Mutex to syncronize db access
+Mutex sqlMutex; //Mutex to syncronize table ids and the list of connections
 
-std::stringstream MDSql::preparedStream;	// Stream.
-sqlite3_stmt * MDSql::preparedStmt;
+/** In-memory database of one thread.
+ * It is opened the first time a thread creates a MetaData and it is closed when
+ * the thread has finished and no MetaData stored in it is alive.
+ */
+class MDSqlConnection
+{
+public:
+    sqlite3 *db;
+    Mutex mutex; //Mutex to syncronize the access of several threads to this connection
+    int refs;
+    std::set<MDSql *> tables; //MetaData stored in this connection
+
+    /** Connection of the calling thread, opened if needed */
+    static MDSqlConnection *current();
+
+    void ref();
+    void unref();
+
+    /// Settings applied to every connection
+    static std::set<MDSqlConnection *> connections;
+    static bool mathExtensions, regExtensions;
+    static int timeOut;
+
+private:
+    MDSqlConnection();
+    ~MDSqlConnection();
+    static void createKey();
+    static void releaseThread(void *connection);
+    static pthread_key_t key;
+    static pthread_once_t keyOnce;
+};
+
+std::set<MDSqlConnection *> MDSqlConnection::connections;
+bool MDSqlConnection::mathExtensions = false;
+bool MDSqlConnection::regExtensions = false;
+int MDSqlConnection::timeOut = -1;
+pthread_key_t MDSqlConnection::key;
+pthread_once_t MDSqlConnection::keyOnce = PTHREAD_ONCE_INIT;
+
+void MDSqlConnection::createKey()
+{
+    pthread_key_create(&key, &MDSqlConnection::releaseThread);
+}
+
+void MDSqlConnection::releaseThread(void *connection)
+{
+    ((MDSqlConnection *)connection)->unref();
+}
+
+MDSqlConnection *MDSqlConnection::current()
+{
+    pthread_once(&keyOnce, &MDSqlConnection::createKey);
+    MDSqlConnection *connection = (MDSqlConnection *)pthread_getspecific(key);
+    if (connection == NULL)
+    {
+        connection = new MDSqlConnection();
+        pthread_setspecific(key, connection);
+    }
+    return connection;
+}
+
+MDSqlConnection::MDSqlConnection()
+{
+    refs = 1; //The thread
+    char *errmsg;
+    if (sqlite3_open("", &db) != SQLITE_OK)
+        REPORT_ERROR(ERR_MD_SQL,formatString("Error opening database: %s", sqlite3_errmsg(db)));
+
+    sqlite3_exec(db, "PRAGMA temp_store=MEMORY",NULL, NULL, &errmsg);
+    sqlite3_exec(db, "PRAGMA synchronous=OFF",NULL, NULL, &errmsg);
+    sqlite3_exec(db, "PRAGMA count_changes=OFF",NULL, NULL, &errmsg);
+    sqlite3_exec(db, "PRAGMA page_size=4092",NULL, NULL, &errmsg);
+
+    sqlMutex.lock();
+    if (mathExtensions)
+    {
+        sqlite3_enable_load_extension(db, 1);
+        sqlite3_load_extension(db, "libXmippCore.so", 0, 0);
+    }
+    if (regExtensions)
+        sqlite3_create_function(db, "regexp", 2, SQLITE_ANY,0, &sqlite_regexp,0,0);
+    if (timeOut >= 0)
+        sqlite3_busy_timeout(db, timeOut);
+    connections.insert(this);
+    sqlMutex.unlock();
+
+    MDSql::sqlBeginTrans(db);
+}
+
+MDSqlConnection::~MDSqlConnection()
+{
+    sqlMutex.lock();
+    connections.erase(this);
+    sqlMutex.unlock();
+    MDSql::sqlCommitTrans(db);
+    sqlite3_close(db);
+}
+
+void MDSqlConnection::ref()
+{
+    mutex.lock();
+    ++refs;
+    mutex.unlock();
+}
+
+void MDSqlConnection::unref()
+{
+    mutex.lock();
+    bool last = (--refs == 0);
+    mutex.unlock();
+    if (last)
+        delete this;
+}
 
 void sqlite_regexp(sqlite3_context* context, int argc, sqlite3_value** values) {
     int ret;
@@ -115,74 +223,66 @@ MDSql::MDSql(MetaData *md)
     tableId = getUniqueId();
     //std::cerr << ">>>> creating md with table id: " << tableId << std::endl;
     sqlMutex.unlock();
+    connection = MDSqlConnection::current();
+    connection->ref();
+    db = connection->db;
     myMd = md;
-    myCache = new MDCache();
+    myColumns = new MDColumnStore();
     beThreadSafe = false;
-
+    preparedOperation = PREPARED_NONE;
+    preparedRow = String::npos;
+    zLeftover = NULL;
+    connection->mutex.lock();
+    connection->tables.insert(this);
+    connection->mutex.unlock();
 }
 
 MDSql::~MDSql()
 {
-    delete myCache;
+    connection->mutex.lock();
+    connection->tables.erase(this);
+    connection->mutex.unlock();
+    delete myColumns;
+    connection->unref();
 }
 
 bool MDSql::createMd()
 {
-    sqlMutex.lock();
+    connection->mutex.lock();
     //std::cerr << "creating md" <<std::endl;
     bool result = createTable(&(myMd->activeLabels));
+    myColumns->reset(myMd->activeLabels);
     //std::cerr << "leave creating md" <<std::endl;
-    sqlMutex.unlock();
+    connection->mutex.unlock();
 
     return result;
 }
 
 bool MDSql::clearMd()
 {
-    sqlMutex.lock();
+    connection->mutex.lock();
     //std::cerr << "clearing md" <<std::endl;
-    myCache->clear();
     bool result = dropTable();
+    // The sequence of objIDs is dropped with the table
+    myColumns->reset(std::vector<MDLabel>());
+    myColumns->nextId = 1;
     //std::cerr << "leave clearing md" <<std::endl;
-    sqlMutex.unlock();
+    connection->mutex.unlock();
 
     return result;
 }
 
 size_t MDSql::getObjId()
 {
-	size_t id;		// Return value.
-
-	// Get last inserted row id.
-	id = sqlite3_last_insert_rowid(db);
-
-	return(id);
+    return myColumns->lastId;
 }
 
 size_t MDSql::addRow()
 {
-    //Fixme: this can be done in the constructor of MDCache only once
-    sqlite3_stmt * &stmt = myCache->addRowStmt;
-    //sqlite3_stmt * stmt = NULL;
-
-    if (stmt == NULL)
-    {
-        std::stringstream ss;
-        ss << "INSERT INTO " << tableName(tableId) << " DEFAULT VALUES;";
-        sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
-//#define DEBUG
-#ifdef DEBUG
-    std::cerr << "DEBUG_JM: addRow: " << ss.str() <<std::endl;
-#endif
-#undef DEBUG
-    }
-    sqlite3_reset(stmt);
-    size_t id = BAD_OBJID;
-    if (execSingleStmt(stmt))
-        id = sqlite3_last_insert_rowid(db);
-
-
-    //sqlite3_finalize(stmt);
+    loadColumns();
+    size_t id = myColumns->nextId++;
+    myColumns->addRow(id);
+    myColumns->lastId = id;
     return id;
 }
 
@@ -191,25 +291,45 @@ bool MDSql::addColumn(MDLabel column)
     std::stringstream ss;
     ss << "ALTER TABLE " << tableName(tableId)
     << " ADD COLUMN " << MDL::label2SqlColumn(column) <<";";
-    return execSingleStmt(ss);
+    bool result = execSingleStmt(ss);
+    myColumns->addColumn(column);
+    return result;
 }
 
 bool  MDSql::activateMathExtensions(void)
 {
     const char* lib = "libXmippCore.so";
-    sqlite3_enable_load_extension(db, 1);
-    if( sqlite3_load_extension(db, lib, 0, 0)!= SQLITE_OK)
+    MDSqlConnection::current();
+    bool ok = true;
+    sqlMutex.lock();
+    MDSqlConnection::mathExtensions = true;
+    for (std::set<MDSqlConnection *>::iterator it = MDSqlConnection::connections.begin();
+         it != MDSqlConnection::connections.end(); ++it)
+    {
+        sqlite3_enable_load_extension((*it)->db, 1);
+        if( sqlite3_load_extension((*it)->db, lib, 0, 0)!= SQLITE_OK)
+            ok = false;
+    }
+    sqlMutex.unlock();
+    if (!ok)
         REPORT_ERROR(ERR_MD_SQL,"Cannot activate sqlite extensions");
-    else
-        return true;
+    return true;
 }
 
 bool  MDSql::activateRegExtensions(void)
 {
-	if( sqlite3_create_function(db, "regexp", 2, SQLITE_ANY,0, &sqlite_regexp,0,0)!= SQLITE_OK)
+    MDSqlConnection::current();
+    bool ok = true;
+    sqlMutex.lock();
+    MDSqlConnection::regExtensions = true;
+    for (std::set<MDSqlConnection *>::iterator it = MDSqlConnection::connections.begin();
+         it != MDSqlConnection::connections.end(); ++it)
+        if( sqlite3_create_function((*it)->db, "regexp", 2, SQLITE_ANY,0, &sqlite_regexp,0,0)!= SQLITE_OK)
+            ok = false;
+    sqlMutex.unlock();
+    if (!ok)
         REPORT_ERROR(ERR_MD_SQL,"Cannot activate sqlite extensions");
-    else
-        return true;
+    return true;
 }
 
 bool  MDSql::deactivateThreadMuting(void)
@@ -237,11 +357,14 @@ bool MDSql::renameColumn(const std::vector<MDLabel> oldLabel, const std::vector<
          ++itOld, ++itNew )
         std::replace(v1.begin(), v1.end(), *itOld, *itNew);
 
+    syncTable();
     int oldTableId = tableId;
     sqlMutex.lock();
     tableId = getUniqueId();
-    createTable(&v1);
     sqlMutex.unlock();
+    connection->mutex.lock();
+    createTable(&v1);
+    connection->mutex.unlock();
     //2 Now we can copy the original data to the new table:
     String oldLabelString=" objID";
     String newLabelString=" objID";
@@ -272,11 +395,17 @@ bool MDSql::renameColumn(const std::vector<MDLabel> oldLabel, const std::vector<
     result = execSingleStmt(sqlCommand);
     tableId=oldTableId;
     myMd->activeLabels=v1;
+    size_t nextId = myColumns->nextId;
+    myColumns->reset(v1);
+    myColumns->nextId = nextId;
+    tableModified();
     return result;
 }
 
 size_t MDSql::size(void)
 {
+    if (myColumns->valid)
+        return myColumns->size();
     std::stringstream ss;
     ss << "SELECT COUNT(*) FROM "<< tableName(tableId) << ";";
     return execSingleIntStmt(ss);
@@ -284,353 +413,372 @@ size_t MDSql::size(void)
 
 bool MDSql::setObjectValues( size_t id, const std::vector<MDObject*> columnValues, const std::vector<MDLabel> *desiredLabels)
 {
-    bool r = true;			// Return value.
-    int i=0, j=0;			// Loop indexes.
-    int rc;
-
-    // Add values.
-    if (desiredLabels==NULL)
+    size_t row;
+    if (preparedOperation == PREPARED_INSERT)
     {
-        bindValue( this->preparedStmt, 1, *(columnValues[0]));
-        for (i=1; i<columnValues.size() ;i++)
-        {
-        	bindValue( this->preparedStmt, i+1, *(columnValues[i]));
-        }
+        id = myColumns->nextId++;
+        row = myColumns->addRow(id);
+        myColumns->lastId = id;
+    }
+    else if (preparedOperation == PREPARED_UPDATE)
+    {
+        // As an UPDATE, nothing is done if the object does not exist
+        if ((row = myColumns->findRow(id)) == String::npos)
+            return true;
+        myColumns->setDirty(row);
     }
-    // Add only desired columns.
     else
     {
-		for (i=0; i<desiredLabels->size() ;i++)
-		{
-			for (j=0; j<columnValues.size() ;j++)
-			{
-				if (columnValues[j]->label == (*desiredLabels)[i])
-				{
-					bindValue( this->preparedStmt, i+1, *(columnValues[j]));
-					break;
-				}
-			}
-		}
+        std::cerr << "MDSql::setObjectValues: no insert or update has been initialized" << std::endl;
+        return false;
     }
 
-    // id != -1 means there is a WHERE clause in the query sentence and id must be added.
-    if (id != -1)
+    // Add values.
+    if (desiredLabels==NULL)
     {
-    	sqlite3_bind_int( this->preparedStmt, i+1, id);
+        size_t n = std::min(columnValues.size(), preparedLabels.size());
+        for (size_t i=0; i<n ;i++)
+            if (columnValues[i] != NULL)
+                myColumns->setValue(*myColumns->getColumn(preparedLabels[i]), row, *(columnValues[i]));
     }
-
-    // Execute statement.
-    rc = sqlite3_step( this->preparedStmt);
-    if (rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE)
+    // Add only desired columns.
+    else
     {
-        std::cerr << "MDSql::setObjectValue(MDObject): " << std::endl
-        << "   " << this->preparedStream.str() << std::endl
-        <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
-        r = false;
+        for (size_t i=0; i<desiredLabels->size() ;i++)
+        {
+            for (size_t j=0; j<columnValues.size() ;j++)
+            {
+                if (columnValues[j]->label == (*desiredLabels)[i])
+                {
+                    myColumns->setValue(*myColumns->getColumn((*desiredLabels)[i]), row, *(columnValues[j]));
+                    break;
+                }
+            }
+        }
     }
 
-    // Reset statement and bindings.
-    sqlite3_clear_bindings(this->preparedStmt);
-    sqlite3_reset(this->preparedStmt);
-
-    return r;
+    return true;
 }
 
 void MDSql::finalizePreparedStmt(void)
 {
-	if (this->preparedStmt != NULL)
-	{
-		sqlite3_finalize( this->preparedStmt);
-		this->preparedStmt = NULL;
-	}
+    preparedOperation = PREPARED_NONE;
+    preparedLabels.clear();
+    preparedRow = String::npos;
 }
 
 //set column with a given value
 bool MDSql::setObjectValue(const MDObject &value)
 {
-    bool r = true;
-    int rc;
-    MDLabel column = value.label;
-    std::stringstream ss;
-    sqlite3_stmt * stmt;
-    ss << "UPDATE " << tableName(tableId)
-    << " SET " << MDL::label2StrSql(column) << "=?;";
-    rc = sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
-    bindValue(stmt, 1, value);
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE)
+    loadColumns();
+    MDColumnStore::Column *column = myColumns->getColumn(value.label);
+    if (column == NULL)
     {
-        std::cerr << "MDSql::setObjectValue(MDObject): " << std::endl
-        << "   " << ss.str() << std::endl
-        <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
-        r = false;
+        std::cerr << "MDSql::setObjectValue(MDObject): no such column: "
+        << MDL::label2StrSql(value.label) << std::endl;
+        return false;
     }
-    sqlite3_finalize(stmt);
-    return r;
+    size_t n = myColumns->ids.size();
+    for (size_t row = 0; row < n; ++row)
+        if (myColumns->alive[row])
+        {
+            myColumns->setValue(*column, row, value);
+            myColumns->setDirty(row);
+        }
+    return true;
 }
 
 bool MDSql::setObjectValue(const int objId, const MDObject &value)
 {
-    bool r = true;
-    int rc;
-    MDLabel column = value.label;
-    std::stringstream ss;
-    //Check cached statements for setObjectValue
-    sqlite3_stmt * &stmt = myCache->setValueCache[column];
-    //sqlite3_stmt * stmt = NULL;
-    if (stmt == NULL)//if not exists create the stmt
-    {
-        std::string sep = (MDL::isString(column) || MDL::isVector(column)) ? "'" : "";
-        ss << "UPDATE " << tableName(tableId)
-        << " SET " << MDL::label2StrSql(column) << "=? WHERE objID=?;";
-//#define DEBUG
-#ifdef DEBUG
-        std::cerr << "DEBUG_JM: setObjectValue: " << ss.str() << std::endl;
-
-#endif
-
-        sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
+    loadColumns();
+    MDColumnStore::Column *column = myColumns->getColumn(value.label);
+    if (column == NULL)
+    {
+        std::cerr << "MDSql::setObjectValue: no such column: "
+        << MDL::label2StrSql(value.label) << std::endl;
+        return false;
     }
-    sqlite3_reset(stmt);
-    bindValue(stmt, 1, value);
-    sqlite3_bind_int(stmt, 2, objId);
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE)
+    size_t row = myColumns->findRow(objId);
+    if (row != String::npos)
     {
-        std::cerr << "MDSql::setObjectValue: " << std::endl
-        << "   " << ss.str() << std::endl
-        <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
-        r = false;
+        myColumns->setValue(*column, row, value);
+        myColumns->setDirty(row);
     }
+    return true;
+}
 
-    return r;
+/* Check that there is a column for every label of a row operation */
+bool checkColumns(const MDColumnStore &columns, const std::vector<MDLabel> &labels, const char *function)
+{
+    for (size_t i = 0; i < labels.size(); i++)
+        if (columns.getColumn(labels[i]) == NULL)
+        {
+            printf("%s: could not prepare statement: no such column: %s\n",
+                   function, MDL::label2StrSql(labels[i]).c_str());
+            return false;
+        }
+    return true;
 }
 
 bool MDSql::initializeSelect( bool addWhereObjId, std::vector<MDLabel> labels)
 {
-	int 	i=0;					// Loop counter.
-	bool	createdOK=true;		// Return value.
-	std::stringstream ss;		// Sentence string.
-
-	// Initialize SELECT sentence.
-	ss << "SELECT ";
-
-	// Add columns names.
-	if (labels.size() > 0)
-	{
-		// Add columns names.
-		ss << MDL::label2StrSql(labels[0]);
-		for (i=1; i<labels.size() ;i++)
-		{
-			if (labels[i] != MDL_STAR_COMMENT)
-			{
-				ss << "," << MDL::label2StrSql(labels[i]);
-			}
-		}
-	}
-	// Select all columns.
-	else
-	{
-		ss << " * ";
-	}
-
-	// Add table.
-	ss << " FROM " << tableName(tableId);
-
-	// Check if add WHERE clause to select by id.
-	if (addWhereObjId)
-	{
-		ss << " WHERE objID=?";
-	}
-
-	if (sqlite3_prepare_v2(db, ss.str().c_str(), -1, &this->preparedStmt, &zLeftover) != SQLITE_OK)
-	{
-		createdOK = false;
-		printf( "could not prepare statement: %s\n", sqlite3_errmsg(db) );
-		this->preparedStmt = NULL;
-	}
-
-	return(createdOK);
+    loadColumns();
+    finalizePreparedStmt();
+    if (!checkColumns(*myColumns, labels, "initializeSelect"))
+        return false;
+    preparedOperation = addWhereObjId ? PREPARED_SELECT : PREPARED_SELECT_ALL;
+    preparedLabels = labels;
+    preparedRow = addWhereObjId ? String::npos : 0;
+    return true;
 }
 
 bool MDSql::initializeInsert(const std::vector<MDLabel> *labels, const std::vector<MDObject*> &values)
 {
-	int 	i=0;				// Loop counter.
-	int		length=0;			// # labels.
-	bool	createdOK=true;		// Return value.
-
-	// Clear preparedStream.
-	this->preparedStream.str(std::string());
-
-	// Initialize SQL sentence.
-	this->preparedStream << "INSERT INTO " << tableName(tableId);
-
-	// Add columns.
-	this->preparedStream << " (";
-
-	// Execute branch if "labels" size is not zero.
-	if (labels != NULL)
-	{
-		length = labels->size();
-		this->preparedStream << MDL::label2StrSql((*labels)[0]);
-		for (i=1; i<length ;i++)
-		{
-			this->preparedStream << "," << MDL::label2StrSql((*labels)[i]);
-		}
-	}
-	// Execute branch if "values" size is not zero.
-	else if ((length = values.size()) > 0)
-	{
-		this->preparedStream << MDL::label2StrSql((*values[0]).label);
-		for (i=1; i<length ;i++)
-		{
-			this->preparedStream << "," << MDL::label2StrSql((*values[i]).label);
-		}
-	}
-
-	// Add one '?' character for each label.
-	this->preparedStream << ") VALUES (?";
-	for (i=1; i<length ;i++)
-	{
-		this->preparedStream << ",?";
-	}
-	this->preparedStream << ");";
-
-	// Prepare statement.
-	//std::cout << this->preparedStream.str().c_str() << std::endl;
-	if (sqlite3_prepare_v2(db, this->preparedStream.str().c_str(), -1, &this->preparedStmt, &zLeftover) != SQLITE_OK)
-	{
-		printf( "initializeInsert: could not prepare statement: %s\n", sqlite3_errmsg(db) );
-		this->preparedStmt = NULL;
-		createdOK = false;
-	}
-
-	return(createdOK);
+    loadColumns();
+    finalizePreparedStmt();
+    if (labels != NULL)
+        preparedLabels = *labels;
+    else
+        for (size_t i = 0; i < values.size(); i++)
+            preparedLabels.push_back(values[i]->label);
+    if (!checkColumns(*myColumns, preparedLabels, "initializeInsert"))
+    {
+        preparedLabels.clear();
+        return false;
+    }
+    preparedOperation = PREPARED_INSERT;
+    return true;
 }
 
 bool MDSql::initializeUpdate( std::vector<MDLabel> labels)
 {
-	int 	i=0;				// Loop counter.
-	int		length=0;			// # labels.
-	bool	createdOK=true;		// Return value.
-
-	// Get # labels.
-	length = labels.size();
-
-	// Check there are labels.
-	if (length > 0)
-	{
-		// Clear preparedStream.
-		this->preparedStream.str(std::string());
+    loadColumns();
+    finalizePreparedStmt();
+    if (labels.empty() || !checkColumns(*myColumns, labels, "initializeUpdate"))
+        return false;
+    preparedOperation = PREPARED_UPDATE;
+    preparedLabels = labels;
+    return true;
+}
 
-		// Initialize SQL sentence.
-		this->preparedStream << "UPDATE " << tableName(tableId) << " SET ";
+bool MDSql::getObjectsValues( std::vector<MDLabel> labels, std::vector<MDObject> *values)
+{
+    size_t row = preparedRow;
+    if (preparedOperation == PREPARED_SELECT)
+        preparedRow = String::npos; // A bound object is returned only once
+    else if (preparedOperation == PREPARED_SELECT_ALL)
+    {
+        size_t n = myColumns->ids.size();
+        while (row < n && !myColumns->alive[row])
+            ++row;
+        if (row >= n)
+            row = String::npos;
+        preparedRow = row + 1;
+    }
+    else
+        row = String::npos;
 
-		// Add labels.
-		this->preparedStream << MDL::label2StrSql(labels[0]) << "=?";
-		for (i=1; i<length ;i++)
-		{
-			this->preparedStream << ", " << MDL::label2StrSql(labels[i]) << "=?";
-		}
+    // If no row retrieved then return false.
+    if (row == String::npos)
+        return false;
 
-		// Insert where clause.
-		this->preparedStream << " WHERE objID=?;";
+    for (size_t i=0; i<labels.size() ;i++)
+    {
+        if (labels[i] != MDL_STAR_COMMENT)
+        {
+            MDObject value(labels[i]);
+            MDColumnStore::Column *column = myColumns->getColumn(labels[i]);
+            if (column != NULL)
+                myColumns->getValue(*column, row, value);
+            (*values).push_back(value);
+        }
+    }
+    return true;
+}
 
-		// Prepare statement.
-		if (sqlite3_prepare_v2(db, this->preparedStream.str().c_str(), -1, &this->preparedStmt, &zLeftover) != SQLITE_OK)
-		{
-			printf( "initializeUpdate: could not prepare statement: %s\n", sqlite3_errmsg(db) );
-			this->preparedStmt = NULL;
-			createdOK = false;
-		}
-	}
-	else
-	{
-		this->preparedStmt = NULL;
-		createdOK = false;
-	}
+bool MDSql::getObjectValue(const int objId, MDObject  &value)
+{
+    if (beThreadSafe) { connection->mutex.lock(); }
+    loadColumns();
+    MDColumnStore::Column *column = myColumns->getColumn(value.label);
+    size_t row = (column == NULL) ? String::npos : myColumns->findRow(objId);
+    bool wasSuccess = (row != String::npos);
+    if (wasSuccess)
+        myColumns->getValue(*column, row, value);
+    if (beThreadSafe) { connection->mutex.unlock(); }
 
-	return(createdOK);
+    return wasSuccess;
 }
 
-
-bool MDSql::getObjectsValues( std::vector<MDLabel> labels, std::vector<MDObject> *values)
+bool MDSql::getColumnValues(const MDLabel label, std::vector<double> &values)
 {
-	bool ret=true;				// Return value.
-	int i=0;					// Loop counter.
-
-	// Execute statement.
-	if (sqlite3_step(this->preparedStmt) == SQLITE_ROW)
-	{
-		for (i=0; i<labels.size() ;i++)
-		{
-			if (labels[i] != MDL_STAR_COMMENT)
-			{
-				MDObject value(labels[i]);
-				extractValue(this->preparedStmt, i, value);
-				(*values).push_back(value);
-			}
-		}
-	}
-	// If no row retrieved then return false.
-	else
-	{
-		ret = false;
-	}
-
-	return(ret);
+    if (beThreadSafe) { connection->mutex.lock(); }
+    loadColumns();
+    MDColumnStore::Column *column = myColumns->getColumn(label);
+    bool wasSuccess = (column != NULL);
+    if (wasSuccess)
+    {
+        MDLabelType type = MDL::labelType(label);
+        size_t n = myColumns->ids.size();
+        values.resize(myColumns->size());
+        double * value = values.empty() ? NULL : &values[0];
+        for (size_t row = 0; row < n; ++row)
+            if (myColumns->alive[row])
+            {
+                // Converted as the MDObject of the label would be
+                if (type == LABEL_BOOL)
+                    *value++ = (column->getInt(row) == 1) ? 1 : 0;
+                else if (type == LABEL_DOUBLE)
+                    *value++ = column->getDouble(row);
+                else
+                    *value++ = column->getInt(row);
+            }
+    }
+    if (beThreadSafe) { connection->mutex.unlock(); }
+
+    return wasSuccess;
 }
 
-bool MDSql::getObjectValue(const int objId, MDObject  &value)
+bool MDSql::setColumnValues(const MDLabel label, const std::vector<double> &values)
 {
-	if (beThreadSafe) { sqlMutex.lock(); }
-    std::stringstream ss;
-    MDLabel column = value.label;
-    sqlite3_stmt * &stmt = myCache->getValueCache[column];
+    loadColumns();
+    MDColumnStore::Column *column = myColumns->getColumn(label);
+    if (column == NULL)
+    {
+        std::cerr << "MDSql::setColumnValues: no such column: "
+        << MDL::label2StrSql(label) << std::endl;
+        return false;
+    }
+    if (values.size() != myColumns->size())
+        return false;
+    MDObject value(label);
 
-    if (stmt == NULL)//prepare stmt if not exists
+    // Integer values are cast only if they are exact and fit in the label type.
+    // The columns keep size_t values as int, as sqlite reads them
+    if (value.type == LABEL_INT || value.type == LABEL_SIZET)
     {
-        //std::cerr << "Creating cache " << ++count <<std::endl;
-        ss << "SELECT " << MDL::label2StrSql(column)
-        << " FROM " << tableName(tableId)
-        << " WHERE objID=?";// << objId << ";";
-        sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
+        double minValue = (value.type == LABEL_INT) ? INT_MIN : 0;
+        double maxValue = INT_MAX;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            double d = values[i];
+            if (!(d >= minValue && d <= maxValue) || d != floor(d))
+                REPORT_ERROR(ERR_VALUE_INCORRECT, formatString("setColumnValues: value %f of row %lu "
+                             "is not a valid %s", d, i, MDL::label2Str(label).c_str()));
+        }
     }
 
-//#define DEBUG
-#ifdef DEBUG
+    size_t n = myColumns->ids.size(), i = 0;
+    for (size_t row = 0; row < n; ++row)
+        if (myColumns->alive[row])
+        {
+            double d = values[i++];
+            switch (value.type)
+            {
+            case LABEL_BOOL:
+                value.data.boolValue = (d != 0);
+                break;
+            case LABEL_INT:
+                value.data.intValue = (int) d;
+                break;
+            case LABEL_SIZET:
+                value.data.longintValue = (size_t) d;
+                break;
+            default:
+                value.data.doubleValue = d;
+            }
+            myColumns->setValue(*column, row, value);
+            myColumns->setDirty(row);
+        }
+    return true;
+}
 
-    std::cerr << "getObjectValue: " << ss.str() <<std::endl;
-#endif
+/* Order of the rows by a column, the objID order is kept for equal values */
+class MDColumnOrder
+{
+public:
+    const MDColumnStore &columns;
+    const MDColumnStore::Column &column;
+    bool asc;
 
-    sqlite3_reset(stmt);
-    sqlite3_bind_int(stmt, 1, objId);
+    MDColumnOrder(const MDColumnStore &columns, const MDColumnStore::Column &column, bool asc):
+            columns(columns), column(column), asc(asc)
+    {}
 
-    bool wasSuccess = (sqlite3_step(stmt) == SQLITE_ROW);
+    bool operator()(size_t row1, size_t row2) const
+    {
+        int cmp = columns.compareRows(column, row1, row2);
+        return asc ? cmp < 0 : cmp > 0;
+    }
+};
 
-    if (wasSuccess)
+bool MDSql::selectRows(const MDQuery *queryPtr, std::vector<size_t> &rows) const
+{
+    rows.clear();
+    const MDColumnStore::Column *orderColumn = NULL;
+    if (queryPtr != NULL)
     {
-        extractValue(stmt, 0, value);
-        sqlite3_step(stmt);
+        if (!queryPtr->isColumnar(*myColumns))
+            return false;
+        if (queryPtr->orderLabel != MDL_OBJID &&
+            (orderColumn = myColumns->getColumn(queryPtr->orderLabel)) == NULL)
+            return false;
+        if (queryPtr->limit == -1 && queryPtr->offset > 0)
+            REPORT_ERROR(ERR_MD_SQL, "Sqlite does not support OFFSET without LIMIT");
     }
-    if (beThreadSafe) { sqlMutex.unlock(); }
+    loadColumns();
 
-    return wasSuccess;
+    // Query by objID, as done to access single objects
+    const MDValueRelational *relational = dynamic_cast<const MDValueRelational *>(queryPtr);
+    if (relational != NULL && relational->op == EQ && relational->value->label == MDL_OBJID)
+    {
+        size_t row = myColumns->findRow(relational->value->data.longintValue);
+        if (row != String::npos)
+            rows.push_back(row);
+    }
+    else
+    {
+        size_t n = myColumns->ids.size();
+        rows.reserve(myColumns->size());
+        for (size_t row = 0; row < n; ++row)
+            if (myColumns->alive[row] && (queryPtr == NULL || queryPtr->matches(*myColumns, row)))
+                rows.push_back(row);
+    }
+
+    if (queryPtr != NULL)
+    {
+        if (orderColumn != NULL)
+            std::stable_sort(rows.begin(), rows.end(), MDColumnOrder(*myColumns, *orderColumn, queryPtr->asc));
+        else if (!queryPtr->asc)
+            std::reverse(rows.begin(), rows.end());
+        size_t offset = std::min((size_t)std::max(queryPtr->offset, 0), rows.size());
+        rows.erase(rows.begin(), rows.begin() + offset);
+        if (queryPtr->limit >= 0 && (size_t)queryPtr->limit < rows.size())
+            rows.resize(queryPtr->limit);
+    }
+    return true;
 }
 
 void MDSql::selectObjects(std::vector<size_t> &objectsOut, const MDQuery *queryPtr)
 {
-    std::stringstream ss;
-    sqlite3_stmt *stmt;
     objectsOut.clear();
 
-    ss << "SELECT objID FROM " << tableName(tableId);
-    if (queryPtr != NULL)
+    std::vector<size_t> rows;
+    if (selectRows(queryPtr, rows))
     {
-        ss << queryPtr->whereString();
-        ss << queryPtr->orderByString();
-        ss << queryPtr->limitString();
+        objectsOut.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i)
+            objectsOut[i] = myColumns->ids[rows[i]];
+        return;
     }
+
+    std::stringstream ss;
+    sqlite3_stmt *stmt;
+    syncTable();
+    ss << "SELECT objID FROM " << tableName(tableId);
+    ss << queryPtr->whereString();
+    ss << queryPtr->orderByString();
+    ss << queryPtr->limitString();
     sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
 #ifdef DEBUG
 
@@ -648,15 +796,46 @@ size_t MDSql::deleteObjects(const MDQuery *queryPtr)
 {
     std::stringstream ss;
     ss << "DELETE FROM " << tableName(tableId);
-    if (queryPtr != NULL)
-        ss << queryPtr->whereString();
+    if (queryPtr == NULL)
+    {
+        size_t removed = size();
+        execSingleStmt(ss);
+        myColumns->clearRows();
+        myColumns->valid = true;
+        return removed;
+    }
 
-    if (execSingleStmt(ss))
+    std::vector<size_t> rows;
+    if (selectRows(queryPtr, rows))
     {
-        return sqlite3_changes(db);
+        for (size_t i = 0; i < rows.size(); ++i)
+            myColumns->removeRow(rows[i]);
+        return rows.size();
     }
-    return 0;
 
+    syncTable();
+    ss << queryPtr->whereString();
+    size_t removed = 0;
+    if (execSingleStmt(ss))
+        removed = sqlite3_changes(db);
+    tableModified();
+    return removed;
+}
+
+size_t MDSql::deleteObjects(const std::vector<size_t> &objects)
+{
+    loadColumns();
+    size_t removed = 0;
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        size_t row = myColumns->findRow(objects[i]);
+        if (row != String::npos)
+        {
+            myColumns->removeRow(row);
+            ++removed;
+        }
+    }
+    return removed;
 }
 
 size_t MDSql::copyObjects(MetaData *mdPtrOut, const MDQuery *queryPtr) const
@@ -666,10 +845,17 @@ size_t MDSql::copyObjects(MetaData *mdPtrOut, const MDQuery *queryPtr) const
 
 size_t MDSql::copyObjects(MDSql * sqlOut, const MDQuery *queryPtr) const
 {
+    std::vector<size_t> rows;
+    if (selectRows(queryPtr, rows))
+        return copyRows(sqlOut, rows);
+
     //NOTE: Is assumed that the destiny table has
     // the same columns that the source table, if not
     // the INSERT will fail
     std::stringstream ss, ss2;
+    std::vector<String> imported;
+    sqlOut->syncTable();
+    String tableIn = sqlOut->importTable(this, imported);
     ss << "INSERT INTO " << tableName(sqlOut->tableId);
     //Add columns names to the insert and also to select
     //* couldn't be used because maybe are duplicated objID's
@@ -682,18 +868,86 @@ size_t MDSql::copyObjects(MDSql * sqlOut, const MDQuery *queryPtr) const
         sep = ", ";
     }
     ss << "(" << ss2.str() << ") SELECT " << ss2.str();
-    ss << " FROM " << tableName(tableId);
+    ss << " FROM " << tableIn;
     if (queryPtr != NULL)
     {
         ss << queryPtr->whereString();
         ss << queryPtr->orderByString();
         ss << queryPtr->limitString();
     }
+    size_t copied = 0;
     if (sqlOut->execSingleStmt(ss))
+        copied = sqlite3_changes(sqlOut->db);
+    sqlOut->dropImported(imported);
+    sqlOut->tableModified();
+    return copied;
+}
+
+size_t MDSql::copyObjects(MDSql * sqlOut, const std::vector<size_t> &objects) const
+{
+    loadColumns();
+    std::vector<size_t> rows;
+    rows.reserve(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        size_t row = myColumns->findRow(objects[i]);
+        if (row != String::npos)
+            rows.push_back(row);
+    }
+    return copyRows(sqlOut, rows);
+}
+
+size_t MDSql::copyRows(MDSql *sqlOut, const std::vector<size_t> &rows) const
+{
+    sqlOut->loadColumns();
+    MDColumnStore &columnsOut = *(sqlOut->myColumns);
+    const std::vector<MDLabel> &labels = myMd->activeLabels;
+    std::vector<MDColumnStore::Column *> in(labels.size()), out(labels.size());
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        in[i] = myColumns->getColumn(labels[i]);
+        out[i] = columnsOut.getColumn(labels[i]);
+        if (in[i] == NULL || out[i] == NULL)
+            REPORT_ERROR(ERR_MD_SQL, formatString("Error copying objects: table %s has no column named %s",
+                                                  tableName(in[i] == NULL ? tableId : sqlOut->tableId).c_str(),
+                                                  MDL::label2StrSql(labels[i]).c_str()));
+    }
+    for (size_t r = 0; r < rows.size(); ++r)
+    {
+        size_t rowOut = columnsOut.addRow(columnsOut.nextId++);
+        for (size_t i = 0; i < labels.size(); ++i)
+            columnsOut.copyValue(*in[i], rows[r], *out[i], rowOut);
+    }
+    if (!rows.empty())
+        columnsOut.lastId = columnsOut.ids.back();
+    return rows.size();
+}
+
+size_t MDSql::addRows(const MDColumnStore &rows)
+{
+    loadColumns();
+    MDColumnStore &columnsOut = *myColumns;
+    size_t n = rows.ids.size();
+    std::vector<size_t> rowsOut;
+    rowsOut.reserve(n);
+    for (size_t r = 0; r < n; ++r)
+        if (rows.alive[r])
+            rowsOut.push_back(columnsOut.addRow(columnsOut.nextId++));
+        else
+            rowsOut.push_back(String::npos);
+    // Column by column, the values of a column are contiguous in both stores
+    for (size_t i = 0; i < rows.columns.size(); ++i)
     {
-        return sqlite3_changes(db);
+        const MDColumnStore::Column &in = *(rows.columns[i]);
+        MDColumnStore::Column *out = columnsOut.getColumn(in.label);
+        if (out != NULL)
+            for (size_t r = 0; r < n; ++r)
+                if (rowsOut[r] != String::npos)
+                    columnsOut.copyValue(in, r, *out, rowsOut[r]);
     }
-    return 0;
+    if (rows.size() > 0)
+        columnsOut.lastId = columnsOut.ids.back();
+    return rows.size();
 }
 
 void MDSql::aggregateMd(MetaData *mdPtrOut,
@@ -702,6 +956,10 @@ void MDSql::aggregateMd(MetaData *mdPtrOut,
 {
     std::stringstream ss;
     std::stringstream ss2;
+    MDSql *sqlOut = mdPtrOut->myMDSql;
+    std::vector<String> imported;
+    sqlOut->syncTable();
+    String tableIn = sqlOut->importTable(this, imported);
     std::string aggregateStr = MDL::label2StrSql(mdPtrOut->activeLabels[0]);
     ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
     << "(" << aggregateStr;
@@ -736,11 +994,13 @@ void MDSql::aggregateMd(MetaData *mdPtrOut,
         << ") AS " << MDL::label2StrSql(mdPtrOut->activeLabels[i+1]);
     }
     ss << ") SELECT " << ss2.str();
-    ss << " FROM " << tableName(tableId);
+    ss << " FROM " << tableIn;
     ss << " GROUP BY " << aggregateStr;
     ss << " ORDER BY " << aggregateStr << ";";
     //std::cerr << "ss " << ss.str() <<std::endl;
-    execSingleStmt(ss);
+    sqlOut->execSingleStmt(ss);
+    sqlOut->dropImported(imported);
+    sqlOut->tableModified();
 }
 
 
@@ -753,6 +1013,10 @@ void MDSql::aggregateMdGroupBy(MetaData *mdPtrOut,
     std::stringstream ss;
     std::stringstream ss2;
     std::stringstream groupByStr;
+    MDSql *sqlOut = mdPtrOut->myMDSql;
+    std::vector<String> imported;
+    sqlOut->syncTable();
+    String tableIn = sqlOut->importTable(this, imported);
 
     groupByStr << MDL::label2StrSql(groupByLabels[0]);
     for (size_t i = 1; i < groupByLabels.size(); i++)
@@ -786,18 +1050,73 @@ void MDSql::aggregateMdGroupBy(MetaData *mdPtrOut,
     ss2 << ") AS " << MDL::label2StrSql(resultLabel);
 
     ss << " SELECT " << ss2.str();
-    ss << " FROM " << tableName(tableId);
+    ss << " FROM " << tableIn;
     ss << " GROUP BY " << groupByStr.str();
     ss << " ORDER BY " << groupByStr.str() << ";";
 
     //std::cerr << "ss " << ss.str() <<std::endl;
-    execSingleStmt(ss);
+    sqlOut->execSingleStmt(ss);
+    sqlOut->dropImported(imported);
+    sqlOut->tableModified();
 }
 
 
+/* Aggregation of a numeric column, as sqlite3 does it (NULL values are ignored,
+ * and the result of an empty aggregation is read as 0).
+ * Returns false if the column does not exist or contains text.
+ */
+bool aggregateColumn(const MDColumnStore &columns, const AggregateOperation operation,
+                     MDLabel operateLabel, double &result)
+{
+    const MDColumnStore::Column *column = columns.getColumn(operateLabel);
+    if (column == NULL || column->storage == MDColumnStore::STORE_TEXT)
+        return false;
+    size_t count = 0;
+    double sum = 0, min = 0, max = 0;
+    size_t n = columns.ids.size();
+    for (size_t row = 0; row < n; ++row)
+        if (columns.alive[row] && column->isSet[row])
+        {
+            double value = column->getDouble(row);
+            if (count == 0 || value < min)
+                min = value;
+            if (count == 0 || value > max)
+                max = value;
+            sum += value;
+            ++count;
+        }
+    switch (operation)
+    {
+    case AGGR_COUNT:
+        result = count;
+        break;
+    case AGGR_MAX:
+        result = max;
+        break;
+    case AGGR_MIN:
+        result = min;
+        break;
+    case AGGR_SUM:
+        result = sum;
+        break;
+    case AGGR_AVG:
+        result = (count == 0) ? 0 : sum / count;
+        break;
+    default:
+        REPORT_ERROR(ERR_MD_SQL, "Invalid aggregate operation.");
+    }
+    return true;
+}
+
 double MDSql::aggregateSingleDouble(const AggregateOperation operation,
                                     MDLabel operateLabel)
 {
+    double result;
+    loadColumns();
+    if (aggregateColumn(*myColumns, operation, operateLabel, result))
+        return result;
+
+    syncTable();
     std::stringstream ss;
     ss << "SELECT ";
     //Start iterating on second label, first is the
@@ -830,6 +1149,12 @@ double MDSql::aggregateSingleDouble(const AggregateOperation operation,
 size_t MDSql::aggregateSingleSizeT(const AggregateOperation operation,
                                    MDLabel operateLabel)
 {
+    double result;
+    loadColumns();
+    if (aggregateColumn(*myColumns, operation, operateLabel, result))
+        return (size_t)(int)(long long)result; // read as sqlite3_column_int
+
+    syncTable();
     std::stringstream ss;
     ss << "SELECT ";
     //Start iterating on second label, first is the
@@ -887,6 +1212,14 @@ void MDSql::indexModify(const std::vector<MDLabel> columns, bool create)
 
 size_t MDSql::firstRow()
 {
+    if (myColumns->valid)
+    {
+        size_t n = myColumns->ids.size();
+        for (size_t row = 0; row < n; ++row)
+            if (myColumns->alive[row])
+                return myColumns->ids[row];
+        return (size_t)-1; // as COALESCE(..., -1) below
+    }
     std::stringstream ss;
     ss << "SELECT COALESCE(MIN(objID), -1) AS MDSQL_FIRST_ID FROM "
     << tableName(tableId) << ";";
@@ -895,6 +1228,13 @@ size_t MDSql::firstRow()
 
 size_t MDSql::lastRow()
 {
+    if (myColumns->valid)
+    {
+        for (size_t row = myColumns->ids.size(); row-- > 0; )
+            if (myColumns->alive[row])
+                return myColumns->ids[row];
+        return (size_t)-1; // as COALESCE(..., -1) below
+    }
     std::stringstream ss;
     ss << "SELECT COALESCE(MAX(objID), -1) AS MDSQL_LAST_ID FROM "
     << tableName(tableId) << ";";
@@ -903,6 +1243,15 @@ size_t MDSql::lastRow()
 
 size_t MDSql::nextRow(size_t currentRow)
 {
+    if (myColumns->valid)
+    {
+        const std::vector<size_t> &ids = myColumns->ids;
+        size_t n = ids.size();
+        for (size_t row = std::upper_bound(ids.begin(), ids.end(), currentRow) - ids.begin(); row < n; ++row)
+            if (myColumns->alive[row])
+                return ids[row];
+        return (size_t)-1; // as COALESCE(..., -1) below
+    }
     std::stringstream ss;
     ss << "SELECT COALESCE(MIN(objID), -1) AS MDSQL_NEXT_ID FROM "
     << tableName(tableId)
@@ -912,6 +1261,14 @@ size_t MDSql::nextRow(size_t currentRow)
 
 size_t MDSql::previousRow(size_t currentRow)
 {
+    if (myColumns->valid)
+    {
+        const std::vector<size_t> &ids = myColumns->ids;
+        for (size_t row = std::lower_bound(ids.begin(), ids.end(), currentRow) - ids.begin(); row-- > 0; )
+            if (myColumns->alive[row])
+                return ids[row];
+        return (size_t)-1; // as COALESCE(..., -1) below
+    }
     std::stringstream ss;
     ss << "SELECT COALESCE(MAX(objID), -1) AS MDSQL_PREV_ID FROM "
     << tableName(tableId)
@@ -921,6 +1278,7 @@ size_t MDSql::previousRow(size_t currentRow)
 
 int MDSql::columnMaxLength(MDLabel column)
 {
+    syncTable();
     std::stringstream ss;
     ss << "SELECT MAX(COALESCE(LENGTH("<< MDL::label2StrSql(column)
     <<"), -1)) AS MDSQL_STRING_LENGTH FROM "
@@ -931,18 +1289,22 @@ int MDSql::columnMaxLength(MDLabel column)
 void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns, SetOperation operation)
 {
     std::stringstream ss, ss2;
-    bool execStmt = true;
     int size;
     std::string sep = " ";
     std::vector<MDLabel> * labelVector;
-
-    switch (operation)
+    // The statements are executed in the connection of the output
+    MDSql *sqlOut = mdPtrOut->myMDSql;
+    if (operation == UNION)
     {
-    case UNION:
-        copyObjects(mdPtrOut->myMDSql);
-        execStmt = false;
-        break;
+        copyObjects(sqlOut);
+        return;
+    }
+    std::vector<String> imported;
+    sqlOut->syncTable();
+    String tableIn = sqlOut->importTable(this, imported);
 
+    switch (operation)
+    {
     case UNION_DISTINCT: //unionDistinct
         //Create string with columns list
         size = mdPtrOut->activeLabels.size();
@@ -955,7 +1317,7 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
         ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
         << " (" << ss2.str() << ")"
         << " SELECT " << ss2.str()
-        << " FROM " << tableName(tableId)
+        << " FROM " << tableIn
         << " WHERE ";
         for (size_t j=0; j<columns.size(); ++j)
         {
@@ -984,7 +1346,7 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
             ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
             << " (" << ss2.str() << ")"
             << " SELECT DISTINCT " << ss2.str()
-            << " FROM " << tableName(tableId) << ";";
+            << " FROM " << tableIn << ";";
         }
         else {
             // We need this special case for the REMOVE_DUPLICATE because when using a subset
@@ -994,8 +1356,8 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
             ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
             << " (ObjId," << ss2.str() << ")"
             << " SELECT M.* FROM (SELECT " << MDL::label2StrSql(columns[0]) << ", MIN(ObjId) AS first "
-            << " FROM " << tableName(tableId) << " GROUP BY " << MDL::label2StrSql(columns[0])
-            << " ) foo JOIN " << tableName(tableId) << " M ON foo.first = M.ObjId;";
+            << " FROM " << tableIn << " GROUP BY " << MDL::label2StrSql(columns[0])
+            << " ) foo JOIN " << tableIn << " M ON foo.first = M.ObjId;";
         }
         break;
 
@@ -1011,7 +1373,7 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
             if (operation == INTERSECTION)
                 ss << " NOT";
 			ss << " IN (SELECT " << MDL::label2StrSql(columns[j])
-			   << " FROM " << tableName(tableId) << ") ";
+			   << " FROM " << tableIn << ") ";
         }
         ss << ";";
         break;
@@ -1019,8 +1381,9 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
         REPORT_ERROR(ERR_ARG_INCORRECT,"Cannot use this operation for a set operation");
     }
     //std::cerr << "ss " << ss.str() <<std::endl;
-    if (execStmt)
-        execSingleStmt(ss);
+    sqlOut->execSingleStmt(ss);
+    sqlOut->dropImported(imported);
+    sqlOut->tableModified();
 }
 
 bool MDSql::equals(const MDSql &op)
@@ -1033,6 +1396,9 @@ bool MDSql::equals(const MDSql &op)
         return (false);
     int size  = myMd->activeLabels.size();
     std::stringstream sqlQuery,ss2,ss2Group;
+    std::vector<String> imported;
+    syncTable();
+    String tableOp = importTable(&op, imported);
 
     ss2 << MDL::label2StrSql(MDL_OBJID);
     ss2Group << MDL::label2StrSql(MDL_OBJID);
@@ -1062,12 +1428,14 @@ bool MDSql::equals(const MDSql &op)
     FROM " <<   tableName(tableId)
     <<      " UNION ALL \
     SELECT " << ss2.str() << "\
-    FROM " << tableName(op.tableId)
+    FROM " << tableOp
     <<     ") tmp"
     << " GROUP BY " << ss2Group.str()
     << " HAVING COUNT(*) <> 2"
     << ") tmp1";
-    return (execSingleIntStmt(sqlQuery)==0);
+    bool result = (execSingleIntStmt(sqlQuery)==0);
+    dropImported(imported);
+    return result;
 }
 
 void MDSql::setOperate(const MetaData *mdInLeft,
@@ -1125,6 +1493,10 @@ void MDSql::setOperate(const MetaData *mdInLeft,
 			mdInLeft->addIndex(columnsLeft[0]);
     	}
     }
+    std::vector<String> imported;
+    syncTable();
+    String tableLeft = importTable(mdInLeft->myMDSql, imported);
+    String tableRight = importTable(mdInRight->myMDSql, imported);
     size = myMd->activeLabels.size();
     size_t sizeLeft = mdInLeft->activeLabels.size();
 
@@ -1133,17 +1505,17 @@ void MDSql::setOperate(const MetaData *mdInLeft,
         ss2 << sep << MDL::label2StrSql( myMd->activeLabels[i]);
         ss3 << sep;
         if (i < sizeLeft && mdInLeft->activeLabels[i] == myMd->activeLabels[i])
-            ss3 << tableName(mdInLeft->myMDSql->tableId) << ".";
+            ss3 << tableLeft << ".";
         else
-            ss3 << tableName(mdInRight->myMDSql->tableId) << ".";
+            ss3 << tableRight << ".";
         ss3 << MDL::label2StrSql( myMd->activeLabels[i]);
         sep = ", ";
     }
     ss << "INSERT INTO " << tableName(tableId)
     << " (" << ss2.str() << ")"
     << " SELECT " << ss3.str()
-    << " FROM " << tableName(mdInLeft->myMDSql->tableId)
-    << join_type << " JOIN " << tableName(mdInRight->myMDSql->tableId);
+    << " FROM " << tableLeft
+    << join_type << " JOIN " << tableRight;
 
     if (operation != NATURAL_JOIN)
     {
@@ -1152,8 +1524,8 @@ void MDSql::setOperate(const MetaData *mdInLeft,
         {
         	if (j>0)
         		ss << " AND ";
-        	ss << tableName(mdInLeft->myMDSql->tableId) << "." << MDL::label2StrSql(columnsLeft[j])
-               << "=" << tableName(mdInRight->myMDSql->tableId) << "." << MDL::label2StrSql(columnsRight[j]);
+        	ss << tableLeft << "." << MDL::label2StrSql(columnsLeft[j])
+               << "=" << tableRight << "." << MDL::label2StrSql(columnsRight[j]);
         }
         ss << ") ";
     }
@@ -1167,10 +1539,10 @@ void MDSql::setOperate(const MetaData *mdInLeft,
                 if(mdInRight->activeLabels[i] == mdInLeft->activeLabels[j])
                 {
                     ss << sep
-                    << tableName(mdInRight->myMDSql->tableId) << "."
+                    << tableRight << "."
                     << MDL::label2StrSql(mdInRight->activeLabels[i])
                     << " = "
-                    << tableName(mdInLeft->myMDSql->tableId) << "."
+                    << tableLeft << "."
                     << MDL::label2StrSql(mdInLeft->activeLabels[j]);
                     sep = " AND ";
                 }
@@ -1183,6 +1555,8 @@ void MDSql::setOperate(const MetaData *mdInLeft,
     //    for (int j = 0; j < sizeLeft; j++)
     //     std::cerr << "mdInLeft->activeLabels:"  << mdInLeft->activeLabels[1] << std::endl;
     execSingleStmt(ss);
+    dropImported(imported);
+    tableModified();
     //std::cerr << "ss:" << ss.str() << std::endl;
     //dumpToFile("kk.sqlite");
     //exit(0);
@@ -1191,17 +1565,27 @@ void MDSql::setOperate(const MetaData *mdInLeft,
 bool MDSql::operate(const String &expression)
 {
     std::stringstream ss;
+    syncTable();
     ss << "UPDATE " << tableName(tableId) << " SET " << expression;
 
-    return execSingleStmt(ss);
+    bool result = execSingleStmt(ss);
+    tableModified();
+    return result;
 }
 
 void MDSql::dumpToFile(const FileName &fileName)
 {
     sqlite3 *pTo;
     sqlite3_backup *pBackup;
+    MDSqlConnection *connection = MDSqlConnection::current();
+    sqlite3 *db = connection->db;
+    int rc;
 
-    sqlCommitTrans();
+    connection->mutex.lock();
+    for (std::set<MDSql *>::iterator it = connection->tables.begin(); it != connection->tables.end(); ++it)
+        (*it)->syncTable();
+    connection->mutex.unlock();
+    sqlCommitTrans(db);
     rc = sqlite3_open(fileName.c_str(), &pTo);
     if( rc==SQLITE_OK )
     {
@@ -1216,7 +1600,7 @@ void MDSql::dumpToFile(const FileName &fileName)
     else
         REPORT_ERROR(ERR_MD_SQL, "dumpToFile: error opening db file");
     sqlite3_close(pTo);
-    sqlBeginTrans();
+    sqlBeginTrans(db);
 }
 
 void MDSql::copyTableFromFileDB(const FileName blockname,
@@ -1295,7 +1679,8 @@ void MDSql::copyTableFromFileDB(const FileName blockname,
 
     //Copy table to memory
     //tableName(tableId);
-    sqlCommitTrans();
+    char *errmsg;
+    sqlCommitTrans(db);
     dropTable();
     createMd();
 
@@ -1306,6 +1691,7 @@ void MDSql::copyTableFromFileDB(const FileName blockname,
         std::cerr << "Couldn't attach or create table:  " << errmsg << std::endl;
         return;
     }
+    tableModified();
     String selectCmd = formatString("SELECT %s FROM load.%s", activeLabel.c_str(), _blockname.c_str());
     sqlCommand = formatString("INSERT INTO %s %s", tableName(tableId).c_str(), selectCmd.c_str());
 
@@ -1327,12 +1713,14 @@ void MDSql::copyTableFromFileDB(const FileName blockname,
         return;
     }
     sqlite3_exec(db, "DETACH load",NULL,NULL,&errmsg);
-    sqlBeginTrans();
+    sqlBeginTrans(db);
 }
 
 void MDSql::copyTableToFileDB(const FileName blockname, const FileName &fileName)
 {
-    sqlCommitTrans();
+    char *errmsg;
+    syncTable();
+    sqlCommitTrans(db);
     String _blockname;
     if(blockname.empty())
         _blockname=DEFAULT_BLOCK_NAME;
@@ -1358,44 +1746,28 @@ void MDSql::copyTableToFileDB(const FileName blockname, const FileName &fileName
         return;
     }
     sqlite3_exec(db, "DETACH save",NULL,NULL,&errmsg);
-    sqlBeginTrans();
-}
-
-bool MDSql::sqlBegin()
-{
-    if (table_counter > 0)
-        return true;
-    //std::cerr << "entering sqlBegin" <<std::endl;
-    rc = sqlite3_open("", &db);
-
-    sqlite3_exec(db, "PRAGMA temp_store=MEMORY",NULL, NULL, &errmsg);
-    sqlite3_exec(db, "PRAGMA synchronous=OFF",NULL, NULL, &errmsg);
-    sqlite3_exec(db, "PRAGMA count_changes=OFF",NULL, NULL, &errmsg);
-    sqlite3_exec(db, "PRAGMA page_size=4092",NULL, NULL, &errmsg);
-
-    return sqlBeginTrans();
+    sqlBeginTrans(db);
 }
 
 void MDSql::sqlTimeOut(int miliseconds)
 {
-    if (sqlite3_busy_timeout(db, miliseconds) != SQLITE_OK)
-    {
-        std::cerr << "Couldn't not set timeOut:  " << std::endl;
-        exit(0);
-
-    }
-
+    MDSqlConnection::current();
+    sqlMutex.lock();
+    MDSqlConnection::timeOut = miliseconds;
+    for (std::set<MDSqlConnection *>::iterator it = MDSqlConnection::connections.begin();
+         it != MDSqlConnection::connections.end(); ++it)
+        if (sqlite3_busy_timeout((*it)->db, miliseconds) != SQLITE_OK)
+        {
+            std::cerr << "Couldn't not set timeOut:  " << std::endl;
+            exit(0);
+        }
+    sqlMutex.unlock();
 }
 
-void MDSql::sqlEnd()
+bool MDSql::sqlBeginTrans(sqlite3 *db)
 {
-    sqlCommitTrans();
-    sqlite3_close(db);
-    //std::cerr << "Database sucessfully closed." <<std::endl;
-}
+    char *errmsg;
 
-bool MDSql::sqlBeginTrans()
-{
     if (sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errmsg) != SQLITE_OK)
     {
         std::cerr << "Couldn't begin transaction:  " << errmsg << std::endl;
@@ -1404,7 +1776,7 @@ bool MDSql::sqlBeginTrans()
     return true;
 }
 
-bool MDSql::sqlCommitTrans()
+bool MDSql::sqlCommitTrans(sqlite3 *db)
 {
     char *errmsg;
 
@@ -1518,128 +1890,667 @@ std::string MDSql::tableName(const int tableId) const
     return ss.str();
 }
 
+String MDSql::importTable(const MDSql *sqlIn, std::vector<String> &imported)
+{
+    // Other threads may be using the connection of the source table
+    Mutex &inMutex = sqlIn->connection->mutex;
+    sqlite3_stmt *stmtIn = NULL, *stmtOut = NULL;
+    inMutex.lock();
+    try
+    {
+        sqlIn->syncTable();
+        if (sqlIn->connection == connection)
+        {
+            inMutex.unlock();
+            return tableName(sqlIn->tableId);
+        }
+
+        // Temporary table with the same columns
+        sqlMutex.lock();
+        std::stringstream ssName;
+        ssName << "MDImport_" << getUniqueId();
+        sqlMutex.unlock();
+        String name = ssName.str();
+        const std::vector<MDLabel> &labels = sqlIn->myMd->activeLabels;
+        std::stringstream ss, ssSelect, ssInsert;
+        ss << "CREATE TEMP TABLE " << name
+        << "(objID INTEGER PRIMARY KEY ASC AUTOINCREMENT";
+        ssSelect << "SELECT objID";
+        ssInsert << "INSERT INTO " << name << " VALUES (?";
+        for (size_t i = 0; i < labels.size(); i++)
+        {
+            ss << ", " << MDL::label2SqlColumn(labels[i]);
+            ssSelect << ", " << MDL::label2StrSql(labels[i]);
+            ssInsert << ",?";
+        }
+        ss << ");";
+        ssSelect << " FROM " << tableName(sqlIn->tableId) << ";";
+        ssInsert << ");";
+        execSingleStmt(ss);
+        imported.push_back(name);
+
+        // Copy the rows, values are copied as they are stored
+        sqlite3_prepare_v2(sqlIn->db, ssSelect.str().c_str(), -1, &stmtIn, NULL);
+        sqlite3_prepare_v2(db, ssInsert.str().c_str(), -1, &stmtOut, NULL);
+        int columns = labels.size() + 1;
+        while (sqlite3_step(stmtIn) == SQLITE_ROW)
+        {
+            for (int i = 0; i < columns; i++)
+                sqlite3_bind_value(stmtOut, i+1, sqlite3_column_value(stmtIn, i));
+            execSingleStmt(stmtOut, &ssInsert);
+            sqlite3_reset(stmtOut);
+        }
+        sqlite3_finalize(stmtIn);
+        sqlite3_finalize(stmtOut);
+        inMutex.unlock();
+        return name;
+    }
+    catch (...)
+    {
+        sqlite3_finalize(stmtIn);
+        sqlite3_finalize(stmtOut);
+        inMutex.unlock();
+        throw;
+    }
+}
+
+void MDSql::dropImported(std::vector<String> &imported)
+{
+    for (size_t i = 0; i < imported.size(); i++)
+    {
+        std::stringstream ss;
+        ss << "DROP TABLE IF EXISTS " << imported[i] << ";";
+        execSingleStmt(ss);
+    }
+    imported.clear();
+}
+
 bool MDSql::bindStatement( size_t id)
 {
-	bool success=true;		// Return value.
+    preparedRow = myColumns->findRow(id);
+    return true;
+}
+
+void MDSql::loadColumns() const
+{
+    if (myColumns->valid)
+        return;
+    MDColumnStore &columns = *myColumns;
+    columns.clearRows();
+
+    std::stringstream ss;
+    ss << "SELECT objID";
+    size_t nColumns = columns.columns.size();
+    for (size_t i = 0; i < nColumns; i++)
+        ss << ", " << MDL::label2StrSql(columns.columns[i]->label);
+    ss << " FROM " << tableName(tableId) << ";";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        size_t row = columns.addRow(sqlite3_column_int(stmt, 0), false);
+        for (size_t i = 0; i < nColumns; i++)
+        {
+            MDColumnStore::Column &column = *(columns.columns[i]);
+            if (sqlite3_column_type(stmt, i + 1) == SQLITE_NULL)
+                continue;
+            column.isSet[row] = 1;
+            switch (column.storage)
+            {
+            case MDColumnStore::STORE_INTEGER:
+                column.ints[row] = sqlite3_column_int(stmt, i + 1);
+                break;
+            case MDColumnStore::STORE_REAL:
+                column.doubles[row] = sqlite3_column_double(stmt, i + 1);
+                break;
+            case MDColumnStore::STORE_TEXT:
+                column.setText(row, (const char *)sqlite3_column_text(stmt, i + 1));
+                break;
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
 
-	// Clear current statement.
-	sqlite3_clear_bindings(this->preparedStmt);
-	sqlite3_reset(this->preparedStmt);
+    // objIDs are never reused in an AUTOINCREMENT table
+    ss.str("");
+    ss << "SELECT seq FROM sqlite_sequence WHERE name='" << tableName(tableId) << "';";
+    sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        columns.nextId = std::max(columns.nextId, (size_t)sqlite3_column_int64(stmt, 0) + 1);
+    sqlite3_finalize(stmt);
+    if (!columns.ids.empty())
+        columns.nextId = std::max(columns.nextId, columns.ids.back() + 1);
+    columns.valid = true;
+}
+
+void MDSql::syncTable() const
+{
+    MDColumnStore &columns = *myColumns;
+    if (!columns.valid || columns.dirtyRows.empty())
+        return;
 
-	// Bind object id.
-	if (sqlite3_bind_int(this->preparedStmt, 1, id) != SQLITE_OK)
-	{
-		success = false;
-	}
+    std::stringstream ssInsert, ssDelete;
+    size_t nColumns = columns.columns.size();
+    ssInsert << "INSERT OR REPLACE INTO " << tableName(tableId) << " (objID";
+    for (size_t i = 0; i < nColumns; i++)
+        ssInsert << ", " << MDL::label2StrSql(columns.columns[i]->label);
+    ssInsert << ") VALUES (?";
+    for (size_t i = 0; i < nColumns; i++)
+        ssInsert << ",?";
+    ssInsert << ");";
+    ssDelete << "DELETE FROM " << tableName(tableId) << " WHERE objID=?;";
+    sqlite3_stmt *stmtInsert, *stmtDelete;
+    sqlite3_prepare_v2(db, ssInsert.str().c_str(), -1, &stmtInsert, NULL);
+    sqlite3_prepare_v2(db, ssDelete.str().c_str(), -1, &stmtDelete, NULL);
 
-	return(success);
+    int rc;
+    std::sort(columns.dirtyRows.begin(), columns.dirtyRows.end());
+    for (size_t k = 0; k < columns.dirtyRows.size(); ++k)
+    {
+        size_t row = columns.dirtyRows[k];
+        columns.dirty[row] = 0;
+        sqlite3_stmt *stmt = stmtDelete;
+        if (columns.alive[row])
+        {
+            stmt = stmtInsert;
+            for (size_t i = 0; i < nColumns; i++)
+            {
+                const MDColumnStore::Column &column = *(columns.columns[i]);
+                if (!column.isSet[row])
+                    sqlite3_bind_null(stmt, i + 2);
+                else if (column.storage == MDColumnStore::STORE_INTEGER)
+                    sqlite3_bind_int(stmt, i + 2, column.ints[row]);
+                else if (column.storage == MDColumnStore::STORE_REAL)
+                    sqlite3_bind_double(stmt, i + 2, column.doubles[row]);
+                else
+                {
+                    const String &str = column.dictionary[column.codes[row]];
+                    sqlite3_bind_text(stmt, i + 2, str.c_str(), str.size(), SQLITE_STATIC);
+                }
+            }
+        }
+        sqlite3_bind_int64(stmt, 1, columns.ids[row]);
+        rc = sqlite3_step(stmt);
+        if (rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE)
+            REPORT_ERROR(ERR_MD_SQL,formatString("Error code: %d message: %s\n  Sqlite query: %s",
+                                                 rc, sqlite3_errmsg(db), ssInsert.str().c_str()));
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmtInsert);
+    sqlite3_finalize(stmtDelete);
+    columns.dirtyRows.clear();
+    columns.compact();
 }
 
-int MDSql::bindValue(sqlite3_stmt *stmt, const int position, const MDObject &valueIn)
+void MDSql::tableModified()
 {
-    //First reset the statement
-    //rc  = sqlite3_reset(stmt);
-    //std::cerr << "rc after reset: " << rc <<std::endl;
-  if (valueIn.failed)
-  {
-    // If a value was wronly parsed, set NULL in their sqlite entry
-    std::cerr << "WARNING!!! valueIn.failed = True, binding NULL" << std::endl;
+    myColumns->clearRows();
+    myColumns->valid = false;
+    finalizePreparedStmt();
+}
 
-    return sqlite3_bind_null(stmt, position);
-  }
-  else
-  {
-    switch (valueIn.type)
+bool MDValueRelational::isColumnar(const MDColumnStore &columns) const
+{
+    // Numbers in the SQL string are written with the precision of the stream
+    switch (value->type)
     {
-    case LABEL_BOOL: //bools are int in sqlite3
-        return sqlite3_bind_int(stmt, position, valueIn.data.boolValue ? 1 : 0);
+    case LABEL_BOOL:
     case LABEL_INT:
-        return sqlite3_bind_int(stmt, position, valueIn.data.intValue);
     case LABEL_SIZET:
-        return sqlite3_bind_int(stmt, position, valueIn.data.longintValue);
     case LABEL_DOUBLE:
-        return sqlite3_bind_double(stmt, position, valueIn.data.doubleValue);
+        number = atof(value->toString(false, true).c_str());
+        break;
     case LABEL_STRING:
-        return sqlite3_bind_text(stmt, position, valueIn.data.stringValue->c_str(), -1, SQLITE_TRANSIENT);
-    case LABEL_VECTOR_DOUBLE:
-    case LABEL_VECTOR_SIZET:
-        return sqlite3_bind_text(stmt, position, valueIn.toString(false, true).c_str(), -1, SQLITE_TRANSIENT);
+        break;
+    default:
+        return false;
+    }
+    if (value->label == MDL_OBJID)
+        return value->type != LABEL_STRING;
+    const MDColumnStore::Column *column = columns.getColumn(value->label);
+    if (column == NULL)
+        return false;
+    return (column->storage == MDColumnStore::STORE_TEXT) == (value->type == LABEL_STRING);
+}
+
+bool MDValueRelational::matches(const MDColumnStore &columns, size_t row) const
+{
+    if (value->label == MDL_OBJID)
+    {
+        double id = (double)columns.ids[row];
+        switch (op)
+        {
+        case EQ:
+            return id == number;
+        case NE:
+            return id != number;
+        case GT:
+            return id > number;
+        case LT:
+            return id < number;
+        case GE:
+            return id >= number;
+        case LE:
+            return id <= number;
+        }
+    }
+    return columns.compareValue(*columns.getColumn(value->label), row, *value, number, op);
+}
+
+//----------- MDColumnStore -------------------
+MDColumnStore::Column::Column(MDLabel label)
+{
+    this->label = label;
+    switch (MDL::labelType(label))
+    {
+    case LABEL_BOOL:
+    case LABEL_INT:
+    case LABEL_SIZET:
+        storage = STORE_INTEGER;
+        break;
+    case LABEL_DOUBLE:
+        storage = STORE_REAL;
+        break;
+    default:
+        storage = STORE_TEXT;
+    }
+    deduplicate = true;
+    firstUniqueCode = 0;
+}
+
+void MDColumnStore::Column::addRow()
+{
+    isSet.push_back(0);
+    switch (storage)
+    {
+    case STORE_INTEGER:
+        ints.push_back(0);
+        break;
+    case STORE_REAL:
+        doubles.push_back(0.);
+        break;
+    case STORE_TEXT:
+        codes.push_back(0);
+        break;
+    }
+}
+
+size_t MDColumnStore::Column::intern(const String &str)
+{
+    if (deduplicate)
+    {
+        std::map<String, size_t>::iterator it = lookup.lower_bound(str);
+        if (it != lookup.end() && it->first == str)
+            return it->second;
+        lookup.insert(it, std::make_pair(str, dictionary.size()));
+        // Strings that are rarely repeated are not worth a dictionary
+        if (dictionary.size() >= 1024 && 2 * dictionary.size() > codes.size())
+        {
+            lookup.clear();
+            deduplicate = false;
+            firstUniqueCode = dictionary.size();
+        }
+    }
+    dictionary.push_back(str);
+    return dictionary.size() - 1;
+}
+
+void MDColumnStore::Column::setText(size_t row, const String &str)
+{
+    size_t code = codes[row];
+    if (!deduplicate && isSet[row] && code >= firstUniqueCode)
+        dictionary[code] = str;
+    else
+        codes[row] = intern(str);
+    isSet[row] = 1;
+}
+
+double MDColumnStore::Column::getDouble(size_t row) const
+{
+    if (!isSet[row])
+        return 0.;
+    switch (storage)
+    {
+    case STORE_INTEGER:
+        return ints[row];
+    case STORE_REAL:
+        return doubles[row];
+    default:
+        return atof(dictionary[codes[row]].c_str());
+    }
+}
+
+int MDColumnStore::Column::getInt(size_t row) const
+{
+    if (!isSet[row])
+        return 0;
+    switch (storage)
+    {
+    case STORE_INTEGER:
+        return ints[row];
+    case STORE_REAL:
+        return (int)(long long)doubles[row];
+    default:
+        return atoi(dictionary[codes[row]].c_str());
+    }
+}
+
+String MDColumnStore::Column::getText(size_t row) const
+{
+    if (!isSet[row])
+        return "";
+    switch (storage)
+    {
+    case STORE_INTEGER:
+        return formatString("%d", ints[row]);
+    case STORE_REAL:
+        return formatString("%.15g", doubles[row]);
     default:
-        REPORT_ERROR(ERR_ARG_INCORRECT,"Do not know how to handle this type");
+        return dictionary[codes[row]];
+    }
+}
+
+MDColumnStore::MDColumnStore()
+{
+    byLabel.resize(MDL_LAST_LABEL, NULL);
+    nAlive = 0;
+    nextId = 1;
+    lastId = BAD_OBJID;
+    valid = true;
+}
+
+MDColumnStore::~MDColumnStore()
+{
+    for (size_t i = 0; i < columns.size(); i++)
+        delete columns[i];
+}
+
+void MDColumnStore::reset(const std::vector<MDLabel> &labels)
+{
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        byLabel[columns[i]->label] = NULL;
+        delete columns[i];
     }
-  }
+    columns.clear();
+    clearRows();
+    valid = true;
+    for (size_t i = 0; i < labels.size(); i++)
+        addColumn(labels[i]);
 }
 
-void MDSql::extractValue(sqlite3_stmt *stmt, const int position, MDObject &valueOut)
+void MDColumnStore::clearRows()
 {
-    switch (valueOut.type)
+    ids.clear();
+    alive.clear();
+    dirty.clear();
+    dirtyRows.clear();
+    nAlive = 0;
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        Column *column = columns[i];
+        *column = Column(column->label);
+    }
+}
+
+MDColumnStore::Column * MDColumnStore::addColumn(MDLabel label)
+{
+    Column *column = getColumn(label);
+    if (column == NULL && label > MDL_UNDEFINED && label < MDL_LAST_LABEL)
+    {
+        column = new Column(label);
+        for (size_t i = 0; i < ids.size(); i++)
+            column->addRow();
+        columns.push_back(column);
+        byLabel[label] = column;
+    }
+    return column;
+}
+
+size_t MDColumnStore::addRow(size_t id, bool isNew)
+{
+    size_t row = ids.size();
+    ids.push_back(id);
+    alive.push_back(1);
+    dirty.push_back(0);
+    for (size_t i = 0; i < columns.size(); i++)
+        columns[i]->addRow();
+    ++nAlive;
+    if (isNew)
+        setDirty(row);
+    return row;
+}
+
+size_t MDColumnStore::findRow(size_t id) const
+{
+    size_t n = ids.size();
+    if (n == 0 || id < ids[0])
+        return String::npos;
+    // Dense objIDs are the common case
+    size_t row = id - ids[0];
+    if (row >= n || ids[row] != id)
+    {
+        std::vector<size_t>::const_iterator it = std::lower_bound(ids.begin(), ids.end(), id);
+        if (it == ids.end() || *it != id)
+            return String::npos;
+        row = it - ids.begin();
+    }
+    return alive[row] ? row : String::npos;
+}
+
+void MDColumnStore::removeRow(size_t row)
+{
+    if (alive[row])
+    {
+        alive[row] = 0;
+        --nAlive;
+        setDirty(row);
+    }
+}
+
+bool MDColumnStore::setValue(size_t row, const MDObject &value)
+{
+    Column *column = getColumn(value.label);
+    if (column == NULL)
+        return false;
+    setValue(*column, row, value);
+    return true;
+}
+
+void MDColumnStore::setValue(Column &column, size_t row, const MDObject &value)
+{
+    // Values that failed to parse are NULL
+    if (value.failed)
+    {
+        column.isSet[row] = 0;
+        return;
+    }
+    double d;
+    switch (value.type)
     {
     case LABEL_BOOL: //bools are int in sqlite3
-        valueOut.data.boolValue = sqlite3_column_int(stmt, position) == 1;
+        d = value.data.boolValue ? 1 : 0;
         break;
     case LABEL_INT:
-        valueOut.data.intValue = sqlite3_column_int(stmt, position);
+        d = value.data.intValue;
         break;
     case LABEL_SIZET:
-        valueOut.data.longintValue = sqlite3_column_int(stmt, position);
+        d = (int)value.data.longintValue;
         break;
     case LABEL_DOUBLE:
-        valueOut.data.doubleValue = sqlite3_column_double(stmt, position);
+        d = value.data.doubleValue;
         break;
     case LABEL_STRING:
-    {
-        std::stringstream ss;
-        ss << sqlite3_column_text(stmt, position);
-        valueOut.data.stringValue->assign(ss.str());
-
+        if (column.storage == STORE_TEXT)
+        {
+            column.setText(row, *(value.data.stringValue));
+            return;
+        }
+        d = atof(value.data.stringValue->c_str());
         break;
+    default:
+        column.setText(row, value.toString(false, true));
+        return;
     }
-    case LABEL_VECTOR_DOUBLE:
-    case LABEL_VECTOR_SIZET:
+    switch (column.storage)
     {
-        std::stringstream ss;
-        ss << sqlite3_column_text(stmt, position);
-        valueOut.fromStream(ss);
+    case STORE_INTEGER:
+        column.ints[row] = (int)d;
+        break;
+    case STORE_REAL:
+        column.doubles[row] = d;
         break;
+    case STORE_TEXT:
+        column.setText(row, value.toString(false, true));
+        return;
     }
+    column.isSet[row] = 1;
+}
+
+void MDColumnStore::getValue(const Column &column, size_t row, MDObject &value) const
+{
+    switch (value.type)
+    {
+    case LABEL_BOOL: //bools are int in sqlite3
+        value.data.boolValue = column.getInt(row) == 1;
+        break;
+    case LABEL_INT:
+        value.data.intValue = column.getInt(row);
+        break;
+    case LABEL_SIZET:
+        value.data.longintValue = column.getInt(row);
+        break;
+    case LABEL_DOUBLE:
+        value.data.doubleValue = column.getDouble(row);
+        break;
+    case LABEL_STRING:
+        if (column.storage == STORE_TEXT && column.isSet[row])
+            value.data.stringValue->assign(column.dictionary[column.codes[row]]);
+        else
+            value.data.stringValue->assign(column.getText(row));
+        break;
+    case LABEL_VECTOR_DOUBLE:
+    case LABEL_VECTOR_SIZET:
+        {
+            std::stringstream ss;
+            ss << column.getText(row);
+            value.fromStream(ss);
+            break;
+        }
     default:
-        REPORT_ERROR(ERR_ARG_INCORRECT,"Do not know how to extract a value of type " + valueOut.type);
+        REPORT_ERROR(ERR_ARG_INCORRECT,"Do not know how to extract a value of type " + value.type);
     }
 }
 
-MDCache::MDCache()
+void MDColumnStore::copyValue(const Column &columnIn, size_t rowIn, Column &columnOut, size_t rowOut)
 {
-    this->addRowStmt = NULL;
-    this->iterStmt = NULL;
+    if (!columnIn.isSet[rowIn])
+    {
+        columnOut.isSet[rowOut] = 0;
+        return;
+    }
+    if (columnIn.storage != columnOut.storage)
+    {
+        MDObject value(columnOut.label);
+        getValue(columnIn, rowIn, value);
+        setValue(columnOut, rowOut, value);
+        return;
+    }
+    switch (columnIn.storage)
+    {
+    case STORE_INTEGER:
+        columnOut.ints[rowOut] = columnIn.ints[rowIn];
+        break;
+    case STORE_REAL:
+        columnOut.doubles[rowOut] = columnIn.doubles[rowIn];
+        break;
+    case STORE_TEXT:
+        {
+            // A copy, the dictionary may be the same
+            String str = columnIn.dictionary[columnIn.codes[rowIn]];
+            columnOut.setText(rowOut, str);
+            break;
+        }
+    }
+    columnOut.isSet[rowOut] = 1;
 }
 
-MDCache::~MDCache()
+int MDColumnStore::compareRows(const Column &column, size_t row1, size_t row2) const
 {
-    clear();
+    bool set1 = column.isSet[row1], set2 = column.isSet[row2];
+    if (!set1 || !set2)
+        return (int)set1 - (int)set2;
+    switch (column.storage)
+    {
+    case STORE_INTEGER:
+        return (column.ints[row1] > column.ints[row2]) - (column.ints[row1] < column.ints[row2]);
+    case STORE_REAL:
+        return (column.doubles[row1] > column.doubles[row2]) - (column.doubles[row1] < column.doubles[row2]);
+    default:
+        {
+            size_t code1 = column.codes[row1], code2 = column.codes[row2];
+            return (code1 == code2) ? 0 : column.dictionary[code1].compare(column.dictionary[code2]);
+        }
+    }
 }
 
-void MDCache::clear()
+bool MDColumnStore::compareValue(const Column &column, size_t row, const MDObject &literal,
+                                 double number, RelationalOp op) const
 {
-    //Clear cached statements
-    std::map<MDLabel, sqlite3_stmt*>::iterator it;
-    //FIXME: This is a bit dirty here...should be moved to MDSQl
-    for (it = setValueCache.begin(); it != setValueCache.end(); it++)
-        sqlite3_finalize(it->second);
-    setValueCache.clear();
-
-    for (it = getValueCache.begin(); it != getValueCache.end(); it++)
-        sqlite3_finalize(it->second);
-    getValueCache.clear();
-
-    if (iterStmt != NULL)
+    // NULL values do not satisfy any comparison
+    if (!column.isSet[row])
+        return false;
+    int cmp;
+    if (column.storage == STORE_TEXT)
+        cmp = column.dictionary[column.codes[row]].compare(*(literal.data.stringValue));
+    else
+    {
+        double value = column.getDouble(row);
+        cmp = (value > number) - (value < number);
+    }
+    switch (op)
     {
-        sqlite3_finalize(iterStmt);
-        iterStmt = NULL;
+    case EQ:
+        return cmp == 0;
+    case NE:
+        return cmp != 0;
+    case GT:
+        return cmp > 0;
+    case LT:
+        return cmp < 0;
+    case GE:
+        return cmp >= 0;
+    case LE:
+        return cmp <= 0;
+    default:
+        REPORT_ERROR(ERR_ARG_INCORRECT,"Unknown binary operator");
     }
+    return false;
+}
 
-    if (addRowStmt != NULL)
+void MDColumnStore::compact()
+{
+    if (nAlive == ids.size())
+        return;
+    size_t n = ids.size(), k = 0;
+    std::vector<size_t> idsOut;
+    idsOut.reserve(nAlive);
+    for (size_t i = 0; i < columns.size(); i++)
     {
-        sqlite3_finalize(addRowStmt);
-        addRowStmt = NULL;
+        Column &column = *(columns[i]);
+        Column columnOut(column.label);
+        for (size_t row = 0; row < n; ++row)
+            if (alive[row])
+            {
+                columnOut.addRow();
+                copyValue(column, row, columnOut, columnOut.isSet.size() - 1);
+            }
+        column = columnOut;
     }
+    for (size_t row = 0; row < n; ++row)
+        if (alive[row])
+            ids[k++] = ids[row];
+    ids.resize(k);
+    alive.assign(k, 1);
+    dirty.assign(k, 0);
 }
@@ -32,10 +32,10 @@
 #include <sqlite3.h>
 #include "metadata_label.h"
 #include <vector>
-class MDSqlStaticInit;
+class MDSqlConnection;
 class MDQuery;
 class MetaData;
-class MDCache;
+class MDColumnStore;
 
 /** @addtogroup MetaData
  * @{
@@ -69,11 +69,26 @@ void sqlite_regexp(sqlite3_context* context, int argc, sqlite3_value** values);
 
 /** This class will manage SQL database interactions.
  * This class is designed to used inside a MetaData.
+ *
+ * Each thread works on its own in-memory database: a MetaData is stored in the
+ * connection of the thread that created it, together with its prepared statements
+ * and error state, so MetaData objects owned by different threads can be read and
+ * updated concurrently. Operations between MetaData of different connections
+ * (copies, set operations, joins) first copy the foreign table into the connection
+ * where the statement is executed.
+ *
+ * The rows are also kept in a columnar store (see MDColumnStore). Values, rows,
+ * iteration, sorting, splitting, single column aggregations and value queries
+ * work on the columns; the SQL table is only synchronized with them when an
+ * operation needs SQL (expressions, joins, set operations, grouping), and the
+ * columns are reloaded from the table after it has been modified by SQL.
  */
 class MDSql
 {
 public:
+    /** Dump the database of the calling thread to a file */
     static void dumpToFile(const FileName &fileName);
+    /** Set the busy timeout of all the connections */
     static void sqlTimeOut(int miliSeconds);
 
     /**This library will provide common mathematical and string functions in
@@ -171,6 +186,18 @@ private:
      */
     bool getObjectValue(const int objId, MDObject  &value);
 
+    /** Get the values of a numeric column (bool, int, size_t or double)
+     * of all objects, in objID order.
+     */
+    bool getColumnValues(const MDLabel label, std::vector<double> &values);
+
+    /** Set the values of a numeric column of all objects, in objID order.
+     * There must be one value for every object. The values of integer
+     * labels must be integers in the range of int (non negative for
+     * size_t, which the columns keep as int), otherwise an error is reported.
+     */
+    bool setColumnValues(const MDLabel label, const std::vector<double> &values);
+
     /** This function will select some elements from table.
      * The 'limit' is the maximum number of object
      * returned, if is -1, all will be returned
@@ -188,6 +215,10 @@ private:
      */
     size_t deleteObjects(const MDQuery *queryPtr = NULL);
 
+    /** This function will delete the objects with the given ids.
+     */
+    size_t deleteObjects(const std::vector<size_t> &objects);
+
     /** Copy the objects from a metada to other.
      * return the number of objects copied
      * */
@@ -196,6 +227,11 @@ private:
     size_t copyObjects(MetaData * mdPtrOut,
                        const MDQuery *queryPtr = NULL) const;
 
+    /** Copy the objects with the given ids, in that order.
+     */
+    size_t copyObjects(MDSql * sqlOut,
+                       const std::vector<size_t> &objects) const;
+
     /** This function performs aggregation operations.
      */
     void aggregateMd(MetaData *mdPtrOut,
@@ -260,15 +296,32 @@ private:
     ~MDSql();
 
     static int table_counter;
-    static sqlite3 *db;
-
-    static MDSqlStaticInit initialization; //Just for initialization
 
-    ///Just call this function once, at static initialization
-    static bool sqlBegin();
-    static void sqlEnd();
-    static bool sqlBeginTrans();
-    static bool sqlCommitTrans();
+    /// Connection where the table lives (the one of the creating thread) and its handle
+    MDSqlConnection *connection;
+    sqlite3 *db;
+
+    static bool sqlBeginTrans(sqlite3 *db);
+    static bool sqlCommitTrans(sqlite3 *db);
+
+    /// Rows of the metadata
+    MDColumnStore *myColumns;
+    /// Load the rows of the table into the columns if they were modified by SQL
+    void loadColumns() const;
+    /// Write into the table the rows modified in the columns
+    void syncTable() const;
+    /// Called after modifying the table with SQL, the columns will be reloaded
+    void tableModified();
+    /** Rows selected by a query (or all of them), sorted and limited as the query says.
+     * Returns false if the query needs SQL.
+     */
+    bool selectRows(const MDQuery *queryPtr, std::vector<size_t> &rows) const;
+    /// Append the given rows to the metadata of sqlOut
+    size_t copyRows(MDSql *sqlOut, const std::vector<size_t> &rows) const;
+    /** Append the rows of a columnar store (i.e. parsed from a file) as new objects.
+     * The columns are matched by label, those not in the metadata are ignored.
+     */
+    size_t addRows(const MDColumnStore &rows);
     /** Return an unique id for each metadata
      * this function should be called once for each
      * metada and the id will be used for operations
@@ -290,24 +343,32 @@ private:
 
     String tableName(const int tableId) const;
 
+    /** Name of the table of sqlIn as seen from the connection of this MDSql.
+     * If sqlIn lives in another connection its rows are copied to a temporary
+     * table of this connection, whose name is added to imported so that it can be
+     * dropped with dropImported() once the statement has been executed.
+     */
+    String importTable(const MDSql *sqlIn, std::vector<String> &imported);
+    void dropImported(std::vector<String> &imported);
+
     bool 	bindStatement( size_t id);
-    int 	bindValue(sqlite3_stmt *stmt, const int position, const MDObject &valueIn);
-    void 	extractValue(sqlite3_stmt *stmt, const int position, MDObject &valueOut);
 
-    static char *errmsg;
-    static const char *zLeftover;
-    static int rc;
-    static sqlite3_stmt *stmt;
+    const char *zLeftover;
 
-    static std::stringstream preparedStream;	// Stream.
-    static sqlite3_stmt * preparedStmt;	// SQL statement.
+    /// Row operation started with initializeSelect, initializeInsert or initializeUpdate
+    enum PreparedOperation
+    {
+        PREPARED_NONE, PREPARED_SELECT, PREPARED_SELECT_ALL, PREPARED_INSERT, PREPARED_UPDATE
+    };
+    PreparedOperation preparedOperation;
+    std::vector<MDLabel> preparedLabels;
+    size_t preparedRow; // Row bound to the select or next row to return
 
     ///Non-static attributes
     int tableId;
     MetaData *myMd;
-    MDCache *myCache;
 
-    friend class MDSqlStaticInit;
+    friend class MDSqlConnection;
     friend class MetaData;
     friend class MDIterator;
     ///similar to "operator"
@@ -373,6 +434,20 @@ public:
     {
         return " ";
     }
+
+    /** Return true if the query can be evaluated on the columns of a metadata.
+     * Queries with SQL expressions should not override it, they are run by sqlite.
+     */
+    virtual bool isColumnar(const MDColumnStore &/*columns*/) const
+    {
+        return queryStringFunc() == " ";
+    }
+
+    /** Return true if a row of the columns satisfies the query */
+    virtual bool matches(const MDColumnStore &/*columns*/, size_t /*row*/) const
+    {
+        return true;
+    }
 }
 ;//End of class MDQuery
 
@@ -398,6 +473,7 @@ class MDValueRelational: public MDQuery
 {
     MDObject *value;
     RelationalOp op;
+    mutable double number; // Numeric value as written in the SQL string
 public:
 
     template <class T>
@@ -444,6 +520,10 @@ public:
         return (value == NULL) ? " " : MDL::label2Str(value->label) + opString() + value->toString(false, true);
     }
 
+    virtual bool isColumnar(const MDColumnStore &columns) const;
+    virtual bool matches(const MDColumnStore &columns, size_t row) const;
+    friend class MDSql;
+
     template <class T>
     void setValue(T &value)
     {
@@ -575,6 +655,16 @@ public:
         return ss.str();
     }
 
+    virtual bool isColumnar(const MDColumnStore &columns) const
+    {
+        return query1 != NULL && query1->isColumnar(columns) && query2->isColumnar(columns);
+    }
+
+    virtual bool matches(const MDColumnStore &columns, size_t row) const
+    {
+        return query1->matches(columns, row) && query2->matches(columns, row);
+    }
+
     ~MDValueRange()
     {
         delete query1;
@@ -673,41 +763,135 @@ public:
         return " ";
     }
 
+    virtual bool isColumnar(const MDColumnStore &columns) const
+    {
+        for (size_t i = 0; i < queries.size(); i++)
+            if (!queries[i]->isColumnar(columns))
+                return false;
+        return true;
+    }
+
+    /** As in SQL, AND takes precedence over OR */
+    virtual bool matches(const MDColumnStore &columns, size_t row) const
+    {
+        if (queries.empty())
+            return true;
+        bool result = false;
+        bool term = queries[0]->matches(columns, row);
+        for (size_t i = 1; i < queries.size(); i++)
+            if (operations[i] == "OR")
+            {
+                result = result || term;
+                term = queries[i]->matches(columns, row);
+            }
+            else
+                term = term && queries[i]->matches(columns, row);
+        return result || term;
+    }
+
 }
 ;//end of class MDMultiQuery
 
-/** Class to store some cached sql statements.
+/** Columnar storage of the rows of a MetaData.
+ * Each column is a typed vector: integers (bool, int and size_t labels, stored
+ * as sqlite3 stores them), doubles, or codes of a dictionary of strings (strings
+ * and vectors, in their SQL text form). Strings are deduplicated while they
+ * repeat often enough. Rows are kept in ascending objID order; removed rows are
+ * only marked until the next compaction.
  */
-class MDCache
+class MDColumnStore
 {
 public:
-    sqlite3_stmt *iterStmt;
-    std::map<MDLabel, sqlite3_stmt*> getValueCache;
-    std::map<MDLabel, sqlite3_stmt*> setValueCache;
-    sqlite3_stmt *addRowStmt;
-
-    MDCache();
-    ~MDCache();
-    void clear();
-};
-
-/** Just to work as static constructor for initialize database.
- */
-class MDSqlStaticInit
-{
-private:
-    MDSqlStaticInit()
+    /** How values are stored */
+    enum Storage
     {
-        MDSql::sqlBegin();
-    }//close constructor
+        STORE_INTEGER, STORE_REAL, STORE_TEXT
+    };
 
-    ~MDSqlStaticInit()
+    /** Values of one label */
+    class Column
     {
-        MDSql::sqlEnd();
-    }//close destructor
+    public:
+        MDLabel label;
+        Storage storage;
+        std::vector<int> ints;
+        std::vector<double> doubles;
+        std::vector<size_t> codes;
+        std::vector<String> dictionary;
+        std::map<String, size_t> lookup;
+        bool deduplicate; // If false, codes from firstUniqueCode are used by a single row
+        size_t firstUniqueCode;
+        std::vector<char> isSet; // false for NULL values
+
+        Column(MDLabel label);
+        void addRow();
+        /// Code of a string, reused if it is already in the dictionary
+        size_t intern(const String &str);
+        void setText(size_t row, const String &str);
+        /// Numeric value, as sqlite3 converts it
+        double getDouble(size_t row) const;
+        int getInt(size_t row) const;
+        String getText(size_t row) const;
+    };
+
+    std::vector<size_t> ids;
+    std::vector<char> alive;
+    std::vector<char> dirty;
+    std::vector<size_t> dirtyRows; // Rows that differ from the SQL table
+    size_t nAlive;
+    size_t nextId; // objID of the next row
+    size_t lastId; // objID of the last inserted row
+    bool valid; // If false the rows should be loaded from the SQL table
+    std::vector<Column *> columns; // In table order
+
+    MDColumnStore();
+    ~MDColumnStore();
+
+    /** Remove the rows and define the columns of an empty table */
+    void reset(const std::vector<MDLabel> &labels);
+    /** Remove the rows, objIDs are not reused */
+    void clearRows();
+    Column * addColumn(MDLabel label);
+    Column * getColumn(MDLabel label) const
+    {
+        return (label > MDL_UNDEFINED && label < MDL_LAST_LABEL) ? byLabel[label] : NULL;
+    }
+    /** Add a row with NULL values and return its position */
+    size_t addRow(size_t id, bool isNew = true);
+    /** Position of a living row, String::npos if not found */
+    size_t findRow(size_t id) const;
+    void removeRow(size_t row);
+    void setDirty(size_t row)
+    {
+        if (!dirty[row])
+        {
+            dirty[row] = 1;
+            dirtyRows.push_back(row);
+        }
+    }
+    size_t size() const
+    {
+        return nAlive;
+    }
 
-    friend class MDSql;
-}
-;//close class MDSqlStaticInit
+    /** Store a value, returns false if there is no column for it */
+    bool setValue(size_t row, const MDObject &value);
+    void setValue(Column &column, size_t row, const MDObject &value);
+    /** Read a value as sqlite3 converts it to the type of the MDObject */
+    void getValue(const Column &column, size_t row, MDObject &value) const;
+    void copyValue(const Column &columnIn, size_t rowIn, Column &columnOut, size_t rowOut);
+    /** Order of two rows as in ORDER BY (NULL values first) */
+    int compareRows(const Column &column, size_t row1, size_t row2) const;
+    /** Compare a value with a literal as the WHERE clause of a MDValueRelational.
+     * Numeric literals are given as number, string literals as literal.
+     */
+    bool compareValue(const Column &column, size_t row, const MDObject &literal,
+                      double number, RelationalOp op) const;
+    /** Remove dead rows, the rows must not be dirty */
+    void compact();
+
+private:
+    std::vector<Column *> byLabel;
+};
 
 #endif
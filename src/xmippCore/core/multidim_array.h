@@ -1377,7 +1377,7 @@ public:
                 mFd = mmapFile(data, nzyxdim);
             }
         }
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *) data,0,nzyxdim*sizeof(T));
         nzyxdimAlloc = nzyxdim;
     }
 
@@ -1402,7 +1402,7 @@ public:
             if (data == NULL)
                 REPORT_ERROR(ERR_MEM_NOTENOUGH, "Allocate: No space left");
         }
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *) data,0,nzyxdim*sizeof(T));
         nzyxdimAlloc = nzyxdim;
     }
 
@@ -1613,7 +1613,7 @@ public:
             else
                 new_data = new T [NZYXdim];
 
-            memset(new_data,0,NZYXdim*sizeof(T));
+            memset((void *) new_data,0,NZYXdim*sizeof(T));
         }
         catch (std::bad_alloc &)
         {
@@ -3000,6 +3000,57 @@ public:
         return (T) columns;
     }
 
+    /** Interpolates the value of the nth 3D matrix M at the point (x,y,z) knowing
+     * that this image is a set of B-spline coefficients of degree 3.
+     *
+     * Same result as interpolatedElementBSpline3D(x,y,z,3), but the weights
+     * and mirrored indexes along each axis are computed only once.
+     * (x,y,z) are in logical coordinates.
+     */
+    inline T interpolatedElementBSpline3D_Degree3(double x, double y, double z) const
+    {
+        // Logical to physical
+        z -= STARTINGZ(*this);
+        y -= STARTINGY(*this);
+        x -= STARTINGX(*this);
+
+        int l1 = (int)ceil(x - 2);
+        int m1 = (int)ceil(y - 2);
+        int n1 = (int)ceil(z - 2);
+        int Xdim=(int)XSIZE(*this);
+        int Ydim=(int)YSIZE(*this);
+        int Zdim=(int)ZSIZE(*this);
+
+        int equivalent_l[4], equivalent_m[4], equivalent_n[4];
+        double wx[4], wy[4], wz[4];
+        for (int i = 0; i < 4; i++)
+        {
+            int l = l1 + i, m = m1 + i, n = n1 + i;
+            equivalent_l[i] = (l<0) ? -l-1 : ((l>=Xdim) ? 2*Xdim-l-1 : l);
+            equivalent_m[i] = (m<0) ? -m-1 : ((m>=Ydim) ? 2*Ydim-m-1 : m);
+            equivalent_n[i] = (n<0) ? -n-1 : ((n>=Zdim) ? 2*Zdim-n-1 : n);
+            BSPLINE03(wx[i], x - (double) l);
+            BSPLINE03(wy[i], y - (double) m);
+            BSPLINE03(wz[i], z - (double) n);
+        }
+
+        double zyxsum = 0.0;
+        for (int n = 0; n < 4; n++)
+        {
+            double yxsum = 0.0;
+            for (int m = 0; m < 4; m++)
+            {
+                const T *ref = &DIRECT_A3D_ELEM(*this, equivalent_n[n], equivalent_m[m], 0);
+                double xsum = 0.0;
+                for (int l = 0; l < 4; l++)
+                    xsum += (double) ref[equivalent_l[l]] * wx[l];
+                yxsum += xsum * wy[m];
+            }
+            zyxsum += yxsum * wz[n];
+        }
+        return (T) zyxsum;
+    }
+
 	/** Interpolates the value of the nth 1D vector M at the point (x) knowing
      * that this vector is a set of B-spline coefficients
      *
@@ -3294,7 +3345,7 @@ public:
 
     /** Minimum and maximum of the values in the array.
      *
-     * As doubles.
+     * As doubles, of the size values from offset.
      */
     void computeDoubleMinMaxRange(double& minval, double& maxval,size_t offset, size_t size) const
     {
@@ -3307,7 +3358,7 @@ public:
         T val;
         size_t n;
 
-        for (n=offset,ptr=data+offset; n<size; ++n, ++ptr)
+        for (n=0,ptr=data+offset; n<size; ++n, ++ptr)
         {
             val = *ptr;
             if (val < minval)
@@ -3527,7 +3578,8 @@ public:
 
     /** Median
      *
-     * Calculate the median element.
+     * Calculate the median element. The middle elements are found by
+     * selection, without sorting the whole array.
      *
      * @code
      * med = v1.computeMedian();
@@ -3541,16 +3593,19 @@ public:
         if (XSIZE(*this) == 1)
             return DIRECT_MULTIDIM_ELEM(*this,0);
 
+        checkDimension(1);
+
         // Initialise data
-        MultidimArray<T> temp;
-        this->sort(temp);
+        MultidimArray<T> temp(*this);
+        T* first=temp.data;
+        T* middle=first+NZYXSIZE(temp)/2;
+        std::nth_element(first, middle, first+NZYXSIZE(temp));
 
-        // Get median
+        // Get median, the lower half is left before the middle element
         if (NZYXSIZE(*this)%2==0)
-            return 0.5*(DIRECT_MULTIDIM_ELEM(temp,NZYXSIZE(*this)/2-1)+
-                        DIRECT_MULTIDIM_ELEM(temp,NZYXSIZE(*this)/2  ));
+            return 0.5*(*std::max_element(first, middle)+*middle);
         else
-            return DIRECT_MULTIDIM_ELEM(temp,NZYXSIZE(*this)/2);
+            return *middle;
     }
 
     /** Adjust the range of the array to a given one.
@@ -4309,7 +4364,7 @@ public:
     {
         if (data == NULL || !sameShape(op))
             resizeNoCopy(op);
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *) data,0,nzyxdim*sizeof(T));
     }
 
     /** Initialize to zeros with current size.
@@ -4323,7 +4378,8 @@ public:
      */
     inline void initZeros()
     {
-        memset(data,0,nzyxdim*sizeof(T));
+        // The zero of the complex types is also all bits 0
+        memset((void *) data,0,nzyxdim*sizeof(T));
     }
 
     /** Initialize to zeros with a given size.
@@ -4332,7 +4388,7 @@ public:
     {
         if (xdim!=Xdim || ydim!=Ydim || zdim!=Zdim || ndim!=Ndim)
             resize(Ndim, Zdim,Ydim,Xdim,false);
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *) data,0,nzyxdim*sizeof(T));
     }
 
     /** Initialize to zeros with a given size.
@@ -5762,6 +5818,16 @@ double MultidimArray< std::complex< double > >::computeAvg() const;
 template<>
 void MultidimArray< std::complex< double > >::maxIndex(size_t &lmax, int& kmax, int& imax, int& jmax) const;
 template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMax(double& minval, double& maxval) const;
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMaxRange(double& minval, double& maxval, size_t pos, size_t size) const;
+template<>
+void MultidimArray< std::complex< float > >::rangeAdjust(std::complex< float > minF, std::complex< float > maxF);
+template<>
+double MultidimArray< std::complex< float > >::computeAvg() const;
+template<>
+void MultidimArray< std::complex< float > >::maxIndex(size_t &lmax, int& kmax, int& imax, int& jmax) const;
+template<>
 bool operator==(const MultidimArray< std::complex< double > >& op1,
                 const MultidimArray< std::complex< double > >& op2);
 template<>
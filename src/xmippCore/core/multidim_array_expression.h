@@ -0,0 +1,331 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_MULTIDIM_ARRAY_EXPRESSION_H_
+#define CORE_MULTIDIM_ARRAY_EXPRESSION_H_
+
+#include <cmath>
+#include "multidim_array.h"
+#include "xmipp_threads.h"
+
+/** @defgroup MultidimArrayExpressions Element-wise expressions of arrays
+ *  @ingroup MultidimensionalArrays
+ *
+ * Compound element-wise expressions of MultidimArrays evaluated in a single
+ * pass, without temporary arrays. The operands are wrapped with arrayExpr()
+ * and the expression is built with the usual arithmetic operators, scalars
+ * of the type of the arrays and the functions sqrt, abs, exp and log. Nothing
+ * is computed until evaluateExpression() writes the result, in a loop simple
+ * enough for the compiler to vectorize it, optionally split among threads.
+ * The operators of MultidimArray itself are not affected.
+ *
+ * The result may be one of the operands, since every element is read before
+ * it is written. All the arrays must have the same shape.
+ *
+ * @code
+ * MultidimArray<double> a, b, c, d;
+ * ...
+ * evaluateExpression(d, arrayExpr(a) * b + 2.0 * arrayExpr(c)); // d=a*b+2c
+ * evaluateExpression(a, arrayExpr(a) - sqrt(arrayExpr(b)), 4); // 4 threads
+ * @endcode
+ */
+//@{
+/** Base class of the expressions.
+ * E is the class of the expression, which provides value_type, the value of
+ * the element n with operator[] and the array that gives the shape with
+ * array(), NULL for the scalars.
+ */
+template<typename E>
+class ArrayExpr
+{
+public:
+    /// The expression itself
+    const E & self() const
+    {
+        return static_cast<const E &>(*this);
+    }
+};
+
+/** Expression made of an array */
+template<typename T>
+class ArrayExprTerm: public ArrayExpr< ArrayExprTerm<T> >
+{
+public:
+    typedef T value_type;
+
+    ArrayExprTerm(const MultidimArray<T> &op): v(&op), data(MULTIDIM_ARRAY(op))
+    {}
+
+    inline T operator[](size_t n) const
+    {
+        return data[n];
+    }
+
+    const MultidimArray<T> * array() const
+    {
+        return v;
+    }
+
+private:
+    const MultidimArray<T> * v;
+    const T * data;
+};
+
+/** Expression made of a scalar */
+template<typename T>
+class ArrayExprScalar: public ArrayExpr< ArrayExprScalar<T> >
+{
+public:
+    typedef T value_type;
+
+    ArrayExprScalar(T value): value(value)
+    {}
+
+    inline T operator[](size_t) const
+    {
+        return value;
+    }
+
+    const MultidimArray<T> * array() const
+    {
+        return NULL;
+    }
+
+private:
+    T value;
+};
+
+/** Element-wise operation of two expressions */
+template<typename Op, typename L, typename R>
+class ArrayExprBinary: public ArrayExpr< ArrayExprBinary<Op, L, R> >
+{
+public:
+    typedef typename L::value_type value_type;
+
+    ArrayExprBinary(const L &l, const R &r): l(l), r(r)
+    {
+        const MultidimArray<value_type> * vl = l.array();
+        const MultidimArray<value_type> * vr = r.array();
+        if (vl != NULL && vr != NULL && !vl->sameShape(*vr))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, "Array expression: operands of different shapes");
+    }
+
+    inline value_type operator[](size_t n) const
+    {
+        return Op::apply(l[n], r[n]);
+    }
+
+    const MultidimArray<value_type> * array() const
+    {
+        return l.array() != NULL ? l.array() : r.array();
+    }
+
+private:
+    L l;
+    R r;
+};
+
+/** Element-wise function of an expression */
+template<typename Op, typename E>
+class ArrayExprUnary: public ArrayExpr< ArrayExprUnary<Op, E> >
+{
+public:
+    typedef typename E::value_type value_type;
+
+    ArrayExprUnary(const E &e): e(e)
+    {}
+
+    inline value_type operator[](size_t n) const
+    {
+        return Op::apply(e[n]);
+    }
+
+    const MultidimArray<value_type> * array() const
+    {
+        return e.array();
+    }
+
+private:
+    E e;
+};
+
+/* Operations of the expressions */
+struct ArrayExprPlus
+{
+    template<typename T> static inline T apply(T a, T b) { return a + b; }
+};
+struct ArrayExprMinus
+{
+    template<typename T> static inline T apply(T a, T b) { return a - b; }
+};
+struct ArrayExprMult
+{
+    template<typename T> static inline T apply(T a, T b) { return a * b; }
+};
+struct ArrayExprDivide
+{
+    template<typename T> static inline T apply(T a, T b) { return a / b; }
+};
+struct ArrayExprNegate
+{
+    template<typename T> static inline T apply(T a) { return -a; }
+};
+struct ArrayExprSqrt
+{
+    template<typename T> static inline T apply(T a) { return (T) std::sqrt(a); }
+};
+struct ArrayExprAbs
+{
+    template<typename T> static inline T apply(T a) { return a < 0 ? -a : a; }
+};
+struct ArrayExprExp
+{
+    template<typename T> static inline T apply(T a) { return (T) std::exp(a); }
+};
+struct ArrayExprLog
+{
+    template<typename T> static inline T apply(T a) { return (T) std::log(a); }
+};
+
+/** Array as an operand of an expression */
+template<typename T>
+ArrayExprTerm<T> arrayExpr(const MultidimArray<T> &v)
+{
+    return ArrayExprTerm<T>(v);
+}
+
+/* Operators between expressions, arrays and scalars. At least one of the
+ * operands is an expression, so that the operators of MultidimArray are not
+ * replaced. */
+#define ARRAY_EXPR_OPERATOR(op, Op) \
+template<typename L, typename R> \
+ArrayExprBinary<Op, L, R> operator op(const ArrayExpr<L> &l, const ArrayExpr<R> &r) \
+{ \
+    return ArrayExprBinary<Op, L, R>(l.self(), r.self()); \
+} \
+template<typename L> \
+ArrayExprBinary<Op, L, ArrayExprTerm<typename L::value_type> > \
+operator op(const ArrayExpr<L> &l, const MultidimArray<typename L::value_type> &r) \
+{ \
+    return ArrayExprBinary<Op, L, ArrayExprTerm<typename L::value_type> >(l.self(), r); \
+} \
+template<typename R> \
+ArrayExprBinary<Op, ArrayExprTerm<typename R::value_type>, R> \
+operator op(const MultidimArray<typename R::value_type> &l, const ArrayExpr<R> &r) \
+{ \
+    return ArrayExprBinary<Op, ArrayExprTerm<typename R::value_type>, R>(l, r.self()); \
+} \
+template<typename L> \
+ArrayExprBinary<Op, L, ArrayExprScalar<typename L::value_type> > \
+operator op(const ArrayExpr<L> &l, typename L::value_type r) \
+{ \
+    return ArrayExprBinary<Op, L, ArrayExprScalar<typename L::value_type> >(l.self(), r); \
+} \
+template<typename R> \
+ArrayExprBinary<Op, ArrayExprScalar<typename R::value_type>, R> \
+operator op(typename R::value_type l, const ArrayExpr<R> &r) \
+{ \
+    return ArrayExprBinary<Op, ArrayExprScalar<typename R::value_type>, R>(l, r.self()); \
+}
+ARRAY_EXPR_OPERATOR(+, ArrayExprPlus)
+ARRAY_EXPR_OPERATOR(-, ArrayExprMinus)
+ARRAY_EXPR_OPERATOR(*, ArrayExprMult)
+ARRAY_EXPR_OPERATOR(/, ArrayExprDivide)
+#undef ARRAY_EXPR_OPERATOR
+
+/* Functions of expressions */
+#define ARRAY_EXPR_FUNCTION(f, Op) \
+template<typename E> \
+ArrayExprUnary<Op, E> f(const ArrayExpr<E> &e) \
+{ \
+    return ArrayExprUnary<Op, E>(e.self()); \
+}
+ARRAY_EXPR_FUNCTION(operator-, ArrayExprNegate)
+ARRAY_EXPR_FUNCTION(sqrt, ArrayExprSqrt)
+ARRAY_EXPR_FUNCTION(abs, ArrayExprAbs)
+ARRAY_EXPR_FUNCTION(exp, ArrayExprExp)
+ARRAY_EXPR_FUNCTION(log, ArrayExprLog)
+#undef ARRAY_EXPR_FUNCTION
+
+/* Elements first..last-1 of an expression */
+template<typename T, typename E>
+void evaluateExpressionRange(T * result, const E &expression, size_t first, size_t last)
+{
+    for (size_t n = first; n < last; ++n)
+        result[n] = expression[n];
+}
+
+/* Data shared by the threads of evaluateExpression */
+template<typename T, typename E>
+struct EvaluateExpressionData
+{
+    T * result;
+    const E * expression;
+    ThreadTaskDistributor * distributor;
+};
+
+/* Each thread evaluates the blocks given by the distributor */
+template<typename T, typename E>
+void evaluateExpressionThread(ThreadArgument &thArg)
+{
+    EvaluateExpressionData<T, E> * data = (EvaluateExpressionData<T, E> *) thArg.workClass;
+    size_t first, last;
+    while (data->distributor->getTasks(first, last))
+        evaluateExpressionRange(data->result, *data->expression, first, last + 1);
+}
+
+/// Arrays smaller than this are always evaluated by a single thread
+#define ARRAY_EXPR_MIN_THREAD_SIZE 65536
+
+/** Evaluate an expression.
+ * The result is resized to the shape of the arrays of the expression if it
+ * does not have it. Large arrays are split among nThreads threads.
+ */
+template<typename T, typename E>
+void evaluateExpression(MultidimArray<T> &result, const ArrayExpr<E> &expression, int nThreads = 1)
+{
+    const E &e = expression.self();
+    const MultidimArray<T> * shape = e.array();
+    if (shape == NULL)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "evaluateExpression: the expression has no array");
+    if (result.data == NULL || !result.sameShape(*shape))
+        result.resizeNoCopy(*shape);
+
+    size_t size = MULTIDIM_SIZE(result);
+    if (nThreads > 1 && size >= ARRAY_EXPR_MIN_THREAD_SIZE)
+    {
+        // A few blocks per thread, so that they end at the same time
+        size_t blockSize = XMIPP_MAX(size / (4 * nThreads), (size_t) 1);
+        ThreadTaskDistributor distributor(size, blockSize);
+        EvaluateExpressionData<T, E> data;
+        data.result = MULTIDIM_ARRAY(result);
+        data.expression = &e;
+        data.distributor = &distributor;
+        ThreadManager thMgr(nThreads, &data);
+        thMgr.run(evaluateExpressionThread<T, E>);
+    }
+    else
+        evaluateExpressionRange(MULTIDIM_ARRAY(result), e, 0, size);
+}
+//@}
+#endif
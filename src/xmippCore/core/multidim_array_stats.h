@@ -0,0 +1,319 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_MULTIDIM_ARRAY_STATS_H_
+#define CORE_MULTIDIM_ARRAY_STATS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "multidim_array.h"
+#include "multidim_array_generic.h"
+#include "xmipp_threads.h"
+
+/** @defgroup MultidimArrayStats Statistics of arrays
+ *  @ingroup MultidimensionalArrays
+ *
+ * Average, standard deviation, minimum and maximum of all the elements of a
+ * MultidimArray, or of the elements given by a list of direct indexes, in a
+ * single pass. The sums are accumulated in ARRAY_STATS_LANES independent
+ * lanes, so that the compiler can vectorize the loop, and large arrays are
+ * split among threads. The partial results are always combined in the same
+ * order, so the result does not depend on the scheduling of the threads.
+ *
+ * The index list of a binary mask is computed once with binaryMaskIndexes()
+ * and used for all the images of the same shape.
+ *
+ * @code
+ * ArrayStats stats;
+ * computeArrayStats(I, stats);
+ * std::vector<size_t> bg;
+ * binaryMaskIndexes(mask, I, bg);
+ * computeArrayStats(I, bg, stats, 4); // 4 threads
+ * std::cout << stats.avg() << " " << stats.stddev() << std::endl;
+ * @endcode
+ */
+//@{
+/** Number of elements, sums, minimum and maximum of a set of values */
+class ArrayStats
+{
+public:
+    size_t N;
+    double sum, sum2, minval, maxval;
+
+    ArrayStats()
+    {
+        clear();
+    }
+
+    /** No values */
+    void clear()
+    {
+        N = 0;
+        sum = sum2 = minval = maxval = 0;
+    }
+
+    /** Add the values of other statistics */
+    void merge(const ArrayStats &other)
+    {
+        if (other.N == 0)
+            return;
+        if (N == 0)
+        {
+            *this = other;
+            return;
+        }
+        N += other.N;
+        sum += other.sum;
+        sum2 += other.sum2;
+        minval = XMIPP_MIN(minval, other.minval);
+        maxval = XMIPP_MAX(maxval, other.maxval);
+    }
+
+    /** Average, 0 if there are no values */
+    double avg() const
+    {
+        return N > 0 ? sum / N : 0;
+    }
+
+    /** Standard deviation.
+     * With the N/(N-1) correction, as computeStats_within_binary_mask. It is
+     * 0 if there are less than 2 values.
+     */
+    double stddev() const
+    {
+        if (N < 2)
+            return 0;
+        double mean = sum / N;
+        return sqrt(fabs(sum2 / N - mean * mean) * N / (N - 1));
+    }
+};
+
+/* Access to the elements of the array, or to those of an index list */
+struct ArrayStatsAllElements
+{
+    inline size_t operator[](size_t n) const
+    {
+        return n;
+    }
+};
+struct ArrayStatsIndexedElements
+{
+    const size_t * indexes;
+    inline size_t operator[](size_t n) const
+    {
+        return indexes[n];
+    }
+};
+
+/// Independent partial sums of the single pass
+#define ARRAY_STATS_LANES 4
+
+/* Statistics of the elements first..last-1 */
+template<typename T, typename I>
+void computeArrayStatsRange(const T * data, const I &elements, size_t first, size_t last,
+                            ArrayStats &stats)
+{
+    stats.clear();
+    if (first >= last)
+        return;
+
+    double sum[ARRAY_STATS_LANES], sum2[ARRAY_STATS_LANES];
+    double minval[ARRAY_STATS_LANES], maxval[ARRAY_STATS_LANES];
+    double v0 = data[elements[first]];
+    for (int l = 0; l < ARRAY_STATS_LANES; ++l)
+    {
+        sum[l] = sum2[l] = 0;
+        minval[l] = maxval[l] = v0;
+    }
+
+    size_t n = first;
+    for (; n + ARRAY_STATS_LANES <= last; n += ARRAY_STATS_LANES)
+        for (int l = 0; l < ARRAY_STATS_LANES; ++l)
+        {
+            double v = data[elements[n + l]];
+            sum[l] += v;
+            sum2[l] += v * v;
+            minval[l] = v < minval[l] ? v : minval[l];
+            maxval[l] = v > maxval[l] ? v : maxval[l];
+        }
+    for (; n < last; ++n)
+    {
+        double v = data[elements[n]];
+        sum[0] += v;
+        sum2[0] += v * v;
+        minval[0] = XMIPP_MIN(minval[0], v);
+        maxval[0] = XMIPP_MAX(maxval[0], v);
+    }
+
+    stats.N = last - first;
+    stats.minval = stats.maxval = v0;
+    for (int l = 0; l < ARRAY_STATS_LANES; ++l)
+    {
+        stats.sum += sum[l];
+        stats.sum2 += sum2[l];
+        stats.minval = XMIPP_MIN(stats.minval, minval[l]);
+        stats.maxval = XMIPP_MAX(stats.maxval, maxval[l]);
+    }
+}
+
+/* Data shared by the threads of computeArrayStats */
+template<typename T, typename I>
+struct ArrayStatsData
+{
+    const T * data;
+    const I * elements;
+    size_t blockSize;
+    std::vector<ArrayStats> * blocks;
+    ThreadTaskDistributor * distributor;
+};
+
+/* Each thread computes the statistics of the blocks given by the distributor */
+template<typename T, typename I>
+void computeArrayStatsThread(ThreadArgument &thArg)
+{
+    ArrayStatsData<T, I> * data = (ArrayStatsData<T, I> *) thArg.workClass;
+    size_t first, last;
+    while (data->distributor->getTasks(first, last))
+        computeArrayStatsRange(data->data, *data->elements, first, last + 1,
+                               (*data->blocks)[first / data->blockSize]);
+}
+
+/// Sets of values smaller than this are always processed by a single thread
+#define ARRAY_STATS_MIN_THREAD_SIZE 65536
+
+/* Statistics of size elements, with nThreads threads */
+template<typename T, typename I>
+void computeArrayStats(const T * data, const I &elements, size_t size, ArrayStats &stats,
+                       int nThreads)
+{
+    if (nThreads > 1 && size >= ARRAY_STATS_MIN_THREAD_SIZE)
+    {
+        // A few blocks per thread, so that they end at the same time
+        size_t blockSize = XMIPP_MAX(size / (4 * nThreads), (size_t) 1);
+        std::vector<ArrayStats> blocks((size + blockSize - 1) / blockSize);
+        ThreadTaskDistributor distributor(size, blockSize);
+        ArrayStatsData<T, I> threadData;
+        threadData.data = data;
+        threadData.elements = &elements;
+        threadData.blockSize = blockSize;
+        threadData.blocks = &blocks;
+        threadData.distributor = &distributor;
+        ThreadManager thMgr(nThreads, &threadData);
+        thMgr.run(computeArrayStatsThread<T, I>);
+
+        stats.clear();
+        for (size_t b = 0; b < blocks.size(); ++b)
+            stats.merge(blocks[b]);
+    }
+    else
+        computeArrayStatsRange(data, elements, 0, size, stats);
+}
+
+/** Statistics of all the elements of an array.
+ * Large arrays are split among nThreads threads.
+ */
+template<typename T>
+void computeArrayStats(const MultidimArray<T> &v, ArrayStats &stats, int nThreads = 1)
+{
+    ArrayStatsAllElements elements;
+    computeArrayStats(MULTIDIM_ARRAY(v), elements, MULTIDIM_SIZE(v), stats, nThreads);
+}
+
+/** Statistics of the elements of an array given by their direct indexes.
+ * The indexes are usually the ones of a binary mask, see binaryMaskIndexes().
+ * Long lists are split among nThreads threads.
+ */
+template<typename T>
+void computeArrayStats(const MultidimArray<T> &v, const std::vector<size_t> &indexes,
+                       ArrayStats &stats, int nThreads = 1)
+{
+    if (!indexes.empty() && indexes.back() >= MULTIDIM_SIZE(v))
+        REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, "computeArrayStats: the indexes do not belong to this array");
+    ArrayStatsIndexedElements elements;
+    elements.indexes = indexes.empty() ? NULL : &indexes[0];
+    computeArrayStats(MULTIDIM_ARRAY(v), elements, indexes.size(), stats, nThreads);
+}
+
+/** Statistics of all the elements of a generic array */
+inline void computeArrayStats(const MultidimArrayGeneric &v, ArrayStats &stats, int nThreads = 1)
+{
+#define COMPUTESTATS(type) computeArrayStats(*((MultidimArray<type>*)v.im), stats, nThreads);
+
+    SWITCHDATATYPE(v.datatype, COMPUTESTATS);
+
+#undef COMPUTESTATS
+}
+
+/** Statistics of the elements of a generic array given by their direct indexes */
+inline void computeArrayStats(const MultidimArrayGeneric &v, const std::vector<size_t> &indexes,
+                              ArrayStats &stats, int nThreads = 1)
+{
+#define COMPUTESTATS(type) computeArrayStats(*((MultidimArray<type>*)v.im), indexes, stats, nThreads);
+
+    SWITCHDATATYPE(v.datatype, COMPUTESTATS);
+
+#undef COMPUTESTATS
+}
+
+/** Direct indexes of the elements of v inside a binary mask.
+ * The elements are the ones of the first image of v, in the region in common
+ * with the mask, for which the mask is larger than 0, in increasing order.
+ * The indexes are valid for all the arrays with the shape and origin of v.
+ */
+template<typename T1, typename T>
+void binaryMaskIndexes(const MultidimArray<T1> &mask, const MultidimArray<T> &v,
+                       std::vector<size_t> &indexes)
+{
+    SPEED_UP_tempsInt;
+    indexes.clear();
+    FOR_ALL_ELEMENTS_IN_COMMON_IN_ARRAY3D(mask, v)
+    if (A3D_ELEM(mask, k, i, j) > 0)
+        indexes.push_back(((k - STARTINGZ(v)) * YSIZE(v) + (i - STARTINGY(v))) * XSIZE(v) +
+                          (j - STARTINGX(v)));
+}
+
+/** Quantile of the elements of an array.
+ * The value below which there is a fraction p of the elements, interpolating
+ * linearly between the two closest elements. The elements are found by
+ * selection, without sorting the array. p=0.5 gives the median.
+ */
+template<typename T>
+double computeArrayQuantile(const MultidimArray<T> &v, double p)
+{
+    size_t size = MULTIDIM_SIZE(v);
+    if (size == 0)
+        return 0;
+    std::vector<T> temp(MULTIDIM_ARRAY(v), MULTIDIM_ARRAY(v) + size);
+    double position = CLIP(p, 0., 1.) * (size - 1);
+    size_t n = (size_t) floor(position);
+    std::nth_element(temp.begin(), temp.begin() + n, temp.end());
+    double lower = temp[n];
+    if (n + 1 == size)
+        return lower;
+    // The upper part is after the selected element
+    double upper = *std::min_element(temp.begin() + n + 1, temp.end());
+    return lower + (position - n) * (upper - lower);
+}
+//@}
+#endif
@@ -26,6 +26,9 @@
 #include "xmipp_image_base.h"
 #include "xmipp_hdf5.h"
 
+// Compression level of the deflate filter when it is not given
+#define HDF5_DEFAULT_DEFLATE 4
+
 
 
 DataType ImageBase::datatypeH5(hid_t h5datatype)
@@ -173,6 +176,32 @@ int ImageBase::readHDF5(size_t select_img)
 
     cparms = H5Dget_create_plist(dataset); /* Get properties handle first. */
 
+    // The chunk cache must hold a whole chunk, otherwise the chunks read partially
+    // are read and decompressed again for every access
+    if (H5Pget_layout(cparms) == H5D_CHUNKED)
+    {
+        hsize_t chunk[4];
+        int chunkRank = H5Pget_chunk(cparms, 4, chunk);
+        hid_t h5datatype = H5Dget_type(dataset);
+        size_t chunkBytes = H5Tget_size(h5datatype);
+        H5Tclose(h5datatype);
+        for (int i = 0; i < chunkRank; ++i)
+            chunkBytes *= chunk[i];
+
+        hid_t dapl = H5Dget_access_plist(dataset);
+        size_t nslots, nbytes;
+        double w0;
+        H5Pget_chunk_cache(dapl, &nslots, &nbytes, &w0);
+        if (chunkBytes > nbytes)
+        {
+            // Chunks already read are not needed anymore
+            H5Pset_chunk_cache(dapl, nslots, chunkBytes, 1.);
+            H5Dclose(dataset);
+            dataset = H5Dopen2(fhdf5, dsname.c_str(), dapl);
+        }
+        H5Pclose(dapl);
+    }
+
     // Get dataset rank and dimension.
     filespace = H5Dget_space(dataset);    /* Get filespace handle first. */
     //    rank      = H5Sget_simple_extent_ndims(filespace);
@@ -204,12 +233,14 @@ int ImageBase::readHDF5(size_t select_img)
     }
 
     DataType datatype = datatypeH5(h5datatype);
+    H5Tclose(h5datatype);
     MDMainHeader.setValue(MDL_DATATYPE,(int) datatype);
 
     // Setting isStack depending on provider
     switch (provider.first)
     {
     case MISTRAL: // rank 3 arrays are stacks
+    case XMIPP:
         isStack = true;
         break;
         //    case EMAN: // Images in stack are stored in separated groups
@@ -236,7 +267,13 @@ int ImageBase::readHDF5(size_t select_img)
 
     //Read header only
     if(dataMode == HEADER || (dataMode == _HEADER_ALL && aDim.ndim > 1))
+    {
+        // The file cannot be closed while its objects are open
+        H5Pclose(cparms);
+        H5Sclose(filespace);
+        H5Dclose(dataset);
         return errCode;
+    }
 
 
     // EMAN stores each image in a separate dataset
@@ -252,7 +289,12 @@ int ImageBase::readHDF5(size_t select_img)
     MD.resize(imgEnd - imgStart,MDL::emptyHeader);
 
     if (dataMode < DATA)   // Don't read  data if not necessary but read the header
+    {
+        H5Pclose(cparms);
+        H5Sclose(filespace);
+        H5Dclose(dataset);
         return errCode;
+    }
 
     if ( H5Pget_layout(cparms) == H5D_CONTIGUOUS ) //We can read it directly
         readData(fimg, select_img, datatype, 0);
@@ -267,54 +309,31 @@ int ImageBase::readHDF5(size_t select_img)
         hsize_t offset[4]; // Hyperslab offset in the file
         hsize_t  count[4]; // Size of the hyperslab in the file
 
-        // Define the offset and count of the hyperslab to be read.
-
-        switch (rank)
+        // The whole dataset but the images, which are the first dimension of
+        // stacks, are read at once with a single hyperslab
+        for (int i = 0; i < rank; ++i)
         {
-        case 4:
-            count[0] = 1;
-        case 3:
-            //            if (stack)
-            count[rank-3] = aDim.zdim;
-            offset[rank-2]  = 0;
-        case 2:
-            count[rank-2]  = aDim.ydim;
-            offset[rank-2]  = 0;
-            break;
+            offset[i] = 0;
+            count[i] = dims[i];
+        }
+        if (rank == 4 || (rank == 3 && isStack))
+        {
+            offset[0] = imgStart;
+            count[0] = imgEnd - imgStart;
         }
-        count[rank-1]  = aDim.xdim;
-        offset[rank-1]  = 0;
-
-        aDim.xdim = dims[rank-1];
-        aDim.ydim = (rank>1)?dims[rank-2]:1;
-        aDim.zdim = (rank == 4)?dims[1]:1;
-        // size_t nDimFile = (rank>2)?dims[0]:1 ;
 
         // Define the memory space to read a hyperslab.
         memspace = H5Screate_simple(rank,count,NULL);
 
-        size_t data = (size_t) this->mdaBase->getArrayPointer();
-        size_t pad = aDim.zyxdim*gettypesize(myT());
-
+        if ( H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+                                 count, NULL) < 0 )
+            REPORT_ERROR(ERR_IO_NOREAD, formatString("readHDF5: Error selecting hyperslab %d from filename %s",
+                         imgStart, filename.c_str()));
 
-        for (size_t idx = imgStart, imN = 0; idx < imgEnd; ++idx, ++imN)
-        {
-
-            // Set the offset of the hyperslab to be read
-            offset[0] = idx;
-
-            if ( H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-                                     count, NULL) < 0 )
-                REPORT_ERROR(ERR_IO_NOREAD, formatString("readHDF5: Error selecting hyperslab %d from filename %s",
-                             imgStart, filename.c_str()));
-
-            //            movePointerTo(ALL_SLICES,imN);
-            // Read
-            if ( H5Dread(dataset, H5Datatype(myT()), memspace, filespace,
-                         H5P_DEFAULT, (void*)(data + pad*imN)) < 0 )
-                REPORT_ERROR(ERR_IO_NOREAD,formatString("readHDF5: Error reading hyperslab %d from filename %s",
-                                                        imgStart, filename.c_str()));
-        }
+        if ( H5Dread(dataset, H5Datatype(myT()), memspace, filespace,
+                     H5P_DEFAULT, this->mdaBase->getArrayPointer()) < 0 )
+            REPORT_ERROR(ERR_IO_NOREAD,formatString("readHDF5: Error reading hyperslab %d from filename %s",
+                                                    imgStart, filename.c_str()));
         H5Sclose(memspace);
     }
 
@@ -327,5 +346,177 @@ int ImageBase::readHDF5(size_t select_img)
 
 int ImageBase::writeHDF5(size_t select_img, bool isStack, int mode, String bitDepth, CastWriteMode castMode)
 {
-    REPORT_ERROR(ERR_NOT_IMPLEMENTED, "writeHDF5: Not implemented yet.");
+    if (isComplexT())
+        REPORT_ERROR(ERR_TYPE_INCORRECT,"rwHDF5: Complex images are not supported by HDF5 format.");
+
+    // Datatype and storage options: [datatype][,chunk=<images>][,deflate=<level>][,shuffle]
+    StringVector params;
+    splitString(bitDepth, ",", params);
+    String strDT;
+    size_t chunkImages = 1;
+    int deflateLevel = -1;
+    bool shuffle = false;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        if (params[i].find("chunk=") == 0)
+            chunkImages = textToInteger(params[i].substr(6));
+        else if (params[i].find("deflate=") == 0)
+            deflateLevel = textToInteger(params[i].substr(8));
+        else if (params[i] == "deflate")
+            deflateLevel = HDF5_DEFAULT_DEFLATE;
+        else if (params[i] == "shuffle")
+            shuffle = true;
+        else
+            strDT = params[i];
+    }
+    if (chunkImages < 1 || deflateLevel > 9)
+        REPORT_ERROR(ERR_ARG_INCORRECT, formatString("rwHDF5: incorrect storage options %s", bitDepth.c_str()));
+
+    DataType wDType, myTypeID = myT();
+    if (strDT.empty())
+    {
+        castMode = CW_CAST;
+        wDType = myTypeID;
+    }
+    else
+        wDType = (strDT == "default") ? DT_Float : datatypeRAW(strDT);
+    hid_t h5datatype = H5Datatype(wDType);
+
+    /* As we cannot mmap a HDF5 File, when this option is passed we are going to
+     * allocate the multidimarray of Image, after creating the dataset of the stack
+     */
+    bool allocateOnly = mmapOnWrite;
+    if (mmapOnWrite)
+    {
+        mmapOnWrite = false;
+        MDMainHeader.setValue(MDL_DATATYPE,(int) myTypeID);
+    }
+
+    ArrayDim aDim;
+    mdaBase->getDimensions(aDim);
+
+    String dsname = filename.getBlockName();
+    if (dsname.empty())
+        dsname = H5ProviderMap.find("Xmipp")->second.second;
+
+    // Images are the first dimension of the dataset, 2D images are stored in rank 3
+    int rank = (aDim.zdim > 1) ? 4 : 3;
+    hsize_t dims[4], maxdims[4], offset[4], count[4];
+    dims[0] = 0;
+    maxdims[0] = H5S_UNLIMITED;
+    count[0] = aDim.ndim;
+    dims[rank-1] = maxdims[rank-1] = count[rank-1] = aDim.xdim;
+    dims[rank-2] = maxdims[rank-2] = count[rank-2] = aDim.ydim;
+    if (rank == 4)
+        dims[1] = maxdims[1] = count[1] = aDim.zdim;
+    for (int i = 0; i < rank; ++i)
+        offset[i] = 0;
+    offset[0] = (mode == WRITE_APPEND) ? replaceNsize : IMG_INDEX(select_img);
+
+    hid_t dataset = -1;
+    if (mode != WRITE_OVERWRITE)
+    {
+        H5E_BEGIN_TRY
+        {
+            dataset = H5Dopen2(fhdf5, dsname.c_str(), H5P_DEFAULT);
+        }
+        H5E_END_TRY;
+    }
+
+    hid_t filespace;
+    if (dataset < 0)
+    {
+        // Chunked dataset, so that images can be appended and compressed
+        hsize_t chunk[4];
+        for (int i = 1; i < rank; ++i)
+            chunk[i] = dims[i];
+        chunk[0] = chunkImages;
+        dims[0] = offset[0] + aDim.ndim;
+
+        hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+        H5Pset_chunk(dcpl, rank, chunk);
+        if (shuffle)
+            H5Pset_shuffle(dcpl);
+        if (deflateLevel >= 0)
+        {
+            if (!H5Zfilter_avail(H5Z_FILTER_DEFLATE))
+                REPORT_ERROR(ERR_NOT_IMPLEMENTED, "rwHDF5: deflate filter is not available.");
+            H5Pset_deflate(dcpl, deflateLevel);
+        }
+        hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+        H5Pset_create_intermediate_group(lcpl, 1);
+        filespace = H5Screate_simple(rank, dims, maxdims);
+        dataset = H5Dcreate2(fhdf5, dsname.c_str(), h5datatype, filespace, lcpl, dcpl, H5P_DEFAULT);
+        H5Pclose(lcpl);
+        H5Pclose(dcpl);
+        if (dataset < 0)
+            REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Cannot create dataset '%s' in %s",
+                         dsname.c_str(), filename.c_str()));
+    }
+    else
+    {
+        filespace = H5Dget_space(dataset);
+        if (H5Sget_simple_extent_dims(filespace, dims, NULL) != rank)
+            REPORT_ERROR(ERR_MULTIDIM_DIM, formatString("writeHDF5: Dataset '%s' has different dimensions",
+                         dsname.c_str()));
+        if (offset[0] + aDim.ndim > dims[0])
+        {
+            dims[0] = offset[0] + aDim.ndim;
+            H5Sclose(filespace);
+            if (H5Dset_extent(dataset, dims) < 0)
+                REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Cannot extend dataset '%s'",
+                             dsname.c_str()));
+            filespace = H5Dget_space(dataset);
+        }
+    }
+
+    // Only write images when needed
+    if (dataMode >= DATA && !allocateOnly)
+    {
+        if (wDType == myTypeID)
+        {
+            // All images are written at once from the array
+            hid_t memspace = H5Screate_simple(rank, count, NULL);
+            H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
+            if (H5Dwrite(dataset, h5datatype, memspace, filespace, H5P_DEFAULT,
+                         mdaBase->getArrayPointer()) < 0)
+                REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Error writing %s", filename.c_str()));
+            H5Sclose(memspace);
+        }
+        else
+        {
+            // Images are converted one by one
+            size_t datasize_n = aDim.zyxdim;
+            std::vector<char> page(datasize_n * gettypesize(wDType));
+            count[0] = 1;
+            hid_t memspace = H5Screate_simple(rank, count, NULL);
+            size_t imgStart = offset[0];
+            for (size_t i = 0; i < aDim.ndim; ++i)
+            {
+                if (castMode == CW_CAST)
+                    getPageFromT(i*datasize_n, &page[0], wDType, datasize_n);
+                else
+                {
+                    double min0, max0;
+                    mdaBase->computeDoubleMinMaxRange(min0, max0, i*datasize_n, datasize_n);
+                    getCastConvertPageFromT(i*datasize_n, &page[0], wDType, datasize_n, min0, max0, castMode);
+                }
+                offset[0] = imgStart + i;
+                H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
+                if (H5Dwrite(dataset, h5datatype, memspace, filespace, H5P_DEFAULT, &page[0]) < 0)
+                    REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Error writing %s", filename.c_str()));
+            }
+            H5Sclose(memspace);
+        }
+    }
+
+    H5Sclose(filespace);
+    H5Dclose(dataset);
+
+    if (allocateOnly)
+    {
+        dataMode = DATA;
+        mdaBase->coreAllocateReuse();
+    }
+    return 0;
 }
@@ -44,10 +44,21 @@ hid_t H5Datatype(DataType datatype);
 
 
 /** Read Images from HDF5 container files.
+  * The images of chunked datasets are read with a single hyperslab.
   */
 int readHDF5(size_t select_img);
 
 /** Write Images to HDF5 container files.
+  * Images are stored in a chunked dataset, /Xmipp/images by default, whose first
+  * dimension is the image number. The storage options follow the datatype after
+  * the "%" symbol, separated by commas:
+  * - chunk=<n>: images per chunk (1 by default)
+  * - deflate[=<level>]: deflate compression (level 4 by default)
+  * - shuffle: byte shuffling before the compression
+  *
+  * @code
+  * img.write("particles.h5%uint16,deflate,shuffle");
+  * @endcode
   */
 int writeHDF5(size_t select_img, bool isStack=false, int mode=WRITE_OVERWRITE, String bitDepth="", CastWriteMode castMode = CW_CAST);
 
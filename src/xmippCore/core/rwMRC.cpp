@@ -306,13 +306,11 @@ int ImageBase::readMRC(size_t select_img, bool isStack)
 
     // Lets read the data
 
-    // 4-bits mode: Here is the magic to expand the compressed images
-    if (datatype == DT_UHalfByte){
+    // 4-bits mode: the values are unpacked from the file
+    if (datatype == DT_UHalfByte)
         readData4bit(fimg, select_img, datatype, 0);
-    }
-    else{
+    else
         readData(fimg, select_img, datatype, 0);
-    }
 
     return errCode;
 }
@@ -392,6 +390,9 @@ int ImageBase::writeMRC(size_t select_img, bool isStack, int mode, const String
         case DT_CDouble:
             header->mode = 4;
             break;
+        case DT_UHalfByte:
+            header->mode = 101;
+            break;
         default:
             REPORT_ERROR(ERR_TYPE_INCORRECT,"ERROR: incorrect MRC bits depth value.");
         }
@@ -402,7 +403,10 @@ int ImageBase::writeMRC(size_t select_img, bool isStack, int mode, const String
         MDMainHeader.setValue(MDL_DATATYPE,(int) wDType);
         if (!checkMmapT(wDType))
         {
-            if (dataMode < DATA && castMode == CW_CAST) // This means ImageGeneric wants to know which DataType must use in mapFile2Write
+            /* Packed 4-bit pages cannot be mapped as any T, so they are always written
+             * from memory by writeData4bit when the image is closed.
+             */
+            if (dataMode < DATA && castMode == CW_CAST && wDType != DT_UHalfByte) // This means ImageGeneric wants to know which DataType must use in mapFile2Write
                 return 0;
             else //Mapping is an extra. When not available, go on and do not report an error.
             {
@@ -537,6 +541,9 @@ int ImageBase::writeMRC(size_t select_img, bool isStack, int mode, const String
     size_t datasize, datasize_n;
     datasize_n = Xdim*Ydim*Zdim;
     datasize = datasize_n * gettypesize(wDType);
+    // 4-bit values are packed two per byte and every row starts at a byte boundary
+    if (wDType == DT_UHalfByte)
+        datasize = (Xdim + 1) / 2 * Ydim * Zdim;
 
     //#define DEBUG
 #ifdef DEBUG
@@ -614,6 +621,8 @@ int ImageBase::writeMRC(size_t select_img, bool isStack, int mode, const String
                 fseek(fimg, datasize-1, SEEK_CUR);
                 fputc(0, fimg);
             }
+            else if (wDType == DT_UHalfByte)
+                writeData4bit(fimg, i*datasize_n, Xdim, Ydim*Zdim, castMode);
             else
                 writeData(fimg, i*datasize_n, wDType, datasize_n, castMode);
         }
@@ -20,6 +20,8 @@ int readMRC(size_t select_img, bool isStack=false);
 
 /** MRC Writer
   * @ingroup MRC
+  * Counting mode movies can be written in 4 bits (mode 101) with the uint4
+  * bit depth, e.g. "movie.mrcs%uint4".
 */
 int writeMRC(size_t select_img, bool isStack=false, int mode=WRITE_OVERWRITE, const String &bitDepth="", CastWriteMode castMode = CW_CAST);
 
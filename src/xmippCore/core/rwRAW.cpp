@@ -32,6 +32,8 @@ DataType ImageBase::datatypeRAW(String strDT)
 
     if(strDT=="uint8")
         datatype = DT_UChar;
+    else if (strDT=="uint4" || strDT=="uhalfint8")
+        datatype = DT_UHalfByte;
     else if (strDT=="int8")
         datatype = DT_SChar;
     else if (strDT=="uint16")
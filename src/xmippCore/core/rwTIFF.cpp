@@ -23,7 +23,10 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <algorithm>
 #include "xmipp_image_base.h"
+#include "xmipp_datatype_cast.h"
+#include "xmipp_threads.h"
 
 /**
  * castTiffTile2T
@@ -39,7 +42,6 @@ void ImageBase::castTiffTile2T(
     unsigned short samplesPerPixel,
     DataType datatype)
 {
-    int typeSize = gettypesize(datatype);
     unsigned int i, j;
     unsigned int x_max = x + tileWidth,
                          y_max = y + tileLength;
@@ -49,10 +51,31 @@ void ImageBase::castTiffTile2T(
     if (y_max > imageLength)
         y_max = imageLength;
 
+    // 4-bit samples are unpacked to one byte per sample row by row
+    size_t rowSamples = (size_t) tileWidth * samplesPerPixel;
+    size_t sampleSize = gettypesize(datatype);
+    size_t rowBytes = rowSamples * sampleSize;
+    std::vector<unsigned char> unpacked;
+    if (datatype == DT_UHalfByte)
+    {
+        rowBytes = (rowSamples + 1) / 2;
+        unpacked.resize(rowSamples);
+    }
 
     for (j = y; j < y_max; j++)
-        for (i = x; i < x_max; i++)
-            setPage2T(offset+(j*imageWidth + i), (char*) tif_buf+((j-y)*samplesPerPixel*typeSize*tileWidth+(i-x)*samplesPerPixel*typeSize), datatype, (size_t) 1);
+    {
+        char * row = tif_buf + (j - y) * rowBytes;
+        if (datatype == DT_UHalfByte)
+        {
+            unpackNibbles((unsigned char *) row, &unpacked[0], rowSamples, true);
+            row = (char *) &unpacked[0];
+        }
+        if (samplesPerPixel == 1)
+            setPage2T(offset + ((size_t) j*imageWidth + x), row, datatype, (size_t) (x_max - x));
+        else
+            for (i = x; i < x_max; i++)
+                setPage2T(offset+((size_t) j*imageWidth + i), row + (i-x)*samplesPerPixel*sampleSize, datatype, (size_t) 1);
+    }
 }
 
 /** castTiffLine2T
@@ -70,8 +93,11 @@ void ImageBase::castTiffLine2T(
     unsigned int x;
     int typeSize = gettypesize(datatype);
 
-    for (x = 0; x < imageWidth; x++)
-        setPage2T(offset+(y*imageWidth + x), (char*) tif_buf+(samplesPerPixel*typeSize * x), datatype, (size_t) 1);
+    if (samplesPerPixel == 1)
+        setPage2T(offset + (size_t) y*imageWidth, tif_buf, datatype, (size_t) imageWidth);
+    else
+        for (x = 0; x < imageWidth; x++)
+            setPage2T(offset+((size_t) y*imageWidth + x), (char*) tif_buf+(samplesPerPixel*typeSize * x), datatype, (size_t) 1);
 }
 
 /** Determine datatype of the TIFF format file.
@@ -83,6 +109,9 @@ DataType ImageBase::datatypeTIFF(TIFFDirHead dHead)
 
     switch (dHead.bitsPerSample)
     {
+    case 4:
+        datatype = DT_UHalfByte;
+        break;
     case 8:
         if (dHead.imageSampleFormat == SAMPLEFORMAT_INT)
             datatype = DT_SChar;
@@ -123,6 +152,127 @@ DataType ImageBase::datatypeTIFF(TIFFDirHead dHead)
     return datatype;
 }
 
+/**
+ *  Read the image of the current directory of a TIFF file.
+*/
+void ImageBase::readTIFFDirectory(TIFF* tif, const TIFFDirHead &dHead, size_t offset)
+{
+    DataType datatype = datatypeTIFF(dHead);
+    // If samplesPerPixel is higher than 3 it means there are extra samples, as associated alpha data
+    // Greyscale images are usually samplesPerPixel=1
+    // RGB images are usually samplesPerPixel=3 (this is only implemented for untiled 8-bit tiffs)
+    unsigned short samplesPerPixel = (dHead.samplesPerPixel > 3) ? 1 : dHead.samplesPerPixel;
+    size_t width = dHead.imageWidth;
+    char*  tif_buf = NULL;
+
+    if (TIFFIsTiled(tif))
+    {
+        // Dimensions of tiles
+        uint32 tileWidth = 0, tileLength = 0;
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH,&tileLength);
+        tsize_t tileSize = TIFFTileSize(tif);
+        if ((tif_buf = (char*)_TIFFmalloc(tileSize)) == NULL)
+            REPORT_ERROR(ERR_MEM_NOTENOUGH, "rwTIFF: No space for tile buffer");
+
+        for (uint32 y = 0; y < dHead.imageLength; y += tileLength)
+            for (uint32 x = 0; x < dHead.imageWidth; x += tileWidth)
+            {
+                if (TIFFReadEncodedTile(tif, TIFFComputeTile(tif, x, y, 0, 0), tif_buf, tileSize) < 0)
+                {
+                    _TIFFfree(tif_buf);
+                    REPORT_ERROR(ERR_IO_NOREAD, formatString("rwTIFF: Error reading a tile of %s", TIFFFileName(tif)));
+                }
+                castTiffTile2T(offset, tif_buf, x, y,
+                               dHead.imageWidth, dHead.imageLength,
+                               tileWidth, tileLength,
+                               samplesPerPixel, datatype);
+            }
+    }
+    else
+    {
+        // Whole strips are decoded and cast at once
+        uint32 rowsPerStrip;
+        TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+        rowsPerStrip = std::min(rowsPerStrip, (uint32) dHead.imageLength);
+        tsize_t scanline = TIFFScanlineSize(tif);
+        if ((tif_buf = (char*)_TIFFmalloc(scanline * rowsPerStrip)) == NULL)
+            REPORT_ERROR(ERR_MEM_NOTENOUGH, "rwTIFF: No space for strip buffer");
+        std::vector<unsigned char> unpacked;
+        if (datatype == DT_UHalfByte)
+            unpacked.resize(rowsPerStrip * width);
+
+        for (uint32 y = 0; y < dHead.imageLength; y += rowsPerStrip)
+        {
+            uint32 nRows = std::min(rowsPerStrip, (uint32) dHead.imageLength - y);
+            if (TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, y, 0), tif_buf, nRows * scanline) < 0)
+            {
+                _TIFFfree(tif_buf);
+                REPORT_ERROR(ERR_IO_NOREAD, formatString("rwTIFF: Error reading a strip of %s", TIFFFileName(tif)));
+            }
+            if (datatype == DT_UHalfByte)
+            {
+                // Rows start at a byte boundary
+                for (uint32 r = 0; r < nRows; ++r)
+                    unpackNibbles((unsigned char *) tif_buf + r * scanline, &unpacked[r * width], width, true);
+                setPage2T(offset + y * width, (char *) &unpacked[0], datatype, nRows * width);
+            }
+            else if (samplesPerPixel == 1 && (size_t) scanline == width * gettypesize(datatype))
+                setPage2T(offset + y * width, tif_buf, datatype, nRows * width);
+            else
+                for (uint32 r = 0; r < nRows; ++r)
+                    castTiffLine2T(offset, tif_buf + r * scanline, y + r,
+                                   dHead.imageWidth, dHead.imageLength,
+                                   samplesPerPixel, datatype);
+        }
+    }
+    _TIFFfree(tif_buf);
+}
+
+// Threads decoding the frames of compressed stacks, set by each thread for its own reads
+static thread_local size_t tiffReadThreads = 1;
+
+void ImageBase::setTIFFReadThreads(size_t nThreads)
+{
+    tiffReadThreads = std::max(nThreads, (size_t) 1);
+}
+
+size_t ImageBase::getTIFFReadThreads()
+{
+    return tiffReadThreads;
+}
+
+void ImageBase::threadReadTIFFFrames(ThreadArgument &thArg)
+{
+    TIFFFrameReader * reader = (TIFFFrameReader *) thArg.workClass;
+    TIFF * tif = TIFFOpen(reader->fileName.c_str(), "r");
+    try
+    {
+        if (tif == NULL)
+            REPORT_ERROR(ERR_IO_NOTOPEN, "rwTIFF: There is a problem opening the TIFF file.");
+        while (true)
+        {
+            reader->mutex.lock();
+            size_t i = reader->next++;
+            bool finished = i >= reader->imgEnd || !reader->error.empty();
+            reader->mutex.unlock();
+            if (finished)
+                break;
+            if (!TIFFSetDirectory(tif, (tdir_t) i))
+                REPORT_ERROR(ERR_IO_NOREAD, formatString("rwTIFF: Cannot read directory %lu", i));
+            reader->image->readTIFFDirectory(tif, (*reader->dirHead)[i], reader->pad * (i - reader->imgStart));
+        }
+    }
+    catch (XmippError &xe)
+    {
+        reader->mutex.lock();
+        reader->error = xe.getMessage();
+        reader->mutex.unlock();
+    }
+    if (tif != NULL)
+        TIFFClose(tif);
+}
+
 /**
  *  Read TIFF format files.
 */
@@ -136,7 +286,6 @@ int ImageBase::readTIFF(size_t select_img, bool isStack)
 
     //    TIFFSetWarningHandler(NULL); // Switch off warning messages
 
-    char*  tif_buf = NULL;
     std::vector<TIFFDirHead> dirHead;
     TIFFDirHead dhRef;
 
@@ -251,82 +400,39 @@ int ImageBase::readTIFF(size_t select_img, bool isStack)
     mdaBase->coreAllocateReuse();
 
     size_t pad = aDim.yxdim;
-    int imReaded = 0;
 
     MD.clear();
     MD.resize(aDim.ndim,MDL::emptyHeader);
 
-    uint32 rowsperstrip;
-    tsize_t scanline;
-
-    unsigned int x, y;
-    // Dimensions of tiles
-    unsigned int tileWidth, tileLength;
-    tileWidth = tileLength = 0;
+    // The frames of compressed movies may be decoded in parallel, each thread with its own handler
+    uint16 compression = COMPRESSION_NONE;
+    TIFFSetDirectory(tif,(tdir_t) imgStart);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+    size_t nThreads = 1;
+    if (compression != COMPRESSION_NONE)
+        nThreads = std::max(std::min(imgEnd - imgStart, tiffReadThreads), (size_t) 1);
 
-    for (size_t i = imgStart; i < imgEnd; ++i)
+    if (nThreads > 1)
     {
-        TIFFSetDirectory(tif,(tdir_t) i);
-
-        // If samplesPerPixel is higher than 3 it means there are extra samples, as associated alpha data
-        // Greyscale images are usually samplesPerPixel=1
-        // RGB images are usually samplesPerPixel=3 (this is only implemented for untiled 8-bit tiffs)
-        if (dirHead[i].samplesPerPixel > 3)
-            dirHead[i].samplesPerPixel = 1;
-
-        if (TIFFIsTiled(tif))
-        {
-            TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
-            TIFFGetField(tif, TIFFTAG_TILELENGTH,&tileLength);
-            tif_buf = (char*)_TIFFmalloc(TIFFTileSize(tif));
-        }
-        else
-        {
-            TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsperstrip);
-            scanline = TIFFScanlineSize(tif);
-            tif_buf = (char*)_TIFFmalloc(scanline);
-        }
-        if (tif_buf == 0)
-        {
-            TIFFError(TIFFFileName(tif), "No space for strip buffer");
-            exit(-1);
-        }
-
-        /* Start to convert the TIFF image to type T */
-
-        datatype = datatypeTIFF(dirHead[i]);
-
-        if (TIFFIsTiled(tif))
-        {
-            for (y = 0; y < dirHead[0].imageLength; y += tileLength)
-                for (x = 0; x < dirHead[0].imageWidth; x += tileWidth)
-                {
-                    TIFFReadTile(tif, tif_buf, x, y, 0, 0);
-                    if (swap)
-                        swapPage((char*)tif_buf, TIFFTileSize(tif)*sizeof(unsigned char), datatype);
-
-                    castTiffTile2T((pad*imReaded), tif_buf, x, y,
-                                   dirHead[i].imageWidth, dirHead[i].imageLength,
-                                   tileWidth, tileLength,
-                                   dirHead[i].samplesPerPixel,
-                                   datatype);
-                }
-        }
-        else
+        TIFFFrameReader reader;
+        reader.image = this;
+        reader.fileName = TIFFFileName(tif);
+        reader.dirHead = &dirHead;
+        reader.imgStart = reader.next = imgStart;
+        reader.imgEnd = imgEnd;
+        reader.pad = pad;
+        ThreadManager thMgr(nThreads, &reader);
+        thMgr.run(threadReadTIFFFrames);
+        if (!reader.error.empty())
+            REPORT_ERROR(ERR_IO_NOREAD, formatString("readTIFF (%s): %s", filename.c_str(), reader.error.c_str()));
+    }
+    else
+        for (size_t i = imgStart; i < imgEnd; ++i)
         {
-            for (y = 0; y < dirHead[i].imageLength; y++)
-            {
-                TIFFReadScanline(tif, tif_buf, y);
-                castTiffLine2T((pad*imReaded), tif_buf, y,
-                               dirHead[i].imageWidth, dirHead[i].imageLength,
-                               dirHead[i].samplesPerPixel,
-                               datatype);
-            }
+            TIFFSetDirectory(tif,(tdir_t) i);
+            readTIFFDirectory(tif, dirHead[i], pad * (i - imgStart));
         }
 
-        ++imReaded;
-        _TIFFfree(tif_buf);
-    }
     return 0;
 }
 
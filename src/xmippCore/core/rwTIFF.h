@@ -52,6 +52,20 @@ struct TIFFDirHead
     }
 };
 
+/** Frames of a TIFF movie decoded by several threads
+*/
+struct TIFFFrameReader
+{
+    ImageBase * image;
+    String fileName;
+    std::vector<TIFFDirHead> * dirHead;
+    size_t imgStart, imgEnd, pad;
+    // Protected by mutex
+    Mutex mutex;
+    size_t next;
+    String error;
+};
+
 /** castTiffTile2T
   * write the content of a tile from a TIFF file to an image array
   */
@@ -80,7 +94,20 @@ void castTiffLine2T(
   */
 DataType datatypeTIFF(TIFFDirHead dHead);
 
+/** Read the image of the current directory of a TIFF file.
+  * The image is decoded a whole strip or tile at a time and stored in
+  * the image array from offset.
+  */
+void readTIFFDirectory(TIFF* tif, const TIFFDirHead &dHead, size_t offset);
+
+/** Work function of the threads that decode the frames of a TIFF movie.
+  * Each thread opens its own handler of the file.
+  */
+static void threadReadTIFFFrames(ThreadArgument &thArg);
+
 /** Read TIFF format files.
+  * The frames of compressed stacks are decoded in parallel when
+  * setTIFFReadThreads was called with more than one thread.
   */
 int readTIFF(size_t select_img, bool isStack=false);
 
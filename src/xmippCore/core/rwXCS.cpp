@@ -0,0 +1,479 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <limits>
+#include <unistd.h>
+#include <zlib.h>
+#include "xmipp_image_base.h"
+#include "xmipp_datatype_cast.h"
+#include "xmipp_threads.h"
+
+// Identifier and version of the format
+#define XCS_MAGIC "XCS1"
+
+// The read-write lock of every open XCS file and the number of XCSFileLock
+// objects using it. The file locks of other processes may not exclude the
+// threads of this one, which also read and update the index.
+struct XCSThreadLock
+{
+    pthread_rwlock_t rwlock;
+    size_t users;
+};
+static std::map<String, XCSThreadLock *> xcsFileLocks;
+static Mutex xcsFileLocksMutex;
+
+/** Shared (readers) or exclusive (writers) lock of an XCS file, of the
+ * other threads and of the other processes, while the object exists.
+ *
+ * Open file description locks are used when the kernel has them, since the
+ * classic fcntl locks of a process are all released when any of its
+ * descriptors of the file is closed.
+ */
+class XCSFileLock
+{
+    String fn;
+    XCSThreadLock * threadLock;
+    int fd;
+    int unlockCmd;
+public:
+    XCSFileLock(const String &_fn, FILE * file, bool shared): fn(_fn)
+    {
+        xcsFileLocksMutex.lock();
+        XCSThreadLock * &fileLock = xcsFileLocks[fn];
+        if (fileLock == NULL)
+        {
+            fileLock = new XCSThreadLock;
+            pthread_rwlock_init(&fileLock->rwlock, NULL);
+            fileLock->users = 0;
+        }
+        ++fileLock->users;
+        threadLock = fileLock;
+        xcsFileLocksMutex.unlock();
+        if (shared)
+            pthread_rwlock_rdlock(&threadLock->rwlock);
+        else
+            pthread_rwlock_wrlock(&threadLock->rwlock);
+
+        fd = fileno(file);
+        struct flock fl;
+        memset(&fl, 0, sizeof(fl));
+        fl.l_type = shared ? F_RDLCK : F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        unlockCmd = F_SETLK;
+#ifdef F_OFD_SETLKW
+        if (fcntl(fd, F_OFD_SETLKW, &fl) == 0)
+            unlockCmd = F_OFD_SETLK;
+        else if (errno == EINVAL) // Kernel without open file description locks
+#endif
+            fcntl(fd, F_SETLKW, &fl);
+    }
+    ~XCSFileLock()
+    {
+        struct flock fl;
+        memset(&fl, 0, sizeof(fl));
+        fl.l_type = F_UNLCK;
+        fl.l_whence = SEEK_SET;
+        fcntl(fd, unlockCmd, &fl);
+        pthread_rwlock_unlock(&threadLock->rwlock);
+
+        xcsFileLocksMutex.lock();
+        if (--threadLock->users == 0)
+        {
+            pthread_rwlock_destroy(&threadLock->rwlock);
+            delete threadLock;
+            xcsFileLocks.erase(fn);
+        }
+        xcsFileLocksMutex.unlock();
+    }
+};
+
+/* Regions of the file not used by the header, the index or the blocks of
+ * the images. New blocks and indexes are written in them, so that the file
+ * keeps its previous content until the header points to the new index.
+ */
+class XCSFreeSpace
+{
+    // Start and end of the free regions, the last one ends at the end of the file
+    std::vector< std::pair<uint64_t, uint64_t> > gaps;
+public:
+    /** Free regions between the used ones, given by their start and end */
+    XCSFreeSpace(std::vector< std::pair<uint64_t, uint64_t> > used)
+    {
+        std::sort(used.begin(), used.end());
+        uint64_t position = 0;
+        for (size_t i = 0; i < used.size(); ++i)
+        {
+            if (used[i].first > position)
+                gaps.push_back(std::make_pair(position, used[i].first));
+            position = std::max(position, used[i].second);
+        }
+        gaps.push_back(std::make_pair(position, std::numeric_limits<uint64_t>::max()));
+    }
+
+    /** Position of a region of the given size, taken from the first free region it fits in */
+    uint64_t allocate(uint64_t size)
+    {
+        for (size_t i = 0; ; ++i)
+            if (gaps[i].second - gaps[i].first >= size)
+            {
+                uint64_t position = gaps[i].first;
+                gaps[i].first += size;
+                return position;
+            }
+    }
+};
+
+/* Write all the bytes of a buffer at a position of the file */
+static bool pwriteAll(int fd, const void * buffer, size_t size, uint64_t position)
+{
+    const char * ptr = (const char *) buffer;
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fd, ptr, size, position);
+        if (written <= 0)
+            return false;
+        ptr += written;
+        size -= written;
+        position += written;
+    }
+    return true;
+}
+
+/**
+ *  Read XCS stacks.
+*/
+int ImageBase::readXCS(size_t select_img)
+{
+    // The header, the index and the blocks are read while no other thread or
+    // process writes the file. The stream may have buffered the file before locking
+    XCSFileLock fileLock(dataFName, fimg, true);
+    XCSHead header;
+    if (fseek(fimg, 0, SEEK_SET) != 0 || fread(&header, sizeof(XCSHead), 1, fimg) != 1)
+        REPORT_ERROR(ERR_IO_NOREAD, formatString("readXCS: cannot read the header of %s", filename.c_str()));
+    if (strncmp(header.magic, XCS_MAGIC, 4) != 0)
+        REPORT_ERROR(ERR_IMG_UNKNOWN, formatString("readXCS: %s is not an XCS file", filename.c_str()));
+    if (header.datatype <= DT_Unknown || header.datatype >= DT_LastEntry)
+        REPORT_ERROR(ERR_IMG_NOREAD, formatString("readXCS: byte order of %s not supported", filename.c_str()));
+
+    //Check select_img is lower than stack size
+    if (select_img > header.ndim)
+        REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, formatString("readXCS (%s): Image number %lu exceeds stack size %lu",
+                     filename.c_str(), select_img, (size_t) header.ndim));
+
+    ArrayDim aDim;
+    aDim.xdim = header.xdim;
+    aDim.ydim = header.ydim;
+    aDim.zdim = header.zdim;
+    aDim.ndim = replaceNsize = (select_img == ALL_IMAGES) ? header.ndim : 1;
+    setDimensions(aDim);
+    offset = sizeof(XCSHead);
+
+    //Set main header
+    MDMainHeader.clear();
+    MDMainHeader.setValue(MDL_SAMPLINGRATE_X, header.xSampling);
+    MDMainHeader.setValue(MDL_SAMPLINGRATE_Y, header.ySampling);
+    MDMainHeader.setValue(MDL_SAMPLINGRATE_Z, header.zSampling);
+    MDMainHeader.setValue(MDL_DATATYPE, header.datatype);
+
+    MD.clear();
+    MD.resize(aDim.ndim, MDL::emptyHeader);
+
+    //Read header only
+    if (dataMode < DATA || (dataMode == _HEADER_ALL && aDim.ndim > 1))
+        return 0;
+
+    /* As we cannot mmap a compressed file, when this option is passed we are going
+     * to mmap the multidimarray of Image
+     */
+    if (mmapOnRead)
+    {
+        mmapOnRead = false;
+        if (aDim.nzyxdim*gettypesize((DataType) header.datatype) > tiff_map_min_size)
+            mdaBase->setMmap(true);
+    }
+
+    // Allocate memory for image data (Assume xdim, ydim, zdim and ndim are already set
+    //if memory already allocated use it (no resize allowed)
+    mdaBase->coreAllocateReuse();
+
+    // Blocks of the selected images
+    size_t imgStart = IMG_INDEX(select_img);
+    std::vector<XCSBlock> blocks(aDim.ndim);
+    if (fseek(fimg, header.indexOffset + imgStart * sizeof(XCSBlock), SEEK_SET) != 0 ||
+        fread(&blocks[0], sizeof(XCSBlock), aDim.ndim, fimg) != aDim.ndim)
+        REPORT_ERROR(ERR_IO_NOREAD, formatString("readXCS: cannot read the index of %s", filename.c_str()));
+
+    size_t n = aDim.zyxdim;
+    std::vector<char> compressed, shuffled, page;
+    std::vector<double> values;
+    for (size_t i = 0; i < aDim.ndim; ++i)
+    {
+        const XCSBlock &block = blocks[i];
+        DataType datatype = (DataType) block.datatype;
+
+        // Images not written yet are empty
+        if (block.size == 0)
+        {
+            page.assign(n, 0);
+            setPage2T(i * n, &page[0], DT_UChar, n);
+            continue;
+        }
+
+        size_t pageSize = n * gettypesize(datatype);
+        compressed.resize(block.size);
+        shuffled.resize(pageSize);
+        page.resize(pageSize);
+        uLongf size = pageSize;
+        if (fseek(fimg, block.offset, SEEK_SET) != 0 || fread(&compressed[0], block.size, 1, fimg) != 1)
+            REPORT_ERROR(ERR_IO_NOREAD, formatString("readXCS: cannot read image %lu of %s",
+                         imgStart + i + 1, filename.c_str()));
+        if (uncompress((Bytef *) &shuffled[0], &size, (const Bytef *) &compressed[0], block.size) != Z_OK ||
+            size != pageSize)
+            REPORT_ERROR(ERR_IO_NOREAD, formatString("readXCS: image %lu of %s is corrupted",
+                         imgStart + i + 1, filename.c_str()));
+        unshufflePageBytes(&shuffled[0], &page[0], n, gettypesize(datatype));
+
+        if (block.bits == 0)
+            setPage2T(i * n, &page[0], datatype, n);
+        else
+        {
+            // Values of the quantization levels
+            values.resize(n);
+            if (datatype == DT_UShort)
+                castPage((unsigned short *) &page[0], &values[0], n);
+            else
+                castPage((unsigned char *) &page[0], &values[0], n);
+            for (size_t j = 0; j < n; ++j)
+                values[j] = block.minimum + block.step * values[j];
+            setPage2T(i * n, (char *) &values[0], DT_Double, n);
+        }
+    }
+    return 0;
+}
+
+/**
+ *  Write XCS stacks.
+*/
+int ImageBase::writeXCS(size_t select_img, int mode, const String &bitDepth, CastWriteMode castMode)
+{
+    if (isComplexT())
+        REPORT_ERROR(ERR_TYPE_INCORRECT,"rwXCS: Complex images are not supported by XCS format.");
+
+    // Datatype and compression options: [datatype][,bits=<n>][,deflate=<level>]
+    StringVector params;
+    splitString(bitDepth, ",", params);
+    String strDT;
+    int bits = 0, deflateLevel = XCS_DEFAULT_DEFLATE;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        if (params[i].find("bits=") == 0)
+            bits = textToInteger(params[i].substr(5));
+        else if (params[i].find("deflate=") == 0)
+            deflateLevel = textToInteger(params[i].substr(8));
+        else
+            strDT = params[i];
+    }
+    if (bits < 0 || bits > 16 || deflateLevel < 0 || deflateLevel > 9)
+        REPORT_ERROR(ERR_ARG_INCORRECT, formatString("rwXCS: incorrect compression options %s", bitDepth.c_str()));
+
+    DataType wDType, myTypeID = myT();
+    if (strDT.empty())
+    {
+        castMode = CW_CAST;
+        wDType = (myTypeID == DT_Double) ? DT_Float : myTypeID;
+    }
+    else
+        wDType = (strDT == "default") ? DT_Float : datatypeRAW(strDT);
+
+    switch (wDType)
+    {
+    case DT_UChar:
+    case DT_SChar:
+    case DT_UShort:
+    case DT_Short:
+    case DT_UInt:
+    case DT_Int:
+    case DT_Float:
+    case DT_Double:
+        break;
+    default:
+        REPORT_ERROR(ERR_TYPE_INCORRECT, formatString("rwXCS: XCS format does not support %s datatype.",
+                     datatype2Str(wDType).c_str()));
+    }
+
+    /* As we cannot mmap a compressed file, when this option is passed we are going to mmap
+     * the multidimarray of Image, after writing the header and an index of empty blocks
+     */
+    bool allocateOnly = mmapOnWrite;
+    if (mmapOnWrite)
+    {
+        mmapOnWrite = false;
+        MDMainHeader.setValue(MDL_DATATYPE,(int) myTypeID);
+    }
+
+    // Only the header and the index are written in header modes
+    bool writeImages = (dataMode >= DATA && !allocateOnly);
+    ArrayDim aDim;
+    mdaBase->getDimensions(aDim);
+
+    //locking, of the other threads and of the other processes
+    XCSFileLock fileLock(dataFName, fimg, false);
+
+    // The blocks of existing stacks are kept. New blocks and the new index are
+    // written in the free space of the file, and the header is updated last, so
+    // the previous stack is intact until the new one is complete.
+    // The stream may keep the header read before locking, which other writers
+    // may have changed since then, so the header and the index are read from the file
+    XCSHead header;
+    std::vector<XCSBlock> blocks;
+    std::vector< std::pair<uint64_t, uint64_t> > used(1, std::make_pair((uint64_t) 0, (uint64_t) sizeof(XCSHead)));
+    int fd = fileno(fimg);
+    fflush(fimg);
+    if (mode != WRITE_OVERWRITE && pread(fd, &header, sizeof(XCSHead), 0) == (ssize_t) sizeof(XCSHead) &&
+        strncmp(header.magic, XCS_MAGIC, 4) == 0)
+    {
+        blocks.resize(header.ndim);
+        ssize_t indexSize = header.ndim * sizeof(XCSBlock);
+        if (header.ndim > 0 && pread(fd, &blocks[0], indexSize, header.indexOffset) != indexSize)
+            REPORT_ERROR(ERR_IO_NOREAD, formatString("writeXCS: cannot read the index of %s", filename.c_str()));
+        used.push_back(std::make_pair(header.indexOffset, header.indexOffset + indexSize));
+        for (size_t i = 0; i < blocks.size(); ++i)
+            if (blocks[i].size > 0)
+                used.push_back(std::make_pair(blocks[i].offset, blocks[i].offset + blocks[i].size));
+    }
+    XCSFreeSpace freeSpace(used);
+    memset(&header, 0, sizeof(XCSHead));
+
+    size_t imgStart = (mode == WRITE_APPEND) ? blocks.size() : IMG_INDEX(select_img);
+    XCSBlock emptyBlock;
+    memset(&emptyBlock, 0, sizeof(XCSBlock));
+    if (blocks.size() < imgStart + aDim.ndim)
+        blocks.resize(imgStart + aDim.ndim, emptyBlock);
+    uint64_t indexOffset = freeSpace.allocate(blocks.size() * sizeof(XCSBlock));
+
+    // Quantization levels are stored in the smallest integer type
+    DataType blockDType = (bits == 0) ? wDType : ((bits > 8) ? DT_UShort : DT_UChar);
+    size_t n = aDim.zyxdim;
+    size_t pageSize = n * gettypesize(blockDType);
+    std::vector<char> page, shuffled, compressed;
+    std::vector<double> values;
+    if (writeImages)
+    {
+        page.resize(pageSize);
+        shuffled.resize(pageSize);
+        compressed.resize(compressBound(pageSize));
+    }
+
+    for (size_t i = 0; i < aDim.ndim && writeImages; ++i)
+    {
+        XCSBlock &block = blocks[imgStart + i];
+        block.datatype = blockDType;
+        block.bits = bits;
+        block.minimum = block.step = 0;
+
+        if (bits == 0)
+        {
+            if (castMode == CW_CAST)
+                getPageFromT(i * n, &page[0], wDType, n);
+            else
+            {
+                double min0, max0;
+                mdaBase->computeDoubleMinMaxRange(min0, max0, i * n, n);
+                getCastConvertPageFromT(i * n, &page[0], wDType, n, min0, max0, castMode);
+            }
+        }
+        else
+        {
+            // Levels between the minimum and the maximum of the image
+            double min0, max0;
+            mdaBase->computeDoubleMinMaxRange(min0, max0, i * n, n);
+            block.minimum = min0;
+            block.step = (max0 - min0) / ((1 << bits) - 1);
+            double scale = (block.step > 0) ? 1 / block.step : 0;
+            values.resize(n);
+            getPageFromT(i * n, (char *) &values[0], DT_Double, n);
+            if (blockDType == DT_UShort)
+            {
+                unsigned short * levels = (unsigned short *) &page[0];
+                for (size_t j = 0; j < n; ++j)
+                    levels[j] = (unsigned short) ((values[j] - min0) * scale + 0.5);
+            }
+            else
+            {
+                unsigned char * levels = (unsigned char *) &page[0];
+                for (size_t j = 0; j < n; ++j)
+                    levels[j] = (unsigned char) ((values[j] - min0) * scale + 0.5);
+            }
+        }
+
+        shufflePageBytes(&page[0], &shuffled[0], n, gettypesize(blockDType));
+        uLongf size = compressed.size();
+        if (compress2((Bytef *) &compressed[0], &size, (const Bytef *) &shuffled[0], pageSize, deflateLevel) != Z_OK)
+            REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeXCS: cannot compress image %lu of %s",
+                         imgStart + i + 1, filename.c_str()));
+        block.offset = freeSpace.allocate(size);
+        block.size = size;
+        if (!pwriteAll(fd, &compressed[0], size, block.offset))
+            REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeXCS: cannot write %s", filename.c_str()));
+    }
+
+    // Index and, once it is written, main header
+    double aux;
+    memcpy(header.magic, XCS_MAGIC, 4);
+    header.datatype = (bits == 0) ? wDType : DT_Float;
+    header.bits = bits;
+    header.xdim = aDim.xdim;
+    header.ydim = aDim.ydim;
+    header.zdim = aDim.zdim;
+    header.ndim = blocks.size();
+    header.xSampling = (MDMainHeader.getValue(MDL_SAMPLINGRATE_X, aux)) ? aux : 1.;
+    header.ySampling = (MDMainHeader.getValue(MDL_SAMPLINGRATE_Y, aux)) ? aux : 1.;
+    header.zSampling = (MDMainHeader.getValue(MDL_SAMPLINGRATE_Z, aux)) ? aux : 1.;
+    header.indexOffset = indexOffset;
+    if (!pwriteAll(fd, &blocks[0], blocks.size() * sizeof(XCSBlock), indexOffset) ||
+        !pwriteAll(fd, &header, sizeof(XCSHead), 0))
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeXCS: cannot write %s", filename.c_str()));
+
+    // Remove the free space at the end of the file
+    uint64_t fileEnd = indexOffset + blocks.size() * sizeof(XCSBlock);
+    for (size_t i = 0; i < blocks.size(); ++i)
+        if (blocks[i].size > 0)
+            fileEnd = std::max(fileEnd, blocks[i].offset + blocks[i].size);
+    if (ftruncate(fd, fileEnd) != 0)
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeXCS: cannot write %s", filename.c_str()));
+
+    if (allocateOnly)
+    {
+        dataMode = DATA;
+        if (mdaBase->nzyxdim*gettypesize(myTypeID) > tiff_map_min_size)
+            mdaBase->setMmap(true);
+
+        // Allocate memory for image data (Assume xdim, ydim, zdim and ndim are already set
+        //if memory already allocated use it (no resize allowed)
+        mdaBase->coreAllocateReuse();
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_RWXCS_H_
+#define CORE_RWXCS_H_
+
+///@defgroup XCS Xmipp compressed stack format
+///@ingroup ImageFormats
+/** Stacks of images compressed one by one (extension xcs).
+ *
+ * Every image is stored in its own block: the values are cast to the
+ * datatype of the file, their bytes are shuffled (see shufflePageBytes)
+ * and the result is compressed with deflate. The index of the
+ * file gives the position and size of every block, so that reading an
+ * image only reads its block, and images can be replaced and appended
+ * writing only their blocks and the index.
+ *
+ * New blocks and the new index are written in the space of the file that
+ * the current index does not use (that of replaced blocks and previous
+ * indexes, or the end of the file), and the header is updated last, so an
+ * interrupted write leaves the previous stack readable. Writing is
+ * serialized for the threads and processes writing the same file, and
+ * reading waits for the writers.
+ *
+ * Optionally, the images are quantized (lossy) in 2^bits levels between
+ * their minimum and maximum before compression.
+ *
+ * Write parameters: [datatype][,bits=<n>][,deflate=<level>]
+ * @code
+ * img.write("particles.xcs");              // Lossless, float
+ * img.write("particles.xcs%bits=12");      // 4096 levels per image
+ * img.write("movie.xcs%uint8,deflate=1");  // Lossless, bytes, fastest
+ * @endcode
+ */
+//@{
+/// Compression level of deflate when it is not given
+#define XCS_DEFAULT_DEFLATE 4
+
+/** Main header of XCS files */
+struct XCSHead
+{
+    char magic[4];          // "XCS" and version number
+    int datatype;           // Datatype of the values of the images
+    int bits;               // Bits of the quantization levels, 0 when lossless
+    int unused;
+    uint64_t xdim, ydim, zdim, ndim;
+    double xSampling, ySampling, zSampling;
+    uint64_t indexOffset;   // Position of the index, ndim XCSBlock
+};
+
+/** Compressed block of an image in XCS files */
+struct XCSBlock
+{
+    uint64_t offset;        // Position of the block in the file
+    uint64_t size;          // Bytes of the block, 0 for an image not written yet
+    double minimum;         // Value of the quantization level 0
+    double step;            // Difference between consecutive levels
+    int datatype;           // Datatype of the values (of the levels if quantized)
+    int bits;               // Bits of the quantization levels, 0 when lossless
+};
+
+/** Read XCS stacks.
+ * Only the blocks of the selected images are read, with the file locked
+ * for reading.
+ */
+int readXCS(size_t select_img);
+
+/** Write XCS stacks.
+ */
+int writeXCS(size_t select_img, int mode=WRITE_OVERWRITE, const String &bitDepth="", CastWriteMode castMode = CW_CAST);
+//@}
+#endif /* CORE_RWXCS_H_ */
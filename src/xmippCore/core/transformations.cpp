@@ -497,7 +497,7 @@ void applyGeometry(int SplineDegree,
                    const MultidimArray< std::complex<double> >& V1,
                    const Matrix2D< double > &A, bool inv,
                    bool wrap, std::complex<double> outside,
-                   MultidimArray<double> *BcoeffsPtr)
+                   MultidimArray<double> *BcoeffsPtr, int nThreads)
 {
 
     if (SplineDegree > 1)
@@ -513,8 +513,8 @@ void applyGeometry(int SplineDegree,
         Complex2RealImag(MULTIDIM_ARRAY(oneImg),
                          MULTIDIM_ARRAY(re), MULTIDIM_ARRAY(im),
                          MULTIDIM_SIZE(oneImg));
-        applyGeometry(SplineDegree, rotre, re, A, inv, wrap, outre);
-        applyGeometry(SplineDegree, rotim, im, A, inv, wrap, outim);
+        applyGeometry(SplineDegree, rotre, re, A, inv, wrap, outre, NULL, nThreads);
+        applyGeometry(SplineDegree, rotim, im, A, inv, wrap, outim, NULL, nThreads);
         V2.resize(oneImg);
         RealImag2Complex(MULTIDIM_ARRAY(rotre), MULTIDIM_ARRAY(rotim),
                          MULTIDIM_ARRAY(V2), MULTIDIM_SIZE(re));
@@ -531,20 +531,20 @@ template<>
 void selfApplyGeometry(int Splinedegree,
                        MultidimArray< std::complex<double> > &V1,
                        const Matrix2D<double> &A, bool inv,
-                       bool wrap, std::complex<double> outside)
+                       bool wrap, std::complex<double> outside, int nThreads)
 {
     MultidimArray<std::complex<double> > aux = V1;
-    applyGeometry(Splinedegree, V1, aux, A, inv, wrap, outside);
+    applyGeometry(Splinedegree, V1, aux, A, inv, wrap, outside, NULL, nThreads);
 }
 
 void applyGeometry(int SplineDegree,
                    MultidimArrayGeneric &V2,
                    const MultidimArrayGeneric &V1,
                    const Matrix2D< double > &A, bool inv,
-                   bool wrap, double outside)
+                   bool wrap, double outside, int nThreads)
 {
 #define APPLYGEO(type)  applyGeometry(SplineDegree,(*(MultidimArray<type>*)(V2.im)), \
-                        (*(MultidimArray<type>*)(V1.im)), A, inv, wrap, (type) outside);
+                        (*(MultidimArray<type>*)(V1.im)), A, inv, wrap, (type) outside, NULL, nThreads);
     SWITCHDATATYPE(V1.datatype, APPLYGEO)
 #undef APPLYGEO
 
@@ -37,6 +37,7 @@
 #include "multidim_array_generic.h"
 #include "geometry.h"
 #include "metadata.h"
+#include "xmipp_threads.h"
 #define IS_INV true
 #define IS_NOT_INV false
 #define DONT_WRAP false
@@ -208,6 +209,226 @@ void rotation3DMatrixFromIcoOrientations(const char* icoFrom, const char* icoTo,
 #define BSPLINE3 3
 #define BSPLINE4 4
 
+/* Slices k0..k1-1 of the 3D transformation of applyGeometry, Aref goes from
+ * output to input coordinates. The spline degree (0, 1 or 3) and the wrap mode
+ * are fixed at compile time so that the inner loop has no other branches than
+ * the ones of the interpolation; with Degree=-1 the degree is SplineDegree.
+ */
+template<int Degree, bool Wrap, typename T1, typename T>
+void applyGeometry3DSlices(int SplineDegree,
+                           MultidimArray<T>& __restrict__ V2,
+                           const MultidimArray<T1>& __restrict__ V1,
+                           const Matrix2D<double> &Aref,
+                           const MultidimArray<double> *Bcoeffs,
+                           T outside, size_t k0, size_t k1)
+{
+    size_t m1, n1, o1, m2, n2, o2;
+    double x, y, z, xp, yp, zp;
+    double wx, wy, wz;
+    double Aref00=MAT_ELEM(Aref,0,0);
+    double Aref10=MAT_ELEM(Aref,1,0);
+    double Aref20=MAT_ELEM(Aref,2,0);
+
+    // Find center of MultidimArray
+    double cen_z = (int)(V2.zdim / 2);
+    double cen_y = (int)(V2.ydim / 2);
+    double cen_x = (int)(V2.xdim / 2);
+    double cen_zp = (int)(V1.zdim / 2);
+    double cen_yp = (int)(V1.ydim / 2);
+    double cen_xp = (int)(V1.xdim / 2);
+    double minxp = -cen_xp;
+    double minyp = -cen_yp;
+    double minzp = -cen_zp;
+    double maxxp = V1.xdim - cen_xp - 1;
+    double maxyp = V1.ydim - cen_yp - 1;
+    double maxzp = V1.zdim - cen_zp - 1;
+
+    // V2 is not initialised to 0 because all its pixels are rewritten
+    for (size_t k = k0; k < k1; k++)
+        for (size_t i = 0; i < V2.ydim; i++)
+        {
+            // Calculate position of the beginning of the row in the output
+            // MultidimArray
+            x = -cen_x;
+            y = i - cen_y;
+            z = k - cen_z;
+
+            // Calculate this position in the input image according to the
+            // geometrical transformation they are related by
+            // coords_output(=x,y) = A * coords_input (=xp,yp)
+            xp = x * MAT_ELEM(Aref, 0, 0) + y * MAT_ELEM(Aref, 0, 1) + z * MAT_ELEM(Aref, 0, 2) + MAT_ELEM(Aref, 0, 3);
+            yp = x * MAT_ELEM(Aref, 1, 0) + y * MAT_ELEM(Aref, 1, 1) + z * MAT_ELEM(Aref, 1, 2) + MAT_ELEM(Aref, 1, 3);
+            zp = x * MAT_ELEM(Aref, 2, 0) + y * MAT_ELEM(Aref, 2, 1) + z * MAT_ELEM(Aref, 2, 2) + MAT_ELEM(Aref, 2, 3);
+
+            T * ptrV2 = &dAkij(V2, k, i, 0);
+            for (size_t j = 0; j < V2.xdim; j++)
+            {
+                // If the point is outside the volume, apply a periodic
+                // extension of the volume, what exits by one side enters by
+                // the other
+                bool interp = true;
+                bool x_isOut = XMIPP_RANGE_OUTSIDE(xp, minxp, maxxp);
+                bool y_isOut = XMIPP_RANGE_OUTSIDE(yp, minyp, maxyp);
+                bool z_isOut = XMIPP_RANGE_OUTSIDE(zp, minzp, maxzp);
+
+                if (Wrap)
+                {
+                    if (x_isOut)
+                        xp = realWRAP(xp, minxp - 0.5, maxxp + 0.5);
+
+                    if (y_isOut)
+                        yp = realWRAP(yp, minyp - 0.5, maxyp + 0.5);
+
+                    if (z_isOut)
+                        zp = realWRAP(zp, minzp - 0.5, maxzp + 0.5);
+                }
+                else if (x_isOut || y_isOut || z_isOut)
+                    interp = false;
+
+                if (interp)
+                {
+                    if (Degree == 1)
+                    {
+                        // Linear interpolation
+
+                        // Calculate the integer position in input volume, be
+                        // careful that it is not the nearest but the one at the
+                        // top left corner of the interpolation square. Ie,
+                        // (0.7,0.7) would give (0,0)
+                        // Calculate also weights for point m1+1,n1+1
+                        wx = xp + cen_xp;
+                        m1 = (int) wx;
+                        wx = wx - m1;
+                        m2 = m1 + 1;
+                        wy = yp + cen_yp;
+                        n1 = (int) wy;
+                        wy = wy - n1;
+                        n2 = n1 + 1;
+                        wz = zp + cen_zp;
+                        o1 = (int) wz;
+                        wz = wz - o1;
+                        o2 = o1 + 1;
+
+                        // Perform interpolation
+                        // if wx == 0 means that the rightest point is useless for
+                        // this interpolation, and even it might not be defined if
+                        // m1=xdim-1
+                        // The same can be said for wy.
+                        double wx_1=1-wx;
+                        double wy_1=1-wy;
+                        double wz_1=1-wz;
+
+                        double aux1=wz_1 * wy_1;
+                        double aux2=aux1*wx_1;
+                        double tmp  =  aux2 * DIRECT_A3D_ELEM(V1, o1, n1, m1);
+
+                        if (wx != 0 && m2 < V1.xdim)
+                            tmp += (aux1-aux2)* DIRECT_A3D_ELEM(V1, o1, n1, m2);
+
+                        if (wy != 0 && n2 < V1.ydim)
+                        {
+                            aux1=wz_1 * wy;
+                            aux2=aux1*wx_1;
+                            tmp += aux2 * DIRECT_A3D_ELEM(V1, o1, n2, m1);
+                            if (wx != 0 && m2 < V1.xdim)
+                                tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o1, n2, m2);
+                        }
+
+                        if (wz != 0 && o2 < V1.zdim)
+                        {
+                            aux1=wz * wy_1;
+                            aux2=aux1*wx_1;
+                            tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n1, m1);
+                            if (wx != 0 && m2 < V1.xdim)
+                                tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n1, m2);
+                            if (wy != 0 && n2 < V1.ydim)
+                            {
+                                aux1=wz * wy;
+                                aux2=aux1*wx_1;
+                                tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n2, m1);
+                                if (wx != 0 && m2 < V1.xdim)
+                                    tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n2, m2);
+                            }
+                        }
+
+                        ptrV2[j] = (T)tmp;
+                    }
+                    else if (Degree == 0)
+                        ptrV2[j] = (T)A3D_ELEM(V1,(int)trunc(zp),(int)trunc(yp),(int)trunc(xp));
+                    else if (Degree == 3)
+                        ptrV2[j] = (T) Bcoeffs->interpolatedElementBSpline3D_Degree3(xp, yp, zp);
+                    else
+                        ptrV2[j] = (T) Bcoeffs->interpolatedElementBSpline3D(xp, yp, zp, SplineDegree);
+                }
+                else
+                    ptrV2[j] = outside;
+
+                // Compute new point inside input image
+                xp += Aref00;
+                yp += Aref10;
+                zp += Aref20;
+            }
+        }
+}
+
+/* Slices k0..k1-1 of the 3D transformation of applyGeometry, with the kernel
+ * specialized for the spline degree and wrap mode */
+template<typename T1, typename T>
+void applyGeometry3D(int SplineDegree,
+                     MultidimArray<T>& V2,
+                     const MultidimArray<T1>& V1,
+                     const Matrix2D<double> &Aref,
+                     const MultidimArray<double> *Bcoeffs,
+                     bool wrap, T outside, size_t k0, size_t k1)
+{
+#define APPLYGEO3D(degree) \
+    if (wrap) \
+        applyGeometry3DSlices<degree, true>(SplineDegree, V2, V1, Aref, Bcoeffs, outside, k0, k1); \
+    else \
+        applyGeometry3DSlices<degree, false>(SplineDegree, V2, V1, Aref, Bcoeffs, outside, k0, k1);
+    switch (SplineDegree)
+    {
+    case 0:
+        APPLYGEO3D(0);
+        break;
+    case 1:
+        APPLYGEO3D(1);
+        break;
+    case 3:
+        APPLYGEO3D(3);
+        break;
+    default:
+        APPLYGEO3D(-1);
+        break;
+    }
+#undef APPLYGEO3D
+}
+
+/* Data shared by the threads of the 3D applyGeometry */
+template<typename T1, typename T>
+struct ApplyGeometry3DData
+{
+    int SplineDegree;
+    MultidimArray<T> *V2;
+    const MultidimArray<T1> *V1;
+    const Matrix2D<double> *A;
+    const MultidimArray<double> *Bcoeffs;
+    bool wrap;
+    T outside;
+    ThreadTaskDistributor *distributor;
+};
+
+/* Each thread computes the slices given by the distributor */
+template<typename T1, typename T>
+void applyGeometry3DThread(ThreadArgument &thArg)
+{
+    ApplyGeometry3DData<T1, T> *data = (ApplyGeometry3DData<T1, T> *) thArg.workClass;
+    size_t first, last;
+    while (data->distributor->getTasks(first, last))
+        applyGeometry3D(data->SplineDegree, *data->V2, *data->V1, *data->A, data->Bcoeffs,
+                        data->wrap, data->outside, first, last + 1);
+}
+
 /** Applies a geometrical transformation.
  * @ingroup GeometricalTransformations
  *
@@ -275,6 +496,10 @@ void rotation3DMatrixFromIcoOrientations(const char* icoFrom, const char* icoTo,
  *
  * Although you can also use the constants IS_INV, or WRAP.
  *
+ * The B-spline coefficients of V1 may be given in BcoeffsPtr to avoid
+ * computing them in every call. The slices of 3D volumes are computed by
+ * nThreads threads.
+ *
  * @code
  * Matrix2D< double > A(4,4);
  * A.initIdentity;
@@ -286,7 +511,8 @@ void applyGeometry(int SplineDegree,
                    MultidimArray<T>& __restrict__ V2,
                    const MultidimArray<T1>& __restrict__ V1,
                    const Matrix2D< T2 > &At, bool inv,
-                   bool wrap, T outside = 0, MultidimArray<double> *BcoeffsPtr=NULL)
+                   bool wrap, T outside = 0, MultidimArray<double> *BcoeffsPtr=NULL,
+                   int nThreads = 1)
 {
 #ifndef RELEASE_MODE
     if (&V1 == (MultidimArray<T1>*)&V2)
@@ -728,42 +954,6 @@ void applyGeometry(int SplineDegree,
     else
     {
         // 3D transformation
-    	size_t m1, n1, o1, m2, n2, o2;
-        double x, y, z, xp, yp, zp;
-        double minxp, minyp, maxxp, maxyp, minzp, maxzp;
-        double cen_x, cen_y, cen_z, cen_xp, cen_yp, cen_zp;
-        double wx, wy, wz;
-        double Aref00=MAT_ELEM(Aref,0,0);
-        double Aref10=MAT_ELEM(Aref,1,0);
-        double Aref20=MAT_ELEM(Aref,2,0);
-
-        // Find center of MultidimArray
-        cen_z = (int)(V2.zdim / 2);
-        cen_y = (int)(V2.ydim / 2);
-        cen_x = (int)(V2.xdim / 2);
-        cen_zp = (int)(V1.zdim / 2);
-        cen_yp = (int)(V1.ydim / 2);
-        cen_xp = (int)(V1.xdim / 2);
-        minxp = -cen_xp;
-        minyp = -cen_yp;
-        minzp = -cen_zp;
-        maxxp = V1.xdim - cen_xp - 1;
-        maxyp = V1.ydim - cen_yp - 1;
-        maxzp = V1.zdim - cen_zp - 1;
-
-#ifdef DEBUG
-
-        std::cout << "Geometry 2 center=("
-        << cen_z  << "," << cen_y  << "," << cen_x  << ")\n"
-        << "Geometry 1 center=("
-        << cen_zp << "," << cen_yp << "," << cen_xp << ")\n"
-        << "           min=("
-        << minzp  << "," << minyp  << "," << minxp  << ")\n"
-        << "           max=("
-        << maxzp  << "," << maxyp  << "," << maxxp  << ")\n"
-        ;
-#endif
-
         if (SplineDegree > 1)
         {
             // Build the B-spline coefficients
@@ -774,202 +964,33 @@ void applyGeometry(int SplineDegree,
         		produceSplineCoefficients(SplineDegree, Bcoeffs, V1); //Bcoeffs is a single image
         		BcoeffsToUse = &Bcoeffs;
         	}
-            STARTINGX(*BcoeffsToUse) = (int) minxp;
-            STARTINGY(*BcoeffsToUse) = (int) minyp;
-            STARTINGZ(*BcoeffsToUse) = (int) minzp;
+            STARTINGX(*BcoeffsToUse) = -(int)(V1.xdim / 2);
+            STARTINGY(*BcoeffsToUse) = -(int)(V1.ydim / 2);
+            STARTINGZ(*BcoeffsToUse) = -(int)(V1.zdim / 2);
         }
 
         // Now we go from the output MultidimArray to the input MultidimArray, ie, for any
         // voxel in the output MultidimArray we calculate which are the corresponding
         // ones in the original MultidimArray, make an interpolation with them and put
-        // this value at the output voxel
-
-        // V2 is not initialised to 0 because all its pixels are rewritten
-        for (size_t k = 0; k < V2.zdim; k++)
-            for (size_t i = 0; i < V2.ydim; i++)
-            {
-                // Calculate position of the beginning of the row in the output
-                // MultidimArray
-                x = -cen_x;
-                y = i - cen_y;
-                z = k - cen_z;
-
-                // Calculate this position in the input image according to the
-                // geometrical transformation they are related by
-                // coords_output(=x,y) = A * coords_input (=xp,yp)
-                xp = x * MAT_ELEM(Aref, 0, 0) + y * MAT_ELEM(Aref, 0, 1) + z * MAT_ELEM(Aref, 0, 2) + MAT_ELEM(Aref, 0, 3);
-                yp = x * MAT_ELEM(Aref, 1, 0) + y * MAT_ELEM(Aref, 1, 1) + z * MAT_ELEM(Aref, 1, 2) + MAT_ELEM(Aref, 1, 3);
-                zp = x * MAT_ELEM(Aref, 2, 0) + y * MAT_ELEM(Aref, 2, 1) + z * MAT_ELEM(Aref, 2, 2) + MAT_ELEM(Aref, 2, 3);
-
-                for (size_t j = 0; j < V2.xdim; j++)
-                {
-                    bool interp;
-                    double tmp;
-
-#ifdef DEBUG
-
-                    bool show_debug = false;
-                    if ((i == 0 && j == 0 && k == 0) ||
-                        (i == V2.ydim - 1 && j == V2.xdim - 1 && k == V2.zdim - 1))
-                        show_debug = true;
-
-                    if (show_debug)
-                        std::cout << "(x,y,z)-->(xp,yp,zp)= "
-                        << "(" << x  << "," << y  << "," << z  << ") "
-                        << "(" << xp << "," << yp << "," << zp << ")\n";
-#endif
-
-                    // If the point is outside the volume, apply a periodic
-                    // extension of the volume, what exits by one side enters by
-                    // the other
-                    interp  = true;
-                    bool x_isOut = XMIPP_RANGE_OUTSIDE(xp, minxp, maxxp);
-                    bool y_isOut = XMIPP_RANGE_OUTSIDE(yp, minyp, maxyp);
-                    bool z_isOut = XMIPP_RANGE_OUTSIDE(zp, minzp, maxzp);
-
-                    if (wrap)
-                    {
-                        if (x_isOut)
-                            xp = realWRAP(xp, minxp - 0.5, maxxp + 0.5);
-
-                        if (y_isOut)
-                            yp = realWRAP(yp, minyp - 0.5, maxyp + 0.5);
-
-                        if (z_isOut)
-                            zp = realWRAP(zp, minzp - 0.5, maxzp + 0.5);
-                    }
-                    else if (x_isOut || y_isOut || z_isOut)
-                        interp = false;
-
-                    if (interp)
-                    {
-                        if (SplineDegree == 1)
-                        {
-                            // Linear interpolation
-
-                            // Calculate the integer position in input volume, be
-                            // careful that it is not the nearest but the one at the
-                            // top left corner of the interpolation square. Ie,
-                            // (0.7,0.7) would give (0,0)
-                            // Calculate also weights for point m1+1,n1+1
-                            wx = xp + cen_xp;
-                            m1 = (int) wx;
-                            wx = wx - m1;
-                            m2 = m1 + 1;
-                            wy = yp + cen_yp;
-                            n1 = (int) wy;
-                            wy = wy - n1;
-                            n2 = n1 + 1;
-                            wz = zp + cen_zp;
-                            o1 = (int) wz;
-                            wz = wz - o1;
-                            o2 = o1 + 1;
-
-#ifdef DEBUG
-
-                            if (show_debug)
-                            {
-                                std::cout << "After wrapping(xp,yp,zp)= "
-                                << "(" << xp << "," << yp << "," << zp << ")\n";
-                                std::cout << "(m1,n1,o1)-->(m2,n2,o2)="
-                                << "(" << m1 << "," << n1 << "," << o1 << ") "
-                                << "(" << m2 << "," << n2 << "," << o2 << ")\n";
-                                std::cout << "(wx,wy,wz)="
-                                << "(" << wx << "," << wy << "," << wz << ")\n";
-                            }
-#endif
-
-                            // Perform interpolation
-                            // if wx == 0 means that the rightest point is useless for
-                            // this interpolation, and even it might not be defined if
-                            // m1=xdim-1
-                            // The same can be said for wy.
-                            double wx_1=1-wx;
-                            double wy_1=1-wy;
-                            double wz_1=1-wz;
-
-                            double aux1=wz_1 * wy_1;
-                            double aux2=aux1*wx_1;
-                            tmp  =  aux2 * DIRECT_A3D_ELEM(V1, o1, n1, m1);
-
-                            if (wx != 0 && m2 < V1.xdim)
-                                tmp += (aux1-aux2)* DIRECT_A3D_ELEM(V1, o1, n1, m2);
-
-                            if (wy != 0 && n2 < V1.ydim)
-                            {
-                                aux1=wz_1 * wy;
-                                aux2=aux1*wx_1;
-                                tmp += aux2 * DIRECT_A3D_ELEM(V1, o1, n2, m1);
-                                if (wx != 0 && m2 < V1.xdim)
-                                    tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o1, n2, m2);
-                            }
-
-                            if (wz != 0 && o2 < V1.zdim)
-                            {
-                                aux1=wz * wy_1;
-                                aux2=aux1*wx_1;
-                                tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n1, m1);
-                                if (wx != 0 && m2 < V1.xdim)
-                                    tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n1, m2);
-                                if (wy != 0 && n2 < V1.ydim)
-                                {
-                                    aux1=wz * wy;
-                                    aux2=aux1*wx_1;
-                                    tmp += aux2 * DIRECT_A3D_ELEM(V1, o2, n2, m1);
-                                    if (wx != 0 && m2 < V1.xdim)
-                                        tmp += (aux1-aux2) * DIRECT_A3D_ELEM(V1, o2, n2, m2);
-                                }
-                            }
-
-#ifdef DEBUG
-                            if (show_debug)
-                                std::cout <<
-                                "tmp1=" << DIRECT_A3D_ELEM(V1, o1, n1, m1) << " "
-                                << (T)(wz_1 *wy_1 *wx_1 * DIRECT_A3D_ELEM(V1, o1, n1, m1))
-                                << std::endl <<
-                                "tmp2=" << DIRECT_A3D_ELEM(V1, o1, n1, m2) << " "
-                                << (T)(wz_1 *wy_1 * wx * DIRECT_A3D_ELEM(V1, o1, n1, m2))
-                                << std::endl <<
-                                "tmp3=" << DIRECT_A3D_ELEM(V1, o1, n2, m1) << " "
-                                << (T)(wz_1 * wy *wx_1 * DIRECT_A3D_ELEM(V1, o1, n2, m1))
-                                << std::endl <<
-                                "tmp4=" << DIRECT_A3D_ELEM(V1, o1, n2, m2) << " "
-                                << (T)(wz_1 * wy * wx * DIRECT_A3D_ELEM(V1, o2, n1, m1))
-                                << std::endl <<
-                                "tmp6=" << DIRECT_A3D_ELEM(V1, o2, n1, m2) << " "
-                                << (T)(wz * wy_1 * wx * DIRECT_A3D_ELEM(V1, o2, n1, m2))
-                                << std::endl <<
-                                "tmp7=" << DIRECT_A3D_ELEM(V1, o2, n2, m1) << " "
-                                << (T)(wz * wy *wx_1 * DIRECT_A3D_ELEM(V1, o2, n2, m1))
-                                << std::endl <<
-                                "tmp8=" << DIRECT_A3D_ELEM(V1, o2, n2, m2) << " "
-                                << (T)(wz * wy * wx * DIRECT_A3D_ELEM(V1, o2, n2, m2))
-                                << std::endl <<
-                                "tmp= " << tmp << std::endl;
-#endif
-
-                            dAkij(V2 , k, i, j) = (T)tmp;
-                        }
-                        else if (SplineDegree==0)
-						{
-							dAkij(V2, k, i, j)=(T)A3D_ELEM(V1,(int)trunc(zp),(int)trunc(yp),(int)trunc(xp));
-						}
-                        else
-                        {
-                            // B-spline interpolation
-                            dAkij(V2, k, i, j) =
-                                (T) BcoeffsToUse->interpolatedElementBSpline3D(xp, yp, zp, SplineDegree);
-                        }
-                    }
-                    else
-                        dAkij(V2, k, i, j) = outside;
-
-                    // Compute new point inside input image
-                    xp += Aref00;
-                    yp += Aref10;
-                    zp += Aref20;
-                }
-            }
+        // this value at the output voxel. The slices are independent, so they
+        // may be computed by several threads
+        if (nThreads > 1 && V2.zdim > 1)
+        {
+            ThreadTaskDistributor distributor(V2.zdim, 1);
+            ApplyGeometry3DData<T1, T> data;
+            data.SplineDegree = SplineDegree;
+            data.V2 = &V2;
+            data.V1 = &V1;
+            data.A = &Aref;
+            data.Bcoeffs = BcoeffsToUse;
+            data.wrap = wrap;
+            data.outside = outside;
+            data.distributor = &distributor;
+            ThreadManager thMgr(XMIPP_MIN(nThreads, (int)V2.zdim), &data);
+            thMgr.run(applyGeometry3DThread<T1, T>);
+        }
+        else
+            applyGeometry3D(SplineDegree, V2, V1, Aref, BcoeffsToUse, wrap, outside, 0, V2.zdim);
     }
 }
 
@@ -979,9 +1000,10 @@ void applyGeometry(int SplineDegree,
                    MultidimArray<T>& V2,
                    const MultidimArrayGeneric& V1,
                    const Matrix2D< double > &A, bool inv,
-                   bool wrap, T outside = 0)
+                   bool wrap, T outside = 0, int nThreads = 1)
 {
-#define APPLYGEO(type)  applyGeometry(SplineDegree,V2, (*(MultidimArray<type>*)(V1.im)), A, inv, wrap, outside);
+#define APPLYGEO(type)  applyGeometry(SplineDegree,V2, (*(MultidimArray<type>*)(V1.im)), A, inv, wrap, outside, \
+                                      (MultidimArray<double> *) NULL, nThreads);
     SWITCHDATATYPE(V1.datatype, APPLYGEO)
 #undef APPLYGEO
 }
@@ -997,11 +1019,11 @@ template<typename T>
 void selfApplyGeometry(int SplineDegree,
                        MultidimArray<T>& V1,
                        const Matrix2D< double > &A, bool inv,
-                       bool wrap, T outside = 0)
+                       bool wrap, T outside = 0, int nThreads = 1)
 {
     MultidimArray<T> aux = V1;
     V1.initZeros();
-    applyGeometry(SplineDegree, V1, aux, A, inv, wrap, outside);
+    applyGeometry(SplineDegree, V1, aux, A, inv, wrap, outside, NULL, nThreads);
 }
 
 //Special cases for complex arrays
@@ -1010,21 +1032,22 @@ void applyGeometry(int SplineDegree,
                    MultidimArray< std::complex<double> >& V2,
                    const MultidimArray< std::complex<double> >& V1,
                    const Matrix2D< double > &A, bool inv,
-                   bool wrap, std::complex<double> outside, MultidimArray<double> *BcoeffsPtr);
+                   bool wrap, std::complex<double> outside, MultidimArray<double> *BcoeffsPtr,
+                   int nThreads);
 
 //Special cases for complex arrays
 template<>
 void selfApplyGeometry(int SplineDegree,
                        MultidimArray< std::complex<double> >& V1,
                        const Matrix2D< double > &A, bool inv,
-                       bool wrap, std::complex<double> outside);
+                       bool wrap, std::complex<double> outside, int nThreads);
 
 // Special cases for MultidimArrayGeneric
 void applyGeometry(int SplineDegree,
                    MultidimArrayGeneric &V2,
                    const MultidimArrayGeneric &V1,
                    const Matrix2D< double > &A, bool inv,
-                   bool wrap, double outside);
+                   bool wrap, double outside, int nThreads = 1);
 
 
 /** Produce spline coefficients.
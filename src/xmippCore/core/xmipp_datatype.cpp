@@ -87,7 +87,7 @@ DataType str2Datatype(const std::string & str)
 
     if(str=="uint8")
         datatype = DT_UChar;
-    else if (str == "uhalfint8")
+    else if (str == "uhalfint8" || str == "uint4")
         datatype = DT_UHalfByte;
     else if (str=="int8")
         datatype = DT_SChar;
@@ -0,0 +1,258 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <string.h>
+#include <stdint.h>
+#include "xmipp_datatype_cast.h"
+#include "xmipp_funcs.h"
+
+/* The kernels are plain loops that the compiler vectorizes. With function
+ * multiversioning each one is compiled for AVX2, SSE4.1 and the base
+ * instruction set, and the dynamic loader picks the best one for the
+ * processor, so that binaries built for generic x86-64 still use AVX2.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define CAST_KERNEL __attribute__((target_clones("avx2", "sse4.1", "default"))) static
+#endif
+#endif
+#ifndef CAST_KERNEL
+#define CAST_KERNEL static
+#endif
+
+#define DEFINE_CAST_PAGE(Tin, Tout, name) \
+CAST_KERNEL void castPage_##name(const Tin * __restrict__ in, Tout * __restrict__ out, size_t n) \
+{ \
+    for (size_t i = 0; i < n; ++i) \
+        out[i] = (Tout) in[i]; \
+} \
+template<> void castPage<Tin, Tout>(const Tin * in, Tout * out, size_t n) \
+{ \
+    castPage_##name(in, out, n); \
+}
+
+#define DEFINE_CAST_CONVERT_PAGE(Tin, Tout, name) \
+CAST_KERNEL void castConvertPage_##name(const Tin * __restrict__ in, Tout * __restrict__ out, size_t n, \
+                                        double minF, double slope, double min0) \
+{ \
+    const double lowest = (double) std::numeric_limits<Tout>::min(); \
+    const double highest = (double) std::numeric_limits<Tout>::max(); \
+    for (size_t i = 0; i < n; ++i) \
+    { \
+        double value = minF + slope * static_cast<double>(in[i] - min0); \
+        out[i] = static_cast<Tout>(value < lowest ? lowest : (value > highest ? highest : value)); \
+    } \
+} \
+template<> void castConvertPage<Tin, Tout>(const Tin * in, Tout * out, size_t n, \
+                                           double minF, double slope, double min0) \
+{ \
+    castConvertPage_##name(in, out, n, minF, slope, min0); \
+}
+
+DEFINE_CAST_PAGE(unsigned char, float, uchar_float)
+DEFINE_CAST_PAGE(unsigned char, double, uchar_double)
+DEFINE_CAST_PAGE(signed char, float, schar_float)
+DEFINE_CAST_PAGE(signed char, double, schar_double)
+DEFINE_CAST_PAGE(unsigned short, float, ushort_float)
+DEFINE_CAST_PAGE(unsigned short, double, ushort_double)
+DEFINE_CAST_PAGE(short, float, short_float)
+DEFINE_CAST_PAGE(short, double, short_double)
+DEFINE_CAST_PAGE(int, float, int_float)
+DEFINE_CAST_PAGE(int, double, int_double)
+DEFINE_CAST_PAGE(float, double, float_double)
+DEFINE_CAST_PAGE(double, float, double_float)
+DEFINE_CAST_PAGE(float, unsigned char, float_uchar)
+DEFINE_CAST_PAGE(double, unsigned char, double_uchar)
+DEFINE_CAST_PAGE(float, char, float_char)
+DEFINE_CAST_PAGE(double, char, double_char)
+DEFINE_CAST_PAGE(float, unsigned short, float_ushort)
+DEFINE_CAST_PAGE(double, unsigned short, double_ushort)
+DEFINE_CAST_PAGE(float, short, float_short)
+DEFINE_CAST_PAGE(double, short, double_short)
+
+DEFINE_CAST_CONVERT_PAGE(float, unsigned char, float_uchar)
+DEFINE_CAST_CONVERT_PAGE(double, unsigned char, double_uchar)
+DEFINE_CAST_CONVERT_PAGE(float, char, float_char)
+DEFINE_CAST_CONVERT_PAGE(double, char, double_char)
+DEFINE_CAST_CONVERT_PAGE(float, unsigned short, float_ushort)
+DEFINE_CAST_CONVERT_PAGE(double, unsigned short, double_ushort)
+DEFINE_CAST_CONVERT_PAGE(float, short, float_short)
+DEFINE_CAST_CONVERT_PAGE(double, short, double_short)
+
+// The values are copied with memcpy because pages are not always aligned
+#define DEFINE_SWAP_PAGE(T, bswap) \
+CAST_KERNEL void swapPage_##T(char * page, size_t n) \
+{ \
+    for (size_t i = 0; i < n; ++i, page += sizeof(T)) \
+    { \
+        T value; \
+        memcpy(&value, page, sizeof(T)); \
+        value = bswap(value); \
+        memcpy(page, &value, sizeof(T)); \
+    } \
+}
+
+#ifdef __GNUC__
+DEFINE_SWAP_PAGE(uint16_t, __builtin_bswap16)
+DEFINE_SWAP_PAGE(uint32_t, __builtin_bswap32)
+DEFINE_SWAP_PAGE(uint64_t, __builtin_bswap64)
+#endif
+
+void swapPageBytes(char * page, size_t nBytes, size_t valueSize)
+{
+    size_t n = nBytes / valueSize;
+#ifdef __GNUC__
+    switch (valueSize)
+    {
+    case 1:
+        return;
+    case 2:
+        swapPage_uint16_t(page, n);
+        return;
+    case 4:
+        swapPage_uint32_t(page, n);
+        return;
+    case 8:
+        swapPage_uint64_t(page, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; ++i, page += valueSize)
+        swapbytes(page, valueSize);
+}
+
+CAST_KERNEL void unpackNibbles_lowFirst(const unsigned char * __restrict__ in,
+                                        unsigned char * __restrict__ out, size_t nBytes)
+{
+    for (size_t i = 0; i < nBytes; ++i)
+    {
+        out[2 * i] = in[i] & 15;
+        out[2 * i + 1] = in[i] >> 4;
+    }
+}
+
+CAST_KERNEL void unpackNibbles_highFirst(const unsigned char * __restrict__ in,
+        unsigned char * __restrict__ out, size_t nBytes)
+{
+    for (size_t i = 0; i < nBytes; ++i)
+    {
+        out[2 * i] = in[i] >> 4;
+        out[2 * i + 1] = in[i] & 15;
+    }
+}
+
+void unpackNibbles(const unsigned char * in, unsigned char * out, size_t n, bool highFirst)
+{
+    size_t nBytes = n / 2;
+    if (highFirst)
+        unpackNibbles_highFirst(in, out, nBytes);
+    else
+        unpackNibbles_lowFirst(in, out, nBytes);
+    // Odd number of values, the last one is alone in its byte
+    if (n % 2)
+        out[n - 1] = highFirst ? (in[nBytes] >> 4) : (in[nBytes] & 15);
+}
+
+// Values over 15 saturate
+CAST_KERNEL void packNibbles_lowFirst(const unsigned char * __restrict__ in,
+                                      unsigned char * __restrict__ out, size_t nBytes)
+{
+    for (size_t i = 0; i < nBytes; ++i)
+    {
+        unsigned char first = in[2 * i] < 15 ? in[2 * i] : 15;
+        unsigned char second = in[2 * i + 1] < 15 ? in[2 * i + 1] : 15;
+        out[i] = first | (second << 4);
+    }
+}
+
+CAST_KERNEL void packNibbles_highFirst(const unsigned char * __restrict__ in,
+                                       unsigned char * __restrict__ out, size_t nBytes)
+{
+    for (size_t i = 0; i < nBytes; ++i)
+    {
+        unsigned char first = in[2 * i] < 15 ? in[2 * i] : 15;
+        unsigned char second = in[2 * i + 1] < 15 ? in[2 * i + 1] : 15;
+        out[i] = (first << 4) | second;
+    }
+}
+
+void packNibbles(const unsigned char * in, unsigned char * out, size_t n, bool highFirst)
+{
+    size_t nBytes = n / 2;
+    if (highFirst)
+        packNibbles_highFirst(in, out, nBytes);
+    else
+        packNibbles_lowFirst(in, out, nBytes);
+    // Odd number of values, the last byte is completed with zero
+    if (n % 2)
+    {
+        unsigned char last = in[n - 1] < 15 ? in[n - 1] : 15;
+        out[nBytes] = highFirst ? (last << 4) : last;
+    }
+}
+
+CAST_KERNEL void shuffleBytes(const char * __restrict__ in, char * __restrict__ out,
+                               size_t n, size_t valueSize)
+{
+    for (size_t b = 0; b < valueSize; ++b)
+        for (size_t i = 0; i < n; ++i)
+            out[b * n + i] = in[i * valueSize + b];
+}
+
+CAST_KERNEL void unshuffleBytes(const char * __restrict__ in, char * __restrict__ out,
+                                 size_t n, size_t valueSize)
+{
+    for (size_t b = 0; b < valueSize; ++b)
+        for (size_t i = 0; i < n; ++i)
+            out[i * valueSize + b] = in[b * n + i];
+}
+
+void shufflePageBytes(const char * in, char * out, size_t n, size_t valueSize)
+{
+    if (valueSize == 1)
+        memcpy(out, in, n);
+    else
+        shuffleBytes(in, out, n, valueSize);
+}
+
+void unshufflePageBytes(const char * in, char * out, size_t n, size_t valueSize)
+{
+    if (valueSize == 1)
+        memcpy(out, in, n);
+    else
+        unshuffleBytes(in, out, n, valueSize);
+}
+
+const char * castPageInstructionSet()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    if (__builtin_cpu_supports("sse4.1"))
+        return "sse4.1";
+    return "x86-64";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_DATATYPE_CAST_H_
+#define CORE_DATATYPE_CAST_H_
+
+#include <stddef.h>
+#include <limits>
+
+/** @defgroup DatatypeCast Conversion of pages between datatypes
+ *  @ingroup Datatypes
+ *
+ * Kernels used by Image to convert the pages read from or written to disk.
+ * The conversions between the usual file types (8 and 16 bit integers, float,
+ * double) and float or double, and the byte swapping, are compiled for several
+ * instruction sets (AVX2, SSE4.1 and plain x86-64) and the version supported
+ * by the processor is chosen at run time. Other conversions use the generic
+ * templates below.
+*/
+//@{
+/** Cast n values from type Tin to type Tout.
+ *
+ * @code
+ * castPage((unsigned short *) page, MULTIDIM_ARRAY(data), pageSize);
+ * @endcode
+ */
+template <typename Tin, typename Tout>
+inline void castPage(const Tin * in, Tout * out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (Tout) in[i];
+}
+
+/** Cast n values mapping them linearly to the range of the output type.
+ * out = minF + slope * (in - min0), clamped to the range of Tout (an integer
+ * type). This is the conversion of the CW_CONVERT and CW_ADJUST write modes.
+ */
+template <typename Tin, typename Tout>
+inline void castConvertPage(const Tin * in, Tout * out, size_t n,
+                            double minF, double slope, double min0)
+{
+    const double lowest = (double) std::numeric_limits<Tout>::min();
+    const double highest = (double) std::numeric_limits<Tout>::max();
+    for (size_t i = 0; i < n; ++i)
+    {
+        double value = minF + slope * static_cast<double>(in[i] - min0);
+        out[i] = static_cast<Tout>(value < lowest ? lowest : (value > highest ? highest : value));
+    }
+}
+
+/// @cond
+#define DECLARE_CAST_PAGE(Tin, Tout) \
+template<> void castPage<Tin, Tout>(const Tin * in, Tout * out, size_t n);
+#define DECLARE_CAST_CONVERT_PAGE(Tin, Tout) \
+template<> void castConvertPage<Tin, Tout>(const Tin * in, Tout * out, size_t n, \
+                                           double minF, double slope, double min0);
+
+DECLARE_CAST_PAGE(unsigned char, float)
+DECLARE_CAST_PAGE(unsigned char, double)
+DECLARE_CAST_PAGE(signed char, float)
+DECLARE_CAST_PAGE(signed char, double)
+DECLARE_CAST_PAGE(unsigned short, float)
+DECLARE_CAST_PAGE(unsigned short, double)
+DECLARE_CAST_PAGE(short, float)
+DECLARE_CAST_PAGE(short, double)
+DECLARE_CAST_PAGE(int, float)
+DECLARE_CAST_PAGE(int, double)
+DECLARE_CAST_PAGE(float, double)
+DECLARE_CAST_PAGE(double, float)
+DECLARE_CAST_PAGE(float, unsigned char)
+DECLARE_CAST_PAGE(double, unsigned char)
+DECLARE_CAST_PAGE(float, char)
+DECLARE_CAST_PAGE(double, char)
+DECLARE_CAST_PAGE(float, unsigned short)
+DECLARE_CAST_PAGE(double, unsigned short)
+DECLARE_CAST_PAGE(float, short)
+DECLARE_CAST_PAGE(double, short)
+
+DECLARE_CAST_CONVERT_PAGE(float, unsigned char)
+DECLARE_CAST_CONVERT_PAGE(double, unsigned char)
+DECLARE_CAST_CONVERT_PAGE(float, char)
+DECLARE_CAST_CONVERT_PAGE(double, char)
+DECLARE_CAST_CONVERT_PAGE(float, unsigned short)
+DECLARE_CAST_CONVERT_PAGE(double, unsigned short)
+DECLARE_CAST_CONVERT_PAGE(float, short)
+DECLARE_CAST_CONVERT_PAGE(double, short)
+/// @endcond
+
+/** Reverse the byte order of the values in a page.
+ * nBytes is the size of the page and valueSize the size of each value (2, 4 or 8
+ * use the fast kernels). An incomplete value at the end of the page is not swapped.
+ */
+void swapPageBytes(char * page, size_t nBytes, size_t valueSize);
+
+/** Unpack n 4-bit values, two per byte, to one value per byte.
+ * highFirst is true when the first value of each byte is in its upper half
+ * (TIFF) and false when it is in the lower half (MRC mode 101).
+ */
+void unpackNibbles(const unsigned char * in, unsigned char * out, size_t n, bool highFirst);
+
+/** Pack n values, one per byte, in 4 bits, two per byte.
+ * The values over 15 are saturated. The layout of the bytes is the one of
+ * unpackNibbles.
+ */
+void packNibbles(const unsigned char * in, unsigned char * out, size_t n, bool highFirst);
+
+/** Group the bytes of n values of valueSize bytes by their position in the
+ * value: first byte of all the values, then the second byte, and so on. The
+ * bytes of similar values become repeated sequences that compress better.
+ */
+void shufflePageBytes(const char * in, char * out, size_t n, size_t valueSize);
+
+/** Inverse of shufflePageBytes */
+void unshufflePageBytes(const char * in, char * out, size_t n, size_t valueSize);
+
+/** Name of the instruction set used by the conversion kernels */
+const char * castPageInstructionSet();
+//@}
+#endif
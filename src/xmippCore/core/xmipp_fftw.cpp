@@ -27,21 +27,432 @@
 #include "xmipp_fftw.h"
 #include "args.h"
 #include "transformations.h"
+#include "xmipp_threads.h"
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <map>
 
 static pthread_mutex_t fftw_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
-bool	planCreated=false;
-int		nInstances=0;
+
+// Plan cache --------------------------------------------------------------
+namespace
+{
+enum FFTWPlanKind { PLAN_R2C, PLAN_C2R, PLAN_C2C_FORWARD, PLAN_C2C_BACKWARD };
+
+struct FFTWPlanKey
+{
+    int kind;
+    int rank;
+    int N[3];
+    int howmany;
+    bool inPlace;
+    int alignIn, alignOut;
+    int nthreads;
+    unsigned rigor;
+
+    bool operator<(const FFTWPlanKey &other) const
+    {
+        if (kind != other.kind)
+            return kind < other.kind;
+        if (rank != other.rank)
+            return rank < other.rank;
+        for (int d = 0; d < rank; ++d)
+            if (N[d] != other.N[d])
+                return N[d] < other.N[d];
+        if (howmany != other.howmany)
+            return howmany < other.howmany;
+        if (inPlace != other.inPlace)
+            return inPlace < other.inPlace;
+        if (alignIn != other.alignIn)
+            return alignIn < other.alignIn;
+        if (alignOut != other.alignOut)
+            return alignOut < other.alignOut;
+        if (nthreads != other.nthreads)
+            return nthreads < other.nthreads;
+        return rigor < other.rigor;
+    }
+};
+
+// FFTW functions of each precision
+template<typename T> struct FFTWPrecision;
+
+template<> struct FFTWPrecision<double>
+{
+    typedef fftw_plan Plan;
+    typedef fftw_complex Complex;
+    static void *malloc(size_t n) { return fftw_malloc(n); }
+    static void free(void *p) { fftw_free(p); }
+    static int alignmentOf(void *p) { return fftw_alignment_of((double*)p); }
+    static int initThreads() { return fftw_init_threads(); }
+    static void cleanupThreads() { fftw_cleanup_threads(); }
+    static void planWithNthreads(int n) { fftw_plan_with_nthreads(n); }
+    static void destroyPlan(Plan p) { fftw_destroy_plan(p); }
+    static Plan planR2C(int rank, const int *N, int howmany, double *in, size_t idist,
+                        Complex *out, size_t odist, unsigned rigor)
+    {
+        if (howmany > 1)
+            return fftw_plan_many_dft_r2c(rank, N, howmany, in, NULL, 1, idist, out, NULL, 1, odist, rigor);
+        return fftw_plan_dft_r2c(rank, N, in, out, rigor);
+    }
+    static Plan planC2R(int rank, const int *N, int howmany, Complex *in, size_t idist,
+                        double *out, size_t odist, unsigned rigor)
+    {
+        if (howmany > 1)
+            return fftw_plan_many_dft_c2r(rank, N, howmany, in, NULL, 1, idist, out, NULL, 1, odist, rigor);
+        return fftw_plan_dft_c2r(rank, N, in, out, rigor);
+    }
+    static Plan planC2C(int rank, const int *N, Complex *in, Complex *out, int sign, unsigned rigor)
+    {
+        return fftw_plan_dft(rank, N, in, out, sign, rigor);
+    }
+};
+
+template<> struct FFTWPrecision<float>
+{
+    typedef fftwf_plan Plan;
+    typedef fftwf_complex Complex;
+    static void *malloc(size_t n) { return fftwf_malloc(n); }
+    static void free(void *p) { fftwf_free(p); }
+    static int alignmentOf(void *p) { return fftwf_alignment_of((float*)p); }
+    static int initThreads() { return fftwf_init_threads(); }
+    static void cleanupThreads() { fftwf_cleanup_threads(); }
+    static void planWithNthreads(int n) { fftwf_plan_with_nthreads(n); }
+    static void destroyPlan(Plan p) { fftwf_destroy_plan(p); }
+    static Plan planR2C(int rank, const int *N, int howmany, float *in, size_t idist,
+                        Complex *out, size_t odist, unsigned rigor)
+    {
+        if (howmany > 1)
+            return fftwf_plan_many_dft_r2c(rank, N, howmany, in, NULL, 1, idist, out, NULL, 1, odist, rigor);
+        return fftwf_plan_dft_r2c(rank, N, in, out, rigor);
+    }
+    static Plan planC2R(int rank, const int *N, int howmany, Complex *in, size_t idist,
+                        float *out, size_t odist, unsigned rigor)
+    {
+        if (howmany > 1)
+            return fftwf_plan_many_dft_c2r(rank, N, howmany, in, NULL, 1, idist, out, NULL, 1, odist, rigor);
+        return fftwf_plan_dft_c2r(rank, N, in, out, rigor);
+    }
+    static Plan planC2C(int rank, const int *N, Complex *in, Complex *out, int sign, unsigned rigor)
+    {
+        return fftwf_plan_dft(rank, N, in, out, sign, rigor);
+    }
+};
+
+// All the accesses are protected by fftw_plan_mutex
+std::map<FFTWPlanKey, fftw_plan> planCache;
+std::map<FFTWPlanKey, fftwf_plan> planCacheFloat;
+unsigned planRigor = FFTW_ESTIMATE;
+bool threadsInitialized = false;
+bool threadsInitializedFloat = false;
+
+std::map<FFTWPlanKey, fftw_plan> &cacheOf(double *)
+{
+    return planCache;
+}
+std::map<FFTWPlanKey, fftwf_plan> &cacheOf(float *)
+{
+    return planCacheFloat;
+}
+bool &threadsInitializedOf(double *)
+{
+    return threadsInitialized;
+}
+bool &threadsInitializedOf(float *)
+{
+    return threadsInitializedFloat;
+}
+
+// Maximum alignment (in bytes) that FFTW may report for an array
+const size_t FFTW_MAX_ALIGNMENT = 64;
+
+template<typename T>
+FFTWPlanKey makePlanKey(int kind, int rank, const int *N, int howmany, void *in, void *out,
+                        int nthreads)
+{
+    if (rank < 1 || rank > 3)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "FFTW plan cache: rank must be 1, 2 or 3");
+    if (howmany < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "FFTW plan cache: there must be at least one transform");
+    FFTWPlanKey key;
+    key.kind = kind;
+    key.rank = rank;
+    key.N[0] = key.N[1] = key.N[2] = 0;
+    for (int d = 0; d < rank; ++d)
+        key.N[d] = N[d];
+    key.howmany = howmany;
+    key.inPlace = (in == out);
+    key.alignIn = FFTWPrecision<T>::alignmentOf(in);
+    key.alignOut = FFTWPrecision<T>::alignmentOf(out);
+    key.nthreads = nthreads;
+    key.rigor = planRigor;
+    return key;
+}
+
+/* Plans are computed on scratch buffers with the same alignment as the
+ * user arrays, so that FFTW_MEASURE and FFTW_PATIENT do not overwrite user
+ * data and the plan can be executed later on any array with that alignment. */
+template<typename T>
+typename FFTWPrecision<T>::Plan createPlan(const FFTWPlanKey &key)
+{
+    typedef FFTWPrecision<T> P;
+    typedef typename P::Complex Complex;
+    size_t realSize = 1, complexSize = 1;
+    for (int d = 0; d < key.rank - 1; ++d)
+    {
+        realSize *= key.N[d];
+        complexSize *= key.N[d];
+    }
+    realSize *= key.N[key.rank - 1];
+    if (key.kind == PLAN_R2C || key.kind == PLAN_C2R)
+        complexSize *= key.N[key.rank - 1] / 2 + 1;
+    else
+    {
+        complexSize *= key.N[key.rank - 1];
+        realSize = 2 * complexSize;
+    }
+    size_t realDist = realSize, complexDist = complexSize;
+    realSize *= key.howmany;
+    complexSize *= key.howmany;
+    size_t inBytes, outBytes;
+    if (key.kind == PLAN_R2C)
+    {
+        inBytes = realSize * sizeof(T);
+        outBytes = complexSize * sizeof(Complex);
+    }
+    else if (key.kind == PLAN_C2R)
+    {
+        inBytes = complexSize * sizeof(Complex);
+        outBytes = realSize * sizeof(T);
+    }
+    else
+        inBytes = outBytes = complexSize * sizeof(Complex);
+    if (key.inPlace)
+        inBytes = outBytes = std::max(inBytes, outBytes);
+
+    char *scratchIn = (char*)P::malloc(inBytes + FFTW_MAX_ALIGNMENT);
+    char *scratchOut = key.inPlace ? scratchIn : (char*)P::malloc(outBytes + FFTW_MAX_ALIGNMENT);
+    if (scratchIn == NULL || scratchOut == NULL)
+        REPORT_ERROR(ERR_MEM_NOTENOUGH, "FFTW plan cache: cannot allocate scratch buffers");
+    void *in = scratchIn + key.alignIn;
+    void *out = scratchOut + key.alignOut;
+
+    // The number of threads of FFTW is global, it is always set for the plan,
+    // also to 1, as other code may have changed it
+    bool &initialized = threadsInitializedOf((T*)NULL);
+    if (!initialized)
+    {
+        if (P::initThreads() == 0)
+            REPORT_ERROR(ERR_THREADS_NOTINIT, "FFTW cannot init threads (FFTWPlanCache)");
+        initialized = true;
+    }
+    P::planWithNthreads(key.nthreads);
+
+    // Only real transforms are batched
+    typename P::Plan plan = NULL;
+    switch (key.kind)
+    {
+    case PLAN_R2C:
+        plan = P::planR2C(key.rank, key.N, key.howmany, (T*)in, realDist, (Complex*)out, complexDist,
+                          key.rigor);
+        break;
+    case PLAN_C2R:
+        plan = P::planC2R(key.rank, key.N, key.howmany, (Complex*)in, complexDist, (T*)out, realDist,
+                          key.rigor);
+        break;
+    case PLAN_C2C_FORWARD:
+        if (key.howmany == 1)
+            plan = P::planC2C(key.rank, key.N, (Complex*)in, (Complex*)out, FFTW_FORWARD, key.rigor);
+        break;
+    case PLAN_C2C_BACKWARD:
+        if (key.howmany == 1)
+            plan = P::planC2C(key.rank, key.N, (Complex*)in, (Complex*)out, FFTW_BACKWARD, key.rigor);
+        break;
+    }
+
+    if (scratchOut != scratchIn)
+        P::free(scratchOut);
+    P::free(scratchIn);
+    if (plan == NULL)
+        REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
+    return plan;
+}
+
+template<typename T>
+typename FFTWPrecision<T>::Plan getCachedPlan(int kind, int rank, const int *N, int howmany,
+                                             void *in, void *out, int nthreads)
+{
+    typedef typename FFTWPrecision<T>::Plan Plan;
+    pthread_mutex_lock(&fftw_plan_mutex);
+    Plan plan = NULL;
+    try
+    {
+        FFTWPlanKey key = makePlanKey<T>(kind, rank, N, howmany, in, out, nthreads);
+        std::map<FFTWPlanKey, Plan> &cache = cacheOf((T*)NULL);
+        typename std::map<FFTWPlanKey, Plan>::iterator it = cache.find(key);
+        if (it == cache.end())
+        {
+            plan = createPlan<T>(key);
+            cache[key] = plan;
+        }
+        else
+            plan = it->second;
+    }
+    catch (XmippError &xe)
+    {
+        pthread_mutex_unlock(&fftw_plan_mutex);
+        throw;
+    }
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    return plan;
+}
+
+// Must be called with fftw_plan_mutex locked
+void clearPlanCache()
+{
+    for (std::map<FFTWPlanKey, fftw_plan>::iterator it = planCache.begin(); it != planCache.end(); ++it)
+        fftw_destroy_plan(it->second);
+    planCache.clear();
+    for (std::map<FFTWPlanKey, fftwf_plan>::iterator it = planCacheFloat.begin(); it != planCacheFloat.end(); ++it)
+        fftwf_destroy_plan(it->second);
+    planCacheFloat.clear();
+}
+}
+
+fftw_plan FFTWPlanCache::getPlanR2C(int rank, const int *N, double *in, fftw_complex *out, int nthreads)
+{
+    return getCachedPlan<double>(PLAN_R2C, rank, N, 1, in, out, nthreads);
+}
+
+fftw_plan FFTWPlanCache::getPlanC2R(int rank, const int *N, fftw_complex *in, double *out, int nthreads)
+{
+    return getCachedPlan<double>(PLAN_C2R, rank, N, 1, in, out, nthreads);
+}
+
+fftw_plan FFTWPlanCache::getPlanC2C(int rank, const int *N, fftw_complex *in, fftw_complex *out,
+                                    int sign, int nthreads)
+{
+    return getCachedPlan<double>(sign == FFTW_FORWARD ? PLAN_C2C_FORWARD : PLAN_C2C_BACKWARD,
+                                 rank, N, 1, in, out, nthreads);
+}
+
+fftw_plan FFTWPlanCache::getPlanManyR2C(int rank, const int *N, int howmany, double *in, fftw_complex *out,
+                                        int nthreads)
+{
+    return getCachedPlan<double>(PLAN_R2C, rank, N, howmany, in, out, nthreads);
+}
+
+fftw_plan FFTWPlanCache::getPlanManyC2R(int rank, const int *N, int howmany, fftw_complex *in, double *out,
+                                        int nthreads)
+{
+    return getCachedPlan<double>(PLAN_C2R, rank, N, howmany, in, out, nthreads);
+}
+
+fftwf_plan FFTWPlanCache::getPlanR2C(int rank, const int *N, float *in, fftwf_complex *out, int nthreads)
+{
+    return getCachedPlan<float>(PLAN_R2C, rank, N, 1, in, out, nthreads);
+}
+
+fftwf_plan FFTWPlanCache::getPlanC2R(int rank, const int *N, fftwf_complex *in, float *out, int nthreads)
+{
+    return getCachedPlan<float>(PLAN_C2R, rank, N, 1, in, out, nthreads);
+}
+
+void FFTWPlanCache::setRigor(unsigned rigor)
+{
+    if (rigor != FFTW_ESTIMATE && rigor != FFTW_MEASURE &&
+        rigor != FFTW_PATIENT && rigor != FFTW_EXHAUSTIVE)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "FFTW plan cache: unknown planner rigor");
+    pthread_mutex_lock(&fftw_plan_mutex);
+    planRigor = rigor;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+void FFTWPlanCache::setRigor(const String &rigor)
+{
+    if (rigor == "estimate")
+        setRigor(FFTW_ESTIMATE);
+    else if (rigor == "measure")
+        setRigor(FFTW_MEASURE);
+    else if (rigor == "patient")
+        setRigor(FFTW_PATIENT);
+    else if (rigor == "exhaustive")
+        setRigor(FFTW_EXHAUSTIVE);
+    else
+        REPORT_ERROR(ERR_ARG_INCORRECT, formatString("Unknown FFTW planner rigor: %s", rigor.c_str()));
+}
+
+unsigned FFTWPlanCache::getRigor()
+{
+    return planRigor;
+}
+
+bool FFTWPlanCache::importWisdom(const FileName &fn)
+{
+    if (!fn.exists())
+        return false;
+    FileName fnFloat = fn.addExtension("float");
+    pthread_mutex_lock(&fftw_plan_mutex);
+    int ok = fftw_import_wisdom_from_filename(fn.c_str());
+    if (ok != 0 && fnFloat.exists())
+        ok = fftwf_import_wisdom_from_filename(fnFloat.c_str());
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    return ok != 0;
+}
+
+/* Export the double or single precision wisdom to fn */
+static bool exportWisdomFile(const FileName &fn, bool singlePrecision)
+{
+    // Write to a temporary file and rename, so that concurrent readers
+    // never see a partially written wisdom file
+    FileName fnTmp = formatString("%s.%d.tmp", fn.c_str(), (int)getpid());
+    pthread_mutex_lock(&fftw_plan_mutex);
+    int ok = singlePrecision ? fftwf_export_wisdom_to_filename(fnTmp.c_str()) :
+             fftw_export_wisdom_to_filename(fnTmp.c_str());
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    if (ok == 0 || rename(fnTmp.c_str(), fn.c_str()) != 0)
+    {
+        unlink(fnTmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool FFTWPlanCache::exportWisdom(const FileName &fn)
+{
+    fn.getDir().makePath();
+    return exportWisdomFile(fn, false) && exportWisdomFile(fn.addExtension("float"), true);
+}
+
+FileName FFTWPlanCache::defaultWisdomFile()
+{
+    const char *envWisdom = getenv("XMIPP_FFTW_WISDOM");
+    if (envWisdom != NULL)
+        return envWisdom;
+    const char *home = getenv("HOME");
+    return formatString("%s/.xmipp/fftw_wisdom", home == NULL ? "." : home);
+}
+
+void FFTWPlanCache::clear()
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    clearPlanCache();
+    pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+size_t FFTWPlanCache::size()
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    size_t n = planCache.size() + planCacheFloat.size();
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    return n;
+}
 
 // Constructors and destructors --------------------------------------------
 FourierTransformer::FourierTransformer()
 {
     init();
     nthreads=1;
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances++;
-    pthread_mutex_unlock(&fftw_plan_mutex);
     threadsSetOn=false;
     normSign = FFTW_FORWARD;
 }
@@ -49,9 +460,6 @@ FourierTransformer::FourierTransformer()
 FourierTransformer::FourierTransformer(int _normSign)
 {
     init();
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances++;
-    pthread_mutex_unlock(&fftw_plan_mutex);
     nthreads=1;
     threadsSetOn=false;
     normSign = _normSign;
@@ -74,44 +482,38 @@ void FourierTransformer::init()
     fPlanBackward    = NULL;
     dataPtr          = NULL;
     complexDataPtr   = NULL;
+    fourierDataPtr   = NULL;
 }
 
 void FourierTransformer::clear()
 {
     fFourier.clear();
-    // Anything to do with plans has to be protected for threads!
-    pthread_mutex_lock(&fftw_plan_mutex);
-    if (fPlanForward !=NULL)
-        fftw_destroy_plan(fPlanForward);
-    if (fPlanBackward!=NULL)
-        fftw_destroy_plan(fPlanBackward);
-    pthread_mutex_unlock(&fftw_plan_mutex);
-
+    // Plans belong to the FFTWPlanCache, they must not be destroyed here
     init();
 }
 
 FourierTransformer::~FourierTransformer()
 {
+    // Threads are not cleaned up here, since cached plans
+    // may still be used by other transformers
     clear();
+}
 
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances--;
-
-    // Check if a plan was already created.
-    if (planCreated)
+void FourierTransformer::destroyThreads(void )
+{
+    // Only this transformer goes back to a single thread. The threads of FFTW
+    // and the cached plans are kept, since other transformers may use them
+    nthreads = 1;
+    if(threadsSetOn)
     {
-    	// Check if this is last instance of a FFT.
-        if (nInstances == 0)
-        {
-        	destroyThreads();
-        	planCreated = false;
-        	// Don't call cleanup.
-        	// There might be other transformers, and this call would
-        	// invalidate it's plans
-//        	cleanup();
-        }
+        // Single thread plans for the current arrays
+        if (dataPtr != NULL)
+            recomputePlanR2C();
+        else if (complexDataPtr != NULL)
+            recomputePlanC2C();
     }
-    pthread_mutex_unlock(&fftw_plan_mutex);
+
+    threadsSetOn=false;
 }
 
 // Initialization ----------------------------------------------------------
@@ -170,23 +572,13 @@ void FourierTransformer::recomputePlanR2C()
 		break;
 	}
 
-	pthread_mutex_lock(&fftw_plan_mutex);
-	if (fPlanForward!=NULL)
-		fftw_destroy_plan(fPlanForward);
-	fPlanForward=NULL;
-	fPlanForward = fftw_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-									 (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-	if (fPlanBackward!=NULL)
-		fftw_destroy_plan(fPlanBackward);
-	fPlanBackward=NULL;
-	fPlanBackward = fftw_plan_dft_c2r(ndim, N,
-									  (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-									  FFTW_ESTIMATE);
-	if (fPlanForward == NULL || fPlanBackward == NULL)
-		REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
+	fPlanForward = FFTWPlanCache::getPlanR2C(ndim, N, MULTIDIM_ARRAY(*fReal),
+	               (fftw_complex*) MULTIDIM_ARRAY(fFourier), nthreads);
+	fPlanBackward = FFTWPlanCache::getPlanC2R(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
+	                MULTIDIM_ARRAY(*fReal), nthreads);
 	dataPtr=MULTIDIM_ARRAY(*fReal);
-	planCreated = true;
-	pthread_mutex_unlock(&fftw_plan_mutex);
+	fourierDataPtr=MULTIDIM_ARRAY(fFourier);
+	complexDataPtr=NULL;
 }
 
 void FourierTransformer::setReal(MultidimArray<std::complex<double> > &input)
@@ -202,48 +594,42 @@ void FourierTransformer::setReal(MultidimArray<std::complex<double> > &input)
     fComplex=&input;
 
     if (recomputePlan)
-    {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
+        recomputePlanC2C();
+}
 
-        pthread_mutex_lock(&fftw_plan_mutex);
-        if (fPlanForward!=NULL)
-            fftw_destroy_plan(fPlanForward);
-        fPlanForward=NULL;
-        fPlanForward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        if (fPlanBackward!=NULL)
-            fftw_destroy_plan(fPlanBackward);
-        fPlanBackward=NULL;
-        fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
-        delete [] N;
-        complexDataPtr=MULTIDIM_ARRAY(*fComplex);
-        pthread_mutex_unlock(&fftw_plan_mutex);
+void FourierTransformer::recomputePlanC2C()
+{
+    int ndim=3;
+    if (ZSIZE(*fComplex)==1)
+    {
+        ndim=2;
+        if (YSIZE(*fComplex)==1)
+            ndim=1;
     }
+    int N[3];
+    switch (ndim)
+    {
+    case 1:
+        N[0]=XSIZE(*fComplex);
+        break;
+    case 2:
+        N[0]=YSIZE(*fComplex);
+        N[1]=XSIZE(*fComplex);
+        break;
+    case 3:
+        N[0]=ZSIZE(*fComplex);
+        N[1]=YSIZE(*fComplex);
+        N[2]=XSIZE(*fComplex);
+        break;
+    }
+
+    fPlanForward = FFTWPlanCache::getPlanC2C(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
+                   (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, nthreads);
+    fPlanBackward = FFTWPlanCache::getPlanC2C(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
+                    (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, nthreads);
+    complexDataPtr=MULTIDIM_ARRAY(*fComplex);
+    fourierDataPtr=MULTIDIM_ARRAY(fFourier);
+    dataPtr=NULL;
 }
 
 void FourierTransformer::setFourier(const MultidimArray<std::complex<double> > &inputFourier)
@@ -255,9 +641,27 @@ void FourierTransformer::setFourier(const MultidimArray<std::complex<double> > &
 // Transform ---------------------------------------------------------------
 void FourierTransformer::Transform(int sign)
 {
+    // Cached plans are executed on the current arrays. If any of them was
+    // aliased somewhere else since the plan was computed, update the plan.
+    if (dataPtr!=NULL)
+    {
+        if (dataPtr!=MULTIDIM_ARRAY(*fReal) || fourierDataPtr!=MULTIDIM_ARRAY(fFourier))
+            recomputePlanR2C();
+    }
+    else if (complexDataPtr!=NULL)
+    {
+        if (complexDataPtr!=MULTIDIM_ARRAY(*fComplex) || fourierDataPtr!=MULTIDIM_ARRAY(fFourier))
+            recomputePlanC2C();
+    }
+    else
+        REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans have not been created");
+
     if (sign == FFTW_FORWARD)
     {
-        fftw_execute(fPlanForward);
+        if (dataPtr!=NULL)
+            fftw_execute_dft_r2c(fPlanForward, dataPtr, (fftw_complex*) fourierDataPtr);
+        else
+            fftw_execute_dft(fPlanForward, (fftw_complex*) complexDataPtr, (fftw_complex*) fourierDataPtr);
 
         if (sign == normSign)
         {
@@ -292,7 +696,10 @@ void FourierTransformer::Transform(int sign)
     }
     else if (sign == FFTW_BACKWARD)
     {
-        fftw_execute(fPlanBackward);
+        if (dataPtr!=NULL)
+            fftw_execute_dft_c2r(fPlanBackward, (fftw_complex*) fourierDataPtr, dataPtr);
+        else
+            fftw_execute_dft(fPlanBackward, (fftw_complex*) fourierDataPtr, (fftw_complex*) complexDataPtr);
 
         if (sign == normSign)
         {
@@ -389,6 +796,214 @@ void FourierTransformer::enforceHermitianSymmetry()
     }
 }
 
+// Batch transforms -------------------------------------------------------
+BatchFourierTransformer::BatchFourierTransformer(int _normSign)
+{
+    fReal=NULL;
+    nthreads=1;
+    normSign=_normSign;
+    rank=0;
+    N[0]=N[1]=N[2]=0;
+}
+
+void BatchFourierTransformer::setReal(MultidimArray<double> &stack)
+{
+    fReal=&stack;
+    fFourier.resizeNoCopy(NSIZE(stack),ZSIZE(stack),YSIZE(stack),XSIZE(stack)/2+1);
+    rank=3;
+    N[0]=ZSIZE(stack);
+    N[1]=YSIZE(stack);
+    N[2]=XSIZE(stack);
+    if (ZSIZE(stack)==1)
+    {
+        rank=2;
+        N[0]=YSIZE(stack);
+        N[1]=XSIZE(stack);
+        if (YSIZE(stack)==1)
+        {
+            rank=1;
+            N[0]=XSIZE(stack);
+        }
+    }
+}
+
+void BatchFourierTransformer::getFourierAlias(size_t n, MultidimArray< std::complex<double> > &V)
+{
+    if (n>=NSIZE(fFourier))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"getFourierAlias: Selected image cannot be higher than N size.");
+    V.alias(fFourier);
+    V.setDimensions(XSIZE(fFourier),YSIZE(fFourier),ZSIZE(fFourier),1);
+    V.data=MULTIDIM_ARRAY(fFourier)+n*ZYXSIZE(fFourier);
+    V.nzyxdimAlloc=V.nzyxdim;
+}
+
+void BatchFourierTransformer::Transform(int sign, size_t first, size_t last)
+{
+    if (first>=last)
+        return;
+    int howmany=(int)(last-first);
+    double *real=MULTIDIM_ARRAY(*fReal)+first*ZYXSIZE(*fReal);
+    fftw_complex *fourier=(fftw_complex*)(MULTIDIM_ARRAY(fFourier)+first*ZYXSIZE(fFourier));
+    double isize=1.0/ZYXSIZE(*fReal);
+    if (sign==FFTW_FORWARD)
+    {
+        fftw_plan plan=FFTWPlanCache::getPlanManyR2C(rank,N,howmany,real,fourier);
+        fftw_execute_dft_r2c(plan,real,fourier);
+        if (sign==normSign)
+        {
+            double *ptr=(double*)fourier;
+            size_t nmax=2*howmany*ZYXSIZE(fFourier);
+            for (size_t n=0; n<nmax; ++n)
+                ptr[n]*=isize;
+        }
+    }
+    else
+    {
+        fftw_plan plan=FFTWPlanCache::getPlanManyC2R(rank,N,howmany,fourier,real);
+        fftw_execute_dft_c2r(plan,fourier,real);
+        if (sign==normSign)
+        {
+            size_t nmax=howmany*ZYXSIZE(*fReal);
+            for (size_t n=0; n<nmax; ++n)
+                real[n]*=isize;
+        }
+    }
+}
+
+struct BatchTransformData
+{
+    BatchFourierTransformer *transformer;
+    int sign;
+    size_t batchSize;
+};
+
+// Each thread transforms a batch of consecutive images
+static void batchTransformThread(ThreadArgument &thArg)
+{
+    BatchTransformData *data=(BatchTransformData *)thArg.workClass;
+    size_t Nimgs=NSIZE(*data->transformer->fReal);
+    size_t first=thArg.thread_id*data->batchSize;
+    size_t last=XMIPP_MIN(first+data->batchSize,Nimgs);
+    data->transformer->Transform(data->sign,first,last);
+}
+
+static void runBatchTransform(BatchFourierTransformer &transformer, int sign)
+{
+    if (transformer.fReal==NULL)
+        REPORT_ERROR(ERR_PLANS_NOCREATE,"BatchFourierTransformer: there is no stack to transform");
+    size_t Nimgs=NSIZE(*transformer.fReal);
+    int nthreads=(int)XMIPP_MIN((size_t)transformer.nthreads,Nimgs);
+    if (nthreads<=1)
+        transformer.Transform(sign,0,Nimgs);
+    else
+    {
+        BatchTransformData data;
+        data.transformer=&transformer;
+        data.sign=sign;
+        data.batchSize=(Nimgs+nthreads-1)/nthreads;
+        ThreadManager thMgr(nthreads,&data);
+        thMgr.run(batchTransformThread);
+    }
+}
+
+void BatchFourierTransformer::FourierTransform()
+{
+    runBatchTransform(*this,FFTW_FORWARD);
+}
+
+void BatchFourierTransformer::inverseFourierTransform()
+{
+    runBatchTransform(*this,FFTW_BACKWARD);
+}
+
+// Single precision transforms ---------------------------------------------
+FourierTransformerFloat::FourierTransformerFloat(int _normSign)
+{
+    fReal=NULL;
+    nthreads=1;
+    normSign=_normSign;
+    rank=0;
+    N[0]=N[1]=N[2]=0;
+}
+
+void FourierTransformerFloat::setReal(MultidimArray<float> &input)
+{
+    fReal=&input;
+    fFourier.resizeNoCopy(ZSIZE(input),YSIZE(input),XSIZE(input)/2+1);
+    rank=3;
+    N[0]=ZSIZE(input);
+    N[1]=YSIZE(input);
+    N[2]=XSIZE(input);
+    if (ZSIZE(input)==1)
+    {
+        rank=2;
+        N[0]=YSIZE(input);
+        N[1]=XSIZE(input);
+        if (YSIZE(input)==1)
+        {
+            rank=1;
+            N[0]=XSIZE(input);
+        }
+    }
+}
+
+void FourierTransformerFloat::FourierTransform()
+{
+    if (fReal==NULL)
+        REPORT_ERROR(ERR_PLANS_NOCREATE,"FourierTransformerFloat: there is no array to transform");
+    float *real=MULTIDIM_ARRAY(*fReal);
+    fftwf_complex *fourier=(fftwf_complex*)MULTIDIM_ARRAY(fFourier);
+    fftwf_plan plan=FFTWPlanCache::getPlanR2C(rank,N,real,fourier,nthreads);
+    fftwf_execute_dft_r2c(plan,real,fourier);
+    if (normSign==FFTW_FORWARD)
+    {
+        float isize=1.0f/MULTIDIM_SIZE(*fReal);
+        float *ptr=(float*)fourier;
+        size_t nmax=2*MULTIDIM_SIZE(fFourier);
+        for (size_t n=0; n<nmax; ++n)
+            ptr[n]*=isize;
+    }
+}
+
+void FourierTransformerFloat::inverseFourierTransform()
+{
+    if (fReal==NULL)
+        REPORT_ERROR(ERR_PLANS_NOCREATE,"FourierTransformerFloat: there is no array to transform");
+    float *real=MULTIDIM_ARRAY(*fReal);
+    fftwf_complex *fourier=(fftwf_complex*)MULTIDIM_ARRAY(fFourier);
+    fftwf_plan plan=FFTWPlanCache::getPlanC2R(rank,N,fourier,real,nthreads);
+    fftwf_execute_dft_c2r(plan,fourier,real);
+    if (normSign==FFTW_BACKWARD)
+    {
+        float isize=1.0f/MULTIDIM_SIZE(*fReal);
+        size_t nmax=MULTIDIM_SIZE(*fReal);
+        for (size_t n=0; n<nmax; ++n)
+            real[n]*=isize;
+    }
+}
+
+void FourierTransformerFloat::FourierTransform(MultidimArray<float> &v,
+        MultidimArray< std::complex<float> > &V, bool getCopy)
+{
+    setReal(v);
+    FourierTransform();
+    if (getCopy)
+        V=fFourier;
+    else
+        getFourierAlias(V);
+}
+
+void FourierTransformerFloat::inverseFourierTransform(const MultidimArray< std::complex<float> > &V,
+        MultidimArray<float> &v)
+{
+    setReal(v);
+    if (!V.sameShape(fFourier))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"inverseFourierTransform: the Fourier transform does not match the real array");
+    if (MULTIDIM_ARRAY(V)!=MULTIDIM_ARRAY(fFourier))
+        memcpy(MULTIDIM_ARRAY(fFourier),MULTIDIM_ARRAY(V),MULTIDIM_SIZE(V)*sizeof(std::complex<float>));
+    inverseFourierTransform();
+}
+
 /* FFT Magnitude  ------------------------------------------------------- */
 void FFT_magnitude(const MultidimArray< std::complex<double> > &v,
                    MultidimArray<double> &mag)
@@ -433,22 +1048,29 @@ void convolutionFFTStack(const MultidimArray<double> &img,
     if (&result != &img)
         result = img;
 
-    MultidimArray<double> imgTemp;
+    MultidimArray<double> imgTemp, slices;
     MultidimArray< std::complex< double> > FFTIm, FFTK;
-    FourierTransformer transformer1(FFTW_BACKWARD), transformer2(FFTW_BACKWARD);
+    FourierTransformer transformer2(FFTW_BACKWARD);
+    BatchFourierTransformer transformer1(FFTW_BACKWARD);
 
     transformer2.FourierTransform((MultidimArray<double> &)kernel, FFTK, false);
 
-    for (size_t n = 0; n < ZSIZE(result); n++)
+    // The slices are transformed together as a stack of images
+    slices.alias(result);
+    slices.setDimensions(XSIZE(result), YSIZE(result), 1, ZSIZE(result));
+    transformer1.setReal(slices);
+    transformer1.FourierTransform();
+    for (size_t k = 0; k < ZSIZE(result); k++)
     {
-        imgTemp.aliasSlice(result, n);
-        transformer1.FourierTransform(imgTemp, FFTIm, false);
-
+        transformer1.getFourierAlias(k, FFTIm);
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FFTIm)
         DIRECT_MULTIDIM_ELEM(FFTIm,n) *= DIRECT_MULTIDIM_ELEM(FFTK,n);
+    }
+    transformer1.inverseFourierTransform();
 
-        transformer1.inverseFourierTransform();
-
+    for (size_t k = 0; k < ZSIZE(result); k++)
+    {
+        imgTemp.aliasSlice(result, k);
         CenterFFT(imgTemp, false);
     }
 
@@ -678,8 +1300,30 @@ void scaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<double> &mda
     transformerMp.inverseFourierTransform();
 }
 
+void scaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<float> &mdaIn, MultidimArray<float> &mdaOut, int nThreads)
+{
+    // Same steps as the double version, with single precision transforms
+    MultidimArray<std::complex<float> > MmemFourier;
+    FourierTransformerFloat transformerM;
+    transformerM.setThreadsNumber(nThreads);
+    transformerM.FourierTransform(mdaIn, MmemFourier, false);
+
+    mdaOut.resizeNoCopy(Zdim, Ydim, Xdim);
+    MultidimArray<std::complex<float> > MpmemFourier;
+    FourierTransformerFloat transformerMp;
+    transformerMp.setThreadsNumber(nThreads);
+    transformerMp.setReal(mdaOut);
+    transformerMp.getFourierAlias(MpmemFourier);
+
+    scaleToSizeFourier(mdaIn, mdaOut, MmemFourier, MpmemFourier);
+
+    transformerMp.inverseFourierTransform();
+}
+
 template void scaleToSizeFourier<double>(MultidimArray<double> &mdaIn, MultidimArray<double> &mdaOut,
         MultidimArray<std::complex<double> > &inFourier, MultidimArray<std::complex<double> > &outFourier);
+template void scaleToSizeFourier<float>(MultidimArray<float> &mdaIn, MultidimArray<float> &mdaOut,
+        MultidimArray<std::complex<float> > &inFourier, MultidimArray<std::complex<float> > &outFourier);
 
 template<typename T>
 void scaleToSizeFourier(MultidimArray<T> &mdaIn, MultidimArray<T> &mdaOut,
@@ -733,8 +1377,17 @@ void selfScaleToSizeFourier(int Ydim, int Xdim, MultidimArray<double>& Mpmem,int
     selfScaleToSizeFourier(1, Ydim, Xdim, Mpmem, nThreads);
 }
 
-void selfScaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArrayGeneric &Mpmem, int nThreads)
+void selfScaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArrayGeneric &Mpmem, int nThreads,
+                            bool singlePrecision)
 {
+    if (singlePrecision && Mpmem.datatype==DT_Float)
+    {
+        MultidimArray<float> &mda=*((MultidimArray<float>*)Mpmem.im);
+        MultidimArray<float> aux;
+        scaleToSizeFourier(Zdim, Ydim, Xdim, mda, aux, nThreads);
+        mda=aux;
+        return;
+    }
     MultidimArray<double> aux;
     Mpmem.getImage(aux);
     selfScaleToSizeFourier(Zdim, Ydim, Xdim, aux, nThreads);
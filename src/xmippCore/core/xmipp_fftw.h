@@ -32,6 +32,7 @@
 #include "multidim_array.h"
 #include "multidim_array_generic.h"
 #include "xmipp_fft.h"
+#include "xmipp_filename.h"
 
 
 /** @defgroup FourierW FFTW Fourier transforms
@@ -39,6 +40,89 @@
   *@{
   */
 
+/** Process-wide cache of FFTW plans.
+ * @ingroup FourierW
+ *
+ * Plans are keyed by kind (r2c, c2r, c2c forward/backward), rank, shape,
+ * in-place layout, memory alignment of the arrays, number of threads and
+ * planner rigor. They are computed once on scratch buffers and then shared
+ * by all FourierTransformer objects of the process, that execute them on
+ * their own arrays through the new-array execute interface of FFTW.
+ * Cached plans are owned by the cache and must never be destroyed by
+ * the caller.
+ *
+ * The planner rigor is FFTW_ESTIMATE by default. FFTW_MEASURE and
+ * FFTW_PATIENT give faster plans at the cost of a slower first planning,
+ * which can be amortized across runs by importing/exporting the FFTW wisdom.
+ *
+ * @code
+ * FFTWPlanCache::setRigor("measure");
+ * FFTWPlanCache::importWisdom(FFTWPlanCache::defaultWisdomFile());
+ * ... // Use FourierTransformer as usual
+ * FFTWPlanCache::exportWisdom(FFTWPlanCache::defaultWisdomFile());
+ * @endcode
+ */
+class FFTWPlanCache
+{
+public:
+    /** Plan for a real to complex transform of an array of size N (rank dimensions). */
+    static fftw_plan getPlanR2C(int rank, const int *N, double *in, fftw_complex *out, int nthreads=1);
+
+    /** Plan for a complex to real transform of an array of size N (rank dimensions). */
+    static fftw_plan getPlanC2R(int rank, const int *N, fftw_complex *in, double *out, int nthreads=1);
+
+    /** Plan for a complex to complex transform (sign is FFTW_FORWARD or FFTW_BACKWARD). */
+    static fftw_plan getPlanC2C(int rank, const int *N, fftw_complex *in, fftw_complex *out,
+                                int sign, int nthreads=1);
+
+    /** Plan for howmany real to complex transforms of arrays of size N.
+     * The arrays are contiguous in memory, as their transforms. */
+    static fftw_plan getPlanManyR2C(int rank, const int *N, int howmany, double *in, fftw_complex *out,
+                                    int nthreads=1);
+
+    /** Plan for howmany complex to real transforms of arrays of size N. */
+    static fftw_plan getPlanManyC2R(int rank, const int *N, int howmany, fftw_complex *in, double *out,
+                                    int nthreads=1);
+
+    /** Single precision plan for a real to complex transform. */
+    static fftwf_plan getPlanR2C(int rank, const int *N, float *in, fftwf_complex *out, int nthreads=1);
+
+    /** Single precision plan for a complex to real transform. */
+    static fftwf_plan getPlanC2R(int rank, const int *N, fftwf_complex *in, float *out, int nthreads=1);
+
+    /** Set the planner rigor (FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT or FFTW_EXHAUSTIVE). */
+    static void setRigor(unsigned rigor);
+
+    /** Set the planner rigor by name: estimate, measure, patient or exhaustive. */
+    static void setRigor(const String &rigor);
+
+    /** Current planner rigor */
+    static unsigned getRigor();
+
+    /** Import FFTW wisdom from file.
+     * The wisdom of single precision plans is in fn.float (see exportWisdom).
+     * Returns false if the file does not exist or cannot be read. */
+    static bool importWisdom(const FileName &fn);
+
+    /** Export the accumulated FFTW wisdom to file.
+     * The wisdom of double precision plans is written to fn and the one of
+     * single precision plans to fn.float. The files are written atomically
+     * so that several processes may share the same wisdom files.
+     * Returns false on failure. */
+    static bool exportWisdom(const FileName &fn);
+
+    /** Default wisdom file.
+     * $XMIPP_FFTW_WISDOM if defined, $HOME/.xmipp/fftw_wisdom otherwise. */
+    static FileName defaultWisdomFile();
+
+    /** Destroy all cached plans.
+     * No plan returned by this cache may be executed after this call. */
+    static void clear();
+
+    /** Number of cached plans */
+    static size_t size();
+};
+
 /** Fourier Transformer class.
  * @ingroup FourierW
  *
@@ -101,60 +185,31 @@ public:
     /** Destructor */
     ~FourierTransformer();
 
-    /** Set Number of threads
-     * This function, which should be called once, performs any
-     * one-time initialization required to use threads on your
-     * system.
-     *
-     *  The nthreads argument indicates the number of threads you
-     *  want FFTW to use (or actually, the maximum number). All
-     *  plans subsequently created with any planner routine will use
-     *  that many threads. You can call fftw_plan_with_nthreads,
-     *  create some plans, call fftw_plan_with_nthreads again with a
-     *  different argument, and create some more plans for a new
-     *  number of threads. Plans already created before a call to
-     *  fftw_plan_with_nthreads are unaffected. If you pass an
-     *  nthreads argument of 1 (the default), threads are
-     *  disabled for subsequent plans. */
+    /** Set Number of threads.
+     *  The plans created afterwards by this transformer use tNumber
+     *  threads. The threads of FFTW are initialized, and their number set
+     *  for every plan, by the FFTWPlanCache under its mutex. */
     void setThreadsNumber(int tNumber)
     {
         if (tNumber!=1)
         {
             threadsSetOn=true;
             nthreads = tNumber;
-            if(fftw_init_threads()==0)
-                REPORT_ERROR(ERR_THREADS_NOTINIT, (std::string)"FFTW cannot init threads (setThreadsNumber)");
-            fftw_plan_with_nthreads(nthreads);
         }
     }
+
     /** Change Number of threads.
-     *
-     *  The nthreads argument indicates the number of threads you want FFTW to use
-     *  (or actually, the maximum number). All plans subsequently
-     *  created with any planner routine will use that many
-     *  threads. You can call fftw_plan_with_nthreads, create
-     *  some plans, call fftw_plan_with_nthreads again with a
-     *  different argument, and create some more plans for a new
-     *  number of threads. Plans already created before a call to
-     *  fftw_plan_with_nthreads are unaffected. If you pass an
-     *  nthreads argument of 1 (the default), threads are
-     *  disabled for subsequent plans. */
+     *  As setThreadsNumber, also back to 1. The plans already created
+     *  by this transformer are unaffected. */
     void changeThreadsNumber(int tNumber)
     {
         nthreads = tNumber;
-        fftw_plan_with_nthreads(nthreads);
     }
 
-    /** Destroy Threads. Do not execute any previously created
-     *  plans after calling this function   */
-    void destroyThreads(void )
-    {
-        nthreads = 1;
-        if(threadsSetOn)
-            fftw_cleanup_threads();
-
-        threadsSetOn=false;
-    }
+    /** Destroy Threads. The following transforms of this transformer
+     *  use a single thread. The plans of the FFTWPlanCache and the
+     *  threads of FFTW are kept for other transformers. */
+    void destroyThreads(void );
 
     /** Compute the Fourier transform of a MultidimArray, 2D and 3D.
         If getCopy is false, an alias to the transformed data is returned.
@@ -357,6 +412,9 @@ public:
     /* Pointer to the array of complex<double> with which the plan was computed */
     std::complex<double> * complexDataPtr;
 
+    /* Pointer to the Fourier array with which the plan was computed */
+    std::complex<double> * fourierDataPtr;
+
     /* Init object*/
     void init();
     /** Clear object */
@@ -369,14 +427,19 @@ public:
      */
     void cleanup(void)
     {
+        FFTWPlanCache::clear();
         fftw_cleanup();
     }
 
     /** Recompute transformation plan. Call this method after setting real/fourier alias
      	 and before calling Transform() to correctly update this object.
+     	 Plans are taken from the FFTWPlanCache, so this is cheap for already seen shapes.
     */
     void recomputePlanR2C();
 
+    /** Recompute the complex to complex transformation plan. */
+    void recomputePlanC2C();
+
     /** Computes the transform, specified in Init() function
         If normalization=true the forward transform is normalized
         (no normalization is made in the inverse transform)
@@ -420,6 +483,153 @@ public:
 
 };
 
+/** Fourier transforms of all the images of a stack.
+ * @ingroup FourierW
+ *
+ * The NSIZE images of a stack (2D images or volumes) are transformed with a
+ * single FFTW plan for many transforms. Their Fourier transforms are stored
+ * one after the other in fFourier, of size NSIZE x ZSIZE x YSIZE x XSIZE/2+1.
+ * With several threads the stack is split in as many batches of consecutive
+ * images, each one transformed by a thread. The normalization is the one of
+ * FourierTransformer, by the size of a single image.
+ *
+ * As in FourierTransformer, the memory of the stack is handled externally.
+ *
+ * @code
+ * BatchFourierTransformer transformer;
+ * transformer.setThreadsNumber(4);
+ * transformer.setReal(stack);
+ * transformer.FourierTransform();
+ * MultidimArray< std::complex<double> > F;
+ * for (size_t n=0; n<NSIZE(stack); ++n)
+ * {
+ *     transformer.getFourierAlias(n, F);
+ *     ... // Process the Fourier transform of the image n
+ * }
+ * transformer.inverseFourierTransform(); // Back to stack
+ * @endcode
+ */
+class BatchFourierTransformer
+{
+public:
+    /** Fourier transforms of all the images */
+    MultidimArray< std::complex<double> > fFourier;
+
+    /** Stack of real images, it is not owned by the transformer */
+    MultidimArray<double> *fReal;
+
+    /** Number of threads, each one transforms a batch of images */
+    int nthreads;
+
+    /** Transform that is normalized by the size of the images */
+    int normSign;
+
+public:
+    /** Default constructor, the forward transform is normalized */
+    BatchFourierTransformer(int _normSign=FFTW_FORWARD);
+
+    /** Set the number of threads */
+    void setThreadsNumber(int tNumber)
+    {
+        nthreads=XMIPP_MAX(tNumber,1);
+    }
+
+    /** Set the stack to transform and resize fFourier */
+    void setReal(MultidimArray<double> &stack);
+
+    /** Transform all the images of the stack into fFourier */
+    void FourierTransform();
+
+    /** Transform fFourier back into the stack.
+     * As in FourierTransformer, fFourier is destroyed. */
+    void inverseFourierTransform();
+
+    /** Alias to the Fourier transform of the image n */
+    void getFourierAlias(size_t n, MultidimArray< std::complex<double> > &V);
+
+    /** Transform with sign FFTW_FORWARD or FFTW_BACKWARD.
+     * Only the images first..last-1 of the stack are transformed. */
+    void Transform(int sign, size_t first, size_t last);
+
+private:
+    // Rank and size of the images
+    int rank;
+    int N[3];
+};
+
+/** Fourier transformer of single precision arrays.
+ * @ingroup FourierW
+ *
+ * The same transforms of real arrays as FourierTransformer, for
+ * MultidimArray<float>, with single precision FFTW plans from the
+ * FFTWPlanCache. It halves the memory and the memory traffic of the
+ * transforms of float data, at the cost of a relative precision of about
+ * 1e-6.
+ *
+ * @code
+ * FourierTransformerFloat transformer;
+ * MultidimArray< std::complex<float> > Vfft;
+ * transformer.FourierTransform(V,Vfft,false);
+ * ... // Modify Vfft
+ * transformer.inverseFourierTransform();
+ * @endcode
+ */
+class FourierTransformerFloat
+{
+public:
+    /** Real array, it is not owned by the transformer */
+    MultidimArray<float> *fReal;
+
+    /** Fourier transform */
+    MultidimArray< std::complex<float> > fFourier;
+
+    /** Number of threads of the plans */
+    int nthreads;
+
+    /** Transform that is normalized by the size of the array */
+    int normSign;
+
+public:
+    /** Default constructor, the forward transform is normalized */
+    FourierTransformerFloat(int _normSign=FFTW_FORWARD);
+
+    /** Set the number of threads */
+    void setThreadsNumber(int tNumber)
+    {
+        nthreads=XMIPP_MAX(tNumber,1);
+    }
+
+    /** Set the real array and resize fFourier */
+    void setReal(MultidimArray<float> &input);
+
+    /** Transform the real array into fFourier */
+    void FourierTransform();
+
+    /** Transform fFourier back into the real array.
+     * As in FourierTransformer, fFourier is destroyed. */
+    void inverseFourierTransform();
+
+    /** Compute the Fourier transform of v.
+     * V is a copy of the transform, or an alias to it if getCopy is false. */
+    void FourierTransform(MultidimArray<float> &v, MultidimArray< std::complex<float> > &V,
+                          bool getCopy=true);
+
+    /** Compute the inverse Fourier transform of V into v.
+     * v must have the size of the original array. */
+    void inverseFourierTransform(const MultidimArray< std::complex<float> > &V, MultidimArray<float> &v);
+
+    /** Alias to the Fourier transform */
+    void getFourierAlias(MultidimArray< std::complex<float> > &V)
+    {
+        V.alias(fFourier);
+    }
+
+private:
+    // Rank and size of the real array
+    int rank;
+    int N[3];
+};
+
 /** FFT Magnitude 1D
  * @ingroup FourierOperations
  */
@@ -651,6 +861,9 @@ void frc_dpr(MultidimArray< double > & m1,
  */
 void scaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<double> &mdaIn, MultidimArray<double> &mdaOut, int nThreads=1);
 
+/** Scale matrix using a single precision Fourier transform */
+void scaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<float> &mdaIn, MultidimArray<float> &mdaOut, int nThreads=1);
+
 /** Scale Fourier transform
  * mdaIn and mdaOut define the sizes of the respective image, inFourier is transform to be scaled
  */
@@ -661,8 +874,11 @@ void scaleToSizeFourier(MultidimArray<T> &mdaIn, MultidimArray<T> &mdaOut,
 void selfScaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<double> &mda, int nthreads=1);
 
 void selfScaleToSizeFourier(int Ydim, int Xdim, MultidimArray<double> &mda, int nthreads=1);
-/** MultidimArrayGeneric version */
-void selfScaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArrayGeneric &mda, int nthreads=1);
+/** MultidimArrayGeneric version.
+ * With singlePrecision, float arrays are scaled in place with single
+ * precision transforms instead of being converted to double. */
+void selfScaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArrayGeneric &mda, int nthreads=1,
+                            bool singlePrecision=false);
 void selfScaleToSizeFourier(int Ydim, int Xdim, MultidimArrayGeneric &mda, int nthreads=1);
 
 #define POWER_SPECTRUM 0
@@ -105,6 +105,7 @@ std::map<String, H5infoProvider > createProviderMap()
     m["NXtomo"] = std::make_pair(MISTRAL, "/NXtomo/instrument/sample/data");
     m["TomoNormalized"] = std::make_pair(MISTRAL, "/TomoNormalized/TomoNormalized");
     m["MDF"]  = std::make_pair(EMAN,    "/MDF/images/%i/image");
+    m["Xmipp"] = std::make_pair(XMIPP,  "/Xmipp/images");
     return m;
 }
 
@@ -44,7 +44,8 @@ enum H5FileProvider
 {
     NONE,
     MISTRAL,
-    EMAN
+    EMAN,
+    XMIPP
 } ;
 
 
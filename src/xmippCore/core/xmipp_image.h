@@ -35,6 +35,7 @@
 #include "xmipp_image_generic.h"
 #include "xmipp_color.h"
 #include "multidim_array.h"
+#include "xmipp_datatype_cast.h"
 
 /// @addtogroup Images
 //@{
@@ -191,9 +192,7 @@ public:
                     memcpy(ptrDest, page, pageSize * sizeof(T));
                 else
                 {
-                    unsigned char * ptr = (unsigned char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((unsigned char *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -205,9 +204,7 @@ public:
                 }
                 else
                 {
-                    signed char * ptr = (signed char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((signed char *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -219,9 +216,7 @@ public:
                 }
                 else
                 {
-                    unsigned short * ptr = (unsigned short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((unsigned short *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -233,9 +228,7 @@ public:
                 }
                 else
                 {
-                    short * ptr = (short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((short *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -247,9 +240,7 @@ public:
                 }
                 else
                 {
-                    unsigned int * ptr = (unsigned int *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((unsigned int *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -261,9 +252,7 @@ public:
                 }
                 else
                 {
-                    int * ptr = (int *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((int *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -275,9 +264,7 @@ public:
                 }
                 else
                 {
-                    long * ptr = (long *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((long *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -289,9 +276,7 @@ public:
                 }
                 else
                 {
-                    float * ptr = (float *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((float *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -303,9 +288,7 @@ public:
                 }
                 else
                 {
-                    double * ptr = (double *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
+                    castPage((double *) page, ptrDest, pageSize);
                 }
                 break;
             }
@@ -335,9 +318,7 @@ public:
                 }
                 else
                 {
-                    float * ptr = (float *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (float) srcPtr[i];
+                    castPage(srcPtr, (float *) page, pageSize);
                 }
                 break;
             }
@@ -349,9 +330,7 @@ public:
                 }
                 else
                 {
-                    double * ptr = (double *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (double) srcPtr[i];
+                    castPage(srcPtr, (double *) page, pageSize);
                 }
                 break;
             }
@@ -363,9 +342,7 @@ public:
                 }
                 else
                 {
-                    unsigned short * ptr = (unsigned short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (unsigned short) srcPtr[i];
+                    castPage(srcPtr, (unsigned short *) page, pageSize);
                 }
                 break;
             }
@@ -377,9 +354,7 @@ public:
                 }
                 else
                 {
-                    short * ptr = (short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (short) srcPtr[i];
+                    castPage(srcPtr, (short *) page, pageSize);
                 }
                 break;
             }
@@ -392,9 +367,7 @@ public:
                 }
                 else
                 {
-                    unsigned char * ptr = (unsigned char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (unsigned char) srcPtr[i];
+                    castPage(srcPtr, (unsigned char *) page, pageSize);
                 }
                 break;
             }
@@ -406,9 +379,7 @@ public:
                 }
                 else
                 {
-                    char * ptr = (char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (char) srcPtr[i];
+                    castPage(srcPtr, (char *) page, pageSize);
                 }
                 break;
             }
@@ -431,14 +402,24 @@ public:
     CW_CONVERT) const
     {
 
-        double minF, maxF;
+        double minF = 0, maxF;
         double slope;
-        size_t n;
         DataType myTypeId = myT();
 
         switch (datatype)
         {
             case DT_UHalfByte:
+            {
+                maxF = 15;
+                if (max0 != min0)
+                    slope = static_cast<double>(maxF - minF)
+                            / static_cast<double>(max0 - min0);
+                else
+                    slope = 0;
+                castConvertPage(srcPtr, (unsigned char *) page, pageSize, minF, slope, min0);
+
+                break;
+            }
             case DT_UChar:
             {
                 if (castMode == CW_CONVERT && myTypeId == DT_SChar)
@@ -456,11 +437,7 @@ public:
                     else
                         slope = 0;
                 }
-                unsigned char * ptr = (unsigned char *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<unsigned char>(minF
-                                                        + (slope * static_cast<double>(srcPtr[n] - min0)));
+                castConvertPage(srcPtr, (unsigned char *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -481,11 +458,7 @@ public:
                     else
                         slope = 0;
                 }
-                char * ptr = (char *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<char>(minF
-                                               + (slope * static_cast<double>(srcPtr[n] - min0)));
+                castConvertPage(srcPtr, (char *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -512,11 +485,7 @@ public:
                         slope = 0;
                 }
 
-                unsigned short * ptr = (unsigned short *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<unsigned short>(minF
-                                                         + (slope * static_cast<double>(srcPtr[n] - min0)));
+                castConvertPage(srcPtr, (unsigned short *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -542,11 +511,7 @@ public:
                     else
                         slope = 0;
                 }
-                short * ptr = (short *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<short>(minF
-                                                + (slope * static_cast<double>(srcPtr[n] - min0)));
+                castConvertPage(srcPtr, (short *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -574,11 +539,7 @@ public:
                     else
                         slope = 0;
                 }
-                unsigned int * ptr = (unsigned int *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<unsigned int>(minF
-                                                       + (slope * static_cast<double>(srcPtr[n] - min0)));
+                castConvertPage(srcPtr, (unsigned int *) page, pageSize, minF, slope, min0);
                 break;
             }
             case DT_Int:
@@ -605,11 +566,7 @@ public:
                     else
                         slope = 0;
                 }
-                int * ptr = (int *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<int>(minF
-                                              + (slope * static_cast<double>(srcPtr[n] - min0)));
+                castConvertPage(srcPtr, (int *) page, pageSize, minF, slope, min0);
                 break;
             }
             default:
@@ -1242,8 +1199,8 @@ private:
         if (datatype == DT_UHalfByte){
             //REPORT_ERROR(ERR_MMAP, "Image Class::readData not supported for  "
             //                       "data type " + datatype2Str(DT_UHalfByte));
-            std::cout<<"redirecting from readData to readData4bits!"<<std::endl;
             readData4bit(fimg, select_img, datatype, pad);
+            return;
         }
         // If only half of a transform is stored, it needs to be handled
         if (transform == Hermitian || transform == CentHerm)
@@ -1256,11 +1213,19 @@ private:
 
         selectImgOffset = offset + IMG_INDEX(select_img) * (pagesize + pad);
 
+        // Shared mapping of the file (see ImageFileMap), only when reading
+        ImageFileMap * fileMap = (hFile != NULL) ? hFile->fileMap : NULL;
+        if (fileMap != NULL && selectImgOffset + NSIZE(data) * (pagesize + pad) - pad > fileMap->size)
+            REPORT_ERROR(ERR_IO_SIZE, formatString("readData: file %s is smaller than expected",
+                                                   dataFName.c_str()));
+
         // Flag to know that data is not going to be mapped although mmapOn is true
         if (mmapOnRead && (!checkMmapT(datatype) || swap > 0))
         {
-            String warnMessage;
-            if (swap > 0)
+            // The data of shared mappings is converted into memory without warning
+            if (fileMap != NULL)
+                ;
+            else if (swap > 0)
                 reportWarning("Image::readData: File endianness is swapped and not "
                               "compatible with mmap. Loading into memory.");
             else
@@ -1272,7 +1237,22 @@ private:
             mFd = -1;
         }
 
-        if (mmapOnRead)
+        if (mmapOnRead && fileMap != NULL && selectImgOffset % sizeof(T) == 0 &&
+            (NSIZE(data) == 1 || pad == 0))
+        {
+            // The data is a read-only view of the shared mapping
+            if (data.mmapOn)
+                REPORT_ERROR(ERR_MULTIDIM_DIM,
+                             "Image Class::ReadData: mmap option can not be selected simultaneously\
+                             for both Image class and its Multidimarray.");
+            ImageFileMap::retain(fileMap);
+            viewMap = fileMap;
+            mappedOffset = 0;
+            mappedSize = NSIZE(data) * pagesize;
+            data.data = reinterpret_cast<T*>(fileMap->map + selectImgOffset);
+            data.nzyxdimAlloc = NZYXSIZE(data);
+        }
+        else if (mmapOnRead && fileMap == NULL)
         {
             // Image mmapOn is not compatible with Multidimarray mmapOn
             if (data.mmapOn)
@@ -1291,6 +1271,8 @@ private:
         else
         {
             char* page = NULL;
+            const char * mapped = (fileMap != NULL) ? fileMap->map + selectImgOffset : NULL;
+            mmapOnRead = false;
 
             // Allocate memory for image data (Assume xdim, ydim, zdim and ndim are already set
             //if memory already allocated use it (no resize allowed)
@@ -1306,12 +1288,15 @@ private:
 #endif
 #undef DEBUG
 
-            if (pagesize > pagemax)
+            // Pages of mapped files are only copied when they have to be swapped
+            if (mapped != NULL && !swap)
+                ;
+            else if (pagesize > pagemax)
                 page = (char *) askMemory(pagemax * sizeof(char));
             else
                 page = (char *) askMemory(pagesize * sizeof(char));
 
-            if (fseek(fimg, selectImgOffset, SEEK_SET) == -1)
+            if (mapped == NULL && fseek(fimg, selectImgOffset, SEEK_SET) == -1)
                 REPORT_ERROR(ERR_IO_SIZE, "readData: can not seek the file pointer");
             for (size_t myn = 0; myn < NSIZE(data); myn++)
             {
@@ -1324,7 +1309,15 @@ private:
                     readsize_n = readsize / datatypesize;
 
                     //Read page from disc
-                    if (fread(page, readsize, 1, fimg) != 1)
+                    if (mapped != NULL)
+                    {
+                        if (swap)
+                            memcpy(page, mapped, readsize);
+                        else
+                            page = (char *) mapped;
+                        mapped += readsize;
+                    }
+                    else if (fread(page, readsize, 1, fimg) != 1)
                         REPORT_ERROR(ERR_IO_NOREAD, "Cannot read the whole page");
                     //swap per page
                     if (swap)
@@ -1334,7 +1327,9 @@ private:
                                readsize_n);
                     haveread_n += readsize_n;
                 }
-                if (pad > 0)
+                if (mapped != NULL)
+                    mapped += pad;
+                else if (pad > 0)
                     //fread( padpage, pad, 1, fimg);
                     if (fseek(fimg, pad, SEEK_CUR) == -1)
                         REPORT_ERROR(ERR_IO_SIZE,
@@ -1342,7 +1337,7 @@ private:
             }
             //if ( pad > 0 )
             //    freeMemory(padpage, pad*sizeof(char));
-            if (page > 0)
+            if (page != NULL && (mapped == NULL || swap))
                 freeMemory(page, pagesize * sizeof(char));
 
 #ifdef DEBUG
@@ -1357,7 +1352,11 @@ private:
 
 
     /** Read the raw data from compressed 4bit images
-     * We are assuming the values are stored in 4bits (2 values in 1 byte)
+     * The values are stored in 4 bits, 2 values in 1 byte, the first one in
+     * the lower half, and the rows start at a byte boundary (MRC mode 101).
+     * The frames are unpacked from the shared mapping of the file (see
+     * ImageFileMap), or from a mapping of the file when mmap is requested,
+     * so selecting an image only touches its own pages.
     */
     void
     readData4bit(FILE* fimg, size_t select_img, DataType datatype, size_t pad)
@@ -1371,67 +1370,67 @@ private:
                                    "data type different than " + datatype2Str(DT_UHalfByte));
         }
 
-        size_t selectImgOffset; //4Mb
-        size_t itemSize = ZYXSIZE(data);
-        size_t pagesizeF = itemSize /2;
-        size_t pagesizeM = itemSize;
-        //size_t pagesizeHalf = pagesize/2;
-        size_t haveread_n = 0;
-
-        char* page = NULL;    // Compressed
+        size_t xdim = XSIZE(data);
+        size_t nRows = YSIZE(data) * ZSIZE(data);
+        size_t rowBytes = (xdim + 1) / 2;
+        size_t pagesizeF = rowBytes * nRows; // Packed
+        size_t pagesizeM = ZYXSIZE(data);    // Unpacked
+        size_t selectImgOffset = offset + IMG_INDEX(select_img) * (pagesizeF + pad);
+
+        ImageFileMap * fileMap = (hFile != NULL) ? hFile->fileMap : NULL;
+        bool ownMap = false;
+        if (fileMap == NULL && mmapOnRead)
+            ownMap = (fileMap = ImageFileMap::get(dataFName)) != NULL;
+        // The values are always unpacked into memory
+        mmapOnRead = false;
+
+        if (fileMap != NULL && selectImgOffset + NSIZE(data) * (pagesizeF + pad) - pad > fileMap->size)
+        {
+            if (ownMap)
+                ImageFileMap::release(fileMap);
+            REPORT_ERROR(ERR_IO_SIZE, formatString("readData4bit: file %s is smaller than expected",
+                                                   dataFName.c_str()));
+        }
 
         // Allocate memory for image data (Assume xdim, ydim, zdim and ndim are already set
         //if memory already allocated use it (no resize allowed)
         data.coreAllocateReuse();
 
-        page = (char *) askMemory(pagesizeM);
+        // Images of bytes are unpacked in place
+        bool isUChar = (typeid(T) == typeid(unsigned char));
+        std::vector<unsigned char> packed((fileMap == NULL) ? pagesizeF : 0);
+        std::vector<unsigned char> unpacked(isUChar ? 0 : pagesizeM);
 
-        // Calculate the staring reading pointer.
-        selectImgOffset = offset + IMG_INDEX(select_img) * (pagesizeF + pad);
-
-        if (fseek(fimg, selectImgOffset, SEEK_SET) == -1)
+        if (fileMap == NULL && fseek(fimg, selectImgOffset, SEEK_SET) == -1)
             REPORT_ERROR(ERR_IO_SIZE, "readData4bit: can not seek the file pointer");
         for (size_t myn = 0; myn < NSIZE(data); myn++)
         {
-
+            const unsigned char * page;
             //Read page from disc
-            if (fread(page+pagesizeF, pagesizeF, 1, fimg) != 1)
-                REPORT_ERROR(ERR_IO_NOREAD, "Cannot read the whole page");
-
-            // cast to T per page
-
-            size_t start = pagesizeF;
-            uint8_t mask = 15; // 00001111
-
-            for (size_t i = 0, j = start; i < pagesizeM - 1; i += 2, ++j)
+            if (fileMap != NULL)
+                page = (const unsigned char *) fileMap->map + selectImgOffset + myn * (pagesizeF + pad);
+            else
             {
-                char& value = *(page+j);
-                page[i] = value & mask; // take the lower 4 bits
-                page[i+1] = (value >> 4) & mask; // take the upper 4 bits
+                if (fread(&packed[0], pagesizeF, 1, fimg) != 1)
+                    REPORT_ERROR(ERR_IO_NOREAD, "Cannot read the whole page");
+                if (pad > 0 && fseek(fimg, pad, SEEK_CUR) == -1)
+                    REPORT_ERROR(ERR_IO_SIZE, "readData4bit: can not seek the file pointer");
+                page = &packed[0];
             }
 
-            castPage2T(page, MULTIDIM_ARRAY(data) + haveread_n, datatype,
-                       pagesizeM);
-            haveread_n += pagesizeM;
-
-            if (pad > 0)
-                //fread( padpage, pad, 1, fimg);
-                if (fseek(fimg, pad, SEEK_CUR) == -1)
-                    REPORT_ERROR(ERR_IO_SIZE,
-                                 "readData4bit: can not seek the file pointer");
-
-            //if ( pad > 0 )
-            //    freeMemory(padpage, pad*sizeof(char));
-
-#ifdef DEBUG
+            unsigned char * dest = isUChar ? (unsigned char *) (MULTIDIM_ARRAY(data) + myn * pagesizeM) : &unpacked[0];
+            if (xdim % 2 == 0)
+                unpackNibbles(page, dest, pagesizeM, false);
+            else
+                for (size_t r = 0; r < nRows; ++r)
+                    unpackNibbles(page + r * rowBytes, dest + r * xdim, xdim, false);
 
-            printf("DEBUG readData4bit: Finished reading and converting data\n");
-#endif
+            // cast to T per page
+            if (!isUChar)
+                castPage2T((char *) dest, MULTIDIM_ARRAY(data) + myn * pagesizeM, DT_UChar, pagesizeM);
         }
-        if (page > 0)
-            freeMemory(page, pagesizeM * sizeof(char));
-
-        return;
+        if (ownMap)
+            ImageFileMap::release(fileMap);
     }
 
 
@@ -1493,6 +1492,54 @@ private:
         freeMemory(fdata, rw_max_page_size);
     }
 
+    /* Write the data packed in 4 bits, two values per byte, the first one in
+     * the lower half. Each of the nRows rows of xdim values starts at a byte
+     * boundary. The values are cast and saturated to [0,15], or mapped to
+     * [0,15] in the CW_CONVERT and CW_ADJUST modes.
+     */
+    void
+    writeData4bit(FILE* fimg, size_t offset, size_t xdim, size_t nRows,
+                  CastWriteMode castMode = CW_CAST)
+    {
+        size_t datasize_n = xdim * nRows;
+        size_t rowBytes = (xdim + 1) / 2;
+        size_t pageRows = std::max(rw_max_page_size / xdim, (size_t) 1);
+        double min0 = 0, max0 = 0;
+
+        if (castMode != CW_CAST)
+            data.computeDoubleMinMaxRange(min0, max0, offset, datasize_n);
+
+        pageRows = std::min(pageRows, nRows);
+        std::vector<unsigned char> unpacked(pageRows * xdim), packed(pageRows * rowBytes);
+        std::vector<double> values;
+        if (castMode == CW_CAST)
+            values.resize(pageRows * xdim);
+        for (size_t row = 0; row < nRows; row += pageRows)
+        {
+            size_t n = std::min(pageRows, nRows - row);
+            T * srcPtr = MULTIDIM_ARRAY(data) + offset + row * xdim;
+            if (castMode == CW_CAST)
+            {
+                // Saturated as doubles, a cast to bytes would wrap the values out of [0,255]
+                castPage2Datatype(srcPtr, (char *) &values[0], DT_Double, n * xdim);
+                for (size_t i = 0; i < n * xdim; ++i)
+                {
+                    double value = values[i];
+                    unpacked[i] = (value > 0) ? (unsigned char) std::min(value, 15.) : 0;
+                }
+            }
+            else
+                castConvertPage2Datatype(srcPtr, (char *) &unpacked[0], DT_UHalfByte, n * xdim,
+                                         min0, max0, castMode);
+            if (xdim % 2 == 0)
+                packNibbles(&unpacked[0], &packed[0], n * xdim, false);
+            else
+                for (size_t r = 0; r < n; ++r)
+                    packNibbles(&unpacked[r * xdim], &packed[r * rowBytes], xdim, false);
+            fwrite(&packed[0], n * rowBytes, 1, fimg);
+        }
+    }
+
     /* Mmap the Image class to an image file.
      */
     void
@@ -1546,8 +1593,16 @@ private:
     munmapFile()
     {
 #ifdef XMIPP_MMAP
-        munmap((char*) (data.data) - mappedOffset, mappedSize);
-        close(mFd);
+        if (viewMap != NULL)
+        {
+            ImageFileMap::release(viewMap);
+            viewMap = NULL;
+        }
+        else
+        {
+            munmap((char*) (data.data) - mappedOffset, mappedSize);
+            close(mFd);
+        }
         data.data = NULL;
         mappedSize = mappedOffset = 0;
 #else
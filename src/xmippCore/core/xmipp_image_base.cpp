@@ -25,6 +25,8 @@
 
 #include "xmipp_image_base.h"
 #include "xmipp_image.h"
+#include "xmipp_image_writer.h"
+#include "xmipp_datatype_cast.h"
 #include "xmipp_error.h"
 
 //This is needed for static memory allocation
@@ -46,6 +48,7 @@ void ImageBase::init()
     _exists = mmapOnRead = mmapOnWrite = false;
     mFd        = 0;
     mappedSize = mappedOffset = virtualOffset = 0;
+    viewMap = NULL;
 }
 
 void ImageBase::clearHeader()
@@ -241,11 +244,79 @@ void ImageBase::write(const FileName &name, size_t select_img, bool isStack,
     //    else if (!isStack && mode != WRITE_OVERWRITE)
     //        mode = WRITE_OVERWRITE;
 
+    // The images of a stack open in an ImageStackWriter are written by it. Its slots
+    // are cast to the datatype of the stack, so other cast modes and write parameters
+    // go through the writer of the format
+    if (isStack && mode == WRITE_REPLACE && _swapWrite == 0 && castMode == CW_CAST &&
+        fname.find('%') == String::npos)
+    {
+        ImageStackWriter * writer = ImageStackWriter::find(fname);
+        size_t n = select_img;
+        if (writer != NULL && n == ALL_IMAGES)
+        {
+            FileName fnStack;
+            fname.decompose(n, fnStack);
+        }
+        if (writer != NULL && n != ALL_IMAGES && writer->write(*this, n))
+            return;
+    }
+
     hFile = openFile(fname, mode);
     _write(fname, hFile, select_img, isStack, mode, castMode);
     closeFile(hFile);
 }
 
+size_t ImageBase::getStackSlot(const FileName &fnStack, size_t nStack, int _swapWrite,
+                               std::vector<char> &slot)
+{
+    FileName ext_name = fnStack.getFileFormat();
+    if (!ImageFileMap::isMappedFormat(ext_name))
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("getStackSlot: %s is not a SPIDER or MRC stack",
+                     fnStack.c_str()));
+
+    // Write the image as a stack of one image into memory
+    char * buffer = NULL;
+    size_t bufferSize = 0;
+    ImageFHandler hMem;
+    if ((hMem.fimg = open_memstream(&buffer, &bufferSize)) == NULL)
+        REPORT_ERROR(ERR_MEM_NOTENOUGH, "getStackSlot: cannot create the memory stream");
+    hMem.fhed = NULL;
+    hMem.tif = NULL;
+    hMem.fileMap = NULL;
+    hMem.exist = false;
+    hMem.mode = WRITE_OVERWRITE;
+    hMem.fileName = fnStack.removeAllPrefixes().removeFileFormat();
+    hMem.ext_name = ext_name;
+    swapWrite = _swapWrite;
+    try
+    {
+        _write(fnStack.removePrefixNumber(), &hMem, FIRST_IMAGE, true, WRITE_OVERWRITE);
+    }
+    catch (XmippError &xe)
+    {
+        fclose(hMem.fimg);
+        free(buffer);
+        throw;
+    }
+    fclose(hMem.fimg);
+
+    // The writers leave in offset the size of the main header
+    size_t headerSize = offset;
+    slot.assign(buffer + headerSize, buffer + bufferSize);
+    free(buffer);
+
+    // SPIDER image headers repeat the number of images of the stack
+    if (ext_name.contains("spi") || ext_name.contains("xmp") || ext_name.contains("vol") ||
+        ext_name.contains("stk"))
+    {
+        float maxim = (float) nStack;
+        if (swapWrite)
+            swapPage((char *) &maxim, 1, DT_Float);
+        ((SPIDERhead *) &slot[0])->maxim = maxim;
+    }
+    return headerSize;
+}
+
 void ImageBase::swapPage(char * page, size_t pageNrElements, DataType datatype, int swap)
 {
     size_t datatypesize = gettypesize(datatype);
@@ -264,14 +335,10 @@ void ImageBase::swapPage(char * page, size_t pageNrElements, DataType datatype,
     {
         if ( datatype >= DT_CShort )
             datatypesize /= 2;
-        for ( size_t i = 0; i < pageNrElements; i += datatypesize )
-            swapbytes(page+i, datatypesize);
+        swapPageBytes(page, pageNrElements, datatypesize);
     }
     else if ( swap > 1 )
-    {
-        for (size_t i=0; i<pageNrElements; i+=swap )
-            swapbytes(page+i, swap);
-    }
+        swapPageBytes(page, pageNrElements, swap);
 }
 
 /** Get Rot angle
@@ -493,6 +560,7 @@ ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
         REPORT_ERROR(ERR_PARAM_INCORRECT, "ImageBase::openFile Cannot open an empty Filename.");
 
     ImageFHandler* hFile = new ImageFHandler;
+    hFile->fileMap = NULL;
     FileName fileName, headName = "";
     FileName ext_name = name.getFileFormat();
 
@@ -545,20 +613,32 @@ ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
     }
     else if (ext_name.contains("hdf") || ext_name.contains("h5"))
     {
-        if ((hFile->fhdf5 = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT)) == -1 )
-            REPORT_ERROR(ERR_IO_NOTOPEN,"ImageBase::openFile: There is a problem opening the HDF5 file.");
-        //        hFile->fimg = NULL;
-
-        if ( (hFile->fimg = fopen(fileName.c_str(), wmChar.c_str())) == NULL )
+        hFile->fimg = NULL;
+        hFile->fhed = NULL;
+        hFile->tif = NULL;
+        if (mode != WRITE_READONLY)
         {
-            if (errno == EACCES)
-                REPORT_ERROR(ERR_IO_NOPERM,formatString("Image::openFile: permission denied when opening %s",fileName.c_str()));
+            // Written through the HDF5 library only
+            if (hFile->exist && mode != WRITE_OVERWRITE)
+                hFile->fhdf5 = H5Fopen(fileName.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
             else
-                REPORT_ERROR(ERR_IO_NOTOPEN,formatString("Image::openFile cannot open: %s", fileName.c_str()));
+                hFile->fhdf5 = H5Fcreate(fileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+            if (hFile->fhdf5 < 0)
+                REPORT_ERROR(ERR_IO_NOTOPEN,"ImageBase::openFile: There is a problem opening the HDF5 file.");
         }
+        else
+        {
+            if ((hFile->fhdf5 = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT)) == -1 )
+                REPORT_ERROR(ERR_IO_NOTOPEN,"ImageBase::openFile: There is a problem opening the HDF5 file.");
 
-        hFile->fhed = NULL;
-        hFile->tif = NULL;
+            if ( (hFile->fimg = fopen(fileName.c_str(), wmChar.c_str())) == NULL )
+            {
+                if (errno == EACCES)
+                    REPORT_ERROR(ERR_IO_NOPERM,formatString("Image::openFile: permission denied when opening %s",fileName.c_str()));
+                else
+                    REPORT_ERROR(ERR_IO_NOTOPEN,formatString("Image::openFile cannot open: %s", fileName.c_str()));
+            }
+        }
     }
     else
     {
@@ -587,8 +667,19 @@ ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
             ext_name = "inf";
         }
 
+        // Headers and data of SPIDER and MRC files are read from the shared mapping
+        hFile->fimg = NULL;
+        if (mode == WRITE_READONLY && headName.empty() && ImageFileMap::isEnabled() &&
+            ImageFileMap::isMappedFormat(ext_name) &&
+            (hFile->fileMap = ImageFileMap::get(fileName)) != NULL &&
+            (hFile->fimg = fmemopen(hFile->fileMap->map, hFile->fileMap->size, "r")) == NULL)
+        {
+            ImageFileMap::release(hFile->fileMap);
+            hFile->fileMap = NULL;
+        }
+
         // Open image file
-        if ( (hFile->fimg = fopen(fileName.c_str(), wmChar.c_str())) == NULL )
+        if (hFile->fimg == NULL && (hFile->fimg = fopen(fileName.c_str(), wmChar.c_str())) == NULL )
         {
             if (errno == EACCES)
                 REPORT_ERROR(ERR_IO_NOPERM,formatString("Image::openFile: permission denied when opening %s",fileName.c_str()));
@@ -662,7 +753,7 @@ void ImageBase::closeFile(ImageFHandler* hFile) const
     else if (ext_name.contains("hdf") || ext_name.contains("h5"))
     {
         H5Fclose(fhdf5);
-        if (fclose(fimg) != 0 )
+        if (fimg != NULL && fclose(fimg) != 0 )
             REPORT_ERROR(ERR_IO_NOCLOSED,(String)"Can not close image file "+ filename);
     }
     else
@@ -674,6 +765,8 @@ void ImageBase::closeFile(ImageFHandler* hFile) const
             REPORT_ERROR(ERR_IO_NOCLOSED,(String)"Can not close header file of "
                          + filename);
     }
+    if (hFile != NULL && hFile->fileMap != NULL)
+        ImageFileMap::release(hFile->fileMap);
     delete hFile;
 }
 
@@ -703,6 +796,8 @@ int ImageBase::_read(const FileName &name, ImageFHandler* hFile, DataMode datamo
     mmapOnRead = mapData;
 #endif
 
+    // readData takes the shared mapping of the file from the handler
+    this->hFile = hFile;
     FileName ext_name = hFile->ext_name;
     fimg = hFile->fimg;
     fhed = hFile->fhed;
@@ -767,6 +862,8 @@ int ImageBase::_read(const FileName &name, ImageFHandler* hFile, DataMode datamo
         err = readSPE(select_img,false);
     else if (ext_name.contains("jpg"))//SPE
         err = readJPEG(select_img);
+    else if (ext_name.contains("xcs"))//XCS
+        err = readXCS(select_img);
     else if (ext_name.contains("hdf") || ext_name.contains("h5"))//SPE
         err = readHDF5(select_img);
     else
@@ -801,6 +898,7 @@ void ImageBase::_write(const FileName &name, ImageFHandler* hFile, size_t select
     fimg = hFile->fimg;
     fhed = hFile->fhed;
     tif  = hFile->tif;
+    fhdf5 = hFile->fhdf5;
 
     FileName ext_name = hFile->ext_name;
 
@@ -917,8 +1015,10 @@ void ImageBase::_write(const FileName &name, ImageFHandler* hFile, size_t select
         writeSPE(select_img,isStack,mode);
     else if (ext_name.contains("jpg"))
         writeJPEG(select_img);
-    else if (ext_name.contains("hdf5") || ext_name.contains("h5"))
-        writeHDF5(select_img);
+    else if (ext_name.contains("xcs"))
+        err = writeXCS(select_img,mode,imParam,castMode);
+    else if (ext_name.contains("hdf") || ext_name.contains("h5"))
+        err = writeHDF5(select_img,isStack,mode,imParam,castMode);
     else
         err = writeSPIDER(select_img,isStack,mode);
 
@@ -31,10 +31,12 @@
 #include "transformations.h"
 #include "metadata.h"
 #include "xmipp_datatype.h"
+#include "xmipp_image_map.h"
 //
 //// Includes for rwTIFF which cannot be inside it
 #include <tiffio.h>
 #include <hdf5.h>
+#include "xmipp_threads.h"
 
 
 /* Minimum size of a TIFF file to be mapped to a tempfile in case of mapping from
@@ -112,6 +114,7 @@ struct ImageFHandler
     FileName  ext_name;   // Filename extension
     bool     exist;       // Shows if the file exists. Equal 0 means file does not exist or not stack.
     int        mode;   // Opening mode behavior
+    ImageFileMap* fileMap; // Shared mapping the file is read from (NULL if not mapped)
 };
 
 struct ImageInfo
@@ -254,6 +257,7 @@ protected:
     int                 mFd;         // Handle the file in reading method and mmap
     size_t              mappedSize;  // Size of the mapped file
     size_t              mappedOffset;// Offset for the mapped file
+    ImageFileMap*       viewMap;     // Shared mapping the data is a view of
     size_t          virtualOffset;// MDA Offset when movePointerTo is used
 
 public:
@@ -294,6 +298,15 @@ public:
         return (mmapOnRead || mmapOnWrite);
     }
 
+    /** Threads decoding the frames of compressed TIFF stacks.
+     *  The setting applies to the reads of the calling thread only and it
+     *  is 1 by default, so the worker threads of a program are not affected.
+     */
+    static void setTIFFReadThreads(size_t nThreads);
+
+    /** Threads decoding the frames of compressed TIFF stacks in this thread */
+    static size_t getTIFFReadThreads();
+
     /** Is this file a real-valued image
      *
      *  Check whether a real-space image can be read
@@ -337,7 +350,9 @@ public:
      *
      * Parameter mapData allows to access to image mapped to disk instead of loaded into
      * memory. In case the mapped image is intended to be modified the parameter
-     * mode must be WRITE_REPLACE.
+     * mode must be WRITE_REPLACE. When ImageFileMap is enabled, the data read with
+     * mapData and WRITE_READONLY is a read-only view of the shared mapping of the file
+     * (several images of a MRC stack can be mapped at once).
      *
      * This function cannot apply geometrical transformations.
      */
@@ -412,6 +427,14 @@ public:
     void write(const FileName &name="", size_t select_img = ALL_IMAGES, bool isStack=false,
                int mode=WRITE_OVERWRITE,CastWriteMode castMode = CW_CAST, int _swapWrite = 0);
 
+    /** Image as it is stored in a SPIDER or MRC stack.
+     * The bytes that write() puts in a stack of the format of fnStack when the
+     * image replaces one of its nStack images: the image header, in SPIDER
+     * stacks, and the data. Returns the size of the main header of the stack,
+     * so that image n starts at headerSize+(n-1)*slot.size().
+     */
+    size_t getStackSlot(const FileName &fnStack, size_t nStack, int _swapWrite, std::vector<char> &slot);
+
     /** It changes the behavior of the internal multidimarray so it points to a specific slice/image
       *  from a stack, volume or stack of volumes. No information is deallocated from memory, so it is
       *  also possible to repoint to the whole stack,volume... (passing select_slice = ALL_SLICES and
@@ -791,6 +814,7 @@ protected:
 #include "rwEM.h"
 #include "rwPIF.h"
 #include "rwHDF5.h"
+#include "rwXCS.h"
 
     /// ----------------------------------------------------------
 
@@ -830,6 +854,11 @@ protected:
     virtual void writeData(FILE* fimg, size_t offset, DataType wDType, size_t datasize_n,
                            CastWriteMode castMode=CW_CAST) = 0;
 
+    /** Write the data packed in 4 bits (MRC mode 101)
+     */
+    virtual void writeData4bit(FILE* fimg, size_t offset, size_t xdim, size_t nRows,
+                               CastWriteMode castMode=CW_CAST) = 0;
+
     virtual void setPage2T(size_t offset, char * page, DataType datatype, size_t pageSize ) = 0;
     virtual void getPageFromT(size_t offset, char * page, DataType datatype, size_t pageSize ) = 0;
     virtual void getCastConvertPageFromT(size_t offset, char * page, DataType datatype, size_t pageSize, double min0, double max0, CastWriteMode castMode=CW_CONVERT) const = 0;
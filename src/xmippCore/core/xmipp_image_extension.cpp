@@ -78,21 +78,18 @@ bool checkImageFileSize(const FileName &name, const ImageInfo &imgInfo, bool err
         dataFname = name.removeLastExtension().addExtension("img");
     else if (ext.contains("inf"))
         dataFname = name.removeLastExtension();
-    else if (ext.contains("tif") || ext.contains("jpg") || ext.contains("hdf") || ext.contains("h5"))
+    else if (ext.contains("tif") || ext.contains("jpg") || ext.contains("hdf") || ext.contains("h5") ||
+             ext.contains("xcs"))
         return true;
     else
         dataFname = name;
 
-    size_t explodeFactor = 1;
-
-    if (imgInfo.datatype == DT_UHalfByte){
-        explodeFactor = 2;
-    }
-
-
     size_t expectedSize = imgInfo.adim.nzyxdim*gettypesize(imgInfo.datatype) + imgInfo.offset;
+    // 4-bit values are packed two per byte and every row starts at a byte boundary
+    if (imgInfo.datatype == DT_UHalfByte)
+        expectedSize = (imgInfo.adim.xdim + 1) / 2 * imgInfo.adim.ydim * imgInfo.adim.zdim *
+                       imgInfo.adim.ndim + imgInfo.offset;
     size_t actualSize = dataFname.removeAllPrefixes().removeFileFormat().getFileSize();
-    actualSize *= explodeFactor;
     bool result = (actualSize >= expectedSize);
 
     if (error && !result)
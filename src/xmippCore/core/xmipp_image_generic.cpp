@@ -612,8 +612,14 @@ void createEmptyFile(const FileName &filename, int xdim, int ydim, int Zdim,
         image.setDatatype(DT_Float);
     else
     {
-        strType = filename.substr(found+1).c_str();
-        image.setDatatype(str2Datatype(strType));
+        // Only the datatype of the write parameters, the storage options
+        // (e.g. uint16,deflate or bits=12) are applied by the writers
+        StringVector params;
+        splitString(filename.substr(found+1), ",", params);
+        for (size_t i = 0; i < params.size() && strType.empty(); ++i)
+            if (params[i].find('=') == String::npos && params[i] != "deflate" && params[i] != "shuffle")
+                strType = params[i];
+        image.setDatatype((strType.empty() || strType == "default") ? DT_Float : str2Datatype(strType));
     }
 
     image.mapFile2Write(xdim, ydim, Zdim, filename, false, select_img, isStack, mode, _swapWrite);
@@ -472,6 +472,8 @@ public:
     * is created. Only the header info is written, and if image number is given, then disk space
     * is reserved until select_img .
     * Swap the endianness of the image header is also possible.
+    * The write parameters after % give the datatype and the storage
+    * options of the file, e.g. "stack.h5%uint16,deflate".
     */
 void createEmptyFile(const FileName &_filename, int Xdim, int Ydim, int Zdim = 1,
                      size_t select_img = APPEND_IMAGE, bool isStack = false,
@@ -0,0 +1,170 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xmipp_image_map.h"
+#include "xmipp_threads.h"
+
+// Maximum number of files kept mapped when nobody uses them
+#define IMAGE_FILE_MAPS_MAX 256
+
+/* Mappings by file name. The registry holds one reference of each mapping,
+ * so a mapping stays alive while it is in the registry or used by an image.
+ */
+static std::map<String, ImageFileMap *> fileMaps;
+static Mutex fileMapsMutex;
+static bool fileMapsEnabled = false;
+
+ImageFileMap::ImageFileMap()
+{
+    map = NULL;
+    size = 0;
+    mtime.tv_sec = mtime.tv_nsec = 0;
+    refs = 0;
+}
+
+ImageFileMap::~ImageFileMap()
+{
+    if (map != NULL)
+        munmap(map, size);
+}
+
+ImageFileMap * ImageFileMap::get(const FileName &fn)
+{
+    struct stat info;
+    if (stat(fn.c_str(), &info) != 0 || info.st_size == 0)
+        return NULL;
+
+    ImageFileMap * stale = NULL;
+    fileMapsMutex.lock();
+    std::map<String, ImageFileMap *>::iterator it = fileMaps.find(fn);
+    if (it != fileMaps.end())
+    {
+        ImageFileMap * fileMap = it->second;
+        if (fileMap->size == (size_t) info.st_size && fileMap->mtime.tv_sec == info.st_mtim.tv_sec &&
+            fileMap->mtime.tv_nsec == info.st_mtim.tv_nsec)
+        {
+            fileMap->refs++;
+            fileMapsMutex.unlock();
+            return fileMap;
+        }
+        // The file has changed, images still using the old mapping keep it
+        stale = fileMap;
+        fileMaps.erase(it);
+    }
+    fileMapsMutex.unlock();
+    if (stale != NULL)
+        release(stale);
+
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    char * map = (char *) mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    ImageFileMap * fileMap = new ImageFileMap;
+    fileMap->fileName = fn;
+    fileMap->map = map;
+    fileMap->size = info.st_size;
+    fileMap->mtime = info.st_mtim;
+    fileMap->refs = 2; // the registry and the caller
+
+    ImageFileMap * replaced = NULL;
+    std::map<String, ImageFileMap *> unused;
+    fileMapsMutex.lock();
+    ImageFileMap *& entry = fileMaps[fn];
+    replaced = entry; // another thread mapped the file meanwhile
+    entry = fileMap;
+    if (fileMaps.size() > IMAGE_FILE_MAPS_MAX)
+    {
+        for (it = fileMaps.begin(); it != fileMaps.end(); )
+        {
+            if (it->second->refs == 1)
+            {
+                unused[it->first] = it->second;
+                fileMaps.erase(it++);
+            }
+            else
+                ++it;
+        }
+    }
+    fileMapsMutex.unlock();
+
+    if (replaced != NULL)
+        release(replaced);
+    for (it = unused.begin(); it != unused.end(); ++it)
+        release(it->second);
+    return fileMap;
+}
+
+void ImageFileMap::retain(ImageFileMap * fileMap)
+{
+    fileMapsMutex.lock();
+    fileMap->refs++;
+    fileMapsMutex.unlock();
+}
+
+void ImageFileMap::release(ImageFileMap * fileMap)
+{
+    fileMapsMutex.lock();
+    bool unused = --fileMap->refs == 0;
+    fileMapsMutex.unlock();
+    if (unused)
+        delete fileMap;
+}
+
+void ImageFileMap::clear()
+{
+    std::map<String, ImageFileMap *> dropped;
+    fileMapsMutex.lock();
+    dropped.swap(fileMaps);
+    fileMapsMutex.unlock();
+    for (std::map<String, ImageFileMap *>::iterator it = dropped.begin(); it != dropped.end(); ++it)
+        release(it->second);
+}
+
+void ImageFileMap::setEnabled(bool enabled)
+{
+    fileMapsEnabled = enabled;
+    if (!enabled)
+        clear();
+}
+
+bool ImageFileMap::isEnabled()
+{
+    return fileMapsEnabled;
+}
+
+bool ImageFileMap::isMappedFormat(const FileName &extName)
+{
+    // SPIDER and MRC files, the datatype after % does not matter
+    String ext = extName.substr(0, extName.find('%'));
+    return ext == "spi" || ext == "xmp" || ext == "stk" || ext == "vol" ||
+           ext == "mrc" || ext == "mrcs" || ext == "map" || ext == "st";
+}
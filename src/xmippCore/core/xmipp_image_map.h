@@ -0,0 +1,98 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_IMAGE_MAP_H_
+#define CORE_IMAGE_MAP_H_
+
+#include <stddef.h>
+#include <time.h>
+#include "xmipp_filename.h"
+
+/** @defgroup ImageFileMap Shared mapping of image files
+ *  @ingroup Images
+ *
+ * Read-only mappings of whole image files (SPIDER and MRC), shared by all the
+ * Image objects and threads of the process. When mappings are enabled, the
+ * SPIDER and MRC readers take the headers and data from the mapped file instead
+ * of opening it, seeking and reading it for every image, and an image read with
+ * mapData=true and WRITE_READONLY is a view of the mapped file (converted into
+ * memory only when the datatype on disk differs from the one of the Image).
+ *
+ * The mapping of a file is kept until the file changes (size or modification
+ * time) or until clear() is called.
+ *
+ * @code
+ * ImageFileMap::setEnabled(true);
+ * Image<float> I;
+ * for (size_t n = FIRST_IMAGE; n <= nImages; ++n)
+ * {
+ *     I.read(fnStack, DATA, n, true); // I() is a read-only view of the stack
+ *     ...
+ * }
+ * @endcode
+*/
+//@{
+class ImageFileMap
+{
+public:
+    /// Name of the mapped file
+    FileName fileName;
+    /// Start of the mapped file
+    char * map;
+    /// Size of the file
+    size_t size;
+    /// Modification time of the file when it was mapped
+    struct timespec mtime;
+
+    /** Mapping of a file.
+     * The mapping is retained and must be released with release(). Returns NULL
+     * if the file cannot be mapped.
+     */
+    static ImageFileMap * get(const FileName &fn);
+
+    /// Retain a mapping already obtained with get()
+    static void retain(ImageFileMap * fileMap);
+
+    /// Release a mapping. It is unmapped when nobody uses it
+    static void release(ImageFileMap * fileMap);
+
+    /// Drop the mappings that are not in use
+    static void clear();
+
+    /// Enable or disable the mapping of image files (disabled by default)
+    static void setEnabled(bool enabled);
+
+    /// Are image files mapped?
+    static bool isEnabled();
+
+    /// Is this a format read from mapped files? (SPIDER and MRC)
+    static bool isMappedFormat(const FileName &extName);
+
+private:
+    int refs;
+
+    ImageFileMap();
+    ~ImageFileMap();
+};
+//@}
+#endif
@@ -0,0 +1,303 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "xmipp_image_prefetch.h"
+#include "xmipp_image_base.h"
+#include "xmipp_image_extension.h"
+
+// Bytes of every read of the background thread
+#define IMAGE_PREFETCH_CHUNK (4 << 20)
+
+ImagePrefetcher::ImagePrefetcher(const MetaData &md, MDLabel label, size_t maxBytes)
+{
+    FileName fnImg;
+    FOR_ALL_OBJECTS_IN_METADATA(md)
+    {
+        md.getValue(label, fnImg, __iter.objId);
+        positions[__iter.objId] = images.size();
+        images.push_back(fnImg);
+    }
+    this->maxBytes = maxBytes;
+    position = next = totalBytes = 0;
+    cumulativeBytes.resize(images.size() + 1, 0);
+    stopping = idle = false;
+    thMgr = new ThreadManager(1, this);
+    thMgr->runAsync(prefetchThread);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    condition.lock();
+    stopping = true;
+    condition.broadcast();
+    condition.unlock();
+    thMgr->wait();
+    delete thMgr;
+}
+
+void ImagePrefetcher::setObject(size_t objId)
+{
+    std::map<size_t, size_t>::iterator it = positions.find(objId);
+    if (it == positions.end())
+        return;
+    condition.lock();
+    position = it->second;
+    // The thread has to look at the new position, unless it already finished
+    if (next < images.size())
+        idle = false;
+    condition.broadcast();
+    condition.unlock();
+}
+
+void ImagePrefetcher::waitIdle()
+{
+    condition.lock();
+    while (!idle)
+        condition.wait();
+    condition.unlock();
+}
+
+size_t ImagePrefetcher::prefetched()
+{
+    condition.lock();
+    size_t n = next;
+    condition.unlock();
+    return n;
+}
+
+size_t ImagePrefetcher::bytesRead()
+{
+    condition.lock();
+    size_t bytes = totalBytes;
+    condition.unlock();
+    return bytes;
+}
+
+bool ImagePrefetcher::imageRange(const FileName &fnImg, ImagePrefetchRange &range)
+{
+    size_t no;
+    String str;
+    FileName fnFile;
+    try
+    {
+        fnImg.decompose(no, str);
+    }
+    catch (XmippError &xe)
+    {
+        return false;
+    }
+    fnFile = str;
+    range.fileName = fnFile.removeFileFormat();
+
+    std::map<String, size_t>::iterator itSize = fileSizes.find(range.fileName);
+    if (itSize == fileSizes.end())
+    {
+        struct stat info;
+        size_t size = (stat(range.fileName.c_str(), &info) == 0) ? info.st_size : 0;
+        itSize = fileSizes.insert(std::make_pair(range.fileName, size)).first;
+    }
+    size_t fileSize = itSize->second;
+    if (fileSize == 0)
+        return false;
+
+    // Files of single images are read whole
+    if (no == ALL_IMAGES)
+    {
+        try
+        {
+            ImageInfo imgInfo;
+            getImageInfo(fnFile, imgInfo);
+            if (imgInfo.adim.ndim != 1)
+                return false;
+        }
+        catch (XmippError &xe)
+        {
+            return false;
+        }
+        range.start = 0;
+        range.end = fileSize;
+        return true;
+    }
+
+    // The layout of the stacks of other formats is unknown, reading the whole
+    // file for every image would read the stack once per image
+    if (!ImageFileMap::isMappedFormat(fnFile.getFileFormat()))
+        return false;
+
+    // Images of a stack from its layout
+    std::map<String, ImagePrefetchLayout>::iterator it = layouts.find(range.fileName);
+    if (it == layouts.end())
+    {
+        ImagePrefetchLayout layout;
+        layout.fileSize = fileSize;
+        layout.nImages = 0;
+        try
+        {
+            ImageInfo imgInfo;
+            getImageInfo(fnFile, imgInfo);
+            layout.nImages = imgInfo.adim.ndim;
+            layout.firstData = imgInfo.offset;
+            layout.dataSize = imgInfo.adim.xdim * imgInfo.adim.ydim * imgInfo.adim.zdim *
+                              gettypesize(imgInfo.datatype);
+            // The stride includes the header of every image of SPIDER stacks
+            if (layout.nImages > 1)
+                layout.stride = (layout.fileSize - layout.firstData - layout.dataSize) / (layout.nImages - 1);
+            else
+                layout.stride = layout.dataSize;
+            if (layout.stride < layout.dataSize || layout.firstData + layout.dataSize > layout.fileSize ||
+                layout.stride - layout.dataSize > layout.firstData)
+                layout.nImages = 0;
+        }
+        catch (XmippError &xe)
+        {}
+        it = layouts.insert(std::make_pair(range.fileName, layout)).first;
+        it->second = layout;
+    }
+    const ImagePrefetchLayout &layout = it->second;
+    if (no > layout.nImages)
+        return false;
+    range.start = layout.firstData + (no - 1) * layout.stride - (layout.stride - layout.dataSize);
+    range.end = range.start + layout.stride;
+    return true;
+}
+
+void ImagePrefetcher::readRanges(std::vector<ImagePrefetchRange> &ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    if (buffer.empty())
+        buffer.resize(IMAGE_PREFETCH_CHUNK);
+    String fileName;
+    int fd = -1;
+    size_t first = 0;
+    while (first < ranges.size())
+    {
+        // Adjacent and overlapping ranges are read at once
+        ImagePrefetchRange range = ranges[first];
+        size_t last = first + 1;
+        while (last < ranges.size() && ranges[last].fileName == range.fileName &&
+               ranges[last].start <= range.end)
+        {
+            range.end = std::max(range.end, ranges[last].end);
+            ++last;
+        }
+        first = last;
+
+        if (range.fileName != fileName)
+        {
+            if (fd != -1)
+                close(fd);
+            fileName = range.fileName;
+            fd = open(fileName.c_str(), O_RDONLY);
+        }
+        if (fd == -1)
+            continue;
+        size_t pos = range.start;
+        while (pos < range.end)
+        {
+            ssize_t bytes = pread(fd, &buffer[0], std::min(range.end - pos, buffer.size()), (off_t) pos);
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0)
+                break;
+            pos += bytes;
+        }
+        condition.lock();
+        totalBytes += pos - range.start;
+        condition.unlock();
+    }
+    if (fd != -1)
+        close(fd);
+}
+
+void ImagePrefetcher::prefetchThread(ThreadArgument &thArg)
+{
+    ImagePrefetcher * prefetcher = (ImagePrefetcher *) thArg.workClass;
+    Condition &condition = prefetcher->condition;
+    std::vector<size_t> &cumulativeBytes = prefetcher->cumulativeBytes;
+    size_t nImages = prefetcher->images.size();
+    std::vector<ImagePrefetchRange> ranges;
+    std::vector<size_t> bytes;
+    while (true)
+    {
+        // Wait until the images ahead of the current one use less than maxBytes
+        condition.lock();
+        size_t ahead;
+        while (true)
+        {
+            size_t &next = prefetcher->next;
+            size_t position = prefetcher->position;
+            // The images before the current one are not needed anymore
+            if (position > next)
+            {
+                for (; next <= position && next < nImages; ++next)
+                    cumulativeBytes[next + 1] = cumulativeBytes[next];
+            }
+            ahead = cumulativeBytes[next] - cumulativeBytes[std::min(position, next)];
+            if (prefetcher->stopping || next >= nImages || ahead < prefetcher->maxBytes)
+                break;
+            prefetcher->idle = true;
+            condition.broadcast();
+            condition.wait();
+        }
+        size_t start = prefetcher->next;
+        bool finished = prefetcher->stopping || start >= nImages;
+        prefetcher->idle = finished;
+        if (finished)
+            condition.broadcast();
+        condition.unlock();
+        if (finished)
+            break;
+
+        // Batch of the next images, at most a quarter of maxBytes
+        size_t budget = std::min(prefetcher->maxBytes - ahead, prefetcher->maxBytes / 4);
+        size_t batchBytes = 0, end = start;
+        ranges.clear();
+        bytes.clear();
+        while (end < nImages && (end == start || batchBytes < budget))
+        {
+            ImagePrefetchRange range;
+            size_t imageBytes = 0;
+            if (prefetcher->imageRange(prefetcher->images[end], range))
+            {
+                imageBytes = range.end - range.start;
+                ranges.push_back(range);
+            }
+            bytes.push_back(imageBytes);
+            batchBytes += imageBytes;
+            ++end;
+        }
+        prefetcher->readRanges(ranges);
+
+        condition.lock();
+        // If the current image went past the batch, the next loop skips it
+        for (size_t i = start; i < end; ++i)
+            cumulativeBytes[i + 1] = cumulativeBytes[i] + bytes[i - start];
+        prefetcher->next = end;
+        condition.unlock();
+    }
+}
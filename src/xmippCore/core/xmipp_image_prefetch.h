@@ -0,0 +1,139 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_IMAGE_PREFETCH_H_
+#define CORE_IMAGE_PREFETCH_H_
+
+#include <map>
+#include <vector>
+#include "metadata.h"
+#include "xmipp_threads.h"
+
+/// Bytes read ahead of the image being processed
+#define IMAGE_PREFETCH_BYTES (64 << 20)
+
+/** @defgroup ImagePrefetcher Read-ahead of the images of a metadata
+ *  @ingroup Images
+ *
+ * Background reading of the images that come next in a metadata, so that
+ * they are in memory when the program reads them. The prefetcher follows
+ * the image being processed, given with setObject(), and keeps up to
+ * maxBytes of the following images read. The images ahead are read in
+ * batches: the byte ranges of the images of each batch are sorted by file
+ * and offset and the adjacent ones are read sequentially at once, through
+ * a reusable buffer, into the page cache of the system. The images are
+ * then read as usual, from the shared mapping of the file (see
+ * ImageFileMap) or from the file, without waiting for the disk.
+ *
+ * The images of SPIDER and MRC stacks are located from the header of the
+ * stack, and the files of single images are read whole. The images of
+ * stacks in other formats (HDF5, TIFF, XCS...) are not read ahead, as
+ * their layout is unknown. Errors are ignored, the read of the image
+ * reports them.
+ *
+ * @code
+ * ImagePrefetcher prefetcher(md, MDL_IMAGE);
+ * FOR_ALL_OBJECTS_IN_METADATA(md)
+ * {
+ *     prefetcher.setObject(__iter.objId);
+ *     md.getValue(MDL_IMAGE, fnImg, __iter.objId);
+ *     I.read(fnImg); // already in memory
+ *     ...
+ * }
+ * @endcode
+ */
+//@{
+/** Range of bytes of a file */
+struct ImagePrefetchRange
+{
+    String fileName;
+    size_t start, end;
+
+    bool operator<(const ImagePrefetchRange &other) const
+    {
+        if (fileName != other.fileName)
+            return fileName < other.fileName;
+        return start < other.start;
+    }
+};
+
+/** Layout of the images of a stack file */
+struct ImagePrefetchLayout
+{
+    size_t fileSize, nImages, firstData, dataSize, stride;
+};
+
+/** Background reader of the images that come next in a metadata */
+class ImagePrefetcher
+{
+public:
+    /** Start reading ahead the images of the column label of md, in the
+     * order of the metadata */
+    ImagePrefetcher(const MetaData &md, MDLabel label, size_t maxBytes = IMAGE_PREFETCH_BYTES);
+
+    /** Stop the background thread */
+    ~ImagePrefetcher();
+
+    /** The image of the object objId is being processed.
+     * The prefetcher reads the images that follow it.
+     */
+    void setObject(size_t objId);
+
+    /** Number of images from the start of the metadata already read or skipped */
+    size_t prefetched();
+
+    /** Bytes read by the prefetcher */
+    size_t bytesRead();
+
+    /** Wait until the prefetcher has nothing else to read.
+     * That is, all the images up to the end of the metadata are read, or the
+     * images ahead of the current one already use maxBytes.
+     */
+    void waitIdle();
+
+private:
+    std::vector<FileName> images;
+    std::map<size_t, size_t> positions;
+    size_t maxBytes;
+    std::map<String, ImagePrefetchLayout> layouts;
+    // Size of every file, taken only the first time that it appears
+    std::map<String, size_t> fileSizes;
+    std::vector<char> buffer;
+    // All the fields below are protected by this condition
+    Condition condition;
+    size_t position, next, totalBytes;
+    std::vector<size_t> cumulativeBytes;
+    bool stopping, idle;
+    ThreadManager * thMgr;
+
+    /* Range of bytes of an image, false if it cannot be located */
+    bool imageRange(const FileName &fnImg, ImagePrefetchRange &range);
+
+    /* Read the ranges, joining the adjacent ones */
+    void readRanges(std::vector<ImagePrefetchRange> &ranges);
+
+    /* Work function of the background thread */
+    static void prefetchThread(ThreadArgument &thArg);
+};
+//@}
+#endif
@@ -0,0 +1,272 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "xmipp_image_writer.h"
+#include "xmipp_image_base.h"
+#include "xmipp_image_extension.h"
+
+// Pending bytes from which the background thread starts writing
+#define IMAGE_STACK_WRITER_FLUSH (8 << 20)
+// Pending bytes from which write() waits for the background thread
+#define IMAGE_STACK_WRITER_MAX_PENDING (64 << 20)
+
+/* Open writers by stack file name (without prefixes nor format) */
+static std::map<String, ImageStackWriter *> stackWriters;
+static Mutex stackWritersMutex;
+
+static String stackWriterKey(const FileName &fn)
+{
+    return fn.removeAllPrefixes().removeFileFormat();
+}
+
+ImageStackWriter::ImageStackWriter(const FileName &fnStack)
+{
+    if (!isSupported(fnStack))
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("ImageStackWriter: %s is not a SPIDER or MRC stack",
+                     fnStack.c_str()));
+    this->fnStack = fnStack.removeAllPrefixes();
+    ImageInfo info;
+    getImageInfo(this->fnStack, info);
+    xdim = info.adim.xdim;
+    ydim = info.adim.ydim;
+    zdim = info.adim.zdim;
+    nImages = info.adim.ndim;
+    swap = info.swap ? 1 : 0;
+
+    FileName fnFile = stackWriterKey(fnStack);
+    fileSize = fnFile.getFileSize();
+    if ((fd = open(fnFile.c_str(), O_WRONLY)) == -1)
+        REPORT_ERROR(ERR_IO_NOTOPEN, formatString("ImageStackWriter: cannot open %s", fnFile.c_str()));
+
+    pendingBytes = 0;
+    closing = failed = false;
+    thMgr = new ThreadManager(1, this);
+    thMgr->runAsync(writeThread);
+
+    stackWritersMutex.lock();
+    stackWriters[stackWriterKey(fnStack)] = this;
+    stackWritersMutex.unlock();
+}
+
+ImageStackWriter::~ImageStackWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {}
+}
+
+bool ImageStackWriter::write(ImageBase &img, size_t n)
+{
+    size_t Xdim, Ydim, Zdim, Ndim;
+    img.getDimensions(Xdim, Ydim, Zdim, Ndim);
+    if (Xdim != xdim || Ydim != ydim || Zdim != zdim || Ndim != 1 || n < FIRST_IMAGE || n > nImages)
+        return false;
+
+    // The slots of the images of other datatypes do not match the ones of the file
+    ImageStackSlot slot;
+    size_t headerSize = img.getStackSlot(fnStack, nImages, swap, slot.data);
+    if (headerSize + nImages * slot.data.size() != fileSize)
+        return false;
+    slot.position = headerSize + (n - 1) * slot.data.size();
+
+    condition.lock();
+    while (pendingBytes >= IMAGE_STACK_WRITER_MAX_PENDING && !failed)
+        condition.wait();
+    if (failed || closing)
+    {
+        String msg = failed ? errorMsg : "the writer is closed";
+        condition.unlock();
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("ImageStackWriter: cannot write %s: %s",
+                     fnStack.c_str(), msg.c_str()));
+    }
+    pendingBytes += slot.data.size();
+    pending.push_back(ImageStackSlot());
+    pending.back().position = slot.position;
+    pending.back().data.swap(slot.data);
+    if (pendingBytes >= IMAGE_STACK_WRITER_FLUSH)
+        condition.broadcast();
+    condition.unlock();
+    return true;
+}
+
+void ImageStackWriter::close()
+{
+    if (thMgr == NULL)
+        return;
+    stackWritersMutex.lock();
+    std::map<String, ImageStackWriter *>::iterator it = stackWriters.find(stackWriterKey(fnStack));
+    if (it != stackWriters.end() && it->second == this)
+        stackWriters.erase(it);
+    stackWritersMutex.unlock();
+
+    condition.lock();
+    closing = true;
+    condition.broadcast();
+    condition.unlock();
+    thMgr->wait();
+    delete thMgr;
+    thMgr = NULL;
+
+    if (::close(fd) != 0 && !failed)
+    {
+        failed = true;
+        errorMsg = strerror(errno);
+    }
+    if (failed)
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("ImageStackWriter: cannot write %s: %s",
+                     fnStack.c_str(), errorMsg.c_str()));
+}
+
+ImageStackWriter * ImageStackWriter::find(const FileName &fnImg)
+{
+    stackWritersMutex.lock();
+    ImageStackWriter * writer = NULL;
+    if (!stackWriters.empty())
+    {
+        std::map<String, ImageStackWriter *>::iterator it = stackWriters.find(stackWriterKey(fnImg));
+        if (it != stackWriters.end())
+            writer = it->second;
+    }
+    stackWritersMutex.unlock();
+    return writer;
+}
+
+bool ImageStackWriter::isSupported(const FileName &fnStack)
+{
+    return ImageFileMap::isMappedFormat(fnStack.getFileFormat());
+}
+
+void ImageStackWriter::writeSlots(std::vector<ImageStackSlot> &slots)
+{
+    std::sort(slots.begin(), slots.end());
+    std::vector<struct iovec> iov;
+    size_t first = 0;
+    while (first < slots.size())
+    {
+        // Adjacent slots are written at once
+        iov.clear();
+        size_t position = slots[first].position, last = first;
+        do
+        {
+            struct iovec v;
+            v.iov_base = &slots[last].data[0];
+            v.iov_len = slots[last].data.size();
+            iov.push_back(v);
+            ++last;
+        }
+        while (last < slots.size() && iov.size() < IOV_MAX &&
+               slots[last].position == slots[last - 1].position + slots[last - 1].data.size());
+
+        struct iovec * v = &iov[0];
+        int count = (int) iov.size();
+        while (count > 0)
+        {
+            ssize_t written = pwritev(fd, v, count, (off_t) position);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                REPORT_ERROR(ERR_IO_NOWRITE, strerror(errno));
+            }
+            position += written;
+            while (count > 0 && (size_t) written >= v->iov_len)
+            {
+                written -= v->iov_len;
+                ++v;
+                --count;
+            }
+            if (count > 0)
+            {
+                v->iov_base = (char *) v->iov_base + written;
+                v->iov_len -= written;
+            }
+        }
+        first = last;
+    }
+}
+
+void ImageStackWriter::writeThread(ThreadArgument &thArg)
+{
+    ImageStackWriter * writer = (ImageStackWriter *) thArg.workClass;
+    Condition &condition = writer->condition;
+    std::vector<ImageStackSlot> slots;
+    bool finished = false;
+    while (!finished)
+    {
+        condition.lock();
+        while (!writer->closing && writer->pendingBytes < IMAGE_STACK_WRITER_FLUSH)
+            condition.wait();
+        slots.swap(writer->pending);
+        finished = writer->closing;
+        bool failed = writer->failed;
+        condition.unlock();
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < slots.size(); ++i)
+            bytes += slots[i].data.size();
+        String errorMsg;
+        if (!failed)
+            try
+            {
+                writer->writeSlots(slots);
+            }
+            catch (XmippError &xe)
+            {
+                failed = true;
+                errorMsg = xe.msg;
+            }
+            catch (std::exception &e)
+            {
+                failed = true;
+                errorMsg = e.what();
+            }
+            catch (...)
+            {
+                failed = true;
+                errorMsg = "unknown error";
+            }
+        slots.clear();
+
+        condition.lock();
+        writer->pendingBytes -= bytes;
+        if (failed && !writer->failed)
+        {
+            writer->failed = true;
+            writer->errorMsg = errorMsg;
+        }
+        condition.broadcast();
+        condition.unlock();
+    }
+}
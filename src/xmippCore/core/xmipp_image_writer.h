@@ -0,0 +1,126 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_IMAGE_WRITER_H_
+#define CORE_IMAGE_WRITER_H_
+
+#include <vector>
+#include "xmipp_filename.h"
+#include "xmipp_threads.h"
+
+class ImageBase;
+
+/** @defgroup ImageStackWriter Asynchronous writing of image stacks
+ *  @ingroup Images
+ *
+ * Background writer of the images of an existing SPIDER or MRC stack, which
+ * already has its final size and header (see createEmptyFile). While the
+ * writer is open, ImageBase::write does not open the stack for every image:
+ * the image is converted in the calling thread into the bytes of its slot
+ * in the stack, and a background thread writes the slots of several images
+ * with pwrite, joining the adjacent ones into single writes. The file is
+ * kept open until close(), which writes the remaining images and reports
+ * the write errors.
+ *
+ * The images must have the size of the images of the stack. Those that do
+ * not fit in the slots (other size or datatype), and those written with
+ * write parameters (%) or a cast mode other than CW_CAST, are written by
+ * ImageBase::write as usual.
+ *
+ * @code
+ * createEmptyFile(fnStack, xdim, ydim, 1, nImages, true);
+ * ImageStackWriter writer(fnStack);
+ * for (size_t n = FIRST_IMAGE; n <= nImages; ++n)
+ * {
+ *     ...
+ *     I.write(fnStack, n, true, WRITE_REPLACE); // queued in the writer
+ * }
+ * writer.close();
+ * @endcode
+ */
+//@{
+/** Image waiting to be written */
+struct ImageStackSlot
+{
+    size_t position;
+    std::vector<char> data;
+
+    bool operator<(const ImageStackSlot &other) const
+    {
+        return position < other.position;
+    }
+};
+
+/** Asynchronous writer of the images of a stack */
+class ImageStackWriter
+{
+public:
+    /** Open the stack fnStack, which must exist with all its images.
+     * From now on, the images written into this stack by ImageBase::write
+     * go through this writer.
+     */
+    ImageStackWriter(const FileName &fnStack);
+
+    /** Destructor.
+     * It closes the writer if close() was not called, without reporting
+     * errors.
+     */
+    ~ImageStackWriter();
+
+    /** Queue the image for writing as the image n of the stack.
+     * It can be called from several threads. It waits while there are too
+     * many images pending. Returns false if the image does not fit in the
+     * slots of the stack.
+     */
+    bool write(ImageBase &img, size_t n);
+
+    /** Write the pending images and close the stack */
+    void close();
+
+    /** Writer of the stack of an image filename, NULL if there is none */
+    static ImageStackWriter * find(const FileName &fnImg);
+
+    /** Can stacks of this file be written by an ImageStackWriter? (SPIDER and MRC) */
+    static bool isSupported(const FileName &fnStack);
+
+private:
+    FileName fnStack;
+    int fd;
+    size_t fileSize, nImages, xdim, ydim, zdim;
+    int swap;
+    // All the fields below are protected by this condition
+    Condition condition;
+    std::vector<ImageStackSlot> pending;
+    size_t pendingBytes;
+    bool closing, failed;
+    String errorMsg;
+    ThreadManager * thMgr;
+
+    /* Write a batch of slots, joining the adjacent ones */
+    void writeSlots(std::vector<ImageStackSlot> &slots);
+
+    /* Work function of the background thread */
+    static void writeThread(ThreadArgument &thArg);
+};
+//@}
+#endif
@@ -27,6 +27,11 @@
 #include "xmipp_program.h"
 #include "metadata_extension.h"
 #include "args.h"
+#include "xmipp_fftw.h"
+#include "xmipp_image_writer.h"
+#include "xmipp_image_prefetch.h"
+#include <deque>
+#include <exception>
 void XmippProgram::initComments()
 {
     CommentList comments;
@@ -60,6 +65,17 @@ void XmippProgram::defineCommons()
     addParamsLine("alias --help;");
     addParamsLine("[--gui*]                 : Show a GUI to launch the program.");
     addParamsLine("[--more*]                : Show additional options.");
+    addParamsLine("[--fftw_rigor+ <rigor=estimate>] : Rigor of the FFTW planner.");
+    addParamsLine("                         : Measured plans are slower to compute but faster to execute.");
+    addParamsLine("                         : The default can be changed with the XMIPP_FFTW_RIGOR environment variable.");
+    addParamsLine("    where <rigor>");
+    addParamsLine("     estimate    : Heuristic plans, no planning time");
+    addParamsLine("     measure     : Plans measured on the actual machine");
+    addParamsLine("     patient     : More exhaustive measurements than measure");
+    addParamsLine("     exhaustive  : Most exhaustive measurements");
+    addParamsLine("[--fftw_wisdom+ <file=\"\">] : FFTW wisdom file, loaded before and updated after the run.");
+    addParamsLine("                         : If not given and the rigor is not estimate, ");
+    addParamsLine("                         : $XMIPP_FFTW_WISDOM or ~/.xmipp/fftw_wisdom is used.");
 
     ///This are a set of internal command for MetaProgram usage
     ///they should be hidden
@@ -257,6 +273,7 @@ void XmippProgram::read(int argc, const char ** argv, bool reportErrors)
             {
                 if (verbose) //if 0, ignore the parameter, useful for mpi programs
                     verbose = getIntParam("--verbose");
+                readFFTWParams();
                 this->readParams();
                 doRun = !checkParam("--xmipp_validate_params"); //just validation, not run
             }
@@ -289,12 +306,36 @@ void XmippProgram::read(const String &argumentsLine)
     read(argc, (const char **)argv);
 }
 
+void XmippProgram::readFFTWParams()
+{
+    String rigor = getParam("--fftw_rigor");
+    const char * envRigor = getenv("XMIPP_FFTW_RIGOR");
+    if (!checkParam("--fftw_rigor") && envRigor != NULL)
+        rigor = envRigor;
+    FFTWPlanCache::setRigor(rigor);
+
+    fnFFTWWisdom = getParam("--fftw_wisdom");
+    if (fnFFTWWisdom.empty() && FFTWPlanCache::getRigor() != FFTW_ESTIMATE)
+        fnFFTWWisdom = FFTWPlanCache::defaultWisdomFile();
+    if (!fnFFTWWisdom.empty())
+        FFTWPlanCache::importWisdom(fnFFTWWisdom);
+}
+
+void XmippProgram::storeFFTWWisdom()
+{
+    if (!fnFFTWWisdom.empty() && !FFTWPlanCache::exportWisdom(fnFFTWWisdom) && verbose)
+        std::cerr << "Warning: cannot write FFTW wisdom to " << fnFFTWWisdom << std::endl;
+}
+
 int XmippProgram::tryRun()
 {
     try
     {
         if (doRun)
+        {
             this->run();
+            storeFFTWWisdom();
+        }
     }
     catch (XmippError &xe)
     {
@@ -498,6 +539,7 @@ XmippMetadataProgram::XmippMetadataProgram()
     single_image = input_is_metadata = input_is_stack = output_is_stack = false;
     mdInSize = 0;
     iter = NULL;
+    prefetcher = NULL;
     ndimOut = zdimOut = ydimOut = xdimOut = 0;
     image_label = MDL_IMAGE;
     delete_mdIn = false;
@@ -505,6 +547,11 @@ XmippMetadataProgram::XmippMetadataProgram()
     save_metadata_stack = false;
     keep_input_columns = false;
     track_origin = false;
+    allow_threads = false;
+    map_input = false;
+    write_async = true;
+    prefetch_input = true;
+    nThreads = 1;
 }
 
 void XmippMetadataProgram::init()
@@ -566,6 +613,13 @@ void XmippMetadataProgram::defineParams()
     {
         addParamsLine("  [--dont_apply_geo]   : for 2D-images: do not apply transformation stored in metadata");
     }
+
+    if (allow_threads)
+        addParamsLine("  [--thr <N=1>]        : Number of threads processing images in parallel");
+    addParamsLine(" [--map_input+]       : Map the input stacks once instead of reading them from the file for every image.");
+    addParamsLine("                      : The input stacks must not be modified while the program runs");
+    addParamsLine(" [--dont_write_async+] : Write every output image into the stack instead of writing them in the background");
+    addParamsLine(" [--dont_prefetch+]   : Read every input image when it is processed instead of reading the next ones in the background");
 }//function defineParams
 
 void XmippMetadataProgram::defineLabelParam()
@@ -590,12 +644,22 @@ void XmippMetadataProgram::readParams()
     if (allow_apply_geo)
         apply_geo = !checkParam("--dont_apply_geo");
 
+    if (allow_threads)
+    {
+        nThreads = getIntParam("--thr");
+        if (nThreads < 1)
+            REPORT_ERROR(ERR_ARG_INCORRECT, "The number of threads must be at least 1");
+    }
+
     // The following flags are an "advanced" options to allow save metadata
     // when the -o is an stack, each program can define its default value
     // that's why the || construct before checkParam call
     save_metadata_stack = save_metadata_stack || checkParam("--save_metadata_stack");
     track_origin = track_origin || checkParam("--track_origin");
     keep_input_columns = keep_input_columns || checkParam("--keep_input_columns");
+    map_input = map_input || checkParam("--map_input");
+    write_async = write_async && !checkParam("--dont_write_async");
+    prefetch_input = prefetch_input && !checkParam("--dont_prefetch");
 
     MetaData * md = new MetaData;
     md->read(fn_in, NULL, decompose_stacks);
@@ -693,6 +757,9 @@ void XmippMetadataProgram::startProcessing()
     if (create_empty_stackfile)
         createEmptyFile(fn_out, xdimOut, ydimOut, zdimOut, mdInSize, true, WRITE_OVERWRITE);
 
+    if (map_input)
+        ImageFileMap::setEnabled(true);
+
     //Show some info
     show();
     // Initialize progress bar
@@ -708,6 +775,9 @@ void XmippMetadataProgram::finishProcessing()
     if (allow_time_bar && verbose && !single_image)
         progress_bar(time_bar_size);
     writeOutput();
+
+    if (map_input)
+        ImageFileMap::setEnabled(false);
 }
 
 void XmippMetadataProgram::writeOutput()
@@ -766,9 +836,230 @@ void XmippMetadataProgram::checkPoint()
 {
 }
 
+bool XmippMetadataProgram::prepareImage(size_t objId, size_t objIndex, FileName &fnImg, FileName &fnImgOut,
+                                        MDRow &rowIn, MDRow &rowOut)
+{
+    if (prefetcher != NULL)
+        prefetcher->setObject(objId);
+    mdIn->getRow(rowIn, objId);
+    rowIn.getValue(image_label, fnImg);
+
+    if (fnImg.empty())
+        return false;
+
+    fnImgOut = fnImg;
+
+    if (each_image_produces_an_output)
+    {
+        if (!oroot.empty()) // Compose out name to save as independent images
+        {
+            if (oext.empty()) // If oext is still empty, then use ext of indep input images
+            {
+                if (input_is_stack)
+                    oextBaseName = "spi";
+                else
+                    oextBaseName = fnImg.getFileFormat();
+            }
+
+            if (!baseName.empty() )
+                fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
+            else if (fnImg.isInStack())
+                fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
+            else
+                fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
+        }
+        else if (!fn_out.empty() )
+        {
+            if (single_image)
+                fnImgOut = fn_out;
+            else
+                fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
+        }
+        else
+            fnImgOut = fnImg;
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+    }
+    else if (produces_a_metadata)
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+
+    return true;
+}
+
+/* Image handled by the threads of processImagesInThreads */
+struct MetadataProgramTask
+{
+    size_t order;
+    FileName fnImg, fnImgOut;
+    MDRow rowIn, rowOut;
+};
+
+/* Data shared by the reader/writer thread and the worker threads */
+struct MetadataProgramPipeline
+{
+    XmippMetadataProgram * program;
+    /// All the fields below are protected by this condition
+    Condition condition;
+    /// Images read and waiting for a worker
+    std::deque<MetadataProgramTask *> pending;
+    /// Images processed and waiting to be written in order
+    std::map<size_t, MetadataProgramTask *> processed;
+    /// No more images will be read
+    bool inputFinished;
+    /// Some worker failed, exception to raise in the main thread
+    bool failed;
+    std::exception_ptr error;
+};
+
+void XmippMetadataProgram::processImageThread(ThreadArgument &thArg)
+{
+    MetadataProgramPipeline * pipeline = (MetadataProgramPipeline *) thArg.workClass;
+    Condition &condition = pipeline->condition;
+
+    while (true)
+    {
+        condition.lock();
+        while (pipeline->pending.empty() && !pipeline->inputFinished && !pipeline->failed)
+            condition.wait();
+        if (pipeline->pending.empty() || pipeline->failed)
+        {
+            condition.unlock();
+            break;
+        }
+        MetadataProgramTask * task = pipeline->pending.front();
+        pipeline->pending.pop_front();
+        condition.broadcast(); // There is room for the reader
+        condition.unlock();
+
+        bool ok = true;
+        try
+        {
+            pipeline->program->processImage(task->fnImg, task->fnImgOut, task->rowIn, task->rowOut);
+        }
+        catch (...)
+        {
+            // Any exception (XmippError, bad_alloc...) is raised again by the main thread
+            ok = false;
+            condition.lock();
+            if (!pipeline->failed)
+            {
+                pipeline->failed = true;
+                pipeline->error = std::current_exception();
+            }
+            condition.broadcast();
+            condition.unlock();
+            delete task;
+        }
+        if (!ok)
+            break;
+
+        condition.lock();
+        pipeline->processed[task->order] = task;
+        condition.broadcast();
+        condition.unlock();
+    }
+}
+
+void XmippMetadataProgram::processImagesInThreads()
+{
+    MetadataProgramPipeline pipeline;
+    pipeline.program = this;
+    pipeline.inputFinished = false;
+    pipeline.failed = false;
+    // Bounded queue, so that the reader does not get too far ahead of the workers
+    size_t maxPending = 2 * nThreads;
+
+    ThreadManager thMgr(nThreads, &pipeline);
+    thMgr.runAsync(processImageThread);
+
+    Condition &condition = pipeline.condition;
+    size_t objId, objIndex = 0;
+    size_t nRead = 0, nWritten = 0;
+    // Image being read or written by this thread, and whether it holds the lock
+    MetadataProgramTask * task = NULL;
+    bool locked = true;
+    condition.lock();
+    try
+    {
+        while (true)
+        {
+            // Append to mdOut the processed images in input order
+            std::map<size_t, MetadataProgramTask *>::iterator it;
+            while ((it = pipeline.processed.find(nWritten)) != pipeline.processed.end())
+            {
+                task = it->second;
+                pipeline.processed.erase(it);
+                condition.unlock();
+                locked = false;
+                if (each_image_produces_an_output || produces_a_metadata)
+                    mdOut.addRow(task->rowOut);
+                delete task;
+                task = NULL;
+                checkPoint();
+                showProgress();
+                ++nWritten;
+                condition.lock();
+                locked = true;
+            }
+
+            if (pipeline.failed || (pipeline.inputFinished && nWritten == nRead))
+                break;
+
+            if (!pipeline.inputFinished && pipeline.pending.size() < maxPending)
+            {
+                // Read the next image without blocking the workers
+                condition.unlock();
+                locked = false;
+                task = new MetadataProgramTask;
+                bool moreImages = getImageToProcess(objId, objIndex) &&
+                                  prepareImage(objId, ++objIndex, task->fnImg, task->fnImgOut,
+                                               task->rowIn, task->rowOut);
+                condition.lock();
+                locked = true;
+                if (moreImages)
+                {
+                    task->order = nRead++;
+                    pipeline.pending.push_back(task);
+                }
+                else
+                {
+                    delete task;
+                    pipeline.inputFinished = true;
+                }
+                task = NULL;
+                condition.broadcast();
+            }
+            else
+                condition.wait();
+        }
+    }
+    catch (...)
+    {
+        // An error of this thread stops the workers as an error of theirs,
+        // otherwise they would wait for more input forever
+        delete task;
+        if (!locked)
+            condition.lock();
+        pipeline.failed = true;
+        pipeline.error = std::current_exception();
+    }
+    pipeline.inputFinished = true;
+    condition.broadcast();
+    condition.unlock();
+    thMgr.wait();
+
+    for (size_t i = 0; i < pipeline.pending.size(); ++i)
+        delete pipeline.pending[i];
+    for (std::map<size_t, MetadataProgramTask *>::iterator it = pipeline.processed.begin();
+         it != pipeline.processed.end(); ++it)
+        delete it->second;
+
+    if (pipeline.failed)
+        std::rethrow_exception(pipeline.error);
+}
+
 void XmippMetadataProgram::run()
 {
-    FileName fnImg, fnImgOut, fullBaseName;
+    FileName fnImg, fnImgOut;
     size_t objId;
     MDRow rowIn, rowOut;
     mdOut.clear(); //this allows multiple runs of the same Program object
@@ -790,59 +1081,54 @@ void XmippMetadataProgram::run()
         pathBaseName   = fullBaseName.getDir();
     }
 
-    //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
-    while (getImageToProcess(objId, objIndex))
-    {
-        ++objIndex; //increment for composing starting at 1
-
-        mdIn->getRow(rowIn, objId);
-        rowIn.getValue(image_label, fnImg);
-
-        if (fnImg.empty())
-            break;
+    // The output stack is written in the background, every process of MPI
+    // programs has its own writer
+    ImageStackWriter * stackWriter = NULL;
+    if (create_empty_stackfile && write_async && ImageStackWriter::isSupported(fn_out))
+        stackWriter = new ImageStackWriter(fn_out);
+    // The next input images are read in the background while the current
+    // one is processed
+    if (prefetch_input && !single_image && mdIn->containsLabel(image_label))
+        prefetcher = new ImagePrefetcher(*mdIn, image_label);
 
-        fnImgOut = fnImg;
-
-        if (each_image_produces_an_output)
+    try
+    {
+        if (nThreads > 1 && !single_image)
+            processImagesInThreads();
+        else
         {
-            if (!oroot.empty()) // Compose out name to save as independent images
+            //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+            while (getImageToProcess(objId, objIndex))
             {
-                if (oext.empty()) // If oext is still empty, then use ext of indep input images
-                {
-                    if (input_is_stack)
-                        oextBaseName = "spi";
-                    else
-                        oextBaseName = fnImg.getFileFormat();
-                }
+                ++objIndex; //increment for composing starting at 1
 
-                if (!baseName.empty() )
-                    fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
-                else if (fnImg.isInStack())
-                    fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
-                else
-                    fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
-            }
-            else if (!fn_out.empty() )
-            {
-                if (single_image)
-                    fnImgOut = fn_out;
-                else
-                    fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
-            }
-            else
-                fnImgOut = fnImg;
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
-        }
-        else if (produces_a_metadata)
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+                if (!prepareImage(objId, objIndex, fnImg, fnImgOut, rowIn, rowOut))
+                    break;
 
-        processImage(fnImg, fnImgOut, rowIn, rowOut);
+                processImage(fnImg, fnImgOut, rowIn, rowOut);
 
-        if (each_image_produces_an_output || produces_a_metadata)
-            mdOut.addRow(rowOut);
+                if (each_image_produces_an_output || produces_a_metadata)
+                    mdOut.addRow(rowOut);
 
-        checkPoint();
-        showProgress();
+                checkPoint();
+                showProgress();
+            }
+        }
+    }
+    catch (...)
+    {
+        // Any error of the threads, so that the writer and prefetcher threads are joined
+        delete prefetcher;
+        prefetcher = NULL;
+        delete stackWriter;
+        throw;
+    }
+    delete prefetcher;
+    prefetcher = NULL;
+    if (stackWriter != NULL)
+    {
+        stackWriter->close();
+        delete stackWriter;
     }
     wait();
 
@@ -32,6 +32,9 @@
 #include "metadata.h"
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
+#include "xmipp_threads.h"
+
+class ImagePrefetcher;
 
 
 /** @defgroup Programs2 Basic structure for Xmipp programs
@@ -75,6 +78,9 @@ private:
     /** Create Wiki for help */
     void createWiki();
 
+    /** Read the FFTW planner options and load the FFTW wisdom */
+    void readFFTWParams();
+
     /** Variables related to progress notification */
     size_t progressTotal;
     size_t progressStep;
@@ -95,6 +101,12 @@ protected:
     int argc;
     const char ** argv;
 
+    /// FFTW wisdom file (empty if not used)
+    FileName fnFFTWWisdom;
+
+    /** Save the accumulated FFTW wisdom, if a wisdom file is used */
+    void storeFFTWWisdom();
+
 public:
     /** Flag to check whether to run or not*/
     bool doRun;
@@ -286,7 +298,7 @@ public:
 public:
     //Image<double>   img;
     /// Filenames of input and output Metadata
-    FileName fn_in, fn_out, baseName, pathBaseName, oextBaseName;
+    FileName fn_in, fn_out, baseName, pathBaseName, oextBaseName, fullBaseName;
     /// Apply geo
     bool apply_geo;
     /// Output dimensions
@@ -301,6 +313,8 @@ protected:
 
     /// Iterator over input metadata
     MDIterator * iter;
+    /// Background reader of the next input images, NULL if there is none
+    ImagePrefetcher * prefetcher;
     /// Filenames of input and output Images
     //FileName        fnImg, fnImgOut;
     /// Output extension and root
@@ -336,6 +350,20 @@ protected:
     bool remove_disabled; // Default true
     /// Show process time bar
     bool allow_time_bar; // Default true
+    /// Provide the program with the param --thr to process several images in parallel.
+    /// Only set it if processImage is thread safe: it should not modify members of the
+    /// program and it must not access any MetaData other than rowIn and rowOut
+    bool allow_threads; // Default false
+    /// Read the SPIDER and MRC input files through shared mappings (see ImageFileMap)
+    /// instead of opening them for every image. The user can enable it with --map_input.
+    /// Off by default: an input file truncated while it is mapped kills the program (SIGBUS)
+    bool map_input; // Default false
+    /// Write the images of the output stack in the background (see ImageStackWriter)
+    /// instead of opening the stack for every image. The user can disable it with --dont_write_async
+    bool write_async; // Default true
+    /// Read the next input images in the background (see ImagePrefetcher)
+    /// while the current one is processed. The user can disable it with --dont_prefetch
+    bool prefetch_input; // Default true
 
     // DEDUCED FLAGS
     /// Input is a metadata
@@ -354,6 +382,9 @@ protected:
     /// Some time bar related counters
     size_t time_bar_step, time_bar_size, time_bar_done;
 
+    /// Number of threads processing images (--thr)
+    int nThreads;
+
     virtual void initComments();
     virtual void defineParams();
     virtual void readParams();
@@ -379,6 +410,21 @@ protected:
     /** Define the label param */
     virtual void defineLabelParam();
 
+    /** Compose the output filename and prepare the rows of the image objId.
+     * Returns false if the input image filename is empty.
+     */
+    bool prepareImage(size_t objId, size_t objIndex, FileName &fnImg, FileName &fnImgOut,
+                      MDRow &rowIn, MDRow &rowOut);
+
+    /** Process all the images with nThreads threads.
+     * The calling thread reads the input rows and appends the output rows
+     * to mdOut in input order, while the worker threads call processImage.
+     */
+    void processImagesInThreads();
+
+    /** Work function of the threads started by processImagesInThreads */
+    static void processImageThread(ThreadArgument &thArg);
+
 public:
     XmippMetadataProgram();
 
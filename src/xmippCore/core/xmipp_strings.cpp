@@ -604,6 +604,81 @@ void * _memmem ( const void *haystack, size_t haystack_len, const void *needle,
     return NULL;
 }
 
+const char * memToDouble(const char *str, const char *end, double &value)
+{
+    // Powers of ten that are exact in double precision
+    static const double exactPowers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                         1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                         1e18, 1e19, 1e20, 1e21, 1e22};
+    while (str < end && isspace(*str))
+        ++str;
+    const char *start = str;
+    bool negative = false;
+    if (str < end && (*str == '-' || *str == '+'))
+        negative = (*str++ == '-');
+
+    // Mantissa, at most 19 significant digits are accumulated
+    unsigned long long mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool anyDigit = false;
+    for (; str < end && isdigit(*str); ++str, anyDigit = true)
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*str - '0');
+            if (mantissa != 0)
+                ++digits;
+        }
+        else
+            ++exponent;
+    if (str < end && *str == '.')
+        for (++str; str < end && isdigit(*str); ++str, anyDigit = true)
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*str - '0');
+                --exponent;
+                if (mantissa != 0)
+                    ++digits;
+            }
+    if (!anyDigit)
+        return NULL;
+    if (str < end && (*str == 'e' || *str == 'E'))
+    {
+        ++str;
+        bool negativeExp = false;
+        if (str < end && (*str == '-' || *str == '+'))
+            negativeExp = (*str++ == '-');
+        if (str == end || !isdigit(*str))
+            return NULL;
+        int e = 0;
+        for (; str < end && isdigit(*str); ++str)
+            if (e < 100000)
+                e = e * 10 + (*str - '0');
+        exponent += negativeExp ? -e : e;
+    }
+
+    if (digits <= 15 && exponent >= -22 && exponent <= 22)
+    {
+        // Both the mantissa and the power are exact, so is the rounded result
+        value = (double)mantissa;
+        if (exponent < 0)
+            value /= exactPowers[-exponent];
+        else
+            value *= exactPowers[exponent];
+    }
+    else
+    {
+        // Let strtod round the number
+        String number(start, str - start);
+        value = strtod(number.c_str(), NULL);
+        if (value == HUGE_VAL || value == -HUGE_VAL)
+            return NULL;
+        negative = false;
+    }
+    if (negative)
+        value = -value;
+    return str;
+}
+
 /* Obtain an string from a format in the way of printf works
  *
  */
@@ -389,6 +389,20 @@ char   *memtok(char **src,  char **_end, const char *sep);
 
 /** Memory string search, taken from GNU C Library */
 void * _memmem ( const void *haystack, size_t haystack_len, const void *needle, size_t needle_len);
+
+/** Read the decimal number at the beginning of a memory buffer.
+ * Leading spaces are skipped and the buffer does not need to be null terminated.
+ * The conversion is exact (the same value as strtod): numbers with up to 15
+ * significant digits and small exponents, which is what metadata files
+ * contain, are converted without calling strtod.
+ * Returns the position after the number, or NULL if there is no number or it
+ * overflows.
+ *
+ * @code
+ * const char * next = memToDouble(line, lineEnd, value);
+ * @endcode
+ */
+const char * memToDouble(const char *str, const char *end, double &value);
 //@}
 
 /** Obtain an string from a format in the way of printf works